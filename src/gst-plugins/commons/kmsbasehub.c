@@ -18,6 +18,8 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include "kmsbasehub.h"
 #include "constants.h"
 #include "kmsagnosticcaps.h"
@@ -105,16 +107,45 @@ enum
 
 static guint kms_base_hub_signals[LAST_SIGNAL] = { 0 };
 
+#define DEFAULT_PORT_SLOTS 16
+#define DEFAULT_LEAN_PORTS FALSE
+
+enum
+{
+  PROP_0,
+  PROP_PORT_SLOTS,
+  PROP_LEAN_PORTS,
+  N_PROPERTIES
+};
+
+/* Port ids are made of the slot index and the number of times the slot */
+/* has been reused, so a stale id never matches a newer port */
+#define PORT_SLOT_BITS 16
+#define PORT_SLOT_MASK ((1 << PORT_SLOT_BITS) - 1)
+#define PORT_GENERATION_MASK 0x7fff
+#define MAX_PORT_SLOTS (PORT_SLOT_MASK + 1)
+#define NO_SLOT G_MAXUINT
+
+typedef struct _KmsBaseHubPortData KmsBaseHubPortData;
+
+typedef struct _KmsBaseHubSlot
+{
+  KmsBaseHubPortData *port;
+  guint generation;
+  guint next_free;
+} KmsBaseHubSlot;
+
 struct _KmsBaseHubPrivate
 {
-  GHashTable *ports;
+  KmsBaseHubSlot *slots;
+  guint n_slots;                /* Allocated */
+  guint used_slots;             /* Ever used, the rest are untouched */
+  guint free_slot;              /* Head of the list of released slots */
+  gboolean lean_ports;
   GRecMutex mutex;
-  gint port_count;
   gint pad_added_id;
 };
 
-typedef struct _KmsBaseHubPortData KmsBaseHubPortData;
-
 struct _KmsBaseHubPortData
 {
   KmsBaseHub *hub;
@@ -124,6 +155,14 @@ struct _KmsBaseHubPortData
   GstPad *audio_sink_target;
   GstPad *video_sink_target;
   GstPad *data_sink_target;
+
+  /* Ghost pads of the hub for this port, so they are not searched by name */
+  GstPad *audio_sink_gp;
+  GstPad *video_sink_gp;
+  GstPad *data_sink_gp;
+  GstPad *audio_src_gp;
+  GstPad *video_src_gp;
+  GstPad *data_src_gp;
 };
 
 /* class initialization */
@@ -185,10 +224,130 @@ kms_base_hub_port_data_destroy (gpointer data)
   g_clear_object (&port_data->video_sink_target);
   g_clear_object (&port_data->data_sink_target);
 
+  g_clear_object (&port_data->audio_sink_gp);
+  g_clear_object (&port_data->video_sink_gp);
+  g_clear_object (&port_data->data_sink_gp);
+  g_clear_object (&port_data->audio_src_gp);
+  g_clear_object (&port_data->video_src_gp);
+  g_clear_object (&port_data->data_src_gp);
+
   g_clear_object (&port_data->port);
   g_slice_free (KmsBaseHubPortData, data);
 }
 
+/* Port table. Always used with the hub locked */
+
+static void
+kms_base_hub_alloc_slots (KmsBaseHub * self, guint n_slots)
+{
+  n_slots = MIN (n_slots, MAX_PORT_SLOTS);
+
+  if (n_slots <= self->priv->n_slots) {
+    return;
+  }
+
+  self->priv->slots = g_renew (KmsBaseHubSlot, self->priv->slots, n_slots);
+  memset (self->priv->slots + self->priv->n_slots, 0,
+      (n_slots - self->priv->n_slots) * sizeof (KmsBaseHubSlot));
+  self->priv->n_slots = n_slots;
+}
+
+static KmsBaseHubPortData *
+kms_base_hub_get_port_data (KmsBaseHub * self, gint64 id)
+{
+  KmsBaseHubPortData *port_data;
+  guint slot;
+
+  if (id < 0 || id > G_MAXINT) {
+    return NULL;
+  }
+
+  slot = id & PORT_SLOT_MASK;
+
+  if (slot >= self->priv->used_slots) {
+    return NULL;
+  }
+
+  port_data = self->priv->slots[slot].port;
+
+  if (port_data == NULL || port_data->id != id) {
+    return NULL;
+  }
+
+  return port_data;
+}
+
+/* Returns the id for the new port, -1 if the table is full */
+static gint
+kms_base_hub_take_slot (KmsBaseHub * self)
+{
+  KmsBaseHubPrivate *priv = self->priv;
+  guint slot;
+
+  if (priv->free_slot != NO_SLOT) {
+    slot = priv->free_slot;
+    priv->free_slot = priv->slots[slot].next_free;
+  } else {
+    if (priv->used_slots == priv->n_slots) {
+      kms_base_hub_alloc_slots (self, MAX (priv->n_slots * 2, 1));
+    }
+
+    if (priv->used_slots == priv->n_slots) {
+      return -1;
+    }
+
+    slot = priv->used_slots++;
+  }
+
+  return (priv->slots[slot].generation << PORT_SLOT_BITS) | slot;
+}
+
+static void
+kms_base_hub_release_slot (KmsBaseHub * self, gint id)
+{
+  KmsBaseHubSlot *slot = &self->priv->slots[id & PORT_SLOT_MASK];
+
+  slot->port = NULL;
+  slot->generation = (slot->generation + 1) & PORT_GENERATION_MASK;
+  slot->next_free = self->priv->free_slot;
+  self->priv->free_slot = id & PORT_SLOT_MASK;
+}
+
+/* Returns a new reference to the ghost pad of port 'id' at 'gp_offset', */
+/* or to the pad named 'gp_prefix''id' if the port is not handled */
+static GstPad *
+kms_base_hub_get_port_pad (KmsBaseHub * self, gint id, gulong gp_offset,
+    const gchar * gp_prefix)
+{
+  KmsBaseHubPortData *port_data;
+  GstPad *gp = NULL;
+  gchar *gp_name;
+
+  KMS_BASE_HUB_LOCK (self);
+
+  port_data = kms_base_hub_get_port_data (self, id);
+
+  if (port_data != NULL) {
+    gp = G_STRUCT_MEMBER (GstPad *, port_data, gp_offset);
+
+    if (gp != NULL) {
+      g_object_ref (gp);
+    }
+  }
+
+  KMS_BASE_HUB_UNLOCK (self);
+
+  if (port_data != NULL) {
+    return gp;
+  }
+
+  gp_name = g_strdup_printf ("%s%d", gp_prefix, id);
+  gp = gst_element_get_static_pad (GST_ELEMENT (self), gp_name);
+  g_free (gp_name);
+
+  return gp;
+}
+
 gboolean
 kms_base_hub_link_audio_sink (KmsBaseHub * self, gint id,
     GstElement * internal_element, const gchar * pad_name,
@@ -321,19 +480,14 @@ kms_base_hub_unlink_data_src (KmsBaseHub * self, gint id)
       id);
 }
 
-static void
-release_gint (gpointer data)
-{
-  g_slice_free (gint, data);
-}
-
 static gboolean
-kms_base_hub_unlink_pad (KmsBaseHub * hub, const gchar * gp_name)
+kms_base_hub_unlink_pad (KmsBaseHub * hub, gint id, gulong gp_offset,
+    const gchar * gp_prefix)
 {
   GstPad *gp;
   gboolean ret;
 
-  gp = gst_element_get_static_pad (GST_ELEMENT (hub), gp_name);
+  gp = kms_base_hub_get_port_pad (hub, id, gp_offset, gp_prefix);
 
   if (gp == NULL) {
     return TRUE;
@@ -347,79 +501,43 @@ kms_base_hub_unlink_pad (KmsBaseHub * hub, const gchar * gp_name)
 static gboolean
 kms_base_hub_unlink_audio_sink_default (KmsBaseHub * self, gint id)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (AUDIO_SINK_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_unlink_pad (self, gp_name);
-
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_unlink_pad (self, id,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, audio_sink_gp), AUDIO_SINK_PAD_PREFIX);
 }
 
 static gboolean
 kms_base_hub_unlink_video_sink_default (KmsBaseHub * self, gint id)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (VIDEO_SINK_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_unlink_pad (self, gp_name);
-
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_unlink_pad (self, id,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, video_sink_gp), VIDEO_SINK_PAD_PREFIX);
 }
 
 static gboolean
 kms_base_hub_unlink_data_sink_default (KmsBaseHub * self, gint id)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (DATA_SINK_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_unlink_pad (self, gp_name);
-
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_unlink_pad (self, id,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, data_sink_gp), DATA_SINK_PAD_PREFIX);
 }
 
 static gboolean
 kms_base_hub_unlink_audio_src_default (KmsBaseHub * self, gint id)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (AUDIO_SRC_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_unlink_pad (self, gp_name);
-
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_unlink_pad (self, id,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, audio_src_gp), AUDIO_SRC_PAD_PREFIX);
 }
 
 static gboolean
 kms_base_hub_unlink_video_src_default (KmsBaseHub * self, gint id)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (VIDEO_SRC_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_unlink_pad (self, gp_name);
-
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_unlink_pad (self, id,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, video_src_gp), VIDEO_SRC_PAD_PREFIX);
 }
 
 static gboolean
 kms_base_hub_unlink_data_src_default (KmsBaseHub * self, gint id)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (DATA_SRC_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_unlink_pad (self, gp_name);
-
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_unlink_pad (self, id,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, data_src_gp), DATA_SRC_PAD_PREFIX);
 }
 
 static void
@@ -450,10 +568,11 @@ remove_target_cb (GstPad * pad, GstPad * peer, gpointer data)
   gst_ghost_pad_set_target (GST_GHOST_PAD (pad), NULL);
 }
 
+/* On success the new ghost pad is kept in 'gp_ptr' */
 static gboolean
 kms_base_hub_create_and_link_ghost_pad (KmsBaseHub * hub,
     GstPad * src_pad, const gchar * gp_name, const gchar * gp_template_name,
-    GstPad * target)
+    GstPad * target, GstPad ** gp_ptr)
 {
   GstPadTemplate *templ;
   GstPad *gp;
@@ -473,6 +592,8 @@ kms_base_hub_create_and_link_ghost_pad (KmsBaseHub * hub,
   ret = gst_element_add_pad (GST_ELEMENT (hub), gp);
 
   if (ret) {
+    g_clear_object (gp_ptr);
+    *gp_ptr = g_object_ref (gp);
     gst_pad_link (src_pad, gp);
   } else {
     g_object_unref (gp);
@@ -483,15 +604,15 @@ kms_base_hub_create_and_link_ghost_pad (KmsBaseHub * hub,
 
 static gboolean
 kms_base_hub_link_sink_pad (KmsBaseHub * hub, gint id,
-    const gchar * gp_name, const gchar * gp_template_name,
+    const gchar * gp_prefix, const gchar * gp_template_name,
     GstElement * internal_element, const gchar * pad_name,
-    const gchar * port_src_pad_name, gulong target_offset,
+    const gchar * port_src_pad_name, gulong target_offset, gulong gp_offset,
     gboolean remove_on_unlink)
 {
   KmsBaseHubPortData *port_data;
   gboolean ret;
-  GstPad *gp, *target;
-  GstPad **port_data_target;
+  GstPad *target;
+  GstPad **port_data_target, **port_data_gp;
 
   if (GST_OBJECT_PARENT (internal_element) != GST_OBJECT (hub)) {
     GST_ERROR_OBJECT (hub, "Cannot link %" GST_PTR_FORMAT " wrong hierarchy",
@@ -516,7 +637,7 @@ kms_base_hub_link_sink_pad (KmsBaseHub * hub, gint id,
 
   KMS_BASE_HUB_LOCK (hub);
 
-  port_data = g_hash_table_lookup (hub->priv->ports, &id);
+  port_data = kms_base_hub_get_port_data (hub, id);
 
   if (port_data == NULL) {
     ret = FALSE;
@@ -529,29 +650,27 @@ kms_base_hub_link_sink_pad (KmsBaseHub * hub, gint id,
   }
   *port_data_target = g_object_ref (target);
 
-  gp = gst_element_get_static_pad (GST_ELEMENT (hub), gp_name);
-  if (gp != NULL) {
-    ret = set_target (gp, target);
-    g_object_unref (gp);
+  port_data_gp = G_STRUCT_MEMBER_P (port_data, gp_offset);
+  if (*port_data_gp != NULL) {
+    ret = set_target (*port_data_gp, target);
   } else {
     GstPad *src_pad = gst_element_get_static_pad (port_data->port,
         port_src_pad_name);
 
     if (src_pad != NULL) {
+      gchar *gp_name = g_strdup_printf ("%s%d", gp_prefix, id);
+
       ret = kms_base_hub_create_and_link_ghost_pad (hub, src_pad,
-          gp_name, gp_template_name, target);
+          gp_name, gp_template_name, target, port_data_gp);
       g_object_unref (src_pad);
+      g_free (gp_name);
     } else {
       ret = TRUE;
     }
   }
 
-  GST_DEBUG_OBJECT (hub, "Audio target pad for port %d: %" GST_PTR_FORMAT,
-      port_data->id, port_data->audio_sink_target);
-  GST_DEBUG_OBJECT (hub, "Video target pad for port %d: %" GST_PTR_FORMAT,
-      port_data->id, port_data->video_sink_target);
-  GST_DEBUG_OBJECT (hub, "Data target pad for port %d: %" GST_PTR_FORMAT,
-      port_data->id, port_data->data_sink_target);
+  GST_DEBUG_OBJECT (hub, "Target pad for port %d: %" GST_PTR_FORMAT, id,
+      target);
 
 end:
 
@@ -567,17 +686,10 @@ kms_base_hub_link_audio_sink_default (KmsBaseHub * self, gint id,
     GstElement * internal_element, const gchar * pad_name,
     gboolean remove_on_unlink)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (AUDIO_SINK_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_link_sink_pad (self, id, gp_name, AUDIO_SINK_PAD_NAME,
-      internal_element, pad_name, HUB_AUDIO_SRC_PAD,
+  return kms_base_hub_link_sink_pad (self, id, AUDIO_SINK_PAD_PREFIX,
+      AUDIO_SINK_PAD_NAME, internal_element, pad_name, HUB_AUDIO_SRC_PAD,
       G_STRUCT_OFFSET (KmsBaseHubPortData, audio_sink_target),
-      remove_on_unlink);
-
-  g_free (gp_name);
-
-  return ret;
+      G_STRUCT_OFFSET (KmsBaseHubPortData, audio_sink_gp), remove_on_unlink);
 }
 
 static gboolean
@@ -585,17 +697,10 @@ kms_base_hub_link_video_sink_default (KmsBaseHub * self, gint id,
     GstElement * internal_element, const gchar * pad_name,
     gboolean remove_on_unlink)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (VIDEO_SINK_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_link_sink_pad (self, id, gp_name, VIDEO_SINK_PAD_NAME,
-      internal_element, pad_name, HUB_VIDEO_SRC_PAD,
+  return kms_base_hub_link_sink_pad (self, id, VIDEO_SINK_PAD_PREFIX,
+      VIDEO_SINK_PAD_NAME, internal_element, pad_name, HUB_VIDEO_SRC_PAD,
       G_STRUCT_OFFSET (KmsBaseHubPortData, video_sink_target),
-      remove_on_unlink);
-
-  g_free (gp_name);
-
-  return ret;
+      G_STRUCT_OFFSET (KmsBaseHubPortData, video_sink_gp), remove_on_unlink);
 }
 
 static gboolean
@@ -603,24 +708,19 @@ kms_base_hub_link_data_sink_default (KmsBaseHub * self, gint id,
     GstElement * internal_element, const gchar * pad_name,
     gboolean remove_on_unlink)
 {
-  gboolean ret;
-  gchar *gp_name = g_strdup_printf (DATA_SINK_PAD_PREFIX "%d", id);
-
-  ret = kms_base_hub_link_sink_pad (self, id, gp_name, DATA_SINK_PAD_NAME,
-      internal_element, pad_name, HUB_DATA_SRC_PAD,
+  return kms_base_hub_link_sink_pad (self, id, DATA_SINK_PAD_PREFIX,
+      DATA_SINK_PAD_NAME, internal_element, pad_name, HUB_DATA_SRC_PAD,
       G_STRUCT_OFFSET (KmsBaseHubPortData, data_sink_target),
-      remove_on_unlink);
-
-  g_free (gp_name);
-
-  return ret;
+      G_STRUCT_OFFSET (KmsBaseHubPortData, data_sink_gp), remove_on_unlink);
 }
 
 static gboolean
-kms_base_hub_link_src_pad (KmsBaseHub * self, const gchar * gp_name,
-    const gchar * template_name, GstElement * internal_element,
-    const gchar * pad_name, gboolean remove_on_unlink)
+kms_base_hub_link_src_pad (KmsBaseHub * self, gint id,
+    const gchar * gp_prefix, const gchar * template_name,
+    GstElement * internal_element, const gchar * pad_name, gulong gp_offset,
+    gboolean remove_on_unlink)
 {
+  KmsBaseHubPortData *port_data;
   GstPad *gp, *target;
   gboolean ret;
 
@@ -645,15 +745,18 @@ kms_base_hub_link_src_pad (KmsBaseHub * self, const gchar * gp_name,
     return FALSE;
   }
 
-  gp = gst_element_get_static_pad (GST_ELEMENT (self), gp_name);
+  gp = kms_base_hub_get_port_pad (self, id, gp_offset, gp_prefix);
 
   if (gp == NULL) {
     GstPadTemplate *templ;
+    gchar *gp_name;
 
     templ =
         gst_element_class_get_pad_template (GST_ELEMENT_CLASS
         (G_OBJECT_GET_CLASS (self)), template_name);
+    gp_name = g_strdup_printf ("%s%d", gp_prefix, id);
     gp = gst_ghost_pad_new_no_target_from_template (gp_name, templ);
+    g_free (gp_name);
     g_signal_connect_object (gp, "linked", G_CALLBACK (set_target_cb), target,
         0);
     g_signal_connect (gp, "unlinked", G_CALLBACK (remove_target_cb), NULL);
@@ -664,10 +767,25 @@ kms_base_hub_link_src_pad (KmsBaseHub * self, const gchar * gp_name,
       gst_pad_set_active (gp, TRUE);
     }
 
+    /* Kept before adding the pad, the hub links it to the port on */
+    /* "pad-added" */
+    KMS_BASE_HUB_LOCK (self);
+    port_data = kms_base_hub_get_port_data (self, id);
+    if (port_data != NULL) {
+      GstPad **port_data_gp = G_STRUCT_MEMBER_P (port_data, gp_offset);
+
+      g_clear_object (port_data_gp);
+      *port_data_gp = g_object_ref (gp);
+    }
+
     ret = gst_element_add_pad (GST_ELEMENT (self), gp);
     if (!ret) {
+      if (port_data != NULL) {
+        g_clear_object ((GstPad **) G_STRUCT_MEMBER_P (port_data, gp_offset));
+      }
       g_object_unref (gp);
     }
+    KMS_BASE_HUB_UNLOCK (self);
   } else {
     ret = set_target (gp, target);
     g_object_unref (gp);
@@ -683,15 +801,9 @@ kms_base_hub_link_audio_src_default (KmsBaseHub * self, gint id,
     GstElement * internal_element, const gchar * pad_name,
     gboolean remove_on_unlink)
 {
-  gchar *gp_name = g_strdup_printf (AUDIO_SRC_PAD_PREFIX "%d", id);
-  gboolean ret;
-
-  ret =
-      kms_base_hub_link_src_pad (self, gp_name, AUDIO_SRC_PAD_NAME,
-      internal_element, pad_name, remove_on_unlink);
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_link_src_pad (self, id, AUDIO_SRC_PAD_PREFIX,
+      AUDIO_SRC_PAD_NAME, internal_element, pad_name,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, audio_src_gp), remove_on_unlink);
 }
 
 static gboolean
@@ -699,15 +811,9 @@ kms_base_hub_link_video_src_default (KmsBaseHub * self, gint id,
     GstElement * internal_element, const gchar * pad_name,
     gboolean remove_on_unlink)
 {
-  gchar *gp_name = g_strdup_printf (VIDEO_SRC_PAD_PREFIX "%d", id);
-  gboolean ret;
-
-  ret =
-      kms_base_hub_link_src_pad (self, gp_name, VIDEO_SRC_PAD_NAME,
-      internal_element, pad_name, remove_on_unlink);
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_link_src_pad (self, id, VIDEO_SRC_PAD_PREFIX,
+      VIDEO_SRC_PAD_NAME, internal_element, pad_name,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, video_src_gp), remove_on_unlink);
 }
 
 static gboolean
@@ -715,42 +821,34 @@ kms_base_hub_link_data_src_default (KmsBaseHub * self, gint id,
     GstElement * internal_element, const gchar * pad_name,
     gboolean remove_on_unlink)
 {
-  gchar *gp_name = g_strdup_printf (DATA_SRC_PAD_PREFIX "%d", id);
-  gboolean ret;
-
-  ret =
-      kms_base_hub_link_src_pad (self, gp_name, DATA_SRC_PAD_NAME,
-      internal_element, pad_name, remove_on_unlink);
-  g_free (gp_name);
-
-  return ret;
+  return kms_base_hub_link_src_pad (self, id, DATA_SRC_PAD_PREFIX,
+      DATA_SRC_PAD_NAME, internal_element, pad_name,
+      G_STRUCT_OFFSET (KmsBaseHubPortData, data_src_gp), remove_on_unlink);
 }
 
 static void
-kms_base_hub_remove_port_pad (KmsBaseHub * hub, gint id,
-    const gchar * pad_prefix)
+kms_base_hub_remove_port_pad (KmsBaseHub * hub, GstPad ** pad)
 {
-  gchar *pad_name = g_strdup_printf ("%s%d", pad_prefix, id);
-  GstPad *pad = gst_element_get_static_pad (GST_ELEMENT (hub), pad_name);
+  if (*pad == NULL) {
+    return;
+  }
 
-  GST_DEBUG_OBJECT (hub, "Trying to remove pad: %s -> %" GST_PTR_FORMAT,
-      pad_name, pad);
+  GST_DEBUG_OBJECT (hub, "Removing pad %" GST_PTR_FORMAT, *pad);
 
-  if (pad != NULL) {
-    set_target (pad, NULL);
-    gst_element_remove_pad (GST_ELEMENT (hub), pad);
-    g_object_unref (pad);
-  }
-  g_free (pad_name);
+  set_target (*pad, NULL);
+  gst_element_remove_pad (GST_ELEMENT (hub), *pad);
+  g_clear_object (pad);
 }
 
 static void
-kms_base_hub_remove_port_pads (KmsBaseHub * hub, gint id)
+kms_base_hub_remove_port_pads (KmsBaseHub * hub, KmsBaseHubPortData * port)
 {
-  kms_base_hub_remove_port_pad (hub, id, AUDIO_SINK_PAD_PREFIX);
-  kms_base_hub_remove_port_pad (hub, id, AUDIO_SRC_PAD_PREFIX);
-  kms_base_hub_remove_port_pad (hub, id, VIDEO_SINK_PAD_PREFIX);
-  kms_base_hub_remove_port_pad (hub, id, VIDEO_SRC_PAD_PREFIX);
+  kms_base_hub_remove_port_pad (hub, &port->audio_sink_gp);
+  kms_base_hub_remove_port_pad (hub, &port->audio_src_gp);
+  kms_base_hub_remove_port_pad (hub, &port->video_sink_gp);
+  kms_base_hub_remove_port_pad (hub, &port->video_src_gp);
+  kms_base_hub_remove_port_pad (hub, &port->data_sink_gp);
+  kms_base_hub_remove_port_pad (hub, &port->data_src_gp);
 }
 
 static void
@@ -762,8 +860,7 @@ kms_base_hub_unhandle_port (KmsBaseHub * self, gint id)
 
   KMS_BASE_HUB_LOCK (self);
 
-  port_data = (KmsBaseHubPortData *) g_hash_table_lookup (self->priv->ports,
-      &id);
+  port_data = kms_base_hub_get_port_data (self, id);
 
   if (port_data == NULL) {
     goto end;
@@ -772,23 +869,48 @@ kms_base_hub_unhandle_port (KmsBaseHub * self, gint id)
   GST_DEBUG ("Removing element: %" GST_PTR_FORMAT, port_data->port);
 
   kms_hub_port_unhandled (KMS_HUB_PORT (port_data->port));
-  kms_base_hub_remove_port_pads (self, id);
+  kms_base_hub_remove_port_pads (self, port_data);
 
-  g_hash_table_remove (self->priv->ports, &id);
+  kms_base_hub_release_slot (self, id);
+  kms_base_hub_port_data_destroy (port_data);
 
 end:
   KMS_BASE_HUB_UNLOCK (self);
 }
 
-static gint *
-kms_base_hub_generate_port_id (KmsBaseHub * hub)
+static void
+kms_base_hub_link_port_sink (KmsBaseHub * self, GstPad * pad,
+    const gchar * prefix, gsize prefix_len, const gchar * port_sink_name)
 {
-  gint *id;
+  KmsBaseHubPortData *port;
+  GstPad *sink;
+  gint64 id;
 
-  id = g_slice_new (gint);
-  *id = g_atomic_int_add (&hub->priv->port_count, 1);
+  id = g_ascii_strtoll (GST_OBJECT_NAME (pad) + prefix_len, NULL, 10);
+  port = kms_base_hub_get_port_data (self, id);
 
-  return id;
+  if (port == NULL) {
+    GST_WARNING_OBJECT (self, "No port for %" GST_PTR_FORMAT, pad);
+    return;
+  }
+
+  sink = gst_element_get_static_pad (port->port, port_sink_name);
+  if (sink == NULL) {
+    sink = gst_element_get_request_pad (port->port, port_sink_name);
+  }
+
+  if (sink == NULL) {
+    GST_WARNING_OBJECT (self, "Cannot get %s from %" GST_PTR_FORMAT,
+        port_sink_name, port->port);
+    return;
+  }
+
+  if (GST_PAD_LINK_FAILED (gst_pad_link (pad, sink))) {
+    GST_WARNING_OBJECT (self, "Cannot link %" GST_PTR_FORMAT " to %"
+        GST_PTR_FORMAT, pad, sink);
+  }
+
+  g_object_unref (sink);
 }
 
 static void
@@ -801,40 +923,16 @@ kms_base_hub_pad_added (KmsBaseHub * self, GstPad * pad, gpointer data)
   KMS_BASE_HUB_LOCK (self);
 
   if (g_str_has_prefix (GST_OBJECT_NAME (pad), VIDEO_SRC_PAD_PREFIX)) {
-    KmsBaseHubPortData *port;
-    gint64 id;
-    const gchar *pad_name;
-
-    pad_name = GST_OBJECT_NAME (pad);
-    id = g_ascii_strtoll (pad_name + LENGTH_VIDEO_SRC_PAD_PREFIX, NULL, 10);
-    port = g_hash_table_lookup (self->priv->ports, &id);
-
-    gst_element_link_pads (GST_ELEMENT (self), GST_OBJECT_NAME (pad),
-        port->port, HUB_VIDEO_SINK_PAD);
+    kms_base_hub_link_port_sink (self, pad, VIDEO_SRC_PAD_PREFIX,
+        LENGTH_VIDEO_SRC_PAD_PREFIX, HUB_VIDEO_SINK_PAD);
   }
   else if (g_str_has_prefix (GST_OBJECT_NAME (pad), AUDIO_SRC_PAD_PREFIX)) {
-    KmsBaseHubPortData *port;
-    gint64 id;
-    const gchar *pad_name;
-
-    pad_name = GST_OBJECT_NAME (pad);
-    id = g_ascii_strtoll (pad_name + LENGTH_AUDIO_SRC_PAD_PREFIX, NULL, 10);
-    port = g_hash_table_lookup (self->priv->ports, &id);
-
-    gst_element_link_pads (GST_ELEMENT (self), GST_OBJECT_NAME (pad),
-        port->port, HUB_AUDIO_SINK_PAD);
+    kms_base_hub_link_port_sink (self, pad, AUDIO_SRC_PAD_PREFIX,
+        LENGTH_AUDIO_SRC_PAD_PREFIX, HUB_AUDIO_SINK_PAD);
   }
   else if (g_str_has_prefix (GST_OBJECT_NAME (pad), DATA_SRC_PAD_PREFIX)) {
-    KmsBaseHubPortData *port;
-    gint64 id;
-    const gchar *pad_name;
-
-    pad_name = GST_OBJECT_NAME (pad);
-    id = g_ascii_strtoll (pad_name + LENGTH_DATA_SRC_PAD_PREFIX, NULL, 10);
-    port = g_hash_table_lookup (self->priv->ports, &id);
-
-    gst_element_link_pads (GST_ELEMENT (self), GST_OBJECT_NAME (pad),
-        port->port, HUB_DATA_SINK_PAD);
+    kms_base_hub_link_port_sink (self, pad, DATA_SRC_PAD_PREFIX,
+        LENGTH_DATA_SRC_PAD_PREFIX, HUB_DATA_SINK_PAD);
   }
 
   KMS_BASE_HUB_UNLOCK (self);
@@ -861,7 +959,8 @@ endpoint_pad_added (GstElement * endpoint, GstPad * pad,
         port_data->video_sink_target);
 
     kms_base_hub_create_and_link_ghost_pad (port_data->hub, pad, gp_name,
-        VIDEO_SINK_PAD_NAME, port_data->video_sink_target);
+        VIDEO_SINK_PAD_NAME, port_data->video_sink_target,
+        &port_data->video_sink_gp);
 
     g_free (gp_name);
   }
@@ -875,7 +974,8 @@ endpoint_pad_added (GstElement * endpoint, GstPad * pad,
         port_data->audio_sink_target);
 
     kms_base_hub_create_and_link_ghost_pad (port_data->hub, pad, gp_name,
-        AUDIO_SINK_PAD_NAME, port_data->audio_sink_target);
+        AUDIO_SINK_PAD_NAME, port_data->audio_sink_target,
+        &port_data->audio_sink_gp);
 
     g_free (gp_name);
   }
@@ -889,7 +989,8 @@ endpoint_pad_added (GstElement * endpoint, GstPad * pad,
         port_data->data_sink_target);
 
     kms_base_hub_create_and_link_ghost_pad (port_data->hub, pad, gp_name,
-        DATA_SINK_PAD_NAME, port_data->data_sink_target);
+        DATA_SINK_PAD_NAME, port_data->data_sink_target,
+        &port_data->data_sink_gp);
 
     g_free (gp_name);
   }
@@ -901,7 +1002,8 @@ static gint
 kms_base_hub_handle_port (KmsBaseHub * self, GstElement * hub_port)
 {
   KmsBaseHubPortData *port_data;
-  gint *id;
+  gboolean lean;
+  gint id;
 
   if (!KMS_IS_HUB_PORT (hub_port)) {
     GST_INFO_OBJECT (self, "Invalid HubPort: %" GST_PTR_FORMAT, hub_port);
@@ -917,30 +1019,103 @@ kms_base_hub_handle_port (KmsBaseHub * self, GstElement * hub_port)
 
   GST_DEBUG_OBJECT (self, "Handle HubPort: %" GST_PTR_FORMAT, hub_port);
 
-  id = kms_base_hub_generate_port_id (self);
+  KMS_BASE_HUB_LOCK (self);
 
-  GST_DEBUG_OBJECT (self, "Adding new HubPort, id: %d", *id);
-  port_data = kms_base_hub_port_data_create (self, hub_port, *id);
+  id = kms_base_hub_take_slot (self);
+
+  if (id < 0) {
+    KMS_BASE_HUB_UNLOCK (self);
+    GST_ERROR_OBJECT (self, "No room for more than %d ports", MAX_PORT_SLOTS);
+    return -1;
+  }
+
+  GST_DEBUG_OBJECT (self, "Adding new HubPort, id: %d", id);
+  port_data = kms_base_hub_port_data_create (self, hub_port, id);
+  self->priv->slots[id & PORT_SLOT_MASK].port = port_data;
+
+  lean = self->priv->lean_ports;
+
+  KMS_BASE_HUB_UNLOCK (self);
+
+  if (lean) {
+    g_object_set (hub_port, "lean", TRUE, NULL);
+  }
 
   port_data->signal_id = g_signal_connect (G_OBJECT (hub_port),
       "pad-added", G_CALLBACK (endpoint_pad_added), port_data);
 
+  return id;
+}
+
+static void
+kms_base_hub_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsBaseHub *self = KMS_BASE_HUB (object);
+
   KMS_BASE_HUB_LOCK (self);
-  g_hash_table_insert (self->priv->ports, id, port_data);
+
+  switch (property_id) {
+    case PROP_PORT_SLOTS:
+      kms_base_hub_alloc_slots (self, g_value_get_uint (value));
+      break;
+    case PROP_LEAN_PORTS:
+      if (!KMS_BASE_HUB_GET_CLASS (self)->supports_lean_ports
+          && g_value_get_boolean (value)) {
+        GST_WARNING_OBJECT (self, "Sources of %s are not agnosticbins, "
+            "ports keep their own", G_OBJECT_TYPE_NAME (self));
+        break;
+      }
+      self->priv->lean_ports = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
   KMS_BASE_HUB_UNLOCK (self);
+}
+
+static void
+kms_base_hub_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsBaseHub *self = KMS_BASE_HUB (object);
+
+  KMS_BASE_HUB_LOCK (self);
+
+  switch (property_id) {
+    case PROP_PORT_SLOTS:
+      g_value_set_uint (value, self->priv->n_slots);
+      break;
+    case PROP_LEAN_PORTS:
+      g_value_set_boolean (value, self->priv->lean_ports);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
 
-  return *id;
+  KMS_BASE_HUB_UNLOCK (self);
 }
 
 static void
 kms_base_hub_dispose (GObject * object)
 {
   KmsBaseHub *self = KMS_BASE_HUB (object);
+  guint i;
 
   GST_DEBUG_OBJECT (self, "dispose");
 
   KMS_BASE_HUB_LOCK (self);
-  g_hash_table_remove_all (self->priv->ports);
+  for (i = 0; i < self->priv->used_slots; i++) {
+    KmsBaseHubPortData *port_data = self->priv->slots[i].port;
+
+    if (port_data != NULL) {
+      kms_base_hub_release_slot (self, port_data->id);
+      kms_base_hub_port_data_destroy (port_data);
+    }
+  }
   KMS_BASE_HUB_UNLOCK (self);
 
   G_OBJECT_CLASS (kms_base_hub_parent_class)->dispose (object);
@@ -955,10 +1130,8 @@ kms_base_hub_finalize (GObject * object)
 
   g_rec_mutex_clear (&self->priv->mutex);
 
-  if (self->priv->ports != NULL) {
-    g_hash_table_unref (self->priv->ports);
-    self->priv->ports = NULL;
-  }
+  g_free (self->priv->slots);
+  self->priv->slots = NULL;
 
   G_OBJECT_CLASS (kms_base_hub_parent_class)->finalize (object);
 }
@@ -1002,8 +1175,26 @@ kms_base_hub_class_init (KmsBaseHubClass * klass)
   klass->unlink_data_src =
       GST_DEBUG_FUNCPTR (kms_base_hub_unlink_data_src_default);
 
+  /* Raw outputs, as the ones of a composite, need the port agnosticbin */
+  klass->supports_lean_ports = FALSE;
+
   gobject_class->dispose = GST_DEBUG_FUNCPTR (kms_base_hub_dispose);
   gobject_class->finalize = GST_DEBUG_FUNCPTR (kms_base_hub_finalize);
+  gobject_class->set_property = kms_base_hub_set_property;
+  gobject_class->get_property = kms_base_hub_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PORT_SLOTS,
+      g_param_spec_uint ("port-slots", "Port slots",
+          "Ports the hub has room for before growing its port table",
+          1, MAX_PORT_SLOTS, DEFAULT_PORT_SLOTS,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LEAN_PORTS,
+      g_param_spec_boolean ("lean-ports", "Lean ports",
+          "Make the handled ports output the media of the hub as is, "
+          "without an agnosticbin of their own (see HubPort:lean). Only "
+          "for hubs whose sources are agnosticbins",
+          DEFAULT_LEAN_PORTS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&audio_sink_factory));
@@ -1045,9 +1236,10 @@ kms_base_hub_init (KmsBaseHub * self)
 
   g_rec_mutex_init (&self->priv->mutex);
 
-  self->priv->port_count = 0;
-  self->priv->ports = g_hash_table_new_full (g_int_hash, g_int_equal,
-      release_gint, kms_base_hub_port_data_destroy);
+  self->priv->slots = NULL;
+  self->priv->n_slots = self->priv->used_slots = 0;
+  self->priv->free_slot = NO_SLOT;
+  self->priv->lean_ports = DEFAULT_LEAN_PORTS;
 
   self->priv->pad_added_id = g_signal_connect (G_OBJECT (self),
       "pad-added", G_CALLBACK (kms_base_hub_pad_added), NULL);
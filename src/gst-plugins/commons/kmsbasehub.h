@@ -45,6 +45,13 @@ G_BEGIN_DECLS
   G_TYPE_CHECK_CLASS_TYPE((klass),              \
   KMS_TYPE_BASE_HUB)                            \
 )
+#define KMS_BASE_HUB_GET_CLASS(obj) (   \
+  G_TYPE_INSTANCE_GET_CLASS (           \
+    (obj),                              \
+    KMS_TYPE_BASE_HUB,                  \
+    KmsBaseHubClass                     \
+  )                                     \
+)
 typedef struct _KmsBaseHub KmsBaseHub;
 typedef struct _KmsBaseHubClass KmsBaseHubClass;
 typedef struct _KmsBaseHubPrivate KmsBaseHubPrivate;
@@ -93,6 +100,10 @@ struct _KmsBaseHubClass
   gboolean (*unlink_audio_src) (KmsBaseHub * self, gint id);
   gboolean (*unlink_video_src) (KmsBaseHub * self, gint id);
   gboolean (*unlink_data_src) (KmsBaseHub * self, gint id);
+
+  /* Set by hubs whose sources already are agnosticbins, so their ports */
+  /* can output the media as is when "lean-ports" is set */
+  gboolean supports_lean_ports;
 };
 
 gboolean kms_base_hub_link_audio_sink (KmsBaseHub * self, gint id,
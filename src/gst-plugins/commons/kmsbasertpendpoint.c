@@ -34,6 +34,12 @@
 #include "sdpagent/kmssdpredundantext.h"
 #include "sdpagent/kmssdprtpavpfmediahandler.h"
 #include "kmsremb.h"
+#include "kmsrtcpcomposer.h"
+#include "kmsjitterbuffercontrol.h"
+#include "kmsrtpfanout.h"
+#include "kmsrtpbatch.h"
+#include "kmsrtplayers.h"
+#include "kmslayerselector.h"
 #include "kmsrefstruct.h"
 
 #include <gst/rtp/gstrtpdefs.h>
@@ -74,8 +80,10 @@ G_DEFINE_TYPE_WITH_CODE (KmsBaseRtpEndpoint, kms_base_rtp_endpoint,
 )
 
 #define JB_INITIAL_LATENCY 0
-#define JB_READY_AUDIO_LATENCY 100
-#define JB_READY_VIDEO_LATENCY 500
+#define JB_DEFAULT_AUDIO_MIN_LATENCY 20
+#define JB_DEFAULT_AUDIO_MAX_LATENCY 100
+#define JB_DEFAULT_VIDEO_MIN_LATENCY 50
+#define JB_DEFAULT_VIDEO_MAX_LATENCY 500
 #define RTCP_FB_CCM_FIR   SDP_MEDIA_RTCP_FB_CCM " " SDP_MEDIA_RTCP_FB_FIR
 #define RTCP_FB_NACK_PLI  SDP_MEDIA_RTCP_FB_NACK " " SDP_MEDIA_RTCP_FB_PLI
 
@@ -234,12 +242,22 @@ struct _KmsBaseRtpEndpointPrivate
   KmsRembLocal *rl;
   KmsRembRemote *rm;
 
+  /* RTCP feedback written and filtered for all the sessions */
+  KmsRtcpComposer *rtcp_composer;
+
   /* Port range */
   guint min_port;
   guint max_port;
 
   /* RTP settings */
   guint mtu;
+  gboolean send_batching;
+
+  /* Jitterbuffer latency bounds (ms) */
+  guint audio_jb_min_latency;
+  guint audio_jb_max_latency;
+  guint video_jb_min_latency;
+  guint video_jb_max_latency;
 
   /* RTP statistics */
   KmsBaseRTPStats stats;
@@ -277,6 +295,7 @@ static guint obj_signals[LAST_SIGNAL] = { 0 };
 #define MIN_VIDEO_SEND_BW_DEFAULT 100  // kbps
 #define MAX_VIDEO_SEND_BW_DEFAULT 500  // kbps
 #define DEFAULT_MTU 1200 // Bytes
+#define DEFAULT_SEND_BATCHING FALSE
 
 enum
 {
@@ -295,6 +314,11 @@ enum
   PROP_SUPPORT_FEC,
   PROP_OFFER_DIR,
   PROP_MTU,
+  PROP_AUDIO_JB_MIN_LATENCY,
+  PROP_AUDIO_JB_MAX_LATENCY,
+  PROP_VIDEO_JB_MIN_LATENCY,
+  PROP_VIDEO_JB_MAX_LATENCY,
+  PROP_SEND_BATCHING,
   PROP_LAST
 };
 
@@ -319,22 +343,16 @@ is_proto (const gchar * term, const gchar * opt, const gchar * proto)
 typedef struct _HdrExtData
 {
   GstPad *pad;
-  /* Useful to make buffers writable when needed. */
-  gboolean add_hdr;
-  gboolean set_time;
   gint abs_send_time_id;
 } HdrExtData;
 
 static HdrExtData *
-hdr_ext_data_new (GstPad * pad, gboolean add_hdr, gboolean set_time,
-    gint abs_send_time_id)
+hdr_ext_data_new (GstPad * pad, gint abs_send_time_id)
 {
   HdrExtData *data;
 
   data = g_slice_new0 (HdrExtData);
   data->pad = pad;
-  data->add_hdr = add_hdr;
-  data->set_time = set_time;
   data->abs_send_time_id = abs_send_time_id;
 
   return data;
@@ -358,7 +376,7 @@ kms_base_rtp_endpoint_rtp_hdr_ext_set_time (guint8 * data)
   GstClockTime current_time, ms;
   guint value;
 
-  current_time = kms_utils_get_time_nsecs ();
+  current_time = kms_utils_get_cached_time_nsecs ();
   ms = GST_TIME_AS_MSECONDS (current_time);
   value = (((ms << 18) / 1000) & 0x00ffffff);
 
@@ -367,50 +385,26 @@ kms_base_rtp_endpoint_rtp_hdr_ext_set_time (guint8 * data)
   data[2] = (guint8) (value);
 }
 
+/* The hdrext is added by the payloader probe (see */
+/* kms_base_rtp_endpoint_config_rtp_hdr_ext), so here it is only updated */
 static void
 kms_base_rtp_endpoint_add_rtp_hdr_ext (HdrExtData * data, GstBuffer * buffer)
 {
   GstRTPBuffer rtp = { NULL, };
   guint8 id = data->abs_send_time_id;
-  GstMapFlags map_flags;
   guint8 *time;
   guint size;
 
-  if (data->add_hdr) {
-    map_flags = GST_MAP_WRITE;
-  } else {
-    map_flags = GST_MAP_READ;
-  }
-
-  if (!gst_rtp_buffer_map (buffer, map_flags, &rtp)) {
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp)) {
     GST_WARNING_OBJECT (data->pad, "Can not map RTP buffer");
     return;
   }
 
   if (!gst_rtp_buffer_get_extension_onebyte_header (&rtp,
           id, 0, (gpointer) & time, &size)) {
-    GST_TRACE_OBJECT (data->pad,
+    GST_WARNING_OBJECT (data->pad,
         "RTP hdrext abs-send-time with id '%d' not found", id);
-
-    if (data->add_hdr) {
-      GST_TRACE_OBJECT (data->pad, " Adding new one.");
-    } else {
-      GST_WARNING_OBJECT (data->pad, "Cannot add new one: not writable");
-      goto end;
-    }
-
-    time = g_malloc0 (RTP_HDR_EXT_ABS_SEND_TIME_SIZE);
-    if (data->set_time) {
-      kms_base_rtp_endpoint_rtp_hdr_ext_set_time (time);
-    }
-
-    if (!gst_rtp_buffer_add_extension_onebyte_header (&rtp,
-            id, time, RTP_HDR_EXT_ABS_SEND_TIME_SIZE)) {
-      GST_WARNING_OBJECT (data->pad, "RTP hdrext abs-send-time not added");
-    }
-
-    g_free (time);
-  } else if (data->set_time) {
+  } else {
     if (size != RTP_HDR_EXT_ABS_SEND_TIME_SIZE) {
       GST_WARNING_OBJECT (data->pad,
           "RTP hdrext abs-send-time size with id '%d' not matching", id);
@@ -421,7 +415,6 @@ kms_base_rtp_endpoint_add_rtp_hdr_ext (HdrExtData * data, GstBuffer * buffer)
     }
   }
 
-end:
   gst_rtp_buffer_unmap (&rtp);
 }
 
@@ -429,9 +422,6 @@ static gboolean
 kms_base_rtp_endpoint_add_rtp_hdr_ext_bufflist (GstBuffer ** buf, guint idx,
     HdrExtData * data)
 {
-  if (data->add_hdr) {
-    *buf = gst_buffer_make_writable (*buf);
-  }
   kms_base_rtp_endpoint_add_rtp_hdr_ext (data, *buf);
 
   return TRUE;
@@ -446,32 +436,28 @@ kms_base_rtp_endpoint_add_rtp_hdr_ext_probe (GstPad * pad,
   if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
     GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
 
-    if (data->add_hdr) {
-      buffer = gst_buffer_make_writable (buffer);
-    }
     kms_base_rtp_endpoint_add_rtp_hdr_ext (data, buffer);
-    GST_PAD_PROBE_INFO_DATA (info) = buffer;
   } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
     GstBufferList *bufflist = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
 
-    if (data->add_hdr) {
-      bufflist = gst_buffer_list_make_writable (bufflist);
-    }
+    kms_utils_time_cache_begin ();
     gst_buffer_list_foreach (bufflist,
         (GstBufferListFunc) kms_base_rtp_endpoint_add_rtp_hdr_ext_bufflist,
         data);
-
-    GST_PAD_PROBE_INFO_DATA (info) = bufflist;
+    kms_utils_time_cache_end ();
   }
 
   return GST_PAD_PROBE_OK;
 }
 
+/* The payloader output is rewritten with a new header that carries the */
+/* hdrext, sharing the payload memory: adding it in place would copy the */
+/* whole payload whenever it is shared with other branches */
 static void
 kms_base_rtp_endpoint_config_rtp_hdr_ext (KmsBaseRtpEndpoint * self,
     const GstSDPMedia * media, GstElement * payloader)
 {
-  HdrExtData *data;
+  KmsRtpFanoutPeer peer = { 0 };
   gint abs_send_time_id;
   GstPad *pad;
 
@@ -487,15 +473,12 @@ kms_base_rtp_endpoint_config_rtp_hdr_ext (KmsBaseRtpEndpoint * self,
     return;
   }
 
-  data = hdr_ext_data_new (pad, TRUE, FALSE, abs_send_time_id);
+  peer.abs_send_time_id = abs_send_time_id;
 
   GST_DEBUG_OBJECT (self,
       "Add probe for adding abs-send-time (id: %d, %" GST_PTR_FORMAT
       ").", abs_send_time_id, pad);
-  gst_pad_add_probe (pad,
-      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
-      kms_base_rtp_endpoint_add_rtp_hdr_ext_probe, data,
-      hdr_ext_data_destroy_pointer);
+  kms_rtp_fanout_add_probe (pad, &peer);
   g_object_unref (pad);
 }
 
@@ -912,6 +895,10 @@ kms_base_rtp_endpoint_request_rtp_sink (KmsIRtpSessionManager * manager,
     pad =
         gst_element_get_request_pad (self->priv->rtpbin,
         VIDEO_RTPBIN_RECV_RTP_SINK);
+
+    if (pad != NULL && self->priv->rl != NULL) {
+      kms_remb_local_add_recv_pad (self->priv->rl, pad);
+    }
   } else {
     GST_ERROR_OBJECT (self, "'%s' not valid", media_str);
     return NULL;
@@ -944,7 +931,7 @@ kms_base_rtp_endpoint_request_rtp_src (KmsIRtpSessionManager * manager,
     /* TODO: check if needed for audio */
     abs_send_time_id = sdp_utils_get_abs_send_time_id (media);
     if (abs_send_time_id != -1) {
-      HdrExtData *data = hdr_ext_data_new (pad, FALSE, TRUE, abs_send_time_id);
+      HdrExtData *data = hdr_ext_data_new (pad, abs_send_time_id);
 
       GST_DEBUG_OBJECT (self,
           "Add probe for updating abs-send-time (id: %d, %" GST_PTR_FORMAT ").",
@@ -1084,6 +1071,11 @@ kms_base_rtp_endpoint_create_remb_manager (KmsBaseRtpEndpoint *self,
   kms_remb_local_add_remote_session (self->priv->rl, rtpsession,
       sess->remote_video_ssrc);
 
+  /* REMB is written by the composer along with the rest of the feedback */
+  kms_remb_local_disconnect_rtcp (self->priv->rl);
+  kms_rtcp_composer_add_session (self->priv->rtcp_composer, rtpsession,
+      (KmsRtcpComposerRembFunc) kms_remb_local_get_packet, self->priv->rl);
+
   pad = gst_element_get_static_pad (self->priv->rtpbin, VIDEO_RTPBIN_SEND_RTP_SINK);
   self->priv->rm =
       kms_remb_remote_create (rtpsession,
@@ -1097,6 +1089,19 @@ kms_base_rtp_endpoint_create_remb_manager (KmsBaseRtpEndpoint *self,
     kms_remb_remote_set_params (self->priv->rm, self->priv->remb_params);
   }
 
+  if (sess->video_neg != NULL) {
+    kms_remb_local_set_abs_send_time_id (self->priv->rl,
+        sdp_utils_get_abs_send_time_id (sess->video_neg));
+  }
+
+  /* Packets are counted before the jitterbuffer to get their arrival time */
+  pad = gst_element_get_static_pad (self->priv->rtpbin,
+      VIDEO_RTPBIN_RECV_RTP_SINK);
+  if (pad != NULL) {
+    kms_remb_local_add_recv_pad (self->priv->rl, pad);
+    g_object_unref (pad);
+  }
+
   GST_DEBUG_OBJECT (self, "REMB managers added");
 }
 
@@ -1157,31 +1162,26 @@ kms_base_rtp_endpoint_request_local_key_frame (KmsBaseRtpEndpoint * self)
 /* Payloading configuration begin */
 static GstCaps *
 kms_base_rtp_endpoint_get_caps_from_rtpmap (const gchar * media,
-    const gchar * pt, const gchar * rtpmap)
+    const SdpUtilsPtIndex * index, gint pt)
 {
-  GstCaps *caps = NULL;
+  const gchar *codec_name;
   gint clock_rate;
-  gchar *codec_name = NULL;
 
-  if (rtpmap == NULL) {
+  if (sdp_utils_pt_index_get_rtpmap (index, pt) == NULL) {
     GST_WARNING ("rtpmap is NULL for media '%s'", media);
     return NULL;
   }
 
-  if (!sdp_utils_get_data_from_rtpmap (rtpmap, &codec_name, &clock_rate)) {
+  if (!sdp_utils_pt_index_get_codec (index, pt, &codec_name, &clock_rate)) {
     return NULL;
   }
 
-  caps = gst_caps_new_simple ("application/x-rtp",
+  return gst_caps_new_simple ("application/x-rtp",
       "media", G_TYPE_STRING, media,
-      "payload", G_TYPE_INT, atoi (pt),
+      "payload", G_TYPE_INT, pt,
       "clock-rate", G_TYPE_INT, clock_rate,
       "encoding-name", G_TYPE_STRING,
       kms_utils_get_caps_codec_name_from_sdp (codec_name), NULL);
-
-  g_free (codec_name);
-
-  return caps;
 }
 
 static GstElement *
@@ -1282,6 +1282,9 @@ kms_base_rtp_endpoint_get_depayloader_for_caps (GstCaps * caps)
     depayloader = gst_element_factory_create (factory, NULL);
 
     if (depayloader != NULL) {
+      /* Before the PTS monitor, frames are matched by their timestamp */
+      kms_rtp_layers_tag_depayloader (depayloader,
+          kms_rtp_layers_codec_from_rtp_caps (caps));
       kms_utils_depayloader_monitor_pts_out (depayloader);
       break;
     }
@@ -1438,6 +1441,24 @@ kms_base_rtp_endpoint_connect_payloader (KmsBaseRtpEndpoint * self,
   kms_base_rtp_endpoint_connect_payloader_async (self, conn, payloader, type);
 }
 
+static void
+kms_base_rtp_endpoint_batch_payloader (KmsBaseRtpEndpoint * self,
+    GstElement * payloader)
+{
+  GstPad *pad;
+
+  pad = gst_element_get_static_pad (payloader, "src");
+  if (pad == NULL) {
+    GST_WARNING_OBJECT (self, "No RTP pad to batch in %" GST_PTR_FORMAT,
+        payloader);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "Batching the packets of %" GST_PTR_FORMAT, pad);
+  kms_rtp_batch_add_probe (pad);
+  g_object_unref (pad);
+}
+
 static void
 kms_base_rtp_endpoint_set_media_payloader (KmsBaseRtpEndpoint * self,
     KmsBaseRtpSession * sess, KmsSdpMediaHandler * handler,
@@ -1445,18 +1466,19 @@ kms_base_rtp_endpoint_set_media_payloader (KmsBaseRtpEndpoint * self,
 {
   const gchar *media_str = gst_sdp_media_get_media (media);
   GstElement *payloader;
+  SdpUtilsPtIndex *index;
   GstCaps *caps = NULL;
   guint j, f_len;
   const gchar *rtpbin_pad_name;
   KmsElementPadType type;
 
-  f_len = gst_sdp_media_formats_len (media);
+  index = sdp_utils_pt_index_new (media);
+  f_len = sdp_utils_pt_index_get_n_pts (index);
   for (j = 0; j < f_len && caps == NULL; j++) {
-    const gchar *pt = gst_sdp_media_get_format (media, j);
-    const gchar *rtpmap = sdp_utils_sdp_media_get_rtpmap (media, pt);
-
-    caps = kms_base_rtp_endpoint_get_caps_from_rtpmap (media_str, pt, rtpmap);
+    caps = kms_base_rtp_endpoint_get_caps_from_rtpmap (media_str, index,
+        sdp_utils_pt_index_get_pt (index, j));
   }
+  sdp_utils_pt_index_free (index);
 
   if (caps == NULL) {
     GST_WARNING_OBJECT (self, "Caps not found for media '%s'", media_str);
@@ -1479,8 +1501,14 @@ kms_base_rtp_endpoint_set_media_payloader (KmsBaseRtpEndpoint * self,
     type = KMS_ELEMENT_PAD_TYPE_AUDIO;
     rtpbin_pad_name = AUDIO_RTPBIN_SEND_RTP_SINK;
   } else if (g_strcmp0 (VIDEO_STREAM_NAME, media_str) == 0) {
+    if (self->priv->send_batching) {
+      /* Before the hdrext probe, so it is applied once per list */
+      kms_base_rtp_endpoint_batch_payloader (self, payloader);
+    }
     /* TODO: check if is needed for audio  */
     kms_base_rtp_endpoint_config_rtp_hdr_ext (self, media, payloader);
+    /* Layered sources are adapted to the REMB of this endpoint */
+    kms_layer_selector_add (payloader);
     type = KMS_ELEMENT_PAD_TYPE_VIDEO;
     rtpbin_pad_name = VIDEO_RTPBIN_SEND_RTP_SINK;
   } else {
@@ -1589,32 +1617,12 @@ end:
 }
 
 static void
-complete_caps_with_fb (GstCaps * caps, const GstSDPMedia * media,
-    const gchar * payload)
+complete_caps_with_fb (GstCaps * caps, const SdpUtilsPtIndex * index, gint pt)
 {
   gboolean fir, pli;
-  guint a;
 
-  fir = pli = FALSE;
-
-  for (a = 0;; a++) {
-    const gchar *attr;
-
-    attr = gst_sdp_media_get_attribute_val_n (media, SDP_MEDIA_RTCP_FB, a);
-    if (attr == NULL) {
-      break;
-    }
-
-    if (sdp_utils_rtcp_fb_attr_check_type (attr, payload, RTCP_FB_CCM_FIR)) {
-      fir = TRUE;
-      continue;
-    }
-
-    if (sdp_utils_rtcp_fb_attr_check_type (attr, payload, RTCP_FB_NACK_PLI)) {
-      pli = TRUE;
-      continue;
-    }
-  }
+  fir = sdp_utils_pt_index_has_rtcp_fb (index, pt, RTCP_FB_CCM_FIR);
+  pli = sdp_utils_pt_index_has_rtcp_fb (index, pt, RTCP_FB_NACK_PLI);
 
   if (fir) {
     gst_caps_set_simple (caps, "rtcp-fb-ccm-fir", G_TYPE_BOOLEAN, fir, NULL);
@@ -1721,38 +1729,44 @@ kms_base_rtp_endpoint_get_caps_for_pt (KmsBaseRtpEndpoint * self, guint pt)
   for (i = 0; i < len; i++) {
     const GstSDPMedia *media = gst_sdp_message_get_media (sdp, i);
     const gchar *media_str = gst_sdp_media_get_media (media);
-    const gchar *rtpmap, *fmtp;
+    SdpUtilsPtIndex *index;
+    const gchar *fmtp;
+    GstCaps *caps;
     guint j, f_len;
 
-    f_len = gst_sdp_media_formats_len (media);
-    for (j = 0; j < f_len; j++) {
-      GstCaps *caps;
-      const gchar *payload = gst_sdp_media_get_format (media, j);
+    /* One pass over the media instead of a scan per looked up attribute */
+    index = sdp_utils_pt_index_new (media);
 
-      if (atoi (payload) != pt) {
-        continue;
+    f_len = sdp_utils_pt_index_get_n_pts (index);
+    for (j = 0; j < f_len; j++) {
+      if (sdp_utils_pt_index_get_pt (index, j) == (gint) pt) {
+        break;
       }
+    }
 
-      rtpmap = sdp_utils_sdp_media_get_rtpmap (media, payload);
-      caps =
-          kms_base_rtp_endpoint_get_caps_from_rtpmap (media_str, payload,
-          rtpmap);
-
-      if (caps == NULL) {
-        continue;
-      }
+    if (j == f_len) {
+      sdp_utils_pt_index_free (index);
+      continue;
+    }
 
-      /* Configure codec if it is possible */
-      fmtp = sdp_utils_sdp_media_get_fmtp (media, payload);
+    caps = kms_base_rtp_endpoint_get_caps_from_rtpmap (media_str, index, pt);
 
-      if (fmtp != NULL) {
-        complement_caps_with_fmtp_attrs (caps, fmtp);
-      }
+    if (caps == NULL) {
+      sdp_utils_pt_index_free (index);
+      continue;
+    }
 
-      complete_caps_with_fb (caps, media, payload);
+    /* Configure codec if it is possible */
+    fmtp = sdp_utils_pt_index_get_fmtp (index, pt);
 
-      return caps;
+    if (fmtp != NULL) {
+      complement_caps_with_fmtp_attrs (caps, fmtp);
     }
+
+    complete_caps_with_fb (caps, index, pt);
+    sdp_utils_pt_index_free (index);
+
+    return caps;
   }
 
   return NULL;
@@ -1921,34 +1935,69 @@ kms_base_rtp_endpoint_jitterbuffer_set_latency (GstElement * jitterbuffer,
   g_object_unref (src_pad);
 }
 
+#define SYNC_RTP_LIST_PREALLOC 64
+
 static gboolean
 kms_base_rtp_endpoint_sync_rtp_it (GstBuffer ** buffer, guint idx,
-    KmsRtpSynchronizer * sync)
+    GstClockTime * pts_list)
 {
-  *buffer = gst_buffer_make_writable (*buffer);
-  kms_rtp_synchronizer_process_rtp_buffer (sync, *buffer, NULL);
+  GstClockTime pts = pts_list[idx];
+
+  if (pts != GST_BUFFER_PTS (*buffer)) {
+    *buffer = gst_buffer_make_writable (*buffer);
+    GST_BUFFER_PTS (*buffer) = pts;
+  }
 
   return TRUE;
 }
 
+/* PTSs are computed on the read-only data first, so buffers and lists */
+/* are only made writable (and maybe copied) when a PTS really changes */
 static GstPadProbeReturn
 kms_base_rtp_endpoint_sync_rtp_probe (GstPad * pad, GstPadProbeInfo * info,
     KmsRtpSynchronizer * sync)
 {
   if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
     GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstClockTime pts;
 
-    buffer = gst_buffer_make_writable (buffer);
-    kms_rtp_synchronizer_process_rtp_buffer (sync, buffer, NULL);
-    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    kms_rtp_synchronizer_process_rtp_buffer_pts (sync, buffer, &pts, NULL);
+
+    if (pts != GST_BUFFER_PTS (buffer)) {
+      buffer = gst_buffer_make_writable (buffer);
+      GST_BUFFER_PTS (buffer) = pts;
+      GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    }
   }
   else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
     GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    GstClockTime pts_prealloc[SYNC_RTP_LIST_PREALLOC];
+    GstClockTime *pts_list;
+    gboolean changed = FALSE;
+    guint i, len;
 
-    list = gst_buffer_list_make_writable (list);
-    gst_buffer_list_foreach (list,
-        (GstBufferListFunc) kms_base_rtp_endpoint_sync_rtp_it, sync);
-    GST_PAD_PROBE_INFO_DATA (info) = list;
+    len = gst_buffer_list_length (list);
+    pts_list = len <= SYNC_RTP_LIST_PREALLOC ?
+        pts_prealloc : g_new (GstClockTime, len);
+
+    for (i = 0; i < len; i++) {
+      GstBuffer *buffer = gst_buffer_list_get (list, i);
+
+      kms_rtp_synchronizer_process_rtp_buffer_pts (sync, buffer,
+          &pts_list[i], NULL);
+      changed |= pts_list[i] != GST_BUFFER_PTS (buffer);
+    }
+
+    if (changed) {
+      list = gst_buffer_list_make_writable (list);
+      gst_buffer_list_foreach (list,
+          (GstBufferListFunc) kms_base_rtp_endpoint_sync_rtp_it, pts_list);
+      GST_PAD_PROBE_INFO_DATA (info) = list;
+    }
+
+    if (pts_list != pts_prealloc) {
+      g_free (pts_list);
+    }
   }
 
   return GST_PAD_PROBE_OK;
@@ -2019,14 +2068,23 @@ kms_base_rtp_endpoint_rtpbin_new_jitterbuffer (GstElement * rtpbin,
 {
   KmsRTPSessionStats *rtp_stats;
   KmsSSRCStats *ssrc_stats;
+  guint min_latency, max_latency;
+  GstPad *pad;
 
   g_object_set (jitterbuffer, "mode", 4 /* synced */ ,
       "latency", JB_INITIAL_LATENCY, NULL);
 
   switch (session) {
     case AUDIO_RTP_SESSION: {
+      KMS_ELEMENT_LOCK (self);
+      min_latency = self->priv->audio_jb_min_latency;
+      max_latency = self->priv->audio_jb_max_latency;
+      KMS_ELEMENT_UNLOCK (self);
+
       kms_base_rtp_endpoint_jitterbuffer_set_latency (jitterbuffer,
-          JB_READY_AUDIO_LATENCY);
+          min_latency);
+      kms_jitter_buffer_control_add (jitterbuffer,
+          KMS_ELEMENT_GET_CLASS (self)->loop, min_latency, max_latency);
 
       kms_base_rtp_endpoint_jitterbuffer_monitor_rtp_out (jitterbuffer,
           self->priv->sync_audio);
@@ -2038,8 +2096,15 @@ kms_base_rtp_endpoint_rtpbin_new_jitterbuffer (GstElement * rtpbin,
       break;
     }
     case VIDEO_RTP_SESSION: {
+      KMS_ELEMENT_LOCK (self);
+      min_latency = self->priv->video_jb_min_latency;
+      max_latency = self->priv->video_jb_max_latency;
+      KMS_ELEMENT_UNLOCK (self);
+
       kms_base_rtp_endpoint_jitterbuffer_set_latency (jitterbuffer,
-          JB_READY_VIDEO_LATENCY);
+          min_latency);
+      kms_jitter_buffer_control_add (jitterbuffer,
+          KMS_ELEMENT_GET_CLASS (self)->loop, min_latency, max_latency);
 
       kms_base_rtp_endpoint_jitterbuffer_monitor_rtp_out (jitterbuffer,
           self->priv->sync_video);
@@ -2071,6 +2136,10 @@ kms_base_rtp_endpoint_rtpbin_new_jitterbuffer (GstElement * rtpbin,
 
   KMS_ELEMENT_UNLOCK (self);
 
+  pad = gst_element_get_static_pad (jitterbuffer, "sink");
+  kms_rtcp_composer_add_feedback_probe (self->priv->rtcp_composer, pad, ssrc);
+  g_object_unref (pad);
+
   if (session == VIDEO_RTP_SESSION) {
     gboolean rtcp_nack = kms_base_rtp_endpoint_is_video_rtcp_nack (self);
 
@@ -2120,7 +2189,7 @@ ssrc_stats_add_jitter_stats (GstStructure * ssrc_stats,
     GstElement * jitter_buffer)
 {
   GstStructure *jitter_stats;
-  guint percent, latency;
+  guint percent, latency, target;
 
   g_object_get (jitter_buffer, "percent", &percent, "latency", &latency,
       "stats", &jitter_stats, NULL);
@@ -2128,9 +2197,15 @@ ssrc_stats_add_jitter_stats (GstStructure * ssrc_stats,
   if (jitter_stats == NULL)
     return;
 
+  /* Fixed latency if there is no adaptive control */
+  target = kms_jitter_buffer_control_get_target (jitter_buffer);
+  if (target == 0) {
+    target = latency;
+  }
+
   /* Append adition fields to the stats */
   gst_structure_set (jitter_stats, "latency", G_TYPE_UINT, latency, "percent",
-      G_TYPE_UINT, percent, NULL);
+      G_TYPE_UINT, percent, "target-latency", G_TYPE_UINT, target, NULL);
 
   /* Append jitter buffer stats to the ssrc stats */
   gst_structure_set (ssrc_stats, "jitter-buffer", GST_TYPE_STRUCTURE,
@@ -2460,6 +2535,21 @@ kms_base_rtp_endpoint_set_property (GObject * object, guint property_id,
     case PROP_MTU:
       self->priv->mtu = g_value_get_uint (value);
       break;
+    case PROP_AUDIO_JB_MIN_LATENCY:
+      self->priv->audio_jb_min_latency = g_value_get_uint (value);
+      break;
+    case PROP_AUDIO_JB_MAX_LATENCY:
+      self->priv->audio_jb_max_latency = g_value_get_uint (value);
+      break;
+    case PROP_VIDEO_JB_MIN_LATENCY:
+      self->priv->video_jb_min_latency = g_value_get_uint (value);
+      break;
+    case PROP_VIDEO_JB_MAX_LATENCY:
+      self->priv->video_jb_max_latency = g_value_get_uint (value);
+      break;
+    case PROP_SEND_BATCHING:
+      self->priv->send_batching = g_value_get_boolean (value);
+      break;
     case PROP_OFFER_DIR:
       self->priv->offer_dir = g_value_get_enum (value);
       break;
@@ -2529,6 +2619,21 @@ kms_base_rtp_endpoint_get_property (GObject * object, guint property_id,
     case PROP_MTU:
       g_value_set_uint (value, self->priv->mtu);
       break;
+    case PROP_AUDIO_JB_MIN_LATENCY:
+      g_value_set_uint (value, self->priv->audio_jb_min_latency);
+      break;
+    case PROP_AUDIO_JB_MAX_LATENCY:
+      g_value_set_uint (value, self->priv->audio_jb_max_latency);
+      break;
+    case PROP_VIDEO_JB_MIN_LATENCY:
+      g_value_set_uint (value, self->priv->video_jb_min_latency);
+      break;
+    case PROP_VIDEO_JB_MAX_LATENCY:
+      g_value_set_uint (value, self->priv->video_jb_max_latency);
+      break;
+    case PROP_SEND_BATCHING:
+      g_value_set_boolean (value, self->priv->send_batching);
+      break;
     case PROP_SUPPORT_FEC:
       g_value_set_boolean (value, self->priv->support_fec);
       break;
@@ -2612,6 +2717,8 @@ kms_base_rtp_endpoint_finalize (GObject * gobject)
     kms_list_unref (self->priv->prot_medias);
   }
 
+  /* Uses rl to get the REMB, destroyed first */
+  kms_rtcp_composer_destroy (self->priv->rtcp_composer);
   kms_remb_local_destroy (self->priv->rl);
   kms_remb_remote_destroy (self->priv->rm);
 
@@ -2762,6 +2869,26 @@ kms_element_get_e2e_latency_stats (KmsBaseRtpEndpoint * self, gchar * selector)
   return stats;
 }
 
+static void
+kms_base_rtp_endpoint_append_rtcp_feedback_stats (KmsBaseRtpEndpoint * self,
+    GstStructure * stats)
+{
+  KmsRtcpComposerCounters counters;
+  GstStructure *feedback_stats;
+
+  kms_rtcp_composer_get_counters (self->priv->rtcp_composer, &counters);
+
+  feedback_stats = gst_structure_new ("rtcp-feedback",
+      "key-requests-sent", G_TYPE_UINT64, counters.key_requests_sent,
+      "key-requests-suppressed", G_TYPE_UINT64,
+      counters.key_requests_suppressed, "nacks-sent", G_TYPE_UINT64,
+      counters.nacks_sent, "nacks-suppressed", G_TYPE_UINT64,
+      counters.nacks_suppressed, NULL);
+  gst_structure_set (stats, "rtcp-feedback", GST_TYPE_STRUCTURE,
+      feedback_stats, NULL);
+  gst_structure_free (feedback_stats);
+}
+
 static GstStructure *
 kms_base_rtp_endpoint_stats (KmsElement * obj, gchar * selector)
 {
@@ -2781,6 +2908,8 @@ kms_base_rtp_endpoint_stats (KmsElement * obj, gchar * selector)
       rtp_stats, NULL);
   gst_structure_free (rtp_stats);
 
+  kms_base_rtp_endpoint_append_rtcp_feedback_stats (self, stats);
+
   if (!self->priv->stats.enabled) {
     return stats;
   }
@@ -2854,8 +2983,14 @@ kms_base_rtp_endpoint_constructed (GObject * gobject)
   KmsBaseRtpEndpoint *self = KMS_BASE_RTP_ENDPOINT (gobject);
 
   gchar *self_name = gst_object_get_name (GST_OBJECT_CAST (self));
-  gchar *audio_name = g_strconcat (self_name, "_audio", NULL);
-  gchar *video_name = g_strconcat (self_name, "_video", NULL);
+  gchar *audio_name = NULL;
+  gchar *video_name = NULL;
+
+  /* Audio and video are traced together, so A/V sync can be analyzed */
+  if (kms_rtp_synchronizer_stats_sample ()) {
+    audio_name = g_strconcat (self_name, "_audio", NULL);
+    video_name = g_strconcat (self_name, "_video", NULL);
+  }
 
   self->priv->sync_audio = kms_rtp_synchronizer_new (TRUE, audio_name);
   self->priv->sync_video = kms_rtp_synchronizer_new (TRUE, video_name);
@@ -2989,6 +3124,40 @@ kms_base_rtp_endpoint_class_init (KmsBaseRtpEndpointClass * klass)
           0, G_MAXUINT, DEFAULT_MTU,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_AUDIO_JB_MIN_LATENCY,
+      g_param_spec_uint ("audio-jitterbuffer-min-latency",
+          "Audio jitterbuffer min latency",
+          "Lower bound (ms) of the adaptive audio jitterbuffer latency",
+          0, G_MAXUINT, JB_DEFAULT_AUDIO_MIN_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_AUDIO_JB_MAX_LATENCY,
+      g_param_spec_uint ("audio-jitterbuffer-max-latency",
+          "Audio jitterbuffer max latency",
+          "Upper bound (ms) of the adaptive audio jitterbuffer latency",
+          0, G_MAXUINT, JB_DEFAULT_AUDIO_MAX_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_VIDEO_JB_MIN_LATENCY,
+      g_param_spec_uint ("video-jitterbuffer-min-latency",
+          "Video jitterbuffer min latency",
+          "Lower bound (ms) of the adaptive video jitterbuffer latency",
+          0, G_MAXUINT, JB_DEFAULT_VIDEO_MIN_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_VIDEO_JB_MAX_LATENCY,
+      g_param_spec_uint ("video-jitterbuffer-max-latency",
+          "Video jitterbuffer max latency",
+          "Upper bound (ms) of the adaptive video jitterbuffer latency",
+          0, G_MAXUINT, JB_DEFAULT_VIDEO_MAX_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_SEND_BATCHING,
+      g_param_spec_boolean ("send-batching", "Send batching",
+          "Push the video RTP packets of each frame downstream as a single "
+          "buffer list",
+          DEFAULT_SEND_BATCHING, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (object_class, PROP_SUPPORT_FEC,
       g_param_spec_boolean ("support-fec", "Forward error correction supported",
           "Forward error correction supported", FALSE,
@@ -3421,6 +3590,8 @@ kms_base_rtp_endpoint_init (KmsBaseRtpEndpoint * self)
   self->priv->min_video_send_bw = MIN_VIDEO_SEND_BW_DEFAULT;
   self->priv->max_video_send_bw = MAX_VIDEO_SEND_BW_DEFAULT;
 
+  self->priv->rtcp_composer = kms_rtcp_composer_new ();
+
   self->priv->rtpbin = gst_element_factory_make ("rtpbin", NULL);
   g_assert (self->priv->rtpbin);
   if (!self->priv->rtpbin) {
@@ -3470,6 +3641,12 @@ kms_base_rtp_endpoint_init (KmsBaseRtpEndpoint * self)
   self->priv->max_port = DEFAULT_MAX_PORT;
 
   self->priv->mtu = DEFAULT_MTU;
+  self->priv->send_batching = DEFAULT_SEND_BATCHING;
+
+  self->priv->audio_jb_min_latency = JB_DEFAULT_AUDIO_MIN_LATENCY;
+  self->priv->audio_jb_max_latency = JB_DEFAULT_AUDIO_MAX_LATENCY;
+  self->priv->video_jb_min_latency = JB_DEFAULT_VIDEO_MIN_LATENCY;
+  self->priv->video_jb_max_latency = JB_DEFAULT_VIDEO_MAX_LATENCY;
 
   self->priv->offer_dir = DEFAULT_OFFER_DIR;
 }
@@ -23,6 +23,7 @@
 #include "constants.h"
 #include "kmsutils.h"
 #include "sdp_utils.h"
+#include "kmsrtpssrcrouter.h"
 
 #include "kms-core-enumtypes.h"
 #include "kms-core-marshal.h"
@@ -40,6 +41,9 @@ G_DEFINE_QUARK (BUNDLE_CONN_ADDED, bundle_conn_added);
 #define RTCP_DEMUX_PEER "rtcp-demux-peer"
 G_DEFINE_QUARK (RTCP_DEMUX_PEER, rtcp_demux_peer);
 
+#define SSRC_ROUTER "ssrc-router"
+G_DEFINE_QUARK (SSRC_ROUTER, ssrc_router);
+
 struct _KmsBaseRTPSessionStats
 {
   gboolean enabled;
@@ -310,6 +314,7 @@ rtp_ssrc_demux_new_ssrc_pad (GstElement * ssrcdemux, guint ssrc, GstPad * pad,
     KmsBaseRtpSession * self)
 {
   const gchar *rtp_pad_name = GST_OBJECT_NAME (pad);
+  KmsRtpSsrcRouter *router;
   gchar *rtcp_pad_name;
   const GstSDPMedia *media;
   GstPad *src, *sink;
@@ -333,6 +338,13 @@ rtp_ssrc_demux_new_ssrc_pad (GstElement * ssrcdemux, guint ssrc, GstPad * pad,
     goto end;
   }
 
+  router = g_object_get_qdata (G_OBJECT (ssrcdemux), ssrc_router_quark ());
+  if (router != NULL && kms_rtp_ssrc_router_set_ssrc (router, ssrc,
+          gst_sdp_media_get_media (media))) {
+    /* Next packets of this SSRC will not reach the demuxer */
+    goto end;
+  }
+
   /* RTP */
   sink = kms_i_rtp_session_manager_request_rtp_sink (self->manager, self, media);
   kms_base_rtp_session_link_pads (pad, sink);
@@ -356,7 +368,7 @@ kms_base_rtp_session_add_gst_bundle_elements (KmsBaseRtpSession * self,
     KmsIRtpConnection * conn, const GstSDPMedia * media, gboolean active)
 {
   gboolean added;
-  GstElement *ssrcdemux;
+  GstElement *router, *ssrcdemux;
   GstElement *rtcpdemux;        /* FIXME: Useful for local and remote ssrcs mapping */
   GstPad *src, *sink;
 
@@ -374,23 +386,30 @@ kms_base_rtp_session_add_gst_bundle_elements (KmsBaseRtpSession * self,
     kms_i_rtp_connection_add (conn, GST_BIN (self), active);
   }
 
+  /* SSRCs announced in SDP are routed without the demuxer */
+  router = kms_rtp_ssrc_router_new ();
   ssrcdemux = gst_element_factory_make ("rtpssrcdemux", NULL);
   rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
 
+  g_object_set_qdata_full (G_OBJECT (conn), ssrc_router_quark (),
+      g_object_ref (router), g_object_unref);
+  g_object_set_qdata_full (G_OBJECT (ssrcdemux), ssrc_router_quark (),
+      g_object_ref (router), g_object_unref);
   g_object_set_qdata_full (G_OBJECT (ssrcdemux), rtcp_demux_peer_quark (),
       g_object_ref (rtcpdemux), g_object_unref);
   g_signal_connect (ssrcdemux, "new-ssrc-pad",
       G_CALLBACK (rtp_ssrc_demux_new_ssrc_pad), self);
 
   kms_i_rtp_connection_sink_sync_state_with_parent (conn);
-  gst_bin_add_many (GST_BIN (self), ssrcdemux, rtcpdemux, NULL);
+  gst_bin_add_many (GST_BIN (self), router, ssrcdemux, rtcpdemux, NULL);
 
   /* RTP */
   src = kms_i_rtp_connection_request_rtp_src (conn);
-  sink = gst_element_get_static_pad (ssrcdemux, "sink");
+  sink = gst_element_get_static_pad (router, "sink");
   kms_base_rtp_session_link_pads (src, sink);
   g_object_unref (src);
   g_object_unref (sink);
+  gst_element_link_pads (router, "src_fallback", ssrcdemux, "sink");
 
   /* RTCP */
   src = kms_i_rtp_connection_request_rtcp_src (conn);
@@ -398,14 +417,74 @@ kms_base_rtp_session_add_gst_bundle_elements (KmsBaseRtpSession * self,
   kms_base_rtp_session_link_pads (src, sink);
   g_object_unref (src);
   g_object_unref (sink);
-  gst_element_link_pads (rtcpdemux, "rtcp_src", ssrcdemux, "rtcp_sink");
+  gst_element_link_pads (rtcpdemux, "rtcp_src", router, "rtcp_sink");
+  gst_element_link_pads (router, "rtcp_src_fallback", ssrcdemux, "rtcp_sink");
 
+  gst_element_sync_state_with_parent_target_state (router);
   gst_element_sync_state_with_parent_target_state (ssrcdemux);
   gst_element_sync_state_with_parent_target_state (rtcpdemux);
 
   kms_i_rtp_connection_src_sync_state_with_parent (conn);
 }
 
+static void
+kms_base_rtp_session_add_bundle_route (KmsBaseRtpSession * self,
+    KmsIRtpConnection * conn, const GstSDPMedia * media,
+    const GstSDPMedia * remote_media)
+{
+  const gchar *name = gst_sdp_media_get_media (media);
+  KmsRtpSsrcRouter *router;
+  gchar *pad_name;
+  GstPad *src, *sink;
+  guint32 ssrc, rtx_ssrc;
+
+  router = g_object_get_qdata (G_OBJECT (conn), ssrc_router_quark ());
+  if (router == NULL) {
+    return;
+  }
+
+  if (g_strcmp0 (name, AUDIO_STREAM_NAME) == 0) {
+    ssrc = self->remote_audio_ssrc;
+  } else if (g_strcmp0 (name, VIDEO_STREAM_NAME) == 0) {
+    ssrc = self->remote_video_ssrc;
+  } else {
+    return;
+  }
+
+  /* Pads are created and linked now, not when the first packet arrives */
+  if (kms_rtp_ssrc_router_add_route (router, name)) {
+    /* RTP */
+    pad_name = g_strdup_printf ("src_%s", name);
+    src = gst_element_get_static_pad (GST_ELEMENT (router), pad_name);
+    g_free (pad_name);
+    sink = kms_i_rtp_session_manager_request_rtp_sink (self->manager, self,
+        media);
+    kms_base_rtp_session_link_pads (src, sink);
+    g_object_unref (src);
+    g_object_unref (sink);
+
+    /* RTCP */
+    pad_name = g_strdup_printf ("rtcp_src_%s", name);
+    src = gst_element_get_static_pad (GST_ELEMENT (router), pad_name);
+    g_free (pad_name);
+    sink = kms_i_rtp_session_manager_request_rtcp_sink (self->manager, self,
+        media);
+    kms_base_rtp_session_link_pads (src, sink);
+    g_object_unref (src);
+    g_object_unref (sink);
+  }
+
+  if (ssrc != 0) {
+    kms_rtp_ssrc_router_set_ssrc (router, ssrc, name);
+  }
+
+  /* Retransmissions use the second SSRC of the FID group */
+  rtx_ssrc = sdp_utils_media_get_fid_ssrc (remote_media, 1);
+  if (rtx_ssrc != 0) {
+    kms_rtp_ssrc_router_set_ssrc (router, rtx_ssrc, name);
+  }
+}
+
 static void
 kms_base_rtp_session_link_gst_connection_sink (KmsBaseRtpSession * self,
     KmsIRtpConnection * conn, const GstSDPMedia * media)
@@ -500,7 +579,8 @@ kms_base_rtp_session_add_gst_basic_elements (KmsBaseRtpSession * self,
 
 static gboolean
 kms_base_rtp_session_add_gst_connection_elements (KmsBaseRtpSession * self,
-    KmsSdpMediaHandler * handler, const GstSDPMedia * media, gboolean active)
+    KmsSdpMediaHandler * handler, const GstSDPMedia * media,
+    const GstSDPMedia * remote_media, gboolean active)
 {
   KmsIRtpConnection *conn;
   gint hid, gid;
@@ -516,6 +596,7 @@ kms_base_rtp_session_add_gst_connection_elements (KmsBaseRtpSession * self,
   if (gid >= 0) {
     // BUNDLE connection
     kms_base_rtp_session_add_gst_bundle_elements (self, conn, media, active);
+    kms_base_rtp_session_add_bundle_route (self, conn, media, remote_media);
     kms_base_rtp_session_link_gst_connection_sink (self, conn, media);
   }
   else if (gst_sdp_media_get_attribute_val (media, "rtcp-mux") != NULL) {
@@ -607,7 +688,7 @@ kms_base_rtp_session_configure_media_connection (KmsBaseRtpSession * self,
   active = sdp_utils_media_is_active (neg_media, offerer);
 
   return kms_base_rtp_session_add_gst_connection_elements (self, handler,
-      neg_media, active);
+      neg_media, remote_media, active);
 }
 
 static void
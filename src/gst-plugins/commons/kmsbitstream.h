@@ -0,0 +1,511 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_BITSTREAM_H__
+#define __KMS_BITSTREAM_H__
+
+#include <string.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Frame inspection of encoded video: key frame detection and the picture
+ * size of key frames. Only the frame headers are read (VP8 frame tag, VP9
+ * uncompressed header, H264 NAL headers and SPS), so buffers are never
+ * mapped whole. Header only, it is also used by plugins that do not link
+ * the commons library.
+ */
+
+typedef enum
+{
+  KMS_BITSTREAM_CODEC_UNKNOWN,
+  KMS_BITSTREAM_CODEC_VP8,
+  KMS_BITSTREAM_CODEC_VP9,
+  KMS_BITSTREAM_CODEC_H264,     /* Annex B byte-stream */
+  KMS_BITSTREAM_CODEC_H264_AVC  /* 4 bytes NAL length prefixes */
+} KmsBitstreamCodec;
+
+typedef struct _KmsBitstreamInfo
+{
+  gboolean keyframe;
+  /* Picture size, 0 when the frame does not carry it */
+  gint width;
+  gint height;
+} KmsBitstreamInfo;
+
+/* Bytes read from VP8 and VP9 frames, enough for any key frame header */
+#define KMS_BITSTREAM_VPX_HEADER_SIZE 16
+
+/* Bit reader (MSB first) */
+
+typedef struct _KmsBitReader
+{
+  const guint8 *data;
+  gsize size;
+  gsize byte;
+  guint bit;
+  /* H264 emulation prevention bytes are skipped when set */
+  gboolean epb;
+  guint zeros;
+  gboolean error;
+} KmsBitReader;
+
+static inline void
+kms_bit_reader_init (KmsBitReader * r, const guint8 * data, gsize size,
+    gboolean epb)
+{
+  r->data = data;
+  r->size = size;
+  r->byte = 0;
+  r->bit = 0;
+  r->epb = epb;
+  r->zeros = 0;
+  r->error = FALSE;
+}
+
+static inline guint
+kms_bit_reader_read_bit (KmsBitReader * r)
+{
+  guint v;
+
+  if (r->bit == 0 && r->epb && r->zeros >= 2 && r->byte < r->size
+      && r->data[r->byte] == 0x03) {
+    r->byte++;
+    r->zeros = 0;
+  }
+
+  if (r->byte >= r->size) {
+    r->error = TRUE;
+    return 0;
+  }
+
+  v = (r->data[r->byte] >> (7 - r->bit)) & 1;
+
+  if (++r->bit == 8) {
+    r->zeros = r->data[r->byte] == 0 ? r->zeros + 1 : 0;
+    r->bit = 0;
+    r->byte++;
+  }
+
+  return v;
+}
+
+static inline guint32
+kms_bit_reader_read_bits (KmsBitReader * r, guint n)
+{
+  guint32 v = 0;
+
+  while (n-- > 0) {
+    v = (v << 1) | kms_bit_reader_read_bit (r);
+  }
+
+  return v;
+}
+
+/* Exp-Golomb codes */
+static inline guint32
+kms_bit_reader_read_ue (KmsBitReader * r)
+{
+  guint lz = 0;
+
+  while (kms_bit_reader_read_bit (r) == 0) {
+    if (r->error || ++lz > 31) {
+      r->error = TRUE;
+      return 0;
+    }
+  }
+
+  return ((1u << lz) - 1) + kms_bit_reader_read_bits (r, lz);
+}
+
+static inline gint32
+kms_bit_reader_read_se (KmsBitReader * r)
+{
+  guint32 k = kms_bit_reader_read_ue (r);
+
+  return (k & 1) ? (gint32) ((k + 1) / 2) : -(gint32) (k / 2);
+}
+
+/* VP8 */
+
+static inline gboolean
+kms_bitstream_vp8_parse (const guint8 * data, gsize size,
+    KmsBitstreamInfo * info)
+{
+  info->width = info->height = 0;
+
+  if (size < 3) {
+    return FALSE;
+  }
+
+  /* Frame tag, bit 0 is 0 for key frames */
+  info->keyframe = (data[0] & 0x01) == 0;
+
+  if (!info->keyframe) {
+    return TRUE;
+  }
+
+  if (size < 10 || data[3] != 0x9d || data[4] != 0x01 || data[5] != 0x2a) {
+    return FALSE;
+  }
+
+  /* 14 bits size, 2 bits scaling */
+  info->width = GST_READ_UINT16_LE (data + 6) & 0x3fff;
+  info->height = GST_READ_UINT16_LE (data + 8) & 0x3fff;
+
+  return TRUE;
+}
+
+/* VP9 */
+
+#define KMS_BITSTREAM_VP9_SYNC_CODE 0x498342
+#define KMS_BITSTREAM_VP9_CS_RGB 7
+
+static inline gboolean
+kms_bitstream_vp9_parse (const guint8 * data, gsize size,
+    KmsBitstreamInfo * info)
+{
+  KmsBitReader r;
+  guint profile;
+
+  info->keyframe = FALSE;
+  info->width = info->height = 0;
+
+  kms_bit_reader_init (&r, data, size, FALSE);
+
+  if (kms_bit_reader_read_bits (&r, 2) != 2) {
+    /* Bad frame marker */
+    return FALSE;
+  }
+
+  profile = kms_bit_reader_read_bit (&r);
+  profile |= kms_bit_reader_read_bit (&r) << 1;
+  if (profile == 3) {
+    kms_bit_reader_read_bit (&r);
+  }
+
+  if (kms_bit_reader_read_bit (&r)) {
+    /* show_existing_frame */
+    return !r.error;
+  }
+
+  info->keyframe = kms_bit_reader_read_bit (&r) == 0;
+  /* show_frame, error_resilient_mode */
+  kms_bit_reader_read_bits (&r, 2);
+
+  if (!info->keyframe) {
+    return !r.error;
+  }
+
+  if (kms_bit_reader_read_bits (&r, 24) != KMS_BITSTREAM_VP9_SYNC_CODE) {
+    info->keyframe = FALSE;
+    return FALSE;
+  }
+
+  /* color_config */
+  if (profile >= 2) {
+    kms_bit_reader_read_bit (&r);
+  }
+  if (kms_bit_reader_read_bits (&r, 3) != KMS_BITSTREAM_VP9_CS_RGB) {
+    kms_bit_reader_read_bit (&r);
+    if (profile == 1 || profile == 3) {
+      kms_bit_reader_read_bits (&r, 3);
+    }
+  } else if (profile == 1 || profile == 3) {
+    kms_bit_reader_read_bit (&r);
+  }
+
+  info->width = kms_bit_reader_read_bits (&r, 16) + 1;
+  info->height = kms_bit_reader_read_bits (&r, 16) + 1;
+
+  if (r.error) {
+    info->width = info->height = 0;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* H264 */
+
+#define KMS_BITSTREAM_H264_NAL_SLICE 1
+#define KMS_BITSTREAM_H264_NAL_SLICE_IDR 5
+#define KMS_BITSTREAM_H264_NAL_SPS 7
+
+static inline void
+kms_bitstream_h264_skip_scaling_list (KmsBitReader * r, guint size)
+{
+  gint last = 8, next = 8;
+  guint j;
+
+  for (j = 0; j < size && !r->error; j++) {
+    if (next != 0) {
+      next = (last + kms_bit_reader_read_se (r) + 256) % 256;
+    }
+    last = (next == 0) ? last : next;
+  }
+}
+
+/* 'data' is the SPS NAL unit without its header byte */
+static inline gboolean
+kms_bitstream_h264_parse_sps (const guint8 * data, gsize size,
+    gint * width, gint * height)
+{
+  guint chroma_format_idc = 1, separate_colour_plane = 0;
+  guint profile_idc, poc_type, frame_mbs_only;
+  guint width_mbs, height_map_units;
+  guint crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+  guint crop_unit_x, crop_unit_y;
+  KmsBitReader r;
+  guint i;
+
+  kms_bit_reader_init (&r, data, size, TRUE);
+
+  profile_idc = kms_bit_reader_read_bits (&r, 8);
+  /* constraint flags and level_idc */
+  kms_bit_reader_read_bits (&r, 16);
+  /* seq_parameter_set_id */
+  kms_bit_reader_read_ue (&r);
+
+  if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122
+      || profile_idc == 244 || profile_idc == 44 || profile_idc == 83
+      || profile_idc == 86 || profile_idc == 118 || profile_idc == 128
+      || profile_idc == 138 || profile_idc == 139 || profile_idc == 134
+      || profile_idc == 135) {
+    chroma_format_idc = kms_bit_reader_read_ue (&r);
+    if (chroma_format_idc == 3) {
+      separate_colour_plane = kms_bit_reader_read_bit (&r);
+    }
+    /* bit_depth_luma_minus8, bit_depth_chroma_minus8 */
+    kms_bit_reader_read_ue (&r);
+    kms_bit_reader_read_ue (&r);
+    /* qpprime_y_zero_transform_bypass_flag */
+    kms_bit_reader_read_bit (&r);
+
+    if (kms_bit_reader_read_bit (&r)) {
+      for (i = 0; i < ((chroma_format_idc != 3) ? 8 : 12); i++) {
+        if (kms_bit_reader_read_bit (&r)) {
+          kms_bitstream_h264_skip_scaling_list (&r, i < 6 ? 16 : 64);
+        }
+      }
+    }
+  }
+
+  /* log2_max_frame_num_minus4 */
+  kms_bit_reader_read_ue (&r);
+
+  poc_type = kms_bit_reader_read_ue (&r);
+  if (poc_type == 0) {
+    kms_bit_reader_read_ue (&r);
+  } else if (poc_type == 1) {
+    guint n;
+
+    kms_bit_reader_read_bit (&r);
+    kms_bit_reader_read_se (&r);
+    kms_bit_reader_read_se (&r);
+    n = kms_bit_reader_read_ue (&r);
+    for (i = 0; i < n && !r.error; i++) {
+      kms_bit_reader_read_se (&r);
+    }
+  }
+
+  /* max_num_ref_frames, gaps_in_frame_num_value_allowed_flag */
+  kms_bit_reader_read_ue (&r);
+  kms_bit_reader_read_bit (&r);
+
+  width_mbs = kms_bit_reader_read_ue (&r) + 1;
+  height_map_units = kms_bit_reader_read_ue (&r) + 1;
+
+  frame_mbs_only = kms_bit_reader_read_bit (&r);
+  if (!frame_mbs_only) {
+    kms_bit_reader_read_bit (&r);
+  }
+  /* direct_8x8_inference_flag */
+  kms_bit_reader_read_bit (&r);
+
+  if (kms_bit_reader_read_bit (&r)) {
+    crop_left = kms_bit_reader_read_ue (&r);
+    crop_right = kms_bit_reader_read_ue (&r);
+    crop_top = kms_bit_reader_read_ue (&r);
+    crop_bottom = kms_bit_reader_read_ue (&r);
+  }
+
+  if (r.error) {
+    return FALSE;
+  }
+
+  if (chroma_format_idc == 0 || separate_colour_plane) {
+    crop_unit_x = 1;
+    crop_unit_y = 2 - frame_mbs_only;
+  } else {
+    crop_unit_x = (chroma_format_idc == 3) ? 1 : 2;
+    crop_unit_y = ((chroma_format_idc == 1) ? 2 : 1) * (2 - frame_mbs_only);
+  }
+
+  *width = width_mbs * 16 - crop_unit_x * (crop_left + crop_right);
+  *height = (2 - frame_mbs_only) * height_map_units * 16 -
+      crop_unit_y * (crop_top + crop_bottom);
+
+  return TRUE;
+}
+
+/* Returns the offset of the NAL unit after the start code at or after */
+/* 'offset', or 'size' if there is none */
+static inline gsize
+kms_bitstream_h264_next_nal (const guint8 * data, gsize size, gsize offset)
+{
+  const guint8 *p;
+
+  while (offset + 3 <= size) {
+    p = memchr (data + offset, 0x01, size - offset);
+    if (p == NULL) {
+      return size;
+    }
+
+    offset = p - data;
+    if (offset >= 2 && data[offset - 1] == 0 && data[offset - 2] == 0) {
+      return offset + 1;
+    }
+    offset++;
+  }
+
+  return size;
+}
+
+/* Reads NAL units until the first slice of the access unit */
+static inline gboolean
+kms_bitstream_h264_parse (const guint8 * data, gsize size, gboolean avc,
+    KmsBitstreamInfo * info)
+{
+  gsize offset, nal_size;
+  guint type;
+
+  info->keyframe = FALSE;
+  info->width = info->height = 0;
+
+  offset = avc ? 0 : kms_bitstream_h264_next_nal (data, size, 0);
+
+  while (offset < size) {
+    if (avc) {
+      if (offset + 4 > size) {
+        return FALSE;
+      }
+      nal_size = GST_READ_UINT32_BE (data + offset);
+      offset += 4;
+      if (nal_size == 0 || nal_size > size - offset) {
+        return FALSE;
+      }
+    } else {
+      /* The SPS reader stops before reaching the next start code */
+      nal_size = size - offset;
+    }
+
+    type = data[offset] & 0x1f;
+
+    if (type == KMS_BITSTREAM_H264_NAL_SPS && nal_size > 1) {
+      if (!kms_bitstream_h264_parse_sps (data + offset + 1, nal_size - 1,
+              &info->width, &info->height)) {
+        info->width = info->height = 0;
+      }
+    } else if (type == KMS_BITSTREAM_H264_NAL_SLICE_IDR) {
+      info->keyframe = TRUE;
+      return TRUE;
+    } else if (type == KMS_BITSTREAM_H264_NAL_SLICE) {
+      return TRUE;
+    }
+
+    offset = avc ? offset + nal_size :
+        kms_bitstream_h264_next_nal (data, size, offset);
+  }
+
+  /* No slice found, parameter sets alone are not a key frame */
+  return FALSE;
+}
+
+/* Buffers */
+
+static inline KmsBitstreamCodec
+kms_bitstream_codec_from_caps (const GstCaps * caps)
+{
+  const GstStructure *s;
+  const gchar *format;
+
+  if (caps == NULL || gst_caps_get_size (caps) == 0) {
+    return KMS_BITSTREAM_CODEC_UNKNOWN;
+  }
+
+  s = gst_caps_get_structure (caps, 0);
+
+  if (gst_structure_has_name (s, "video/x-vp8")) {
+    return KMS_BITSTREAM_CODEC_VP8;
+  } else if (gst_structure_has_name (s, "video/x-vp9")) {
+    return KMS_BITSTREAM_CODEC_VP9;
+  } else if (gst_structure_has_name (s, "video/x-h264")) {
+    format = gst_structure_get_string (s, "stream-format");
+
+    if (format != NULL && g_str_has_prefix (format, "avc")) {
+      return KMS_BITSTREAM_CODEC_H264_AVC;
+    }
+
+    return KMS_BITSTREAM_CODEC_H264;
+  }
+
+  return KMS_BITSTREAM_CODEC_UNKNOWN;
+}
+
+/* VP8 and VP9 frame headers are copied to the stack; H264 NAL units are */
+/* read from the first memory of the buffer only                         */
+static inline gboolean
+kms_bitstream_parse_buffer (GstBuffer * buffer, KmsBitstreamCodec codec,
+    KmsBitstreamInfo * info)
+{
+  guint8 header[KMS_BITSTREAM_VPX_HEADER_SIZE];
+  GstMapInfo minfo;
+  GstMemory *mem;
+  gboolean ret;
+  gsize size;
+
+  switch (codec) {
+    case KMS_BITSTREAM_CODEC_VP8:
+      size = gst_buffer_extract (buffer, 0, header, sizeof (header));
+      return kms_bitstream_vp8_parse (header, size, info);
+    case KMS_BITSTREAM_CODEC_VP9:
+      size = gst_buffer_extract (buffer, 0, header, sizeof (header));
+      return kms_bitstream_vp9_parse (header, size, info);
+    case KMS_BITSTREAM_CODEC_H264:
+    case KMS_BITSTREAM_CODEC_H264_AVC:
+      if (gst_buffer_n_memory (buffer) == 0) {
+        return FALSE;
+      }
+
+      mem = gst_buffer_peek_memory (buffer, 0);
+      if (!gst_memory_map (mem, &minfo, GST_MAP_READ)) {
+        return FALSE;
+      }
+
+      ret = kms_bitstream_h264_parse (minfo.data, minfo.size,
+          codec == KMS_BITSTREAM_CODEC_H264_AVC, info);
+      gst_memory_unmap (mem, &minfo);
+
+      return ret;
+    default:
+      return FALSE;
+  }
+}
+
+G_END_DECLS
+#endif /* __KMS_BITSTREAM_H__ */
@@ -0,0 +1,172 @@
+/*
+ * (C) Copyright 2014 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "kmsconvtreebin.h"
+#include "kmsutils.h"
+
+#define GST_DEFAULT_NAME "convtreebin"
+#define GST_CAT_DEFAULT kms_conv_tree_bin_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define kms_conv_tree_bin_parent_class parent_class
+G_DEFINE_TYPE (KmsConvTreeBin, kms_conv_tree_bin, KMS_TYPE_TREE_BIN);
+
+#define KMS_CONV_TREE_BIN_GET_PRIVATE(obj) ( \
+  G_TYPE_INSTANCE_GET_PRIVATE (              \
+    (obj),                                   \
+    KMS_TYPE_CONV_TREE_BIN,                  \
+    KmsConvTreeBinPrivate                    \
+  )                                          \
+)
+
+#define LEAKY_TIME 600000000    /*600 ms */
+
+struct _KmsConvTreeBinPrivate
+{
+  GstCaps *caps;
+  GstBin *source;
+};
+
+static void
+kms_conv_tree_bin_configure (KmsConvTreeBin * self, const GstCaps * caps)
+{
+  KmsTreeBin *tree_bin = KMS_TREE_BIN (self);
+  GstElement *queue, *rate, *mediator, *convert, *capsfilter, *output_tee;
+
+  self->priv->caps = gst_caps_copy (caps);
+
+  queue = kms_utils_element_factory_make ("queue", "convtreebin_");
+  rate = kms_utils_create_rate_for_caps (caps);
+  mediator = kms_utils_create_mediator_element (caps);
+  convert = kms_utils_create_convert_for_caps (caps);
+  capsfilter = kms_utils_element_factory_make ("capsfilter", "convtreebin_");
+
+  if (kms_utils_caps_is_video (caps)) {
+    g_object_set (queue, "leaky", 2, "max-size-time", LEAKY_TIME, NULL);
+  }
+  g_object_set (capsfilter, "caps", self->priv->caps, NULL);
+
+  gst_bin_add_many (GST_BIN (self), queue, mediator, convert, capsfilter,
+      NULL);
+  if (rate) {
+    gst_bin_add (GST_BIN (self), rate);
+  }
+
+  gst_element_sync_state_with_parent (capsfilter);
+  gst_element_sync_state_with_parent (convert);
+  gst_element_sync_state_with_parent (mediator);
+  if (rate) {
+    gst_element_sync_state_with_parent (rate);
+  }
+  gst_element_sync_state_with_parent (queue);
+
+  kms_tree_bin_set_input_element (tree_bin, queue);
+  output_tee = kms_tree_bin_get_output_tee (tree_bin);
+
+  if (rate) {
+    gst_element_link_many (queue, rate, mediator, NULL);
+  } else {
+    gst_element_link (queue, mediator);
+  }
+  gst_element_link_many (mediator, convert, capsfilter, output_tee, NULL);
+}
+
+KmsConvTreeBin *
+kms_conv_tree_bin_new (const GstCaps * caps)
+{
+  KmsConvTreeBin *conv;
+
+  if (!kms_utils_caps_is_raw (caps)) {
+    GST_WARNING ("Only raw media is converted, not %" GST_PTR_FORMAT, caps);
+    return NULL;
+  }
+
+  conv = g_object_new (KMS_TYPE_CONV_TREE_BIN, NULL);
+  kms_conv_tree_bin_configure (conv, caps);
+
+  return conv;
+}
+
+void
+kms_conv_tree_bin_set_source (KmsConvTreeBin * self, GstBin * source)
+{
+  self->priv->source = source;
+}
+
+GstBin *
+kms_conv_tree_bin_get_source (KmsConvTreeBin * self)
+{
+  return self->priv->source;
+}
+
+GstCaps *
+kms_conv_tree_bin_get_caps (KmsConvTreeBin * self)
+{
+  return gst_caps_ref (self->priv->caps);
+}
+
+gboolean
+kms_conv_tree_bin_is_for_caps (KmsConvTreeBin * self, const GstCaps * caps)
+{
+  return gst_caps_is_equal (self->priv->caps, caps);
+}
+
+static void
+kms_conv_tree_bin_finalize (GObject * object)
+{
+  KmsConvTreeBin *self = KMS_CONV_TREE_BIN (object);
+
+  if (self->priv->caps != NULL) {
+    gst_caps_unref (self->priv->caps);
+    self->priv->caps = NULL;
+  }
+
+  /* chain up */
+  G_OBJECT_CLASS (kms_conv_tree_bin_parent_class)->finalize (object);
+}
+
+static void
+kms_conv_tree_bin_init (KmsConvTreeBin * self)
+{
+  self->priv = KMS_CONV_TREE_BIN_GET_PRIVATE (self);
+
+  self->priv->caps = NULL;
+  self->priv->source = NULL;
+}
+
+static void
+kms_conv_tree_bin_class_init (KmsConvTreeBinClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_set_details_simple (gstelement_class,
+      "ConvTreeBin",
+      "Generic",
+      "Bin to convert and distribute RAW media.",
+      "Kurento <kurento@googlegroups.com>");
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+
+  gobject_class->finalize = kms_conv_tree_bin_finalize;
+
+  g_type_class_add_private (klass, sizeof (KmsConvTreeBinPrivate));
+}
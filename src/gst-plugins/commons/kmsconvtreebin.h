@@ -0,0 +1,75 @@
+/*
+ * (C) Copyright 2014 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_CONV_TREE_BIN_H__
+#define __KMS_CONV_TREE_BIN_H__
+
+#include "kmstreebin.h"
+
+G_BEGIN_DECLS
+/* #defines don't like whitespacey bits */
+#define KMS_TYPE_CONV_TREE_BIN \
+  (kms_conv_tree_bin_get_type())
+#define KMS_CONV_TREE_BIN(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),KMS_TYPE_CONV_TREE_BIN,KmsConvTreeBin))
+#define KMS_CONV_TREE_BIN_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),KMS_TYPE_CONV_TREE_BIN,KmsConvTreeBinClass))
+#define KMS_IS_CONV_TREE_BIN(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),KMS_TYPE_CONV_TREE_BIN))
+#define KMS_IS_CONV_TREE_BIN_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),KMS_TYPE_CONV_TREE_BIN))
+#define KMS_CONV_TREE_BIN_CAST(obj) ((KmsConvTreeBin*)(obj))
+
+typedef struct _KmsConvTreeBin KmsConvTreeBin;
+typedef struct _KmsConvTreeBinClass KmsConvTreeBinClass;
+typedef struct _KmsConvTreeBinPrivate KmsConvTreeBinPrivate;
+
+/*
+ * Converts raw media once to the caps wanted by a set of consumers and
+ * distributes the result through its output tee. Elements of the chain
+ * work in passthrough when no conversion is needed, so frames go through
+ * untouched.
+ */
+struct _KmsConvTreeBin
+{
+  KmsTreeBin parent;
+
+  /*< private > */
+  KmsConvTreeBinPrivate *priv;
+};
+
+struct _KmsConvTreeBinClass
+{
+  KmsTreeBinClass parent_class;
+};
+
+GType kms_conv_tree_bin_get_type (void);
+
+KmsConvTreeBin * kms_conv_tree_bin_new (const GstCaps * caps);
+
+/* Bin it takes the media from */
+void kms_conv_tree_bin_set_source (KmsConvTreeBin * self, GstBin * source);
+GstBin * kms_conv_tree_bin_get_source (KmsConvTreeBin * self);
+
+/* Caps the media is converted to, transfer full */
+GstCaps * kms_conv_tree_bin_get_caps (KmsConvTreeBin * self);
+
+/* TRUE if the output of this bin is meant for consumers of 'caps' */
+gboolean kms_conv_tree_bin_is_for_caps (KmsConvTreeBin * self,
+    const GstCaps * caps);
+
+G_END_DECLS
+#endif /* __KMS_CONV_TREE_BIN_H__ */
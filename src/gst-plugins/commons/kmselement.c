@@ -125,19 +125,33 @@ typedef struct _KmsMediaFlowData
   gint media_flowing;
   gint buffers;
   KmsMediaFlowType media_flow_type;
+
+  /* Index inside the media flow monitor slots */
+  guint slot;
 } KmsMediaFlowData;
 
-typedef struct _KmsMediaFlowTimeoutData
+/* Media flow of every pad is checked from a single timer that walks a */
+/* compact array of flow data instead of using one timer per pad */
+typedef struct _KmsMediaFlowMonitor
 {
-  KmsRefStruct ref;
-
-  KmsMediaFlowData *media_flow_data;
-
-  /* Media Flow signal */
-  GOnce init;
+  GMutex mutex;
+  GPtrArray *slots;             /* KmsMediaFlowData, not owned */
   KmsLoop *loop;
   guint source_id;
-} KmsMediaFlowTimeoutData;
+} KmsMediaFlowMonitor;
+
+/* Both transitions are emitted from the monitor loop, so they reach the */
+/* handlers in the same order the flowing state changed */
+typedef struct _KmsMediaFlowChange
+{
+  KmsElement *element;
+  gchar *pad_description;
+  KmsElementPadType type;
+  KmsMediaFlowType media_flow_type;
+  gboolean flowing;
+} KmsMediaFlowChange;
+
+static KmsMediaFlowMonitor flow_monitor;
 
 struct _KmsElementPrivate
 {
@@ -229,9 +243,45 @@ create_output_element_data (KmsElementPadType type)
   return data;
 }
 
+static gboolean media_flow_monitor_tick (gpointer user_data);
+
+static void
+media_flow_monitor_add (KmsMediaFlowData * data)
+{
+  g_mutex_lock (&flow_monitor.mutex);
+
+  data->slot = flow_monitor.slots->len;
+  g_ptr_array_add (flow_monitor.slots, data);
+
+  if (flow_monitor.source_id == 0) {
+    flow_monitor.source_id = kms_loop_timeout_add_full (flow_monitor.loop,
+        G_PRIORITY_DEFAULT, MEDIA_FLOW_INTERNAL_TIME_MSEC,
+        media_flow_monitor_tick, NULL, NULL);
+  }
+
+  g_mutex_unlock (&flow_monitor.mutex);
+}
+
+static void
+media_flow_monitor_remove (KmsMediaFlowData * data)
+{
+  KmsMediaFlowData *last;
+
+  g_mutex_lock (&flow_monitor.mutex);
+
+  /* Keep the array compact moving the last slot to the removed position */
+  last = g_ptr_array_index (flow_monitor.slots, flow_monitor.slots->len - 1);
+  last->slot = data->slot;
+  g_ptr_array_remove_index_fast (flow_monitor.slots, data->slot);
+
+  g_mutex_unlock (&flow_monitor.mutex);
+}
+
 static void
 media_flow_data_destroy (KmsMediaFlowData * data)
 {
+  media_flow_monitor_remove (data);
+
   g_free (data->pad_description);
   g_weak_ref_clear (&data->element);
 
@@ -256,6 +306,8 @@ media_flow_data_new (KmsElement * self, const gchar * description,
   data->type = type;
   data->media_flow_type = media_flow_type;
 
+  media_flow_monitor_add (data);
+
   return data;
 }
 
@@ -271,51 +323,6 @@ media_flow_data_ref (KmsMediaFlowData * data)
   return (KmsMediaFlowData *) kms_ref_struct_ref ((KmsRefStruct *) data);
 }
 
-static void
-media_flow_timeout_data_destroy (KmsMediaFlowTimeoutData * data)
-{
-  if (data->source_id != 0) {
-    kms_loop_remove (data->loop, data->source_id);
-  }
-
-  media_flow_data_unref (data->media_flow_data);
-
-  g_slice_free (KmsMediaFlowTimeoutData, data);
-}
-
-static KmsMediaFlowTimeoutData *
-media_flow_timeout_data_new (KmsElement * self, const gchar * description,
-    KmsElementPadType type, KmsMediaFlowType media_flow_type)
-{
-  KmsElementClass *klass = KMS_ELEMENT_GET_CLASS (self);
-  KmsMediaFlowTimeoutData *data;
-
-  data = g_slice_new0 (KmsMediaFlowTimeoutData);
-
-  kms_ref_struct_init (KMS_REF_STRUCT_CAST (data),
-      (GDestroyNotify) media_flow_timeout_data_destroy);
-
-  data->media_flow_data =
-      media_flow_data_new (self, description, type, media_flow_type);
-  data->init.status = G_ONCE_STATUS_NOTCALLED;
-  data->source_id = 0;
-  data->loop = klass->loop;
-
-  return data;
-}
-
-static void
-media_flow_timeout_data_unref (KmsMediaFlowTimeoutData * data)
-{
-  kms_ref_struct_unref ((KmsRefStruct *) data);
-}
-
-static KmsMediaFlowTimeoutData *
-media_flow_timeout_data_ref (KmsMediaFlowTimeoutData * data)
-{
-  return (KmsMediaFlowTimeoutData *) kms_ref_struct_ref ((KmsRefStruct *) data);
-}
-
 static void
 stream_input_avg_stat_destroy (StreamInputAvgStat * stat)
 {
@@ -556,134 +563,184 @@ kms_element_get_data_output_element (KmsElement * self,
       description);
 }
 
+static void
+media_flow_emit (KmsElement * element, KmsMediaFlowType media_flow_type,
+    gboolean flowing, const gchar * pad_description, KmsElementPadType type)
+{
+  if (media_flow_type == KMS_MEDIA_FLOW_IN) {
+    g_signal_emit (G_OBJECT (element),
+        element_signals[SIGNAL_FLOW_IN_MEDIA], 0, flowing,
+        pad_description, type);
+  } else if (media_flow_type == KMS_MEDIA_FLOW_OUT) {
+    g_signal_emit (G_OBJECT (element),
+        element_signals[SIGNAL_FLOW_OUT_MEDIA], 0, flowing,
+        pad_description, type);
+  }
+}
+
+static KmsMediaFlowChange *
+media_flow_change_new (KmsElement * element, KmsMediaFlowData * data,
+    gboolean flowing)
+{
+  KmsMediaFlowChange *change;
+
+  change = g_slice_new0 (KmsMediaFlowChange);
+  change->element = element;
+  change->pad_description = g_strdup (data->pad_description);
+  change->type = data->type;
+  change->media_flow_type = data->media_flow_type;
+  change->flowing = flowing;
+
+  return change;
+}
+
+static void
+media_flow_change_free (KmsMediaFlowChange * change)
+{
+  g_object_unref (change->element);
+  g_free (change->pad_description);
+  g_slice_free (KmsMediaFlowChange, change);
+}
+
+static void
+media_flow_change_emit (KmsMediaFlowChange * change)
+{
+  media_flow_emit (change->element, change->media_flow_type, change->flowing,
+      change->pad_description, change->type);
+}
+
+static gboolean
+media_flow_change_emit_idle (KmsMediaFlowChange * change)
+{
+  media_flow_change_emit (change);
+
+  return G_SOURCE_REMOVE;
+}
+
 static GstPadProbeReturn
 cb_buffer_received (GstPad * pad, GstPadProbeInfo * info, gpointer data)
 {
-  KmsMediaFlowTimeoutData *fdto_data = (KmsMediaFlowTimeoutData *) data;
-  KmsMediaFlowData *fd_data = fdto_data->media_flow_data;
-  gpointer weak_ptr = g_weak_ref_get (&fd_data->element);
-  KmsElement *element;
+  KmsMediaFlowData *fd_data = (KmsMediaFlowData *) data;
+  gpointer weak_ptr;
 
-  if (weak_ptr == NULL) {
-    return FALSE;
-  }
-
-  element = KMS_ELEMENT (weak_ptr);
-  if (g_atomic_int_compare_and_exchange (&fd_data->media_flowing, 0, 1)) {
-    if (fd_data->media_flow_type == KMS_MEDIA_FLOW_IN) {
-      g_signal_emit (G_OBJECT (element),
-          element_signals[SIGNAL_FLOW_IN_MEDIA], 0, TRUE,
-          fd_data->pad_description, fd_data->type);
-    } else if (fd_data->media_flow_type == KMS_MEDIA_FLOW_OUT) {
-      g_signal_emit (G_OBJECT (element),
-          element_signals[SIGNAL_FLOW_OUT_MEDIA], 0, TRUE,
-          fd_data->pad_description, fd_data->type);
-    }
+  /* Nobody else writes a value different from 0 here, so a relaxed store */
+  /* is enough for the monitor to notice this buffer in its next tick */
+  __atomic_store_n (&fd_data->buffers, 1, __ATOMIC_RELAXED);
+
+  if (G_LIKELY (__atomic_load_n (&fd_data->media_flowing,
+              __ATOMIC_RELAXED) == 1)) {
+    return GST_PAD_PROBE_OK;
   }
 
-  g_atomic_int_compare_and_exchange (&fd_data->buffers, 0, 1);
+  if (!g_atomic_int_compare_and_exchange (&fd_data->media_flowing, 0, 1)) {
+    return GST_PAD_PROBE_OK;
+  }
 
-  g_object_unref (element);
+  weak_ptr = g_weak_ref_get (&fd_data->element);
+  if (weak_ptr == NULL) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* A FALSE emitted by the current tick is always delivered before this */
+  kms_loop_idle_add_full (flow_monitor.loop, G_PRIORITY_DEFAULT,
+      (GSourceFunc) media_flow_change_emit_idle,
+      media_flow_change_new (KMS_ELEMENT (weak_ptr), fd_data, TRUE),
+      (GDestroyNotify) media_flow_change_free);
 
   return GST_PAD_PROBE_OK;
 }
 
-gboolean
-check_if_flow_media (gpointer user_data)
+static gboolean
+media_flow_monitor_tick (gpointer user_data)
 {
-  KmsMediaFlowData *data = (KmsMediaFlowData *) user_data;
-  gpointer weak_ptr;
-  KmsElement *element;
+  GSList *changes = NULL;
+  guint i;
 
   if (g_source_is_destroyed (g_main_current_source ())) {
     return G_SOURCE_REMOVE;
   }
 
-  weak_ptr = g_weak_ref_get (&data->element);
-  if (weak_ptr == NULL) {
+  g_mutex_lock (&flow_monitor.mutex);
+
+  if (flow_monitor.slots->len == 0) {
+    /* Attached again when a new pad is monitored */
+    flow_monitor.source_id = 0;
+    g_mutex_unlock (&flow_monitor.mutex);
     return G_SOURCE_REMOVE;
   }
 
-  element = KMS_ELEMENT (weak_ptr);
-  if (g_atomic_int_get (&data->media_flowing) == 1) {
-    if (g_atomic_int_get (&data->buffers) == 0) {
-      g_atomic_int_set (&data->media_flowing, 0);
-      if (data->media_flow_type == KMS_MEDIA_FLOW_IN) {
-        g_signal_emit (G_OBJECT (element),
-            element_signals[SIGNAL_FLOW_IN_MEDIA], 0, FALSE,
-            data->pad_description, data->type);
-      } else if (data->media_flow_type == KMS_MEDIA_FLOW_OUT) {
-        g_signal_emit (G_OBJECT (element),
-            element_signals[SIGNAL_FLOW_OUT_MEDIA], 0, FALSE,
-            data->pad_description, data->type);
-      }
-    } else {
-      g_atomic_int_set (&data->buffers, 0);
+  for (i = 0; i < flow_monitor.slots->len; i++) {
+    KmsMediaFlowData *data = g_ptr_array_index (flow_monitor.slots, i);
+    KmsMediaFlowChange *change;
+    gpointer weak_ptr;
+
+    if (g_atomic_int_get (&data->media_flowing) == 0) {
+      continue;
     }
-  }
 
-  g_object_unref (element);
+    if (__atomic_exchange_n (&data->buffers, 0, __ATOMIC_RELAXED) != 0) {
+      continue;
+    }
 
-  return G_SOURCE_CONTINUE;
-}
+    g_atomic_int_set (&data->media_flowing, 0);
 
-static gpointer
-attach_timeout (gpointer data)
-{
-  KmsMediaFlowTimeoutData *fdto_data = data;
-  KmsMediaFlowData *fd_data = fdto_data->media_flow_data;
+    weak_ptr = g_weak_ref_get (&data->element);
+    if (weak_ptr == NULL) {
+      continue;
+    }
 
-  fdto_data->source_id = kms_loop_timeout_add_full (fdto_data->loop,
-      G_PRIORITY_DEFAULT, MEDIA_FLOW_INTERNAL_TIME_MSEC, check_if_flow_media,
-      media_flow_data_ref (fd_data), (GDestroyNotify) media_flow_data_unref);
+    /* Signals are emitted without holding the lock because handlers can */
+    /* release pads and then flow data */
+    change = media_flow_change_new (KMS_ELEMENT (weak_ptr), data, FALSE);
+    changes = g_slist_prepend (changes, change);
+  }
 
-  return NULL;
+  g_mutex_unlock (&flow_monitor.mutex);
+
+  g_slist_foreach (changes, (GFunc) media_flow_change_emit, NULL);
+  g_slist_free_full (changes, (GDestroyNotify) media_flow_change_free);
+
+  return G_SOURCE_CONTINUE;
 }
 
 static void
-add_flow_event_probes (GstPad * pad, KmsMediaFlowTimeoutData * fdto_data)
+add_flow_event_probes (GstPad * pad, KmsMediaFlowData * fd_data)
 {
   gst_pad_add_probe (pad,
       GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
       (GstPadProbeCallback) cb_buffer_received,
-      media_flow_timeout_data_ref (fdto_data),
-      (GDestroyNotify) media_flow_timeout_data_unref);
-
-  /* TODO: the timeout could be detached when all pads are removed,
-     but it must be added if a new pad is added */
-  g_once (&fdto_data->init, attach_timeout, fdto_data);
+      media_flow_data_ref (fd_data), (GDestroyNotify) media_flow_data_unref);
 }
 
 static void
 add_flow_event_probes_pad_added (GstElement * element, GstPad * pad,
-    KmsMediaFlowTimeoutData * fdto_data)
+    KmsMediaFlowData * fd_data)
 {
   if (!GST_PAD_IS_SINK (pad)) {
     return;
   }
 
-  add_flow_event_probes (pad, fdto_data);
+  add_flow_event_probes (pad, fd_data);
 }
 
 static void
 media_flow_data_destroy_closure (gpointer data, GClosure * closure)
 {
-  KmsMediaFlowTimeoutData *fdto_data = data;
+  KmsMediaFlowData *fd_data = data;
 
-  media_flow_timeout_data_unref (fdto_data);
+  media_flow_data_unref (fd_data);
 }
 
 static void
 add_flow_out_event_probes_to_element_sinks (GstElement * element,
-    KmsMediaFlowTimeoutData * fdto_data)
+    KmsMediaFlowData * fd_data)
 {
   g_signal_connect_data (element, "pad-added",
       G_CALLBACK (add_flow_event_probes_pad_added),
-      media_flow_timeout_data_ref (fdto_data), media_flow_data_destroy_closure,
-      0);
+      media_flow_data_ref (fd_data), media_flow_data_destroy_closure, 0);
 
   kms_element_for_each_sink_pad (element,
-      (KmsPadCallback) add_flow_event_probes, fdto_data);
+      (KmsPadCallback) add_flow_event_probes, fd_data);
 }
 
 static void
@@ -758,17 +815,20 @@ kms_element_get_output_element (KmsElement * self, KmsElementPadType pad_type,
     gst_element_sync_state_with_parent (sink);
     gst_element_sync_state_with_parent (tee);
   } else {
-    KmsMediaFlowTimeoutData *fdto_data;
+    KmsMediaFlowData *fd_data;
 
     odata->element = KMS_ELEMENT_GET_CLASS (self)->create_output_element (self);
 
-    g_signal_connect (odata->element, "media-transcoding",
-        G_CALLBACK (on_agnosticbin_media_transcoding), self);
+    /* Subclasses may output through elements that never transcode */
+    if (g_signal_lookup ("media-transcoding",
+            G_OBJECT_TYPE (odata->element)) != 0) {
+      g_signal_connect (odata->element, "media-transcoding",
+          G_CALLBACK (on_agnosticbin_media_transcoding), self);
+    }
 
-    fdto_data =
-        media_flow_timeout_data_new (self, desc, pad_type, KMS_MEDIA_FLOW_OUT);
-    add_flow_out_event_probes_to_element_sinks (odata->element, fdto_data);
-    media_flow_timeout_data_unref (fdto_data);
+    fd_data = media_flow_data_new (self, desc, pad_type, KMS_MEDIA_FLOW_OUT);
+    add_flow_out_event_probes_to_element_sinks (odata->element, fd_data);
+    media_flow_data_unref (fd_data);
 
     /* Set video properties to the new element */
     if (pad_type == KMS_ELEMENT_PAD_TYPE_VIDEO) {
@@ -1035,13 +1095,12 @@ end:
   //add probe for media flow in signal
   if ((type == KMS_ELEMENT_PAD_TYPE_VIDEO)
       || (type == KMS_ELEMENT_PAD_TYPE_AUDIO)) {
-    KmsMediaFlowTimeoutData *fdto_data;
+    KmsMediaFlowData *fd_data;
 
-    fdto_data =
-        media_flow_timeout_data_new (self,
+    fd_data = media_flow_data_new (self,
         KMS_FORMAT_PAD_DESCRIPTION (description), type, KMS_MEDIA_FLOW_IN);
-    add_flow_event_probes (pad, fdto_data);
-    media_flow_timeout_data_unref (fdto_data);
+    add_flow_event_probes (pad, fd_data);
+    media_flow_data_unref (fd_data);
   }
 
   return pad;
@@ -1648,6 +1707,61 @@ kms_element_get_input_latency_stats (KmsElement * self, gchar * selector)
   return stats;
 }
 
+static void
+kms_element_append_keyframe_request_stats (KmsElement * self,
+    GstStructure * stats)
+{
+  guint64 requests = 0, forwarded = 0, suppressed = 0;
+  GstStructure *kf_stats;
+  KmsOutputElementData *odata;
+  GHashTableIter iter;
+  gpointer value;
+
+  KMS_ELEMENT_LOCK (self);
+
+  g_hash_table_iter_init (&iter, self->priv->output_elements);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    GstStructure *s = NULL;
+    guint64 v;
+
+    odata = value;
+
+    if (odata->type != KMS_ELEMENT_PAD_TYPE_VIDEO || odata->element == NULL
+        || g_object_class_find_property (G_OBJECT_GET_CLASS (odata->element),
+            "keyframe-request-stats") == NULL) {
+      continue;
+    }
+
+    g_object_get (odata->element, "keyframe-request-stats", &s, NULL);
+    if (s == NULL) {
+      continue;
+    }
+
+    if (gst_structure_get_uint64 (s, "requests", &v)) {
+      requests += v;
+    }
+    if (gst_structure_get_uint64 (s, "forwarded", &v)) {
+      forwarded += v;
+    }
+    if (gst_structure_get_uint64 (s, "suppressed", &v)) {
+      suppressed += v;
+    }
+
+    gst_structure_free (s);
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  kf_stats = gst_structure_new ("keyframe-requests",
+      "requests", G_TYPE_UINT64, requests,
+      "forwarded", G_TYPE_UINT64, forwarded,
+      "suppressed", G_TYPE_UINT64, suppressed, NULL);
+  gst_structure_set (stats, "keyframe-requests", GST_TYPE_STRUCTURE, kf_stats,
+      NULL);
+  gst_structure_free (kf_stats);
+}
+
 static GstStructure *
 kms_element_stats_impl (KmsElement * self, gchar * selector)
 {
@@ -1659,6 +1773,8 @@ kms_element_stats_impl (KmsElement * self, gchar * selector)
     GstStructure *e_stats;
     GstStructure *l_stats;
 
+    kms_element_append_keyframe_request_stats (self, stats);
+
     l_stats = kms_element_get_input_latency_stats (self, selector);
 
     e_stats = gst_structure_new (KMS_ELEMENT_STATS_STRUCT_NAME,
@@ -1913,6 +2029,9 @@ kms_element_class_init (KmsElementClass * klass)
   g_type_class_add_private (klass, sizeof (KmsElementPrivate));
 
   klass->loop = kms_loop_new ();
+
+  flow_monitor.slots = g_ptr_array_new ();
+  flow_monitor.loop = klass->loop;
 }
 
 static void
@@ -26,5 +26,13 @@ typedef enum
   KMS_FILTER_TYPE_VIDEO,
 } KmsFilterType;
 
+/* What a filter worker does with new frames when its queue is full */
+typedef enum
+{
+  KMS_FILTER_DROP_POLICY_NONE,  /* Block until there is room */
+  KMS_FILTER_DROP_POLICY_NEWEST,
+  KMS_FILTER_DROP_POLICY_OLDEST,
+} KmsFilterDropPolicy;
+
 G_END_DECLS
 #endif /* __KMS_FILTER_TYPE__ */
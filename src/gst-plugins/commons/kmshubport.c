@@ -44,9 +44,18 @@ GST_DEBUG_CATEGORY_STATIC (kms_hub_port_debug_category);
   )                                             \
 )
 
+#define DEFAULT_LEAN FALSE
+
+enum
+{
+  PROP_0,
+  PROP_LEAN,
+  N_PROPERTIES
+};
+
 struct _KmsHubPortPrivate
 {
-  void *dummy;
+  gboolean lean;
 };
 
 /* Pad templates */
@@ -279,6 +288,77 @@ kms_hub_port_start_media_type (KmsElement * self, KmsElementPadType type,
   g_object_unref (src);
 }
 
+static GstElement *
+kms_hub_port_create_output_element (KmsElement * element)
+{
+  KmsHubPort *self = KMS_HUB_PORT (element);
+  GstElement *tee;
+  gboolean lean;
+
+  GST_OBJECT_LOCK (self);
+  lean = self->priv->lean;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!lean) {
+    return
+        KMS_ELEMENT_CLASS (kms_hub_port_parent_class)->create_output_element
+        (element);
+  }
+
+  /* Media is already adapted by the agnosticbin of the hub source, which */
+  /* shares its output branches between all the ports subscribed to it */
+  tee = gst_element_factory_make ("tee", NULL);
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (tee),
+          "allow-not-linked") != NULL) {
+    g_object_set (tee, "allow-not-linked", TRUE, NULL);
+  }
+
+  GST_DEBUG_OBJECT (self, "Lean output %" GST_PTR_FORMAT, tee);
+
+  return tee;
+}
+
+static void
+kms_hub_port_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsHubPort *self = KMS_HUB_PORT (object);
+
+  GST_OBJECT_LOCK (self);
+
+  switch (property_id) {
+    case PROP_LEAN:
+      self->priv->lean = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+kms_hub_port_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsHubPort *self = KMS_HUB_PORT (object);
+
+  GST_OBJECT_LOCK (self);
+
+  switch (property_id) {
+    case PROP_LEAN:
+      g_value_set_boolean (value, self->priv->lean);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+}
+
 static void
 kms_hub_port_dispose (GObject * object)
 {
@@ -303,6 +383,17 @@ kms_hub_port_class_init (KmsHubPortClass * klass)
 
   gobject_class->dispose = kms_hub_port_dispose;
   gobject_class->finalize = kms_hub_port_finalize;
+  gobject_class->set_property = kms_hub_port_set_property;
+  gobject_class->get_property = kms_hub_port_get_property;
+
+  KMS_ELEMENT_CLASS (klass)->create_output_element =
+      GST_DEBUG_FUNCPTR (kms_hub_port_create_output_element);
+
+  g_object_class_install_property (gobject_class, PROP_LEAN,
+      g_param_spec_boolean ("lean", "Lean port",
+          "Output the media of the hub as is, through a tee instead of an "
+          "agnosticbin. Only applies to the outputs created afterwards",
+          DEFAULT_LEAN, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gstelement_class->request_new_pad =
       GST_DEBUG_FUNCPTR (kms_hub_port_request_new_pad);
@@ -332,6 +423,7 @@ kms_hub_port_init (KmsHubPort * self)
   GstPadTemplate *templ;
 
   self->priv = KMS_HUB_PORT_GET_PRIVATE (self);
+  self->priv->lean = DEFAULT_LEAN;
 
   kmselement = KMS_ELEMENT (self);
 
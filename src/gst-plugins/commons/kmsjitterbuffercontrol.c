@@ -0,0 +1,411 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "kmsjitterbuffercontrol.h"
+#include "kmsutils.h"
+
+#include <gst/rtp/gstrtpbuffer.h>
+
+#define GST_CAT_DEFAULT kms_jitter_buffer_control_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmsjitterbuffercontrol"
+
+#define KMS_JITTER_BUFFER_CONTROL "kms-jitter-buffer-control"
+G_DEFINE_QUARK (KMS_JITTER_BUFFER_CONTROL, kms_jitter_buffer_control);
+
+#define UPDATE_INTERVAL 1000    /* ms */
+/* Latency is only decreased after this time without increases */
+#define DECREASE_HOLD_TIME (5 * GST_SECOND)
+#define DECREASE_RATIO 0.1
+
+#define JITTER_FACTOR 4
+#define RTX_RTT_FACTOR 1.5
+#define LATENCY_MARGIN 10       /* ms */
+#define LATENCY_HYSTERESIS 5    /* ms */
+
+/* Larger forward sequence number jumps are considered a restart of the */
+/* sender. Backward jumps never restart the estimation.                 */
+#define MAX_DROPOUT 3000
+#define MAX_MISORDER 100
+
+#define NSECS_TO_MSECS(t) ((gdouble) (t) / GST_MSECOND)
+
+typedef struct _KmsJitterBufferControl
+{
+  GstElement *jitterbuffer;     /* Not owned, it owns the controller */
+  GstPad *pad;
+  gulong probe_id;
+
+  guint min_latency;
+  guint max_latency;
+  guint target;
+
+  /* Only accessed from the loop */
+  guint latency;
+  gdouble prev_peak_jitter;
+  guint prev_peak_misorder;
+  GstClockTime last_increase;
+
+  /* Only accessed from the streaming thread */
+  gboolean seq_init;
+  guint16 max_seq;
+  guint32 last_ts;
+  GstClockTime last_arrival;
+
+  /* Shared between the streaming thread and the loop */
+  GMutex mutex;
+  gint clock_rate;
+  gboolean rtx;
+  gboolean started;
+  gdouble jitter;               /* ms, as defined in RFC 3550 */
+  gdouble packet_interval;      /* ms */
+  gdouble peak_jitter;
+  guint peak_misorder;          /* packets */
+} KmsJitterBufferControl;
+
+static void
+kms_jitter_buffer_control_destroy (KmsJitterBufferControl * self)
+{
+  gst_pad_remove_probe (self->pad, self->probe_id);
+  g_object_unref (self->pad);
+
+  g_mutex_clear (&self->mutex);
+
+  g_slice_free (KmsJitterBufferControl, self);
+}
+
+static void
+kms_jitter_buffer_control_update_clock_rate (KmsJitterBufferControl * self)
+{
+  GstCaps *caps;
+  gint clock_rate;
+
+  caps = gst_pad_get_current_caps (self->pad);
+  if (caps == NULL) {
+    return;
+  }
+
+  if (!gst_structure_get_int (gst_caps_get_structure (caps, 0), "clock-rate",
+          &clock_rate)) {
+    clock_rate = 0;
+  }
+
+  gst_caps_unref (caps);
+
+  g_mutex_lock (&self->mutex);
+  self->clock_rate = clock_rate;
+  g_mutex_unlock (&self->mutex);
+}
+
+static guint64
+kms_jitter_buffer_control_get_rtx_rtt (KmsJitterBufferControl * self)
+{
+  GstStructure *stats = NULL;
+  gboolean rtx = FALSE;
+  guint64 rtt = 0;
+
+  g_object_get (self->jitterbuffer, "do-retransmission", &rtx, NULL);
+
+  g_mutex_lock (&self->mutex);
+  self->rtx = rtx;
+  g_mutex_unlock (&self->mutex);
+
+  if (!rtx) {
+    return 0;
+  }
+
+  g_object_get (self->jitterbuffer, "stats", &stats, NULL);
+  if (stats != NULL) {
+    gst_structure_get_uint64 (stats, "rtx-rtt", &rtt);
+    gst_structure_free (stats);
+  }
+
+  return rtt;
+}
+
+static void
+kms_jitter_buffer_control_update (KmsJitterBufferControl * self)
+{
+  gdouble jitter, packet_interval, rtt, target;
+  guint misorder, new_target, latency = self->latency;
+  gboolean started;
+  gint clock_rate;
+  GstClockTime now;
+
+  g_mutex_lock (&self->mutex);
+  started = self->started;
+  clock_rate = self->clock_rate;
+  g_mutex_unlock (&self->mutex);
+
+  if (!started) {
+    return;
+  }
+
+  if (clock_rate == 0) {
+    kms_jitter_buffer_control_update_clock_rate (self);
+  }
+
+  /* Lost packets must wait in the jitterbuffer for their retransmission */
+  rtt = NSECS_TO_MSECS (kms_jitter_buffer_control_get_rtx_rtt (self));
+
+  g_mutex_lock (&self->mutex);
+
+  /* Peaks of the last two intervals, to not forget a burst right away */
+  jitter = MAX (self->peak_jitter, self->prev_peak_jitter);
+  misorder = MAX (self->peak_misorder, self->prev_peak_misorder);
+  packet_interval = self->packet_interval;
+
+  self->prev_peak_jitter = self->peak_jitter;
+  self->peak_jitter = self->jitter;
+  self->prev_peak_misorder = self->peak_misorder;
+  self->peak_misorder = 0;
+
+  g_mutex_unlock (&self->mutex);
+
+  now = kms_utils_get_time_nsecs ();
+
+  target = JITTER_FACTOR * jitter + misorder * packet_interval +
+      RTX_RTT_FACTOR * rtt + LATENCY_MARGIN;
+  new_target = CLAMP ((guint) target, self->min_latency, self->max_latency);
+  g_atomic_int_set (&self->target, new_target);
+
+  if (new_target > latency && (new_target >= latency + LATENCY_HYSTERESIS
+          || new_target == self->max_latency)) {
+    latency = new_target;
+    self->last_increase = now;
+  } else if (new_target + LATENCY_HYSTERESIS <= latency
+      && now - self->last_increase >= DECREASE_HOLD_TIME) {
+    /* Decrease gradually, playout is slowed down meanwhile */
+    latency = MAX (new_target, latency - MAX (latency * DECREASE_RATIO, 1));
+  }
+
+  GST_TRACE_OBJECT (self->jitterbuffer, "Jitter: %.2f ms, misorder: %u, "
+      "RTX RTT: %.2f ms, target: %u ms, latency: %u ms", jitter, misorder, rtt,
+      new_target, latency);
+
+  if (latency != self->latency) {
+    GST_DEBUG_OBJECT (self->jitterbuffer, "Latency changed from %u to %u ms",
+        self->latency, latency);
+    self->latency = latency;
+    g_object_set (self->jitterbuffer, "latency", latency, NULL);
+  }
+}
+
+/* Runs in the loop, the jitterbuffer is queried and configured from here */
+/* instead of from its own streaming thread                               */
+static gboolean
+kms_jitter_buffer_control_timeout (GWeakRef * ref)
+{
+  KmsJitterBufferControl *self;
+  GstElement *jitterbuffer;
+
+  jitterbuffer = g_weak_ref_get (ref);
+  if (jitterbuffer == NULL) {
+    return G_SOURCE_REMOVE;
+  }
+
+  self = g_object_get_qdata (G_OBJECT (jitterbuffer),
+      kms_jitter_buffer_control_quark ());
+
+  if (self != NULL) {
+    kms_jitter_buffer_control_update (self);
+  }
+
+  gst_object_unref (jitterbuffer);
+
+  return self != NULL ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static void
+kms_jitter_buffer_control_timeout_destroy (GWeakRef * ref)
+{
+  g_weak_ref_clear (ref);
+  g_slice_free (GWeakRef, ref);
+}
+
+static void
+kms_jitter_buffer_control_process_buffer (KmsJitterBufferControl * self,
+    GstBuffer * buffer)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstClockTime arrival;
+  guint32 ts;
+  guint16 seq;
+  gint16 delta;
+
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp)) {
+    return;
+  }
+
+  seq = gst_rtp_buffer_get_seq (&rtp);
+  ts = gst_rtp_buffer_get_timestamp (&rtp);
+  gst_rtp_buffer_unmap (&rtp);
+
+  arrival = kms_utils_get_cached_time_nsecs ();
+
+  if (!self->seq_init) {
+    self->seq_init = TRUE;
+    self->max_seq = seq;
+    self->last_ts = ts;
+    self->last_arrival = arrival;
+    self->started = TRUE;
+    return;
+  }
+
+  delta = (gint16) (seq - self->max_seq);
+
+  if (delta > 0 && delta < MAX_DROPOUT) {
+    gdouble arrival_diff;
+
+    arrival_diff = NSECS_TO_MSECS (arrival - self->last_arrival);
+
+    if (self->clock_rate > 0) {
+      gdouble ts_diff, d;
+
+      ts_diff = (gdouble) ((gint32) (ts - self->last_ts)) * 1000 /
+          self->clock_rate;
+      d = ABS (arrival_diff - ts_diff);
+      self->jitter += (d - self->jitter) / 16;
+      self->peak_jitter = MAX (self->peak_jitter, self->jitter);
+    }
+
+    self->packet_interval += (arrival_diff / delta - self->packet_interval) /
+        16;
+
+    self->max_seq = seq;
+    self->last_ts = ts;
+    self->last_arrival = arrival;
+  } else if (delta < 0) {
+    /* With retransmissions, recovered packets arrive about one RTT late  */
+    /* with their old sequence number. That delay is already covered by   */
+    /* the RTT term, so old packets are not counted as reordering either. */
+    if (!self->rtx && delta > -MAX_MISORDER) {
+      self->peak_misorder = MAX (self->peak_misorder, (guint) - delta);
+    }
+  } else if (delta >= MAX_DROPOUT) {
+    GST_DEBUG_OBJECT (self->jitterbuffer,
+        "Sequence number jump (%d), restarting jitter estimation", delta);
+    self->max_seq = seq;
+    self->last_ts = ts;
+    self->last_arrival = arrival;
+  }
+}
+
+static gboolean
+kms_jitter_buffer_control_process_buffer_it (GstBuffer ** buffer, guint idx,
+    KmsJitterBufferControl * self)
+{
+  kms_jitter_buffer_control_process_buffer (self, *buffer);
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+kms_jitter_buffer_control_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  KmsJitterBufferControl *self = user_data;
+
+  g_mutex_lock (&self->mutex);
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    kms_jitter_buffer_control_process_buffer (self,
+        GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    kms_utils_time_cache_begin ();
+    gst_buffer_list_foreach (GST_PAD_PROBE_INFO_BUFFER_LIST (info),
+        (GstBufferListFunc) kms_jitter_buffer_control_process_buffer_it, self);
+    kms_utils_time_cache_end ();
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return GST_PAD_PROBE_OK;
+}
+
+void
+kms_jitter_buffer_control_add (GstElement * jitterbuffer, KmsLoop * loop,
+    guint min_latency, guint max_latency)
+{
+  KmsJitterBufferControl *self;
+  GWeakRef *ref;
+
+  if (min_latency > max_latency) {
+    GST_WARNING_OBJECT (jitterbuffer,
+        "Min latency (%u) greater than max latency (%u)", min_latency,
+        max_latency);
+    max_latency = min_latency;
+  }
+
+  if (min_latency == max_latency) {
+    GST_DEBUG_OBJECT (jitterbuffer, "Fixed latency: %u ms", min_latency);
+    return;
+  }
+
+  self = g_slice_new0 (KmsJitterBufferControl);
+  self->jitterbuffer = jitterbuffer;
+  self->min_latency = min_latency;
+  self->max_latency = max_latency;
+  self->latency = min_latency;
+  self->target = min_latency;
+  self->last_increase = kms_utils_get_time_nsecs ();
+  g_mutex_init (&self->mutex);
+  g_object_get (jitterbuffer, "do-retransmission", &self->rtx, NULL);
+
+  self->pad = gst_element_get_static_pad (jitterbuffer, "sink");
+  self->probe_id = gst_pad_add_probe (self->pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      kms_jitter_buffer_control_probe, self, NULL);
+
+  g_object_set_qdata_full (G_OBJECT (jitterbuffer),
+      kms_jitter_buffer_control_quark (), self,
+      (GDestroyNotify) kms_jitter_buffer_control_destroy);
+
+  /* The timeout stops by itself once the jitterbuffer is gone */
+  ref = g_slice_new0 (GWeakRef);
+  g_weak_ref_init (ref, jitterbuffer);
+  kms_loop_timeout_add_full (loop, G_PRIORITY_DEFAULT, UPDATE_INTERVAL,
+      (GSourceFunc) kms_jitter_buffer_control_timeout, ref,
+      (GDestroyNotify) kms_jitter_buffer_control_timeout_destroy);
+
+  GST_DEBUG_OBJECT (jitterbuffer, "Adaptive latency in [%u, %u] ms",
+      min_latency, max_latency);
+}
+
+guint
+kms_jitter_buffer_control_get_target (GstElement * jitterbuffer)
+{
+  KmsJitterBufferControl *self;
+
+  self = g_object_get_qdata (G_OBJECT (jitterbuffer),
+      kms_jitter_buffer_control_quark ());
+
+  if (self == NULL) {
+    return 0;
+  }
+
+  return g_atomic_int_get (&self->target);
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
@@ -0,0 +1,43 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_JITTER_BUFFER_CONTROL_H__
+#define __KMS_JITTER_BUFFER_CONTROL_H__
+
+#include <gst/gst.h>
+#include "kmsloop.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Adapts the latency of a rtpjitterbuffer between min_latency and
+ * max_latency (ms) following the interarrival jitter, the reordering
+ * depth and the retransmission round-trip time of the received stream.
+ * If both bounds are equal the latency is fixed to that value.
+ *
+ * The stream is measured from the streaming thread, but the jitterbuffer
+ * is only queried and configured from a periodic source in loop.
+ *
+ * The controller lives as long as the jitterbuffer.
+ */
+void kms_jitter_buffer_control_add (GstElement *jitterbuffer, KmsLoop *loop,
+    guint min_latency, guint max_latency);
+
+/* Current latency target (ms) of the controller, 0 if there is none */
+guint kms_jitter_buffer_control_get_target (GstElement *jitterbuffer);
+
+G_END_DECLS
+#endif /* __KMS_JITTER_BUFFER_CONTROL_H__ */
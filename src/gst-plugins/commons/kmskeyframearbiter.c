@@ -0,0 +1,203 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmskeyframearbiter.h"
+#include "kmsutils.h"
+
+#include <gst/video/video-event.h>
+
+#define GST_CAT_DEFAULT kms_keyframe_arbiter_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "keyframearbiter"
+
+#define KMS_KEYFRAME_ARBITER "kms-keyframe-arbiter"
+G_DEFINE_QUARK (KMS_KEYFRAME_ARBITER, kms_keyframe_arbiter);
+
+typedef struct _KmsKeyframeArbiter
+{
+  GMutex mutex;
+  GstClockTime window;
+
+  /* A forwarded request is waiting for its key frame. Accessed atomically */
+  gint pending;
+  GstClockTime last_forwarded;
+
+  KmsKeyframeArbiterStats stats;
+} KmsKeyframeArbiter;
+
+static void
+kms_keyframe_arbiter_init_debug (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+static void
+kms_keyframe_arbiter_destroy (KmsKeyframeArbiter * self)
+{
+  g_mutex_clear (&self->mutex);
+  g_slice_free (KmsKeyframeArbiter, self);
+}
+
+static KmsKeyframeArbiter *
+kms_keyframe_arbiter_get (GstPad * pad)
+{
+  return g_object_get_qdata (G_OBJECT (pad), kms_keyframe_arbiter_quark ());
+}
+
+static GstPadProbeReturn
+kms_keyframe_arbiter_request_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsKeyframeArbiter * self)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstClockTime now;
+  gboolean forward;
+
+  if (!gst_video_event_is_force_key_unit (event)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  now = kms_utils_get_coarse_time_nsecs ();
+
+  g_mutex_lock (&self->mutex);
+
+  self->stats.requests++;
+  forward = !g_atomic_int_get (&self->pending)
+      || self->last_forwarded + self->window <= now;
+
+  if (forward) {
+    g_atomic_int_set (&self->pending, TRUE);
+    self->last_forwarded = now;
+    self->stats.forwarded++;
+  } else {
+    self->stats.suppressed++;
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (!forward) {
+    GST_TRACE_OBJECT (pad, "Key frame already requested, dropping request");
+    return GST_PAD_PROBE_DROP;
+  }
+
+  GST_DEBUG_OBJECT (pad, "Forwarding key frame request");
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+kms_keyframe_arbiter_find_keyframe (GstBuffer ** buffer, guint idx,
+    gboolean * found)
+{
+  *found = !GST_BUFFER_FLAG_IS_SET (*buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  return !*found;
+}
+
+static GstPadProbeReturn
+kms_keyframe_arbiter_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsKeyframeArbiter * self)
+{
+  gboolean keyframe = FALSE;
+  GstBuffer *buffer;
+
+  /* Most buffers go through while nothing is pending */
+  if (!g_atomic_int_get (&self->pending)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    kms_keyframe_arbiter_find_keyframe (&buffer, 0, &keyframe);
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    gst_buffer_list_foreach (GST_PAD_PROBE_INFO_BUFFER_LIST (info),
+        (GstBufferListFunc) kms_keyframe_arbiter_find_keyframe, &keyframe);
+  }
+
+  if (keyframe) {
+    g_atomic_int_set (&self->pending, FALSE);
+
+    GST_TRACE_OBJECT (pad, "Key frame received");
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+void
+kms_keyframe_arbiter_add (GstPad * pad, GstClockTime window)
+{
+  KmsKeyframeArbiter *self;
+
+  kms_keyframe_arbiter_init_debug ();
+
+  if (kms_keyframe_arbiter_get (pad) != NULL) {
+    GST_WARNING_OBJECT (pad, "Key frame arbiter already added");
+    return;
+  }
+
+  self = g_slice_new0 (KmsKeyframeArbiter);
+  g_mutex_init (&self->mutex);
+  self->window = window;
+
+  g_object_set_qdata_full (G_OBJECT (pad), kms_keyframe_arbiter_quark (), self,
+      (GDestroyNotify) kms_keyframe_arbiter_destroy);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      (GstPadProbeCallback) kms_keyframe_arbiter_request_probe, self, NULL);
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) kms_keyframe_arbiter_buffer_probe, self, NULL);
+}
+
+void
+kms_keyframe_arbiter_set_window (GstPad * pad, GstClockTime window)
+{
+  KmsKeyframeArbiter *self = kms_keyframe_arbiter_get (pad);
+
+  if (self == NULL) {
+    GST_WARNING_OBJECT (pad, "No key frame arbiter");
+    return;
+  }
+
+  g_mutex_lock (&self->mutex);
+  self->window = window;
+  g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+kms_keyframe_arbiter_get_stats (GstPad * pad, KmsKeyframeArbiterStats * stats)
+{
+  KmsKeyframeArbiter *self = kms_keyframe_arbiter_get (pad);
+
+  if (self == NULL) {
+    return FALSE;
+  }
+
+  g_mutex_lock (&self->mutex);
+  *stats = self->stats;
+  g_mutex_unlock (&self->mutex);
+
+  return TRUE;
+}
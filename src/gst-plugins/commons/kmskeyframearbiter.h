@@ -0,0 +1,47 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_KEYFRAME_ARBITER_H__
+#define __KMS_KEYFRAME_ARBITER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Merges the key unit requests that every consumer of a source sends
+ * upstream. The arbiter sits on the pad where the source media enters
+ * (the point every branch request goes through) and forwards one request
+ * at most: later requests are suppressed until a key frame goes through
+ * the pad or the window elapses, as that key frame serves them all.
+ */
+
+typedef struct _KmsKeyframeArbiterStats
+{
+  guint64 requests;
+  guint64 forwarded;
+  guint64 suppressed;
+} KmsKeyframeArbiterStats;
+
+void kms_keyframe_arbiter_add (GstPad *pad, GstClockTime window);
+void kms_keyframe_arbiter_set_window (GstPad *pad, GstClockTime window);
+
+/* Returns FALSE if there is no arbiter on 'pad' */
+gboolean kms_keyframe_arbiter_get_stats (GstPad *pad,
+    KmsKeyframeArbiterStats *stats);
+
+G_END_DECLS
+#endif /* __KMS_KEYFRAME_ARBITER_H__ */
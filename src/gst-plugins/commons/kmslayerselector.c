@@ -0,0 +1,312 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmslayerselector.h"
+#include "kmsrtplayers.h"
+#include "kmsutils.h"
+
+#define GST_CAT_DEFAULT kms_layer_selector_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "layerselector"
+
+#define KMS_LAYER_SELECTOR "kms-layer-selector"
+G_DEFINE_QUARK (KMS_LAYER_SELECTOR, kms_layer_selector);
+
+/* Stream time over which the bitrate of the layers is measured */
+#define RATE_WINDOW GST_SECOND
+
+typedef struct _KmsLayerSelector
+{
+  GMutex mutex;
+  GstPad *pad;
+  gulong probe_id;
+  RembEventManager *remb_manager;
+
+  gboolean layered;
+  guint bitrate;
+  gint target;
+  gint current;
+
+  GstClockTime window_start;
+  guint64 bytes[KMS_LAYER_SELECTOR_MAX_LAYERS];
+  guint64 rates[KMS_LAYER_SELECTOR_MAX_LAYERS];
+
+  KmsLayerSelectorStats stats;
+} KmsLayerSelector;
+
+static void
+kms_layer_selector_init_debug (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+static void
+kms_layer_selector_destroy (KmsLayerSelector * self)
+{
+  gst_pad_remove_probe (self->pad, self->probe_id);
+  kms_utils_remb_event_manager_destroy (self->remb_manager);
+  g_mutex_clear (&self->mutex);
+  g_slice_free (KmsLayerSelector, self);
+}
+
+static KmsLayerSelector *
+kms_layer_selector_get (GstElement * element)
+{
+  return g_object_get_qdata (G_OBJECT (element), kms_layer_selector_quark ());
+}
+
+/* Highest layer whose rate, added to the rates of the layers below, fits */
+/* in the bitrate. Always called with the mutex held */
+static void
+kms_layer_selector_update_target (KmsLayerSelector * self)
+{
+  guint64 total;
+  gint layer;
+
+  if (self->bitrate == 0) {
+    self->target = KMS_LAYER_SELECTOR_MAX_LAYERS - 1;
+    return;
+  }
+
+  self->target = 0;
+  total = self->rates[0];
+
+  for (layer = 1; layer < KMS_LAYER_SELECTOR_MAX_LAYERS; layer++) {
+    total += self->rates[layer];
+
+    if (total > self->bitrate) {
+      break;
+    }
+
+    self->target = layer;
+  }
+}
+
+static void
+kms_layer_selector_account (KmsLayerSelector * self, gint layer, gsize size,
+    GstClockTime pts)
+{
+  GstClockTime elapsed;
+  gint i;
+
+  self->bytes[layer] += size;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts)) {
+    return;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->window_start)
+      || pts < self->window_start) {
+    self->window_start = pts;
+    return;
+  }
+
+  elapsed = pts - self->window_start;
+
+  if (elapsed < RATE_WINDOW) {
+    return;
+  }
+
+  for (i = 0; i < KMS_LAYER_SELECTOR_MAX_LAYERS; i++) {
+    self->rates[i] = gst_util_uint64_scale (self->bytes[i] * 8, GST_SECOND,
+        elapsed);
+    self->bytes[i] = 0;
+  }
+
+  self->window_start = pts;
+  kms_layer_selector_update_target (self);
+}
+
+static gboolean
+kms_layer_selector_check_buffer (KmsLayerSelector * self, GstBuffer * buffer)
+{
+  KmsLayerMeta *meta = kms_buffer_get_layer_meta (buffer);
+  gboolean keyframe, forward;
+  gint layer;
+
+  /* Not a layered stream */
+  if (meta == NULL || meta->temporal_id < 0) {
+    return TRUE;
+  }
+
+  layer = MIN (meta->temporal_id, KMS_LAYER_SELECTOR_MAX_LAYERS - 1);
+  keyframe = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  g_mutex_lock (&self->mutex);
+
+  if (!self->layered) {
+    GST_DEBUG_OBJECT (self->pad, "Layered stream, REMB is handled here");
+    self->layered = TRUE;
+    kms_utils_remb_event_manager_set_forward_events (self->remb_manager,
+        FALSE);
+  }
+
+  kms_layer_selector_account (self, layer, gst_buffer_get_size (buffer),
+      GST_BUFFER_PTS (buffer));
+
+  if (self->target < self->current) {
+    /* Nothing depends on the upper layers, they can go at any time */
+    self->current = self->target;
+  } else if (self->current < self->target) {
+    if (keyframe || layer == 0) {
+      self->current = self->target;
+    } else if (meta->layer_sync && layer > self->current
+        && layer <= self->target) {
+      self->current = layer;
+    }
+  }
+
+  forward = layer <= self->current;
+
+  if (forward) {
+    self->stats.forwarded++;
+  } else {
+    self->stats.dropped++;
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return forward;
+}
+
+static gboolean
+kms_layer_selector_filter_list (GstBuffer ** buffer, guint idx,
+    KmsLayerSelector * self)
+{
+  if (!kms_layer_selector_check_buffer (self, *buffer)) {
+    gst_buffer_unref (*buffer);
+    *buffer = NULL;
+  }
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+kms_layer_selector_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsLayerSelector * self)
+{
+  GstBufferList *list;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    if (!kms_layer_selector_check_buffer (self,
+            GST_PAD_PROBE_INFO_BUFFER (info))) {
+      return GST_PAD_PROBE_DROP;
+    }
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    list = gst_buffer_list_make_writable (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+    gst_buffer_list_foreach (list,
+        (GstBufferListFunc) kms_layer_selector_filter_list, self);
+    GST_PAD_PROBE_INFO_DATA (info) = list;
+
+    if (gst_buffer_list_length (list) == 0) {
+      return GST_PAD_PROBE_DROP;
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_layer_selector_bitrate_updated (RembEventManager * manager, guint bitrate,
+    KmsLayerSelector * self)
+{
+  g_mutex_lock (&self->mutex);
+  self->bitrate = bitrate;
+  kms_layer_selector_update_target (self);
+
+  GST_DEBUG_OBJECT (self->pad, "REMB %u bps, forwarding temporal layers"
+      " up to %d", bitrate, self->target);
+
+  g_mutex_unlock (&self->mutex);
+}
+
+void
+kms_layer_selector_add (GstElement * element)
+{
+  KmsLayerSelector *self;
+  GstPad *pad;
+  gint i;
+
+  kms_layer_selector_init_debug ();
+
+  if (kms_layer_selector_get (element) != NULL) {
+    GST_WARNING_OBJECT (element, "Layer selector already added");
+    return;
+  }
+
+  pad = gst_element_get_static_pad (element, "sink");
+
+  if (pad == NULL) {
+    GST_WARNING_OBJECT (element, "No sink pad to select layers");
+    return;
+  }
+
+  self = g_slice_new0 (KmsLayerSelector);
+  g_mutex_init (&self->mutex);
+  self->pad = pad;
+  self->bitrate = 0;
+  self->target = self->current = KMS_LAYER_SELECTOR_MAX_LAYERS - 1;
+  self->window_start = GST_CLOCK_TIME_NONE;
+  for (i = 0; i < KMS_LAYER_SELECTOR_MAX_LAYERS; i++) {
+    self->bytes[i] = self->rates[i] = 0;
+  }
+
+  /* Until the stream is known to be layered REMB keeps going upstream */
+  self->remb_manager = kms_utils_remb_event_manager_create (pad);
+  kms_utils_remb_event_manager_set_forward_events (self->remb_manager, TRUE);
+  kms_utils_remb_event_manager_set_callback (self->remb_manager,
+      (RembBitrateUpdatedCallback) kms_layer_selector_bitrate_updated, self,
+      NULL);
+
+  self->probe_id = gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) kms_layer_selector_buffer_probe, self, NULL);
+
+  /* The manager keeps a reference to the pad */
+  g_object_unref (pad);
+
+  g_object_set_qdata_full (G_OBJECT (element), kms_layer_selector_quark (),
+      self, (GDestroyNotify) kms_layer_selector_destroy);
+}
+
+gboolean
+kms_layer_selector_get_stats (GstElement * element,
+    KmsLayerSelectorStats * stats)
+{
+  KmsLayerSelector *self = kms_layer_selector_get (element);
+
+  if (self == NULL) {
+    return FALSE;
+  }
+
+  g_mutex_lock (&self->mutex);
+  *stats = self->stats;
+  stats->bitrate = self->bitrate;
+  stats->temporal_layer = self->current;
+  g_mutex_unlock (&self->mutex);
+
+  return TRUE;
+}
@@ -0,0 +1,54 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_LAYER_SELECTOR_H__
+#define __KMS_LAYER_SELECTOR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Temporal layer selection for one consumer of a layered stream. The
+ * selector sits on the sink pad of the consumer payloader, measures the
+ * bitrate of every temporal layer of the frames tagged with a KmsLayerMeta
+ * and forwards the highest layers that fit in the REMB the consumer sends.
+ * Layers are dropped at once and added back at upswitch points.
+ *
+ * While the stream is layered the REMB of the consumer is consumed by the
+ * selector, so the publisher keeps sending every layer. Otherwise it goes
+ * on upstream as usual (to an encoder or to the publisher).
+ */
+
+#define KMS_LAYER_SELECTOR_MAX_LAYERS 8
+
+typedef struct _KmsLayerSelectorStats
+{
+  guint64 forwarded;
+  guint64 dropped;
+  guint bitrate;                /* Last REMB, 0 if none */
+  gint temporal_layer;          /* Highest layer being forwarded */
+} KmsLayerSelectorStats;
+
+/* Adds a selector to the "sink" pad of 'element' */
+void kms_layer_selector_add (GstElement *element);
+
+/* Returns FALSE if there is no selector on 'element' */
+gboolean kms_layer_selector_get_stats (GstElement *element,
+    KmsLayerSelectorStats *stats);
+
+G_END_DECLS
+#endif /* __KMS_LAYER_SELECTOR_H__ */
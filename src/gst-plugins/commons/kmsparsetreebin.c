@@ -21,6 +21,7 @@
 
 #include "kmsparsetreebin.h"
 #include "kmsutils.h"
+#include "kmsbitstream.h"
 
 #define GST_DEFAULT_NAME "parsetreebin"
 #define GST_CAT_DEFAULT kms_parse_tree_bin_debug
@@ -154,6 +155,58 @@ bitrate_calculation_probe (GstPad * pad, GstPadProbeInfo * info,
   return GST_PAD_PROBE_OK;
 }
 
+static gboolean
+mark_keyframe (GstBuffer ** buffer, guint idx, gpointer codec)
+{
+  KmsBitstreamInfo info;
+
+  if (!GST_BUFFER_FLAG_IS_SET (*buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    /* Never downgrade a key frame flagged upstream */
+    return TRUE;
+  }
+
+  if (!kms_bitstream_parse_buffer (*buffer, GPOINTER_TO_INT (codec), &info)
+      || !info.keyframe) {
+    return TRUE;
+  }
+
+  *buffer = gst_buffer_make_writable (*buffer);
+  GST_BUFFER_FLAG_UNSET (*buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  return TRUE;
+}
+
+static gboolean
+is_capsfilter (GstElement * element)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  return factory != NULL &&
+      g_strcmp0 (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)),
+      "capsfilter") == 0;
+}
+
+/* Without a parser, key frames are marked from the frame headers */
+/* when upstream flagged them as delta units                      */
+static GstPadProbeReturn
+mark_keyframes_probe (GstPad * pad, GstPadProbeInfo * info, gpointer codec)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    mark_keyframe (&buffer, 0, codec);
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    list = gst_buffer_list_make_writable (list);
+    gst_buffer_list_foreach (list, mark_keyframe, codec);
+    GST_PAD_PROBE_INFO_DATA (info) = list;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
 static void
 kms_parse_tree_bin_configure (KmsParseTreeBin * self, const GstCaps * caps)
 {
@@ -170,6 +223,15 @@ kms_parse_tree_bin_configure (KmsParseTreeBin * self, const GstCaps * caps)
   if (!kms_utils_caps_is_raw (caps) && kms_utils_caps_is_video (caps)) {
     GstPad *sink = gst_element_get_static_pad (output_tee, "sink");
 
+    KmsBitstreamCodec codec = kms_bitstream_codec_from_caps (caps);
+
+    if (codec != KMS_BITSTREAM_CODEC_UNKNOWN
+        && is_capsfilter (self->priv->parser)) {
+      gst_pad_add_probe (sink,
+          GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+          mark_keyframes_probe, GINT_TO_POINTER (codec), NULL);
+    }
+
     gst_pad_add_probe (sink,
         GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
         (GstPadProbeCallback) bitrate_calculation_probe, self, NULL);
@@ -16,9 +16,12 @@
  */
 
 #include "kmsremb.h"
+#include "kmsrembdelay.h"
 #include "kmsrtcp.h"
 #include "constants.h"
 
+#include <gst/rtp/gstrtpbuffer.h>
+
 #define GST_CAT_DEFAULT kmsutils
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "kmsremb"
@@ -39,11 +42,16 @@ G_DEFINE_QUARK (KMS_REMB_REMOTE, kms_remb_remote);
 
 #define REMB_MAX_FACTOR_INPUT_BR 2
 
+/* Sequence number jump considered as a restart of the remote sender */
+#define REMB_SEQ_MAX_DROPOUT 3000
+
 static void
 kms_remb_base_destroy (KmsRembBase * self)
 {
-  g_signal_handler_disconnect (self->rtpsess, self->signal_id);
-  self->signal_id = 0;
+  if (self->signal_id != 0) {
+    g_signal_handler_disconnect (self->rtpsess, self->signal_id);
+    self->signal_id = 0;
+  }
   g_object_set_qdata (self->rtpsess, kms_remb_remote_quark (), NULL);
   g_clear_object (&self->rtpsess);
   g_rec_mutex_clear (&self->mutex);
@@ -66,10 +74,10 @@ kms_remb_base_update_stats (KmsRembBase * self, guint ssrc, guint bitrate)
 
   KMS_REMB_BASE_LOCK (self);
 
-  if (g_hash_table_contains (self->remb_stats, GUINT_TO_POINTER (ssrc))) {
-    value =
-        (guint *) g_hash_table_lookup (self->remb_stats, GUINT_TO_POINTER (ssrc));
-  } else {
+  value =
+      (guint *) g_hash_table_lookup (self->remb_stats, GUINT_TO_POINTER (ssrc));
+
+  if (value == NULL) {
     value = g_slice_new0 (guint);
     g_hash_table_insert (self->remb_stats, GUINT_TO_POINTER (ssrc), value);
   }
@@ -86,11 +94,27 @@ typedef struct _KmsRlRemoteSession
   GObject *rtpsess; // RTPSession* from GstRtpBin->GstRtpSession
   guint ssrc;
 
+  /* Updated by the RTP probe for each packet of ssrc, and read from the */
+  /* RTCP thread. Both hold the KmsRembBase lock.                       */
+  GstClockTime first_arrival;
+  guint64 octets_received;
+  guint64 packets_received;
+  guint64 packets_expected;
+  guint16 max_seq;
+  gboolean seq_init;
+
+  /* Values read in the previous RTCP cycle */
   guint64 last_octets_received;
   guint64 last_packets_received;
   guint64 last_packets_received_expected;
 } KmsRlRemoteSession;
 
+typedef struct _KmsRlRecvProbe
+{
+  GstPad *pad;
+  gulong id;
+} KmsRlRecvProbe;
+
 static KmsRlRemoteSession *
 kms_rl_remote_session_create (GObject * rtpsess, guint ssrc)
 {
@@ -109,24 +133,57 @@ kms_rl_remote_session_destroy (KmsRlRemoteSession * self)
   g_slice_free (KmsRlRemoteSession, self);
 }
 
+static void
+kms_rl_remote_session_count_packet (KmsRlRemoteSession * self, guint16 seq,
+    guint payload_len)
+{
+  guint64 expected = 0;
+  gint16 delta;
+
+  if (!self->seq_init) {
+    self->seq_init = TRUE;
+    self->max_seq = seq;
+    self->first_arrival = kms_utils_get_cached_time_nsecs ();
+    expected = 1;
+  } else {
+    delta = (gint16) (seq - self->max_seq);
+
+    if (delta > 0) {
+      expected = delta;
+      self->max_seq = seq;
+    } else if (delta < -REMB_SEQ_MAX_DROPOUT) {
+      /* In case of an interrupted connection, the sequence number could */
+      /* make a very large jump; restart counting from this packet       */
+      GST_INFO_OBJECT (self->rtpsess,
+          "RTP stats restarted due to gap in RTP sequence numbers");
+      expected = 1;
+      self->max_seq = seq;
+    }
+  }
+
+  self->packets_expected += expected;
+  self->packets_received++;
+  self->octets_received += payload_len;
+}
+
 typedef struct _GetRtpSessionsInfo
 {
   guint count;
-  guint64 bitrate;
   guint fraction_lost_accumulative;     /* the sum of all sessions, it should be normalized */
   guint64 packets_received_expected_interval_accumulative;
   guint64 octets_received_interval;
   guint64 packets_received_interval;
+  GstClockTime first_arrival;   /* of all sessions */
 } GetRtpSessionsInfo;
 
 static void
 kms_rl_remote_session_get_sessions_info (KmsRlRemoteSession * self,
     GetRtpSessionsInfo * data)
 {
-  // Property RTPSession::sources, doc: GStreamer/rtpsession.c
-  GValueArray *arr = NULL;
-  GValue *val;
-  guint i;
+  guint64 octets_received, packets_received, packets_received_expected;
+  guint64 packets_received_interval, packets_received_expected_interval;
+  guint64 packets_lost_interval = 0;
+  guint fraction_lost = 0;
 
   if (self->ssrc == 0) {
     GST_TRACE_OBJECT (self->rtpsess,
@@ -134,136 +191,144 @@ kms_rl_remote_session_get_sessions_info (KmsRlRemoteSession * self,
     return;
   }
 
-  g_object_get (self->rtpsess, "sources", &arr, NULL);
-  if (!arr) {
-    GST_ERROR_OBJECT (self->rtpsess,
-        "RTP Session lacks any RTPSource");
+  octets_received = self->octets_received;
+  packets_received = self->packets_received;
+  packets_received_expected = self->packets_expected;
+
+  if (packets_received == 0) {
+    GST_TRACE_OBJECT (self->rtpsess,
+        "No RTP packets received yet from SSRC: %u", self->ssrc);
     return;
   }
 
-  GST_LOG_OBJECT (self->rtpsess,
-      "RTP Session with %u RTPSource(s) to gather stats", arr->n_values);
+  packets_received_interval = packets_received - self->last_packets_received;
+  packets_received_expected_interval =
+      packets_received_expected - self->last_packets_received_expected;
+
+  /* Same computation than the fraction lost of a RTCP reception report */
+  if (packets_received_expected_interval > packets_received_interval) {
+    packets_lost_interval =
+        packets_received_expected_interval - packets_received_interval;
+  }
+  if (packets_received_expected_interval > 0) {
+    fraction_lost = (packets_lost_interval << 8) /
+        packets_received_expected_interval;
+  }
 
-  // Check that the SSRC which was announced over SDP
-  // coincides with each source's SSRC in this session.
-  for (i = 0; i < arr->n_values; i++) {
-    GObject *rtpsource;
+  data->count++;
 
-    guint ssrc;
-    gboolean is_validated;
-    gboolean is_sender;
+  data->fraction_lost_accumulative +=
+      (fraction_lost * packets_received_expected_interval);
 
-    // FIXME 'g_value_array_get_nth' is deprecated: Use 'GArray' instead
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    // RTPSource*
-    val = g_value_array_get_nth (arr, i);
-    #pragma GCC diagnostic pop
+  data->packets_received_expected_interval_accumulative +=
+      packets_received_expected_interval;
 
-    rtpsource = g_value_get_object (val);
+  data->octets_received_interval +=
+      (octets_received - self->last_octets_received);
 
-    // Property RTPSource::ssrc, doc: GStreamer/rtpsource.c
-    g_object_get (rtpsource,
-        "ssrc", &ssrc,
-        "is-validated", &is_validated,
-        "is-sender", &is_sender,
-        NULL);
+  data->packets_received_interval += packets_received_interval;
 
-    // Each session has a minimum of 2 SSRCs: the sender's and the receiver's;
-    // here we're looking for stats from the sender which had its SSRC registered
-    // for congestion control (by providing it in the SDP negotiation).
+  if (data->first_arrival == 0 || self->first_arrival < data->first_arrival) {
+    data->first_arrival = self->first_arrival;
+  }
 
-    if (!is_validated || !is_sender) {
-      GST_TRACE_OBJECT (self->rtpsess,
-          "Ignore uninteresting RTPSource SSRC: %u", ssrc);
-      continue;
-    }
+  GST_TRACE_OBJECT (self->rtpsess,
+      "SSRC: %u, packets_received: %" G_GUINT64_FORMAT
+      ", packets_lost_interval: %" G_GUINT64_FORMAT
+      ", packets_received_expected_interval: %" G_GUINT64_FORMAT
+      ", packets_received_expected_interval_accumulative: %" G_GUINT64_FORMAT,
+      self->ssrc, packets_received, packets_lost_interval,
+      packets_received_expected_interval,
+      data->packets_received_expected_interval_accumulative);
+
+  self->last_octets_received = octets_received;
+  self->last_packets_received = packets_received;
+  self->last_packets_received_expected = packets_received_expected;
+}
 
-    if (ssrc != self->ssrc) {
-      GST_LOG_OBJECT (self->rtpsess,
-          "SSRC mismatch, RTPSource: %u, SDP: %u", ssrc, self->ssrc);
-      continue;
-    }
+/* Must be called with the KmsRembBase lock held */
+static void
+kms_remb_local_count_rtp_buffer (KmsRembLocal * self, GstBuffer * buffer)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  guint ssrc, payload_len;
+  guint16 seq;
+  GSList *l;
 
-    GST_LOG_OBJECT (self->rtpsess,
-        "SSRC match! RTPSource & SDP: %u", ssrc);
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp)) {
+    return;
+  }
 
-    // Property RTPSource::stats, doc: GStreamer/rtpsource.c
-    GstStructure *s;
-    g_object_get (rtpsource, "stats", &s, NULL);
-    GST_TRACE_OBJECT (rtpsource, "stats: %" GST_PTR_FORMAT, s);
+  ssrc = gst_rtp_buffer_get_ssrc (&rtp);
+  seq = gst_rtp_buffer_get_seq (&rtp);
+  payload_len = gst_rtp_buffer_get_payload_len (&rtp);
 
-    guint64 bitrate = 0, octets_received = 0, packets_received = 0;
-    gint packets_lost = 0;
-    guint fraction_lost = 0;
-    if (!gst_structure_get_uint64 (s, "bitrate", &bitrate)) {
-      GST_ERROR_OBJECT (rtpsource,  "RTPSource stats lack property 'bitrate'");
-    }
-    if (!gst_structure_get_uint64 (s, "octets-received", &octets_received)) {
-      GST_ERROR_OBJECT (rtpsource, "RTPSource stats lack property 'octets-received'");
-    }
-    if (!gst_structure_get_uint64 (s, "packets-received", &packets_received)) {
-      GST_ERROR_OBJECT (rtpsource, "RTPSource stats lack property 'packets-received'");
-    }
-    if (!gst_structure_get_int    (s, "packets-lost", &packets_lost)) {
-      GST_ERROR_OBJECT (rtpsource, "RTPSource stats lack property 'packets-lost'");
-    }
-    if (!gst_structure_get_uint   (s, "sent-rb-fractionlost", &fraction_lost)) {
-      GST_ERROR_OBJECT (rtpsource, "RTPSource stats lack property 'sent-rb-fractionlost'");
-    }
-    gst_structure_free (s);
+  for (l = self->remote_sessions; l != NULL; l = g_slist_next (l)) {
+    KmsRlRemoteSession *rlrs = l->data;
 
-    // In case of an interrupted connection, the sequence number could make
-    // a very large jump, and the RTPSource will reset its stats.
-    // To account for this case, our own counters must be also reset.
-    if (self->last_packets_received > packets_received) {
-      GST_INFO_OBJECT (self->rtpsess,
-        "RTP stats restarted due to gap in RTP sequence numbers");
-      self->last_octets_received = 0;
-      self->last_packets_received = 0;
-      self->last_packets_received_expected = 0;
+    if (rlrs->ssrc == ssrc) {
+      kms_rl_remote_session_count_packet (rlrs, seq, payload_len);
+      break;
     }
+  }
 
-    const guint64 packets_received_expected =
-        packets_received + packets_lost;
+  if (l != NULL && self->cc->packet_arrival != NULL) {
+    gint abs_send_time = -1;
+    guint8 *data;
+    guint size;
 
-    const guint64 packets_received_expected_interval =
-        packets_received_expected - self->last_packets_received_expected;
-    self->last_packets_received_expected = packets_received_expected;
+    if (self->abs_send_time_id > 0
+        && gst_rtp_buffer_get_extension_onebyte_header (&rtp,
+            self->abs_send_time_id, 0, (gpointer *) & data, &size)
+        && size == 3) {
+      abs_send_time = (data[0] << 16) | (data[1] << 8) | data[2];
+    }
 
-    data->count++;
-    data->bitrate += bitrate;
+    self->cc->packet_arrival (self->cc_data,
+        kms_utils_get_cached_time_nsecs (), abs_send_time);
+  }
 
-    data->fraction_lost_accumulative +=
-        (fraction_lost * packets_received_expected_interval);
+  gst_rtp_buffer_unmap (&rtp);
+}
 
-    data->packets_received_expected_interval_accumulative +=
-        packets_received_expected_interval;
+static gboolean
+kms_remb_local_count_rtp_buffer_list (GstBuffer ** buffer, guint idx,
+    KmsRembLocal * self)
+{
+  kms_remb_local_count_rtp_buffer (self, *buffer);
 
-    data->octets_received_interval +=
-        (octets_received - self->last_octets_received);
-    self->last_octets_received = octets_received;
+  return TRUE;
+}
 
-    data->packets_received_interval +=
-        (packets_received - self->last_packets_received);
-    self->last_packets_received = packets_received;
+static GstPadProbeReturn
+kms_remb_local_recv_rtp_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  KmsRembLocal *self = user_data;
 
-    GST_TRACE_OBJECT (rtpsource,
-        "packets_received: %" G_GUINT64_FORMAT
-        ", packets_lost: %" G_GUINT32_FORMAT
-        ", packets_received_expected_interval: %" G_GUINT64_FORMAT
-        ", packets_received_expected_interval_accumulative: %" G_GUINT64_FORMAT,
-        packets_received, packets_lost, packets_received_expected_interval,
-        data->packets_received_expected_interval_accumulative);
+  /* Sessions and controller data can be changed from other threads */
+  KMS_REMB_BASE_LOCK (self);
 
-    break;
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    kms_remb_local_count_rtp_buffer (self, GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    kms_utils_time_cache_begin ();
+    gst_buffer_list_foreach (GST_PAD_PROBE_INFO_BUFFER_LIST (info),
+        (GstBufferListFunc) kms_remb_local_count_rtp_buffer_list, self);
+    kms_utils_time_cache_end ();
   }
 
-  // FIXME 'g_value_array_free' is deprecated: Use 'GArray' instead
-  #pragma GCC diagnostic push
-  #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-  g_value_array_free (arr);
-  #pragma GCC diagnostic pop
+  KMS_REMB_BASE_UNLOCK (self);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_rl_recv_probe_destroy (KmsRlRecvProbe * probe)
+{
+  gst_pad_remove_probe (probe->pad, probe->id);
+  g_object_unref (probe->pad);
+  g_slice_free (KmsRlRecvProbe, probe);
 }
 
 static gboolean
@@ -283,9 +348,11 @@ kms_remb_local_get_video_recv_info (KmsRembLocal * self,
   GST_LOG_OBJECT (KMS_REMB_BASE (self)->rtpsess,
       "KmsRembLocal: Get stats from %u remote session(s)", sessions_count);
 
+  KMS_REMB_BASE_LOCK (self);
   g_slist_foreach (self->remote_sessions,
                    (GFunc) kms_rl_remote_session_get_sessions_info,
                    &data);
+  KMS_REMB_BASE_UNLOCK (self);
 
   if (data.count == 0) {
     GST_LOG_OBJECT (KMS_REMB_BASE (self)->rtpsess,
@@ -301,17 +368,21 @@ kms_remb_local_get_video_recv_info (KmsRembLocal * self,
       "KmsRembLocal: New stats from %u source(s), %lu packets",
       data.count, data.packets_received_expected_interval_accumulative);
 
-  current_time = kms_utils_get_time_nsecs ();
+  current_time = kms_utils_get_coarse_time_nsecs ();
 
   /* Normalize fraction_lost */
   *fraction_lost =
       data.fraction_lost_accumulative /
       data.packets_received_expected_interval_accumulative;
 
-  *bitrate = data.bitrate;
+  *bitrate = 0;
 
-  if (self->last_time != 0) {
-    const GstClockTime elapsed = current_time - self->last_time;
+  /* The first cycle counts from the first packet received, once it is */
+  /* old enough to give a meaningful bitrate                           */
+  if (self->last_time != 0 || current_time >= data.first_arrival +
+      RTCP_MIN_INTERVAL * GST_MSECOND) {
+    const GstClockTime elapsed = current_time - (self->last_time != 0 ?
+        self->last_time : data.first_arrival);
     const guint64 bytes_handled = data.octets_received_interval;
 
     *bitrate = gst_util_uint64_scale (bytes_handled, 8 * GST_SECOND, elapsed);
@@ -330,26 +401,10 @@ kms_remb_local_get_video_recv_info (KmsRembLocal * self,
 }
 
 static gboolean
-kms_remb_local_update (KmsRembLocal * self)
+kms_remb_local_loss_based_update (KmsRembLocal * self, gpointer cc,
+    guint64 bitrate, guint fraction_lost, guint64 packets_rcv_interval)
 {
-  guint64 bitrate, packets_rcv_interval;
-  guint fraction_lost, packets_rcv_interval_top;
-
-  if (!kms_remb_local_get_video_recv_info (self,
-      &bitrate, &fraction_lost, &packets_rcv_interval)) {
-    return FALSE;
-  }
-
-  if (!self->probed) {
-    if (bitrate == 0) {
-      GST_DEBUG_OBJECT (KMS_REMB_BASE (self)->rtpsess,
-          "No probe, and bitrate == 0");
-      return FALSE;
-    }
-
-    self->remb = bitrate;
-    self->probed = TRUE;
-  }
+  guint packets_rcv_interval_top;
 
   packets_rcv_interval_top =
       MAX (self->packets_recv_interval_top, packets_rcv_interval);
@@ -411,10 +466,6 @@ kms_remb_local_update (KmsRembLocal * self)
     }
   }
 
-  if (self->max_bw > 0) {
-    self->remb = MIN (self->remb, self->max_bw * 1000);
-  }
-
   GST_TRACE_OBJECT (KMS_REMB_BASE (self)->rtpsess,
       "REMB: %" G_GUINT32_FORMAT
       ", Threshold: %" G_GUINT32_FORMAT
@@ -427,6 +478,87 @@ kms_remb_local_update (KmsRembLocal * self)
   return TRUE;
 }
 
+static const KmsRembCongestionController loss_based_controller = {
+  KMS_REMB_CONGESTION_CONTROL_LOSS_BASED,
+  NULL,
+  NULL,
+  NULL,
+  kms_remb_local_loss_based_update,
+  NULL,
+  NULL,
+};
+
+static const KmsRembCongestionController *
+kms_remb_local_find_controller (const gchar * name)
+{
+  const KmsRembCongestionController *controllers[] = {
+    &loss_based_controller,
+    kms_remb_delay_based_controller (),
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (controllers); i++) {
+    if (g_strcmp0 (controllers[i]->name, name) == 0) {
+      return controllers[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void
+kms_remb_local_set_controller (KmsRembLocal * self,
+    const KmsRembCongestionController * cc)
+{
+  if (self->cc != NULL && self->cc->destroy != NULL) {
+    self->cc->destroy (self->cc_data);
+  }
+
+  self->cc = cc;
+  self->cc_data = (cc->create != NULL) ? cc->create () : NULL;
+}
+
+static gboolean
+kms_remb_local_update (KmsRembLocal * self)
+{
+  guint64 bitrate, packets_rcv_interval;
+  guint fraction_lost;
+  gboolean ret;
+
+  if (!kms_remb_local_get_video_recv_info (self,
+      &bitrate, &fraction_lost, &packets_rcv_interval)) {
+    return FALSE;
+  }
+
+  if (!self->probed) {
+    if (bitrate == 0) {
+      GST_DEBUG_OBJECT (KMS_REMB_BASE (self)->rtpsess,
+          "No probe, and bitrate == 0");
+      return FALSE;
+    }
+
+    self->remb = bitrate;
+    self->probed = TRUE;
+  }
+
+  KMS_REMB_BASE_LOCK (self);
+  if (self->cc->packet_arrival != NULL && self->abs_send_time_id <= 0) {
+    /* Send times are unknown without abs-send-time, only losses can be used */
+    ret = loss_based_controller.update (self, NULL, bitrate, fraction_lost,
+        packets_rcv_interval);
+  } else {
+    ret = self->cc->update (self, self->cc_data, bitrate, fraction_lost,
+        packets_rcv_interval);
+  }
+  KMS_REMB_BASE_UNLOCK (self);
+
+  if (ret && self->max_bw > 0) {
+    self->remb = MIN (self->remb, self->max_bw * 1000);
+  }
+
+  return ret;
+}
+
 typedef struct _AddSsrcsData
 {
   KmsRembLocal *rl;
@@ -448,43 +580,25 @@ add_ssrcs (KmsRlRemoteSession * rlrs, AddSsrcsData * data)
   kms_remb_base_update_stats (rb, rlrs->ssrc, data->remb_packet->bitrate);
 }
 
-// Signal "RTPSession::on-sending-rtcp" doc: GStreamer/rtpsession.c
-static gboolean
-kms_remb_local_on_sending_rtcp (GObject *rtpsession,
-    GstBuffer *buffer, gboolean is_early, KmsRembLocal *self)
+gboolean
+kms_remb_local_get_packet (KmsRembLocal * self,
+    KmsRTCPPSFBAFBREMBPacket * remb_packet)
 {
-  gboolean ret = FALSE;
+  GObject *rtpsession = KMS_REMB_BASE (self)->rtpsess;
   GstClockTime current_time, elapsed;
-  KmsRTCPPSFBAFBREMBPacket remb_packet;
-  GstRTCPBuffer rtcp = {0,};
-  GstRTCPPacket packet;
-  guint packet_ssrc;
   AddSsrcsData data;
 
-  GST_LOG_OBJECT (rtpsession, "Signal \"RTPSession::on-sending-rtcp\" ...");
-
-  current_time = kms_utils_get_time_nsecs ();
+  current_time = kms_utils_get_coarse_time_nsecs ();
   elapsed = current_time - self->last_sent_time;
   if (self->last_sent_time != 0 && (elapsed < REMB_MAX_INTERVAL * GST_MSECOND)) {
     GST_LOG_OBJECT (rtpsession, "... Not sending: Interval < %u ms", REMB_MAX_INTERVAL);
-    return ret;
-  }
-
-  if (!gst_rtcp_buffer_map (buffer, GST_MAP_READWRITE, &rtcp)) {
-    GST_WARNING_OBJECT (rtpsession, "... Cannot map RTCP buffer");
-    return ret;
-  }
-
-  if (!gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_PSFB, &packet)) {
-    GST_WARNING_OBJECT (rtpsession, "... Cannot add RTCP packet");
-    goto end;
+    return FALSE;
   }
 
   // Update the REMB bitrate estimations
   if (!kms_remb_local_update (self)) {
     GST_LOG_OBJECT (rtpsession, "... Not sending: Stats not updated");
-    gst_rtcp_packet_remove (&packet);
-    goto end;
+    return FALSE;
   }
 
   //const guint32 old_bitrate = self->remb_sent;
@@ -509,11 +623,46 @@ kms_remb_local_on_sending_rtcp (GObject *rtpsession,
 
   self->remb_sent = new_bitrate;
 
-  remb_packet.bitrate = new_bitrate;
-  remb_packet.n_ssrcs = 0;
+  remb_packet->bitrate = new_bitrate;
+  remb_packet->n_ssrcs = 0;
   data.rl = self;
-  data.remb_packet = &remb_packet;
+  data.remb_packet = remb_packet;
+  KMS_REMB_BASE_LOCK (self);
   g_slist_foreach (self->remote_sessions, (GFunc) add_ssrcs, &data);
+  KMS_REMB_BASE_UNLOCK (self);
+
+  self->last_sent_time = current_time;
+
+  return TRUE;
+}
+
+// Signal "RTPSession::on-sending-rtcp" doc: GStreamer/rtpsession.c
+static gboolean
+kms_remb_local_on_sending_rtcp (GObject *rtpsession,
+    GstBuffer *buffer, gboolean is_early, KmsRembLocal *self)
+{
+  gboolean ret = FALSE;
+  KmsRTCPPSFBAFBREMBPacket remb_packet;
+  GstRTCPBuffer rtcp = {0,};
+  GstRTCPPacket packet;
+  guint packet_ssrc;
+
+  GST_LOG_OBJECT (rtpsession, "Signal \"RTPSession::on-sending-rtcp\" ...");
+
+  if (!gst_rtcp_buffer_map (buffer, GST_MAP_READWRITE, &rtcp)) {
+    GST_WARNING_OBJECT (rtpsession, "... Cannot map RTCP buffer");
+    return ret;
+  }
+
+  if (!gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_PSFB, &packet)) {
+    GST_WARNING_OBJECT (rtpsession, "... Cannot add RTCP packet");
+    goto end;
+  }
+
+  if (!kms_remb_local_get_packet (self, &remb_packet)) {
+    gst_rtcp_packet_remove (&packet);
+    goto end;
+  }
 
   g_object_get (rtpsession, "internal-ssrc", &packet_ssrc, NULL);
   if (!kms_rtcp_psfb_afb_remb_marshall_packet (&packet, &remb_packet,
@@ -521,7 +670,6 @@ kms_remb_local_on_sending_rtcp (GObject *rtpsession,
     gst_rtcp_packet_remove (&packet);
   }
 
-  self->last_sent_time = current_time;
   ret = TRUE;
 
 end:
@@ -529,6 +677,17 @@ end:
   return ret;
 }
 
+void
+kms_remb_local_disconnect_rtcp (KmsRembLocal * self)
+{
+  KmsRembBase *base = KMS_REMB_BASE (self);
+
+  if (base->signal_id != 0) {
+    g_signal_handler_disconnect (base->rtpsess, base->signal_id);
+    base->signal_id = 0;
+  }
+}
+
 void
 kms_remb_local_destroy (KmsRembLocal * self)
 {
@@ -540,10 +699,16 @@ kms_remb_local_destroy (KmsRembLocal * self)
     kms_utils_remb_event_manager_destroy (self->event_manager);
   }
 
+  g_slist_free_full (self->recv_probes,
+      (GDestroyNotify) kms_rl_recv_probe_destroy);
   g_slist_free_full (self->remote_sessions,
       (GDestroyNotify) kms_rl_remote_session_destroy);
   kms_remb_base_destroy (KMS_REMB_BASE (self));
 
+  if (self->cc->destroy != NULL) {
+    self->cc->destroy (self->cc_data);
+  }
+
   g_slice_free (KmsRembLocal, self);
 }
 
@@ -574,6 +739,8 @@ kms_remb_local_create (GObject * rtpsession, guint min_bw, guint max_bw)
   self->threshold_factor = DEFAULT_REMB_THRESHOLD_FACTOR;
   self->up_losses = DEFAULT_REMB_UP_LOSSES;
 
+  kms_remb_local_set_controller (self, &loss_based_controller);
+
   return self;
 }
 
@@ -583,16 +750,81 @@ kms_remb_local_add_remote_session (KmsRembLocal * rl, GObject * rtpsess,
 {
   KmsRlRemoteSession *rlrs = kms_rl_remote_session_create (rtpsess, ssrc);
 
+  KMS_REMB_BASE_LOCK (rl);
   rl->remote_sessions = g_slist_append (rl->remote_sessions, rlrs);
+  KMS_REMB_BASE_UNLOCK (rl);
+}
+
+static gint
+kms_rl_recv_probe_compare_pad (KmsRlRecvProbe * probe, GstPad * pad)
+{
+  return (probe->pad == pad) ? 0 : 1;
+}
+
+void
+kms_remb_local_add_recv_pad (KmsRembLocal * rl, GstPad * pad)
+{
+  KmsRlRecvProbe *probe;
+
+  KMS_REMB_BASE_LOCK (rl);
+
+  if (g_slist_find_custom (rl->recv_probes, pad,
+          (GCompareFunc) kms_rl_recv_probe_compare_pad) != NULL) {
+    /* Each packet must be counted only once */
+    goto end;
+  }
+
+  probe = g_slice_new0 (KmsRlRecvProbe);
+  probe->pad = g_object_ref (pad);
+  probe->id = gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      kms_remb_local_recv_rtp_probe, rl, NULL);
+
+  rl->recv_probes = g_slist_prepend (rl->recv_probes, probe);
+
+end:
+  KMS_REMB_BASE_UNLOCK (rl);
+}
+
+void
+kms_remb_local_set_abs_send_time_id (KmsRembLocal * rl, gint id)
+{
+  rl->abs_send_time_id = id;
 }
 
 void
 kms_remb_local_set_params (KmsRembLocal * rl, GstStructure * params)
 {
+  const gchar *cc_name;
   gfloat auxf;
   gint auxi;
   gboolean is_set;
 
+  KMS_REMB_BASE_LOCK (rl);
+
+  cc_name = gst_structure_get_string (params, "congestion-control");
+  if (cc_name != NULL && g_strcmp0 (cc_name, rl->cc->name) != 0) {
+    const KmsRembCongestionController *cc;
+
+    cc = kms_remb_local_find_controller (cc_name);
+
+    if (cc == NULL) {
+      GST_WARNING ("Unknown congestion control '%s'", cc_name);
+    } else if (rl->recv_probes != NULL) {
+      /* The controller is used from the streaming thread since then */
+      GST_WARNING ("Congestion control cannot be changed once media flows");
+    } else {
+      GST_DEBUG ("Using congestion control '%s'", cc_name);
+      kms_remb_local_set_controller (rl, cc);
+    }
+  }
+
+  if (rl->cc->set_params != NULL) {
+    rl->cc->set_params (rl->cc_data, params);
+  }
+
+  KMS_REMB_BASE_UNLOCK (rl);
+
   is_set =
       gst_structure_get (params, "packets-recv-interval-top", G_TYPE_INT,
       &auxi, NULL);
@@ -647,6 +879,8 @@ kms_remb_local_set_params (KmsRembLocal * rl, GstStructure * params)
 void
 kms_remb_local_get_params (KmsRembLocal * rl, GstStructure ** params)
 {
+  KMS_REMB_BASE_LOCK (rl);
+
   gst_structure_set (*params,
       "packets-recv-interval-top", G_TYPE_INT, rl->packets_recv_interval_top,
       "exponential-factor", G_TYPE_FLOAT, rl->exponential_factor,
@@ -654,7 +888,14 @@ kms_remb_local_get_params (KmsRembLocal * rl, GstStructure ** params)
       "lineal-factor-grade", G_TYPE_FLOAT, rl->lineal_factor_grade,
       "decrement-factor", G_TYPE_FLOAT, rl->decrement_factor,
       "threshold-factor", G_TYPE_FLOAT, rl->threshold_factor,
-      "up-losses", G_TYPE_INT, rl->up_losses, NULL);
+      "up-losses", G_TYPE_INT, rl->up_losses,
+      "congestion-control", G_TYPE_STRING, rl->cc->name, NULL);
+
+  if (rl->cc->get_params != NULL) {
+    rl->cc->get_params (rl->cc_data, *params);
+  }
+
+  KMS_REMB_BASE_UNLOCK (rl);
 }
 
 /* KmsRembLocal end */
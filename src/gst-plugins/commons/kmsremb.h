@@ -19,6 +19,7 @@
 #define __KMS_REMB_H__
 
 #include "kmsutils.h" /* TODO: must be not needed */
+#include "kmsrtcp.h"
 
 G_BEGIN_DECLS
 
@@ -41,12 +42,41 @@ struct _KmsRembBase
 
 /* KmsRembLocal begin */
 typedef struct _KmsRembLocal KmsRembLocal;
+typedef struct _KmsRembCongestionController KmsRembCongestionController;
+
+#define KMS_REMB_CONGESTION_CONTROL_LOSS_BASED "loss-based"
+#define KMS_REMB_CONGESTION_CONTROL_DELAY_BASED "delay-based"
+
+/* Algorithm used by KmsRembLocal to estimate the bitrate sent in REMB */
+struct _KmsRembCongestionController
+{
+  const gchar *name;
+
+  gpointer (*create) (void);
+  void (*destroy) (gpointer cc);
+
+  /* Called from the streaming thread for each RTP packet of the remote */
+  /* sessions. abs_send_time is -1 if the packet lacks the extension    */
+  void (*packet_arrival) (gpointer cc, GstClockTime arrival,
+      gint abs_send_time);
+
+  /* Called from the RTCP thread, it must update rl->remb */
+  gboolean (*update) (KmsRembLocal *rl, gpointer cc, guint64 bitrate,
+      guint fraction_lost, guint64 packets_rcv_interval);
+
+  void (*set_params) (gpointer cc, GstStructure *params);
+  void (*get_params) (gpointer cc, GstStructure *params);
+};
 
 struct _KmsRembLocal
 {
   KmsRembBase base;
 
   GSList *remote_sessions; // List<KmsRlRemoteSession*>
+  GSList *recv_probes; // List<KmsRlRecvProbe*>
+  const KmsRembCongestionController *cc;
+  gpointer cc_data;
+  gint abs_send_time_id; // 0 if the extension was not negotiated
   guint min_bw;
   guint max_bw;
 
@@ -75,8 +105,18 @@ KmsRembLocal * kms_remb_local_create (GObject *rtpsess,
   guint min_bw, guint max_bw);
 void kms_remb_local_destroy (KmsRembLocal *rl);
 void kms_remb_local_add_remote_session (KmsRembLocal *rl, GObject *rtpsess, guint ssrc);
+/* Count RTP packets of the remote sessions that go through pad. */
+/* Delay-based estimation needs it before the jitterbuffer       */
+void kms_remb_local_add_recv_pad (KmsRembLocal *rl, GstPad *pad);
+void kms_remb_local_set_abs_send_time_id (KmsRembLocal *rl, gint id);
 void kms_remb_local_set_params (KmsRembLocal *rl, GstStructure *params);
 void kms_remb_local_get_params (KmsRembLocal *rl, GstStructure **params);
+/* Fills remb_packet with the REMB due in this RTCP cycle, if any. It is */
+/* what the "on-sending-rtcp" handler of rl writes                       */
+gboolean kms_remb_local_get_packet (KmsRembLocal *rl,
+    KmsRTCPPSFBAFBREMBPacket *remb_packet);
+/* Stop writing REMB from rl, when another component writes its packets */
+void kms_remb_local_disconnect_rtcp (KmsRembLocal *rl);
 /* KmsRembLocal end */
 
 /* KmsRembRemote begin */
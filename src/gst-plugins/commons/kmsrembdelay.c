@@ -0,0 +1,437 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "kmsrembdelay.h"
+
+#define GST_CAT_DEFAULT kms_remb_delay_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmsrembdelay"
+
+/* abs-send-time is a 24 bits 6.18 fixed point number of seconds */
+#define ABS_SEND_TIME_MASK 0xffffff
+#define ABS_SEND_TIME_NEGATIVE 0x800000
+#define ABS_SEND_TIME_TO_NSECS(t) ((((guint64) (t)) * GST_SECOND) >> 18)
+
+/* Packets sent within this time are considered the same burst */
+#define BURST_TIME (5 * GST_MSECOND)
+
+#define MAX_WINDOW_SIZE 100
+#define MAX_DELTAS 60
+
+#define INITIAL_THRESHOLD 12.5  /* ms */
+#define MIN_THRESHOLD 6.0       /* ms */
+#define MAX_THRESHOLD 600.0     /* ms */
+#define MAX_THRESHOLD_DEVIATION 15.0    /* ms */
+#define THRESHOLD_K_UP 0.0087
+#define THRESHOLD_K_DOWN 0.039
+#define OVERUSE_TIME_THRESHOLD 10.0     /* ms */
+
+#define INCREASE_FACTOR 0.08    /* per second */
+#define MAX_INCREASE_OVER_INCOMING 1.5
+#define MIN_INCREASE_OVER_INCOMING 10000        /* bps */
+#define LOSSES_THRESHOLD 26     /* 10% losses */
+
+#define DEFAULT_WINDOW_SIZE 20
+#define DEFAULT_SMOOTHING 0.9
+#define DEFAULT_THRESHOLD_GAIN 4.0
+#define DEFAULT_BETA 0.85
+
+#define NSECS_TO_MSECS(t) ((gdouble) (t) / GST_MSECOND)
+
+typedef enum
+{
+  KMS_REMB_DELAY_SIGNAL_NORMAL = 0,
+  KMS_REMB_DELAY_SIGNAL_OVERUSE = 1 << 0,
+  KMS_REMB_DELAY_SIGNAL_UNDERUSE = 1 << 1,
+} KmsRembDelaySignal;
+
+typedef struct _KmsRembDelayGroup
+{
+  gboolean valid;
+  guint64 first_send;
+  guint64 last_send;
+  GstClockTime last_arrival;
+} KmsRembDelayGroup;
+
+typedef struct _KmsRembDelay
+{
+  /* Protects the parameters and the trendline window. Parameters can be */
+  /* changed at any time through the "remb-params" property */
+  GMutex mutex;
+
+  guint window_size;
+  gdouble smoothing;
+  gdouble threshold_gain;
+  gdouble beta;
+
+  /* Only accessed from the streaming thread */
+  gboolean send_time_init;
+  guint32 last_abs_send_time;
+  guint64 send_time;            /* unwrapped abs-send-time in ns */
+  KmsRembDelayGroup current;
+  KmsRembDelayGroup previous;
+
+  GstClockTime first_arrival;
+  gdouble accumulated_delay;
+  gdouble smoothed_delay;
+  gdouble window_x[MAX_WINDOW_SIZE];
+  gdouble window_y[MAX_WINDOW_SIZE];
+  guint window_len;
+  guint window_pos;
+  guint num_deltas;
+
+  gdouble threshold;
+  GstClockTime last_threshold_update;
+  gdouble prev_trend;
+  gdouble time_over_using;
+  guint overuse_counter;
+
+  /* KmsRembDelaySignal detected since the last REMB update */
+  guint signals;
+
+  /* Only accessed from the RTCP thread */
+  GstClockTime last_update;
+} KmsRembDelay;
+
+static gpointer
+kms_remb_delay_create (void)
+{
+  KmsRembDelay *self = g_slice_new0 (KmsRembDelay);
+
+  g_mutex_init (&self->mutex);
+  self->window_size = DEFAULT_WINDOW_SIZE;
+  self->smoothing = DEFAULT_SMOOTHING;
+  self->threshold_gain = DEFAULT_THRESHOLD_GAIN;
+  self->beta = DEFAULT_BETA;
+
+  self->first_arrival = GST_CLOCK_TIME_NONE;
+  self->threshold = INITIAL_THRESHOLD;
+  self->last_threshold_update = GST_CLOCK_TIME_NONE;
+  self->time_over_using = -1;
+
+  return self;
+}
+
+static void
+kms_remb_delay_destroy (gpointer cc)
+{
+  KmsRembDelay *self = cc;
+
+  g_mutex_clear (&self->mutex);
+  g_slice_free (KmsRembDelay, self);
+}
+
+static gdouble
+kms_remb_delay_linear_fit_slope (KmsRembDelay * self)
+{
+  gdouble sum_x = 0, sum_y = 0, avg_x, avg_y;
+  gdouble numerator = 0, denominator = 0;
+  guint i;
+
+  for (i = 0; i < self->window_len; i++) {
+    sum_x += self->window_x[i];
+    sum_y += self->window_y[i];
+  }
+
+  avg_x = sum_x / self->window_len;
+  avg_y = sum_y / self->window_len;
+
+  for (i = 0; i < self->window_len; i++) {
+    gdouble x = self->window_x[i] - avg_x;
+
+    numerator += x * (self->window_y[i] - avg_y);
+    denominator += x * x;
+  }
+
+  if (denominator == 0) {
+    return self->prev_trend;
+  }
+
+  return numerator / denominator;
+}
+
+static void
+kms_remb_delay_update_threshold (KmsRembDelay * self, gdouble modified_trend,
+    GstClockTime arrival)
+{
+  gdouble abs_trend = ABS (modified_trend);
+  gdouble k, elapsed;
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->last_threshold_update)) {
+    self->last_threshold_update = arrival;
+  }
+
+  if (abs_trend > self->threshold + MAX_THRESHOLD_DEVIATION) {
+    /* Avoid adapting the threshold to sudden spikes */
+    self->last_threshold_update = arrival;
+    return;
+  }
+
+  k = (abs_trend < self->threshold) ? THRESHOLD_K_DOWN : THRESHOLD_K_UP;
+  elapsed = MIN (NSECS_TO_MSECS (arrival - self->last_threshold_update), 100.0);
+
+  self->threshold += k * (abs_trend - self->threshold) * elapsed;
+  self->threshold = CLAMP (self->threshold, MIN_THRESHOLD, MAX_THRESHOLD);
+  self->last_threshold_update = arrival;
+}
+
+static void
+kms_remb_delay_detect (KmsRembDelay * self, gdouble trend,
+    gdouble arrival_delta, GstClockTime arrival)
+{
+  gdouble modified_trend;
+
+  modified_trend = self->num_deltas * trend * self->threshold_gain;
+
+  if (modified_trend > self->threshold) {
+    if (self->time_over_using < 0) {
+      self->time_over_using = arrival_delta / 2;
+    } else {
+      self->time_over_using += arrival_delta;
+    }
+    self->overuse_counter++;
+
+    if (self->time_over_using > OVERUSE_TIME_THRESHOLD
+        && self->overuse_counter > 1 && trend >= self->prev_trend) {
+      GST_TRACE ("Overuse, trend: %f, threshold: %f", modified_trend,
+          self->threshold);
+      self->time_over_using = 0;
+      self->overuse_counter = 0;
+      g_atomic_int_or (&self->signals, KMS_REMB_DELAY_SIGNAL_OVERUSE);
+    }
+  } else if (modified_trend < -self->threshold) {
+    GST_TRACE ("Underuse, trend: %f, threshold: %f", modified_trend,
+        self->threshold);
+    self->time_over_using = -1;
+    self->overuse_counter = 0;
+    g_atomic_int_or (&self->signals, KMS_REMB_DELAY_SIGNAL_UNDERUSE);
+  } else {
+    self->time_over_using = -1;
+    self->overuse_counter = 0;
+  }
+
+  self->prev_trend = trend;
+  kms_remb_delay_update_threshold (self, modified_trend, arrival);
+}
+
+static void
+kms_remb_delay_update_trendline (KmsRembDelay * self, gdouble delay_delta,
+    gdouble arrival_delta, GstClockTime arrival)
+{
+  self->num_deltas = MIN (self->num_deltas + 1, MAX_DELTAS);
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->first_arrival)) {
+    self->first_arrival = arrival;
+  }
+
+  self->accumulated_delay += delay_delta;
+  self->smoothed_delay = self->smoothing * self->smoothed_delay +
+      (1 - self->smoothing) * self->accumulated_delay;
+
+  self->window_x[self->window_pos] =
+      NSECS_TO_MSECS (arrival - self->first_arrival);
+  self->window_y[self->window_pos] = self->smoothed_delay;
+  self->window_pos = (self->window_pos + 1) % self->window_size;
+  self->window_len = MIN (self->window_len + 1, self->window_size);
+
+  if (self->window_len < self->window_size) {
+    return;
+  }
+
+  kms_remb_delay_detect (self, kms_remb_delay_linear_fit_slope (self),
+      arrival_delta, arrival);
+}
+
+static void
+kms_remb_delay_packet_arrival (gpointer cc, GstClockTime arrival,
+    gint abs_send_time)
+{
+  KmsRembDelay *self = cc;
+
+  if (abs_send_time < 0) {
+    return;
+  }
+
+  if (!self->send_time_init) {
+    self->send_time_init = TRUE;
+    self->send_time = ABS_SEND_TIME_TO_NSECS (abs_send_time);
+  } else {
+    guint32 diff = (abs_send_time - self->last_abs_send_time) &
+        ABS_SEND_TIME_MASK;
+
+    if (diff & ABS_SEND_TIME_NEGATIVE) {
+      /* Reordered packet, it belongs to an already processed group */
+      return;
+    }
+
+    self->send_time += ABS_SEND_TIME_TO_NSECS (diff);
+  }
+  self->last_abs_send_time = abs_send_time;
+
+  if (self->current.valid
+      && self->send_time - self->current.first_send <= BURST_TIME) {
+    self->current.last_send = self->send_time;
+    self->current.last_arrival = arrival;
+    return;
+  }
+
+  /* A new group begins, so the current one is complete */
+  if (self->current.valid && self->previous.valid) {
+    gdouble send_delta, arrival_delta;
+
+    send_delta =
+        NSECS_TO_MSECS (self->current.last_send - self->previous.last_send);
+    arrival_delta = NSECS_TO_MSECS (GST_CLOCK_DIFF (self->previous.last_arrival,
+            self->current.last_arrival));
+
+    g_mutex_lock (&self->mutex);
+    kms_remb_delay_update_trendline (self, arrival_delta - send_delta,
+        arrival_delta, self->current.last_arrival);
+    g_mutex_unlock (&self->mutex);
+  }
+
+  self->previous = self->current;
+  self->current.valid = TRUE;
+  self->current.first_send = self->send_time;
+  self->current.last_send = self->send_time;
+  self->current.last_arrival = arrival;
+}
+
+static gboolean
+kms_remb_delay_update (KmsRembLocal * rl, gpointer cc, guint64 bitrate,
+    guint fraction_lost, guint64 packets_rcv_interval)
+{
+  KmsRembDelay *self = cc;
+  GstClockTime now, elapsed = 0;
+  guint signals;
+  guint64 remb = rl->remb;
+  gdouble beta;
+
+  g_mutex_lock (&self->mutex);
+  beta = self->beta;
+  g_mutex_unlock (&self->mutex);
+
+  signals = g_atomic_int_and (&self->signals, KMS_REMB_DELAY_SIGNAL_NORMAL);
+
+  now = kms_utils_get_coarse_time_nsecs ();
+  if (self->last_update != 0) {
+    elapsed = MIN (now - self->last_update, GST_SECOND);
+  }
+  self->last_update = now;
+
+  if (signals & KMS_REMB_DELAY_SIGNAL_OVERUSE) {
+    /* Multiplicative decrease from the measured incoming bitrate */
+    remb = beta * (bitrate > 0 ? bitrate : remb);
+    GST_TRACE_OBJECT (KMS_REMB_BASE (rl)->rtpsess, "Overuse: decrease");
+  } else if (signals & KMS_REMB_DELAY_SIGNAL_UNDERUSE) {
+    /* Queues are draining, hold the current estimation */
+    GST_TRACE_OBJECT (KMS_REMB_BASE (rl)->rtpsess, "Underuse: hold");
+  } else {
+    remb = remb * (1 + INCREASE_FACTOR * elapsed / GST_SECOND);
+
+    if (bitrate > 0) {
+      remb = MIN (remb, bitrate * MAX_INCREASE_OVER_INCOMING +
+          MIN_INCREASE_OVER_INCOMING);
+    }
+    GST_TRACE_OBJECT (KMS_REMB_BASE (rl)->rtpsess, "Normal: increase");
+  }
+
+  /* Delay cannot detect congestion on lossy links with short queues */
+  if (fraction_lost > LOSSES_THRESHOLD) {
+    remb = remb * (1 - 0.5 * fraction_lost / 256.0);
+  }
+
+  rl->remb = MIN (remb, G_MAXUINT32);
+
+  GST_TRACE_OBJECT (KMS_REMB_BASE (rl)->rtpsess,
+      "REMB: %" G_GUINT32_FORMAT ", bitrate: %" G_GUINT64_FORMAT
+      ", fraction_lost: %u, signals: %u", rl->remb, bitrate, fraction_lost,
+      signals);
+
+  return TRUE;
+}
+
+static void
+kms_remb_delay_set_params (gpointer cc, GstStructure * params)
+{
+  KmsRembDelay *self = cc;
+  gfloat auxf;
+  gint auxi;
+
+  g_mutex_lock (&self->mutex);
+
+  if (gst_structure_get (params, "delay-window-size", G_TYPE_INT, &auxi,
+          NULL)) {
+    self->window_size = CLAMP (auxi, 2, MAX_WINDOW_SIZE);
+    self->window_len = 0;
+    self->window_pos = 0;
+  }
+
+  if (gst_structure_get (params, "delay-smoothing", G_TYPE_FLOAT, &auxf, NULL)) {
+    self->smoothing = CLAMP (auxf, 0.0, 1.0);
+  }
+
+  if (gst_structure_get (params, "delay-threshold-gain", G_TYPE_FLOAT, &auxf,
+          NULL)) {
+    self->threshold_gain = auxf;
+  }
+
+  if (gst_structure_get (params, "delay-beta", G_TYPE_FLOAT, &auxf, NULL)) {
+    self->beta = CLAMP (auxf, 0.0, 1.0);
+  }
+
+  g_mutex_unlock (&self->mutex);
+}
+
+static void
+kms_remb_delay_get_params (gpointer cc, GstStructure * params)
+{
+  KmsRembDelay *self = cc;
+
+  g_mutex_lock (&self->mutex);
+  gst_structure_set (params,
+      "delay-window-size", G_TYPE_INT, self->window_size,
+      "delay-smoothing", G_TYPE_FLOAT, (gfloat) self->smoothing,
+      "delay-threshold-gain", G_TYPE_FLOAT, (gfloat) self->threshold_gain,
+      "delay-beta", G_TYPE_FLOAT, (gfloat) self->beta, NULL);
+  g_mutex_unlock (&self->mutex);
+}
+
+static const KmsRembCongestionController delay_based_controller = {
+  KMS_REMB_CONGESTION_CONTROL_DELAY_BASED,
+  kms_remb_delay_create,
+  kms_remb_delay_destroy,
+  kms_remb_delay_packet_arrival,
+  kms_remb_delay_update,
+  kms_remb_delay_set_params,
+  kms_remb_delay_get_params,
+};
+
+const KmsRembCongestionController *
+kms_remb_delay_based_controller (void)
+{
+  return &delay_based_controller;
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
@@ -0,0 +1,424 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsrtcpcomposer.h"
+#include "kmsutils.h"
+
+#include <gst/video/video-event.h>
+
+#define GST_CAT_DEFAULT kms_rtcp_composer_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "rtcpcomposer"
+
+#define DEFAULT_RTT (100 * GST_MSECOND)
+
+/* Media SSRCs whose last key unit request is remembered */
+#define MAX_KEY_SSRCS 16
+/* NACKed sequence numbers remembered */
+#define NACK_HISTORY 256
+
+#define RETRANSMISSION_REQUEST "GstRTPRetransmissionRequest"
+
+typedef struct _KmsRtcpKeyRequest
+{
+  guint32 ssrc;
+  GstClockTime last_sent;
+} KmsRtcpKeyRequest;
+
+typedef struct _KmsRtcpNack
+{
+  guint32 ssrc;
+  guint16 seqnum;
+  GstClockTime last_sent;
+} KmsRtcpNack;
+
+typedef struct _KmsRtcpComposerSession
+{
+  KmsRtcpComposer *composer;
+  GObject *rtpsess;
+  gulong signal_id;
+  gulong active_signal_id;
+
+  KmsRtcpComposerRembFunc remb_func;
+  gpointer remb_data;
+
+  /* Only used from the RTCP thread of the session */
+  KmsRTCPPSFBAFBREMBPacket remb;
+} KmsRtcpComposerSession;
+
+struct _KmsRtcpComposer
+{
+  GMutex mutex;
+  GSList *sessions;             /* List<KmsRtcpComposerSession *> */
+  GstClockTime rtt;
+  gboolean rtt_measured;
+
+  KmsRtcpKeyRequest keys[MAX_KEY_SSRCS];
+  KmsRtcpNack nacks[NACK_HISTORY];
+  guint nacks_pos;
+
+  KmsRtcpComposerCounters counters;
+};
+
+static void
+kms_rtcp_composer_init_debug (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+static gboolean
+kms_rtcp_composer_write_remb (KmsRtcpComposerSession * sess,
+    GstRTCPBuffer * rtcp, KmsRtcpComposerRembFunc remb_func,
+    gpointer remb_data)
+{
+  GstRTCPPacket packet;
+  guint32 sender_ssrc;
+
+  if (!gst_rtcp_buffer_add_packet (rtcp, GST_RTCP_TYPE_PSFB, &packet)) {
+    GST_WARNING_OBJECT (sess->rtpsess, "No room for REMB");
+    return FALSE;
+  }
+
+  sess->remb.n_ssrcs = 0;
+
+  if (!remb_func (remb_data, &sess->remb)) {
+    gst_rtcp_packet_remove (&packet);
+    return FALSE;
+  }
+
+  g_object_get (sess->rtpsess, "internal-ssrc", &sender_ssrc, NULL);
+
+  if (!kms_rtcp_psfb_afb_remb_marshall_packet (&packet, &sess->remb,
+          sender_ssrc)) {
+    gst_rtcp_packet_remove (&packet);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Signal "RTPSession::on-sending-rtcp" */
+static gboolean
+kms_rtcp_composer_on_sending_rtcp (GObject * rtpsess, GstBuffer * buffer,
+    gboolean is_early, KmsRtcpComposerSession * sess)
+{
+  GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+  KmsRtcpComposerRembFunc remb_func;
+  gpointer remb_data;
+  gboolean written = FALSE;
+
+  g_mutex_lock (&sess->composer->mutex);
+  remb_func = sess->remb_func;
+  remb_data = sess->remb_data;
+  g_mutex_unlock (&sess->composer->mutex);
+
+  if (remb_func == NULL) {
+    return FALSE;
+  }
+
+  /* Mapped once for all the packets written in this cycle */
+  if (!gst_rtcp_buffer_map (buffer, GST_MAP_READWRITE, &rtcp)) {
+    GST_WARNING_OBJECT (rtpsess, "Cannot map RTCP buffer");
+    return FALSE;
+  }
+
+  written |= kms_rtcp_composer_write_remb (sess, &rtcp, remb_func, remb_data);
+
+  gst_rtcp_buffer_unmap (&rtcp);
+
+  return written;
+}
+
+static void
+kms_rtcp_composer_update_rtt (KmsRtcpComposer * self, GstClockTime rtt)
+{
+  g_mutex_lock (&self->mutex);
+
+  if (self->rtt_measured) {
+    /* Smoothed as TCP does with its RTT samples */
+    self->rtt = (7 * self->rtt + rtt) / 8;
+  } else {
+    self->rtt = rtt;
+    self->rtt_measured = TRUE;
+  }
+
+  g_mutex_unlock (&self->mutex);
+}
+
+/* Signal "RTPSession::on-ssrc-active", the source sent a RTCP packet */
+static void
+kms_rtcp_composer_on_ssrc_active (GObject * rtpsess, GObject * source,
+    KmsRtcpComposerSession * sess)
+{
+  GstStructure *stats;
+  gboolean have_rb = FALSE;
+  guint rb_rtt = 0;
+
+  g_object_get (source, "stats", &stats, NULL);
+  if (stats == NULL) {
+    return;
+  }
+
+  /* Round trip of our packets, from the report block of its RR or SR */
+  gst_structure_get (stats, "have-rb", G_TYPE_BOOLEAN, &have_rb,
+      "rb-round-trip", G_TYPE_UINT, &rb_rtt, NULL);
+  gst_structure_free (stats);
+
+  if (!have_rb || rb_rtt == 0) {
+    return;
+  }
+
+  /* 16.16 fixed point seconds */
+  kms_rtcp_composer_update_rtt (sess->composer,
+      gst_util_uint64_scale_int (rb_rtt, GST_SECOND, 65536));
+}
+
+static void
+kms_rtcp_composer_session_destroy (KmsRtcpComposerSession * sess)
+{
+  g_signal_handler_disconnect (sess->rtpsess, sess->signal_id);
+  g_signal_handler_disconnect (sess->rtpsess, sess->active_signal_id);
+  g_object_unref (sess->rtpsess);
+  g_slice_free (KmsRtcpComposerSession, sess);
+}
+
+KmsRtcpComposer *
+kms_rtcp_composer_new (void)
+{
+  KmsRtcpComposer *self = g_slice_new0 (KmsRtcpComposer);
+
+  kms_rtcp_composer_init_debug ();
+
+  g_mutex_init (&self->mutex);
+  self->rtt = DEFAULT_RTT;
+
+  return self;
+}
+
+void
+kms_rtcp_composer_destroy (KmsRtcpComposer * self)
+{
+  if (self == NULL) {
+    return;
+  }
+
+  g_slist_free_full (self->sessions,
+      (GDestroyNotify) kms_rtcp_composer_session_destroy);
+  g_mutex_clear (&self->mutex);
+  g_slice_free (KmsRtcpComposer, self);
+}
+
+void
+kms_rtcp_composer_add_session (KmsRtcpComposer * self, GObject * rtpsess,
+    KmsRtcpComposerRembFunc remb_func, gpointer user_data)
+{
+  KmsRtcpComposerSession *sess;
+  GSList *l;
+
+  g_mutex_lock (&self->mutex);
+
+  for (l = self->sessions; l != NULL; l = l->next) {
+    sess = l->data;
+
+    if (sess->rtpsess == rtpsess) {
+      sess->remb_func = remb_func;
+      sess->remb_data = user_data;
+      g_mutex_unlock (&self->mutex);
+      return;
+    }
+  }
+
+  sess = g_slice_new0 (KmsRtcpComposerSession);
+  sess->composer = self;
+  sess->rtpsess = g_object_ref (rtpsess);
+  sess->remb_func = remb_func;
+  sess->remb_data = user_data;
+  sess->signal_id = g_signal_connect (rtpsess, "on-sending-rtcp",
+      G_CALLBACK (kms_rtcp_composer_on_sending_rtcp), sess);
+  sess->active_signal_id = g_signal_connect (rtpsess, "on-ssrc-active",
+      G_CALLBACK (kms_rtcp_composer_on_ssrc_active), sess);
+
+  self->sessions = g_slist_prepend (self->sessions, sess);
+
+  g_mutex_unlock (&self->mutex);
+}
+
+void
+kms_rtcp_composer_set_rtt (KmsRtcpComposer * self, GstClockTime rtt)
+{
+  g_mutex_lock (&self->mutex);
+  self->rtt = rtt;
+  self->rtt_measured = TRUE;
+  g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+kms_rtcp_composer_check_key_unit (KmsRtcpComposer * self, guint32 ssrc)
+{
+  KmsRtcpKeyRequest *key = NULL;
+  GstClockTime now;
+  gboolean send;
+  guint i;
+
+  now = kms_utils_get_coarse_time_nsecs ();
+
+  g_mutex_lock (&self->mutex);
+
+  for (i = 0; i < MAX_KEY_SSRCS; i++) {
+    if (self->keys[i].ssrc == ssrc) {
+      key = &self->keys[i];
+      break;
+    }
+
+    /* Not found, the least recently requested entry is replaced */
+    if (key == NULL || self->keys[i].last_sent < key->last_sent) {
+      key = &self->keys[i];
+    }
+  }
+
+  send = key->ssrc != ssrc || key->last_sent + self->rtt <= now;
+
+  if (send) {
+    key->ssrc = ssrc;
+    key->last_sent = now;
+    self->counters.key_requests_sent++;
+  } else {
+    self->counters.key_requests_suppressed++;
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return send;
+}
+
+gboolean
+kms_rtcp_composer_check_nack (KmsRtcpComposer * self, guint32 ssrc,
+    guint16 seqnum)
+{
+  GstClockTime now;
+  KmsRtcpNack *nack;
+  guint i;
+
+  now = kms_utils_get_coarse_time_nsecs ();
+
+  g_mutex_lock (&self->mutex);
+
+  for (i = 0; i < NACK_HISTORY; i++) {
+    nack = &self->nacks[i];
+
+    if (nack->ssrc == ssrc && nack->seqnum == seqnum && nack->last_sent != 0
+        && nack->last_sent + self->rtt > now) {
+      self->counters.nacks_suppressed++;
+      g_mutex_unlock (&self->mutex);
+      return FALSE;
+    }
+  }
+
+  nack = &self->nacks[self->nacks_pos];
+  self->nacks_pos = (self->nacks_pos + 1) % NACK_HISTORY;
+
+  nack->ssrc = ssrc;
+  nack->seqnum = seqnum;
+  nack->last_sent = now;
+  self->counters.nacks_sent++;
+
+  g_mutex_unlock (&self->mutex);
+
+  return TRUE;
+}
+
+typedef struct _KmsRtcpFeedbackProbe
+{
+  KmsRtcpComposer *composer;
+  guint32 ssrc;
+} KmsRtcpFeedbackProbe;
+
+static GstPadProbeReturn
+kms_rtcp_composer_feedback_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsRtcpFeedbackProbe * probe)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  const GstStructure *s;
+  guint ssrc, seqnum;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_UPSTREAM) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (gst_video_event_is_force_key_unit (event)) {
+    if (kms_rtcp_composer_check_key_unit (probe->composer, probe->ssrc)) {
+      return GST_PAD_PROBE_OK;
+    }
+
+    GST_DEBUG_OBJECT (pad, "Key unit already requested for SSRC %"
+        G_GUINT32_FORMAT " in this RTT", probe->ssrc);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  s = gst_event_get_structure (event);
+
+  /* NACKs are written by RTPSession; RTX receivers need to see the event */
+  /* to associate the retransmitted packets, so it is only filtered */
+  if (gst_structure_has_name (s, RETRANSMISSION_REQUEST)
+      && gst_structure_get_uint (s, "ssrc", &ssrc)
+      && gst_structure_get_uint (s, "seqnum", &seqnum)
+      && !kms_rtcp_composer_check_nack (probe->composer, ssrc, seqnum)) {
+    GST_TRACE_OBJECT (pad, "Packet %u of SSRC %u already NACKed in this RTT",
+        seqnum, ssrc);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_rtcp_feedback_probe_destroy (gpointer data)
+{
+  g_slice_free (KmsRtcpFeedbackProbe, data);
+}
+
+gulong
+kms_rtcp_composer_add_feedback_probe (KmsRtcpComposer * self, GstPad * pad,
+    guint32 ssrc)
+{
+  KmsRtcpFeedbackProbe *probe = g_slice_new0 (KmsRtcpFeedbackProbe);
+
+  probe->composer = self;
+  probe->ssrc = ssrc;
+
+  return gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      (GstPadProbeCallback) kms_rtcp_composer_feedback_probe, probe,
+      kms_rtcp_feedback_probe_destroy);
+}
+
+void
+kms_rtcp_composer_get_counters (KmsRtcpComposer * self,
+    KmsRtcpComposerCounters * counters)
+{
+  g_mutex_lock (&self->mutex);
+  *counters = self->counters;
+  g_mutex_unlock (&self->mutex);
+}
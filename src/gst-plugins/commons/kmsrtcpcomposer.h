@@ -0,0 +1,76 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_RTCP_COMPOSER_H__
+#define __KMS_RTCP_COMPOSER_H__
+
+#include <gst/gst.h>
+#include "kmsrtcp.h"
+
+G_BEGIN_DECLS
+
+/*
+ * RTCP feedback of the RTP sessions of an endpoint. The composer writes the
+ * application feedback (REMB) into the compound packets the sessions send,
+ * mapping each packet once and reusing a preallocated REMB packet. It also
+ * filters the key unit and retransmission requests going upstream to the
+ * sessions, so a media SSRC gets at most one PLI/FIR and a sequence number
+ * at most one NACK per RTT.
+ */
+
+typedef struct _KmsRtcpComposer KmsRtcpComposer;
+
+typedef struct _KmsRtcpComposerCounters
+{
+  guint64 key_requests_sent;
+  guint64 key_requests_suppressed;
+  guint64 nacks_sent;
+  guint64 nacks_suppressed;
+} KmsRtcpComposerCounters;
+
+/* Fills 'remb' with the REMB of this RTCP cycle. FALSE if none is due */
+typedef gboolean (*KmsRtcpComposerRembFunc) (gpointer user_data,
+    KmsRTCPPSFBAFBREMBPacket *remb);
+
+KmsRtcpComposer * kms_rtcp_composer_new (void);
+void kms_rtcp_composer_destroy (KmsRtcpComposer *self);
+
+/* Writes the REMB given by 'remb_func' in every RTCP packet of 'rtpsess' */
+/* (a RTPSession). Adding a session again replaces its function. The RTT */
+/* of the session, taken from the report blocks it receives, sets the */
+/* window of the redundant request filter */
+void kms_rtcp_composer_add_session (KmsRtcpComposer *self, GObject *rtpsess,
+    KmsRtcpComposerRembFunc remb_func, gpointer user_data);
+
+/* Overrides the RTT, later report blocks are smoothed from it */
+void kms_rtcp_composer_set_rtt (KmsRtcpComposer *self, GstClockTime rtt);
+
+/* Return TRUE if the request must be sent, FALSE if it is redundant */
+gboolean kms_rtcp_composer_check_key_unit (KmsRtcpComposer *self,
+    guint32 ssrc);
+gboolean kms_rtcp_composer_check_nack (KmsRtcpComposer *self, guint32 ssrc,
+    guint16 seqnum);
+
+/* Drops the redundant key unit and retransmission requests sent upstream */
+/* through 'pad', a jitterbuffer sink pad receiving 'ssrc' */
+gulong kms_rtcp_composer_add_feedback_probe (KmsRtcpComposer *self,
+    GstPad *pad, guint32 ssrc);
+
+void kms_rtcp_composer_get_counters (KmsRtcpComposer *self,
+    KmsRtcpComposerCounters *counters);
+
+G_END_DECLS
+#endif /* __KMS_RTCP_COMPOSER_H__ */
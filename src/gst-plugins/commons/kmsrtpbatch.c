@@ -0,0 +1,184 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsrtpbatch.h"
+
+#define GST_CAT_DEFAULT kms_rtp_batch_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "rtpbatch"
+
+typedef struct _KmsRtpBatch
+{
+  GstBufferList *pending;
+  guint32 rtp_ts;
+  /* Result of the last list pushed, for the payloader to see it */
+  GstFlowReturn flow_ret;
+} KmsRtpBatch;
+
+static void
+kms_rtp_batch_init_debug (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+static gboolean
+kms_rtp_batch_parse (GstBuffer * buffer, gboolean * marker, guint32 * rtp_ts)
+{
+  guint8 data[8];
+
+  if (gst_buffer_extract (buffer, 0, data, sizeof (data)) != sizeof (data)
+      || (data[0] >> 6) != 2) {
+    return FALSE;
+  }
+
+  *marker = (data[1] & 0x80) != 0;
+  *rtp_ts = GST_READ_UINT32_BE (data + 4);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+kms_rtp_batch_flush (KmsRtpBatch * batch, GstPad * pad)
+{
+  GstBufferList *list = batch->pending;
+  GstFlowReturn ret;
+
+  if (list == NULL) {
+    return GST_FLOW_OK;
+  }
+
+  batch->pending = NULL;
+
+  GST_TRACE_OBJECT (pad, "Pushing %u packets", gst_buffer_list_length (list));
+  ret = gst_pad_push_list (pad, list);
+
+  if (ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (pad, "Pushing list: %s", gst_flow_get_name (ret));
+    batch->flow_ret = ret;
+  }
+
+  return ret;
+}
+
+/* Buffers kept in a list return OK to the payloader. An error pushing */
+/* the list is returned by the next buffer, which goes downstream alone */
+static GstPadProbeReturn
+kms_rtp_batch_buffer (GstPad * pad, GstPadProbeInfo * info,
+    KmsRtpBatch * batch)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gboolean marker;
+  guint32 rtp_ts;
+
+  if (batch->flow_ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (pad, "Last list returned %s, pushing buffer",
+        gst_flow_get_name (batch->flow_ret));
+    batch->flow_ret = GST_FLOW_OK;
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (!kms_rtp_batch_parse (buffer, &marker, &rtp_ts)) {
+    kms_rtp_batch_flush (batch, pad);
+    batch->flow_ret = GST_FLOW_OK;
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (batch->pending != NULL && rtp_ts != batch->rtp_ts) {
+    /* The previous frame did not end with a marker */
+    if (kms_rtp_batch_flush (batch, pad) != GST_FLOW_OK) {
+      batch->flow_ret = GST_FLOW_OK;
+      return GST_PAD_PROBE_OK;
+    }
+  }
+
+  if (batch->pending == NULL) {
+    if (marker) {
+      /* Single packet frame, nothing to batch */
+      return GST_PAD_PROBE_OK;
+    }
+
+    batch->pending = gst_buffer_list_new_sized (KMS_RTP_BATCH_MAX_PACKETS);
+    batch->rtp_ts = rtp_ts;
+  }
+
+  gst_buffer_list_add (batch->pending, buffer);
+
+  if (marker
+      || gst_buffer_list_length (batch->pending) >= KMS_RTP_BATCH_MAX_PACKETS) {
+    kms_rtp_batch_flush (batch, pad);
+  }
+
+  /* The buffer is owned by the list now */
+  return GST_PAD_PROBE_HANDLED;
+}
+
+static GstPadProbeReturn
+kms_rtp_batch_probe (GstPad * pad, GstPadProbeInfo * info, KmsRtpBatch * batch)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    return kms_rtp_batch_buffer (pad, info, batch);
+  }
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+      if (batch->pending != NULL) {
+        gst_buffer_list_unref (batch->pending);
+        batch->pending = NULL;
+      }
+      batch->flow_ret = GST_FLOW_OK;
+    } else if (GST_EVENT_IS_SERIALIZED (event)) {
+      /* Keep data and events ordered */
+      kms_rtp_batch_flush (batch, pad);
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_rtp_batch_free (gpointer data)
+{
+  KmsRtpBatch *batch = data;
+
+  if (batch->pending != NULL) {
+    gst_buffer_list_unref (batch->pending);
+  }
+
+  g_slice_free (KmsRtpBatch, batch);
+}
+
+gulong
+kms_rtp_batch_add_probe (GstPad * pad)
+{
+  kms_rtp_batch_init_debug ();
+
+  return gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) kms_rtp_batch_probe, g_slice_new0 (KmsRtpBatch),
+      kms_rtp_batch_free);
+}
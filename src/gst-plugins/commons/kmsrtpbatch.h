@@ -0,0 +1,39 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_RTP_BATCH_H__
+#define __KMS_RTP_BATCH_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Batching of RTP packets. Payloaders push the packets of a frame one by
+ * one; the batch probe groups them in a buffer list per frame, so every
+ * element and probe downstream with list support is invoked once per frame.
+ */
+
+/* Packets per list, larger frames are split in several lists */
+#define KMS_RTP_BATCH_MAX_PACKETS 64
+
+/* Groups the packets pushed through 'pad' (a payloader src pad) by RTP */
+/* timestamp. A list is pushed when the marker bit closes the frame, when */
+/* the timestamp changes or before any serialized event */
+gulong kms_rtp_batch_add_probe (GstPad *pad);
+
+G_END_DECLS
+#endif /* __KMS_RTP_BATCH_H__ */
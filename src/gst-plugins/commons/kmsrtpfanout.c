@@ -0,0 +1,340 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsrtpfanout.h"
+#include "kmsutils.h"
+#include "constants.h"
+
+#include <string.h>
+
+#define GST_CAT_DEFAULT kms_rtp_fanout_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "rtpfanout"
+
+#define RTP_FIXED_HEADER_SIZE 12
+#define RTP_ONEBYTE_EXT_PROFILE 0xBEDE
+
+/* Covers the fixed header, a few CSRCs and the usual extensions */
+#define HEADER_BLOCK_SIZE 128
+/* Blocks kept for reuse; the rest are freed when released */
+#define HEADER_POOL_MAX_FREE 4096
+/* Growth when the abs-send-time hdrext has to be added */
+#define HEADER_MAX_GROWTH 8
+
+static GstAtomicQueue *header_pool;
+
+static void
+kms_rtp_fanout_init (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    header_pool = gst_atomic_queue_new (256);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+static gpointer
+header_block_acquire (void)
+{
+  gpointer block = gst_atomic_queue_pop (header_pool);
+
+  if (block == NULL) {
+    block = g_slice_alloc (HEADER_BLOCK_SIZE);
+  }
+
+  return block;
+}
+
+static void
+header_block_release (gpointer block)
+{
+  if (gst_atomic_queue_length (header_pool) < HEADER_POOL_MAX_FREE) {
+    gst_atomic_queue_push (header_pool, block);
+  } else {
+    g_slice_free1 (HEADER_BLOCK_SIZE, block);
+  }
+}
+
+static void
+kms_rtp_fanout_set_abs_send_time (guint8 * data)
+{
+  GstClockTime ms;
+  guint value;
+
+  ms = GST_TIME_AS_MSECONDS (kms_utils_get_cached_time_nsecs ());
+  value = (((ms << 18) / 1000) & 0x00ffffff);
+
+  data[0] = (guint8) (value >> 16);
+  data[1] = (guint8) (value >> 8);
+  data[2] = (guint8) (value);
+}
+
+/* Copies the one-byte hdrext elements of 'in' into 'out', dropping the */
+/* padding and updating or appending abs-send-time. Returns the size of */
+/* 'out' padded to 32 bits, or -1 if 'in' is malformed */
+static gint
+kms_rtp_fanout_rewrite_onebyte_ext (const guint8 * in, guint in_size,
+    guint8 * out, const KmsRtpFanoutPeer * peer)
+{
+  gboolean found = FALSE;
+  guint i = 0, o = 0;
+
+  while (i < in_size) {
+    guint8 id = in[i] >> 4;
+    guint len = (in[i] & 0x0f) + 1;
+
+    if (in[i] == 0) {
+      i++;                      /* padding */
+      continue;
+    }
+
+    if (id == 15) {
+      break;
+    }
+
+    if (i + 1 + len > in_size) {
+      return -1;
+    }
+
+    memcpy (out + o, in + i, 1 + len);
+
+    if (id == peer->abs_send_time_id) {
+      found = TRUE;
+
+      if (peer->set_abs_send_time && len == RTP_HDR_EXT_ABS_SEND_TIME_SIZE) {
+        kms_rtp_fanout_set_abs_send_time (out + o + 1);
+      }
+    }
+
+    i += 1 + len;
+    o += 1 + len;
+  }
+
+  if (!found && peer->abs_send_time_id > 0) {
+    out[o] = (peer->abs_send_time_id << 4) |
+        (RTP_HDR_EXT_ABS_SEND_TIME_SIZE - 1);
+
+    if (peer->set_abs_send_time) {
+      kms_rtp_fanout_set_abs_send_time (out + o + 1);
+    } else {
+      memset (out + o + 1, 0, RTP_HDR_EXT_ABS_SEND_TIME_SIZE);
+    }
+
+    o += 1 + RTP_HDR_EXT_ABS_SEND_TIME_SIZE;
+  }
+
+  while (o % 4 != 0) {
+    out[o++] = 0;
+  }
+
+  return o;
+}
+
+/* Writes the header of 'in' rewritten for 'peer' into 'out', which must */
+/* have room for in_size + HEADER_MAX_GROWTH bytes. Returns its size */
+static guint
+kms_rtp_fanout_rewrite_header (const guint8 * in, guint in_size,
+    guint8 * out, const KmsRtpFanoutPeer * peer)
+{
+  guint csrc_end = RTP_FIXED_HEADER_SIZE + (in[0] & 0x0f) * 4;
+  gboolean has_ext = (in[0] & 0x10) != 0;
+  guint size = csrc_end;
+
+  memcpy (out, in, csrc_end);
+
+  if (peer->ssrc != 0) {
+    GST_WRITE_UINT32_BE (out + 8, peer->ssrc);
+  }
+  GST_WRITE_UINT16_BE (out + 2, GST_READ_UINT16_BE (in + 2) + peer->seq_offset);
+  GST_WRITE_UINT32_BE (out + 4, GST_READ_UINT32_BE (in + 4) + peer->ts_offset);
+
+  if (peer->abs_send_time_id <= 0) {
+    /* Extensions are kept as they are */
+    memcpy (out + csrc_end, in + csrc_end, in_size - csrc_end);
+    return in_size;
+  }
+
+  if (!has_ext) {
+    gint ext_size;
+
+    ext_size = kms_rtp_fanout_rewrite_onebyte_ext (NULL, 0, out + size + 4,
+        peer);
+    GST_WRITE_UINT16_BE (out + size, RTP_ONEBYTE_EXT_PROFILE);
+    GST_WRITE_UINT16_BE (out + size + 2, ext_size / 4);
+    out[0] |= 0x10;
+
+    return size + 4 + ext_size;
+  }
+
+  if (GST_READ_UINT16_BE (in + csrc_end) == RTP_ONEBYTE_EXT_PROFILE) {
+    gint ext_size;
+
+    ext_size = kms_rtp_fanout_rewrite_onebyte_ext (in + csrc_end + 4,
+        in_size - csrc_end - 4, out + size + 4, peer);
+
+    if (ext_size >= 0) {
+      GST_WRITE_UINT16_BE (out + size, RTP_ONEBYTE_EXT_PROFILE);
+      GST_WRITE_UINT16_BE (out + size + 2, ext_size / 4);
+
+      return size + 4 + ext_size;
+    }
+
+    GST_TRACE ("Malformed one-byte hdrext, keeping it as is");
+  } else {
+    GST_TRACE ("Two-byte hdrext, abs-send-time not handled");
+  }
+
+  memcpy (out + csrc_end, in + csrc_end, in_size - csrc_end);
+
+  return in_size;
+}
+
+GstBuffer *
+kms_rtp_fanout_forward (GstBuffer * buffer, const KmsRtpFanoutPeer * peer)
+{
+  guint8 in[HEADER_BLOCK_SIZE], *in_ptr = in;
+  guint8 *out;
+  gsize buffer_size, hdr_size, out_size;
+  GstMemory *mem;
+  GstBuffer *fwd = NULL;
+  guint8 ext[4];
+
+  kms_rtp_fanout_init ();
+
+  buffer_size = gst_buffer_get_size (buffer);
+
+  if (gst_buffer_extract (buffer, 0, in, RTP_FIXED_HEADER_SIZE)
+      != RTP_FIXED_HEADER_SIZE || (in[0] >> 6) != 2) {
+    GST_WARNING ("Not an RTP buffer: %" GST_PTR_FORMAT, buffer);
+    return NULL;
+  }
+
+  hdr_size = RTP_FIXED_HEADER_SIZE + (in[0] & 0x0f) * 4;
+
+  if (in[0] & 0x10) {
+    if (gst_buffer_extract (buffer, hdr_size, ext, 4) != 4) {
+      GST_WARNING ("Truncated RTP hdrext: %" GST_PTR_FORMAT, buffer);
+      return NULL;
+    }
+    hdr_size += 4 + GST_READ_UINT16_BE (ext + 2) * 4;
+  }
+
+  if (hdr_size > buffer_size) {
+    GST_WARNING ("Truncated RTP header: %" GST_PTR_FORMAT, buffer);
+    return NULL;
+  }
+
+  if (hdr_size + HEADER_MAX_GROWTH <= HEADER_BLOCK_SIZE) {
+    out = header_block_acquire ();
+  } else {
+    /* Unusually large header, do not pool it */
+    in_ptr = g_malloc (hdr_size);
+    out = g_malloc (hdr_size + HEADER_MAX_GROWTH);
+  }
+
+  gst_buffer_extract (buffer, 0, in_ptr, hdr_size);
+  out_size = kms_rtp_fanout_rewrite_header (in_ptr, hdr_size, out, peer);
+
+  if (in_ptr != in) {
+    g_free (in_ptr);
+    mem = gst_memory_new_wrapped (0, out, hdr_size + HEADER_MAX_GROWTH, 0,
+        out_size, out, g_free);
+  } else {
+    mem = gst_memory_new_wrapped (0, out, HEADER_BLOCK_SIZE, 0, out_size,
+        out, header_block_release);
+  }
+
+  fwd = gst_buffer_new ();
+  gst_buffer_copy_into (fwd, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+  gst_buffer_append_memory (fwd, mem);
+
+  if (buffer_size > hdr_size) {
+    /* Payload memories are shared, not copied */
+    gst_buffer_copy_into (fwd, buffer, GST_BUFFER_COPY_MEMORY, hdr_size,
+        buffer_size - hdr_size);
+  }
+
+  return fwd;
+}
+
+static gboolean
+kms_rtp_fanout_forward_bufflist (GstBuffer ** buf, guint idx,
+    KmsRtpFanoutPeer * peer)
+{
+  GstBuffer *fwd = kms_rtp_fanout_forward (*buf, peer);
+
+  if (fwd != NULL) {
+    gst_buffer_unref (*buf);
+    *buf = fwd;
+  }
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+kms_rtp_fanout_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsRtpFanoutPeer * peer)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstBuffer *fwd;
+
+    kms_utils_time_cache_begin ();
+    fwd = kms_rtp_fanout_forward (buffer, peer);
+    kms_utils_time_cache_end ();
+
+    if (fwd != NULL) {
+      gst_buffer_unref (buffer);
+      GST_PAD_PROBE_INFO_DATA (info) = fwd;
+    }
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    /* Only the list is copied if shared, buffers are replaced anyway */
+    list = gst_buffer_list_make_writable (list);
+    kms_utils_time_cache_begin ();
+    gst_buffer_list_foreach (list,
+        (GstBufferListFunc) kms_rtp_fanout_forward_bufflist, peer);
+    kms_utils_time_cache_end ();
+    GST_PAD_PROBE_INFO_DATA (info) = list;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_rtp_fanout_peer_free (gpointer peer)
+{
+  g_slice_free (KmsRtpFanoutPeer, peer);
+}
+
+gulong
+kms_rtp_fanout_add_probe (GstPad * pad, const KmsRtpFanoutPeer * peer)
+{
+  KmsRtpFanoutPeer *data = g_slice_dup (KmsRtpFanoutPeer, peer);
+
+  return gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) kms_rtp_fanout_probe, data,
+      kms_rtp_fanout_peer_free);
+}
@@ -0,0 +1,50 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_RTP_FANOUT_H__
+#define __KMS_RTP_FANOUT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Zero-copy forwarding of RTP packets to several peers. The forwarded
+ * buffer is made of a new header memory, taken from a shared pool of small
+ * blocks and rewritten for the peer, followed by the payload memories of
+ * the original buffer, which are shared and never copied. The cost per
+ * peer is proportional to the header size, not to the payload size.
+ */
+
+typedef struct _KmsRtpFanoutPeer
+{
+  guint32 ssrc;                 /* 0 keeps the original SSRC */
+  guint16 seq_offset;           /* Added to the sequence number */
+  guint32 ts_offset;            /* Added to the RTP timestamp */
+  gint abs_send_time_id;        /* One-byte hdrext id, <= 0 to disable */
+  gboolean set_abs_send_time;   /* Write the current time, else just make */
+                                /* sure the hdrext is present */
+} KmsRtpFanoutPeer;
+
+/* Returns a new buffer for 'peer', or NULL if 'buffer' is not valid RTP */
+GstBuffer *kms_rtp_fanout_forward (GstBuffer *buffer,
+    const KmsRtpFanoutPeer *peer);
+
+/* Rewrites every buffer going through 'pad' for 'peer' */
+gulong kms_rtp_fanout_add_probe (GstPad *pad, const KmsRtpFanoutPeer *peer);
+
+G_END_DECLS
+#endif /* __KMS_RTP_FANOUT_H__ */
@@ -0,0 +1,635 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsrtplayers.h"
+
+#include <string.h>
+
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/video/video.h>
+
+#define GST_CAT_DEFAULT kms_rtp_layers_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "rtplayers"
+
+/* Frames whose layer is remembered between the depayloader pads */
+#define LAYER_HISTORY 8
+
+#define H264_NAL_IDR 5
+#define H264_NAL_PREFIX 14
+#define H264_NAL_SLICE_EXT 20
+#define H264_NAL_STAP_A 24
+#define H264_NAL_FU_A 28
+#define H264_NAL_PACSI 30
+
+static void
+kms_rtp_layers_init_debug (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+void
+kms_rtp_layer_info_init (KmsRtpLayerInfo * info)
+{
+  info->temporal_id = KMS_RTP_LAYER_UNKNOWN;
+  info->spatial_id = KMS_RTP_LAYER_UNKNOWN;
+  info->layer_sync = FALSE;
+  info->frame_start = FALSE;
+  info->keyframe = FALSE;
+  info->picture_id = KMS_RTP_LAYER_UNKNOWN;
+  info->tl0picidx = KMS_RTP_LAYER_UNKNOWN;
+}
+
+/* Picture ID with the M bit selecting 7 or 15 bits, shared by VP8 and VP9 */
+static gboolean
+kms_rtp_layers_read_picture_id (const guint8 * data, gsize size, gsize * pos,
+    KmsRtpLayerInfo * info)
+{
+  if (*pos >= size) {
+    return FALSE;
+  }
+
+  if (data[*pos] & 0x80) {
+    if (*pos + 2 > size) {
+      return FALSE;
+    }
+    info->picture_id = ((data[*pos] & 0x7f) << 8) | data[*pos + 1];
+    *pos += 2;
+  } else {
+    info->picture_id = data[*pos];
+    *pos += 1;
+  }
+
+  return TRUE;
+}
+
+gboolean
+kms_rtp_layers_parse_vp8 (const guint8 * data, gsize size,
+    KmsRtpLayerInfo * info)
+{
+  gsize pos = 1;
+  guint8 ext;
+
+  kms_rtp_layer_info_init (info);
+
+  if (size < 1) {
+    return FALSE;
+  }
+
+  /* S bit and partition index 0 */
+  info->frame_start = (data[0] & 0x10) && (data[0] & 0x07) == 0;
+
+  if (data[0] & 0x80) {
+    if (size < 2) {
+      return FALSE;
+    }
+
+    ext = data[1];
+    pos = 2;
+
+    if ((ext & 0x80)
+        && !kms_rtp_layers_read_picture_id (data, size, &pos, info)) {
+      return FALSE;
+    }
+
+    if (ext & 0x40) {
+      if (pos >= size) {
+        return FALSE;
+      }
+      info->tl0picidx = data[pos++];
+    }
+
+    /* TID|Y|KEYIDX is present if either T or K are set */
+    if (ext & 0x30) {
+      if (pos >= size) {
+        return FALSE;
+      }
+      if (ext & 0x20) {
+        info->temporal_id = data[pos] >> 6;
+        info->layer_sync = (data[pos] & 0x20) != 0;
+      }
+      pos++;
+    }
+  }
+
+  if (info->frame_start) {
+    if (pos >= size) {
+      return FALSE;
+    }
+    /* Inverse key frame flag of the VP8 frame tag */
+    info->keyframe = (data[pos] & 0x01) == 0;
+  }
+
+  return TRUE;
+}
+
+gboolean
+kms_rtp_layers_parse_vp9 (const guint8 * data, gsize size,
+    KmsRtpLayerInfo * info)
+{
+  gboolean inter, flexible;
+  gsize pos = 1;
+  guint i;
+
+  kms_rtp_layer_info_init (info);
+
+  if (size < 1) {
+    return FALSE;
+  }
+
+  inter = (data[0] & 0x40) != 0;
+  flexible = (data[0] & 0x10) != 0;
+  info->frame_start = (data[0] & 0x08) != 0;
+
+  if ((data[0] & 0x80)
+      && !kms_rtp_layers_read_picture_id (data, size, &pos, info)) {
+    return FALSE;
+  }
+
+  if (data[0] & 0x20) {
+    if (pos >= size) {
+      return FALSE;
+    }
+
+    info->temporal_id = data[pos] >> 5;
+    info->layer_sync = (data[pos] & 0x10) != 0;
+    info->spatial_id = (data[pos] >> 1) & 0x07;
+    pos++;
+
+    if (!flexible) {
+      if (pos >= size) {
+        return FALSE;
+      }
+      info->tl0picidx = data[pos++];
+    }
+  }
+
+  if (flexible && inter) {
+    /* Up to 3 reference indices, N bit set while more follow */
+    for (i = 0; i < 3; i++) {
+      if (pos >= size) {
+        return FALSE;
+      }
+      if (!(data[pos++] & 0x01)) {
+        break;
+      }
+    }
+  }
+
+  /* The scalability structure that may follow is not needed */
+
+  info->keyframe = info->frame_start && !inter && info->spatial_id <= 0;
+
+  return TRUE;
+}
+
+/* 'data' starts at the NAL unit header */
+static gboolean
+kms_rtp_layers_parse_h264_nal (const guint8 * data, gsize size,
+    KmsRtpLayerInfo * info)
+{
+  guint type;
+
+  if (size < 1) {
+    return FALSE;
+  }
+
+  type = data[0] & 0x1f;
+
+  if (type == H264_NAL_IDR) {
+    info->keyframe = TRUE;
+    return TRUE;
+  }
+
+  if (type != H264_NAL_PREFIX && type != H264_NAL_SLICE_EXT
+      && type != H264_NAL_PACSI) {
+    return TRUE;
+  }
+
+  if (size < 4) {
+    return FALSE;
+  }
+
+  /* Not a SVC extension (MVC) */
+  if (!(data[1] & 0x80)) {
+    return TRUE;
+  }
+
+  if (info->temporal_id == KMS_RTP_LAYER_UNKNOWN) {
+    info->spatial_id = (data[2] >> 4) & 0x07;
+    info->temporal_id = data[3] >> 5;
+  }
+
+  if (data[1] & 0x40) {
+    info->keyframe = TRUE;
+  }
+
+  return TRUE;
+}
+
+gboolean
+kms_rtp_layers_parse_h264 (const guint8 * data, gsize size,
+    KmsRtpLayerInfo * info)
+{
+  gboolean ret = TRUE;
+  gsize pos, nal_size;
+  guint8 nal[4];
+
+  kms_rtp_layer_info_init (info);
+
+  if (size < 1) {
+    return FALSE;
+  }
+
+  switch (data[0] & 0x1f) {
+    case H264_NAL_STAP_A:
+      info->frame_start = TRUE;
+
+      for (pos = 1; ret && pos + 2 < size; pos += 2 + nal_size) {
+        nal_size = GST_READ_UINT16_BE (data + pos);
+
+        ret = pos + 2 + nal_size <= size &&
+            kms_rtp_layers_parse_h264_nal (data + pos + 2, nal_size, info);
+      }
+      break;
+    case H264_NAL_FU_A:
+      if (size < 2) {
+        return FALSE;
+      }
+
+      info->frame_start = (data[1] & 0x80) != 0;
+
+      /* Only the first fragment has the header extension */
+      if (info->frame_start) {
+        /* Rebuild the NAL header from the FU indicator and header */
+        nal[0] = (data[0] & 0xe0) | (data[1] & 0x1f);
+        memcpy (nal + 1, data + 2, MIN (size - 2, 3));
+
+        ret = kms_rtp_layers_parse_h264_nal (nal, MIN (size - 1, 4), info);
+      }
+      break;
+    default:
+      info->frame_start = TRUE;
+      ret = kms_rtp_layers_parse_h264_nal (data, size, info);
+      break;
+  }
+
+  /* H264 has no upswitch flag, tid 0 frames are switching points of the */
+  /* usual hierarchical prediction structures */
+  info->layer_sync = info->temporal_id == 0;
+
+  return ret;
+}
+
+gboolean
+kms_rtp_layers_parse_buffer (GstBuffer * rtp, KmsBitstreamCodec codec,
+    KmsRtpLayerInfo * info)
+{
+  GstRTPBuffer rtpbuffer = GST_RTP_BUFFER_INIT;
+  const guint8 *payload;
+  gboolean ret = FALSE;
+  guint size;
+
+  kms_rtp_layer_info_init (info);
+
+  if (!gst_rtp_buffer_map (rtp, GST_MAP_READ, &rtpbuffer)) {
+    return FALSE;
+  }
+
+  payload = gst_rtp_buffer_get_payload (&rtpbuffer);
+  size = gst_rtp_buffer_get_payload_len (&rtpbuffer);
+
+  switch (codec) {
+    case KMS_BITSTREAM_CODEC_VP8:
+      ret = kms_rtp_layers_parse_vp8 (payload, size, info);
+      break;
+    case KMS_BITSTREAM_CODEC_VP9:
+      ret = kms_rtp_layers_parse_vp9 (payload, size, info);
+      break;
+    case KMS_BITSTREAM_CODEC_H264:
+    case KMS_BITSTREAM_CODEC_H264_AVC:
+      ret = kms_rtp_layers_parse_h264 (payload, size, info);
+      break;
+    default:
+      break;
+  }
+
+  gst_rtp_buffer_unmap (&rtpbuffer);
+
+  return ret;
+}
+
+KmsBitstreamCodec
+kms_rtp_layers_codec_from_rtp_caps (const GstCaps * caps)
+{
+  const gchar *encoding;
+  GstStructure *st;
+
+  if (caps == NULL || gst_caps_get_size (caps) == 0) {
+    return KMS_BITSTREAM_CODEC_UNKNOWN;
+  }
+
+  st = gst_caps_get_structure (caps, 0);
+  encoding = gst_structure_get_string (st, "encoding-name");
+
+  if (g_strcmp0 (encoding, "VP8") == 0) {
+    return KMS_BITSTREAM_CODEC_VP8;
+  } else if (g_strcmp0 (encoding, "VP9") == 0) {
+    return KMS_BITSTREAM_CODEC_VP9;
+  } else if (g_strcmp0 (encoding, "H264") == 0
+      || g_strcmp0 (encoding, "H264-SVC") == 0) {
+    return KMS_BITSTREAM_CODEC_H264;
+  }
+
+  return KMS_BITSTREAM_CODEC_UNKNOWN;
+}
+
+/* Depayloader tagging */
+
+typedef struct _KmsLayerFrame
+{
+  GstClockTime pts;
+  gint temporal_id;
+  gint spatial_id;
+  gboolean layer_sync;
+} KmsLayerFrame;
+
+typedef struct _KmsLayerTagger
+{
+  KmsBitstreamCodec codec;
+
+  GMutex mutex;
+  KmsLayerFrame frames[LAYER_HISTORY];
+  guint pos;
+} KmsLayerTagger;
+
+static void
+kms_layer_tagger_destroy (KmsLayerTagger * self)
+{
+  g_mutex_clear (&self->mutex);
+  g_slice_free (KmsLayerTagger, self);
+}
+
+/* Packets of a frame share their timestamp, so they are merged */
+static void
+kms_layer_tagger_record (KmsLayerTagger * self, GstBuffer * buffer)
+{
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  KmsRtpLayerInfo info;
+  KmsLayerFrame *frame;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts)
+      || !kms_rtp_layers_parse_buffer (buffer, self->codec, &info)
+      || info.temporal_id == KMS_RTP_LAYER_UNKNOWN) {
+    return;
+  }
+
+  g_mutex_lock (&self->mutex);
+
+  frame = &self->frames[(self->pos + LAYER_HISTORY - 1) % LAYER_HISTORY];
+
+  if (frame->pts != pts) {
+    frame = &self->frames[self->pos];
+    self->pos = (self->pos + 1) % LAYER_HISTORY;
+
+    frame->pts = pts;
+    frame->temporal_id = info.temporal_id;
+    frame->spatial_id = info.spatial_id;
+    frame->layer_sync = FALSE;
+  }
+
+  frame->layer_sync |= info.layer_sync || (info.frame_start && info.keyframe);
+
+  g_mutex_unlock (&self->mutex);
+}
+
+static gboolean
+kms_layer_tagger_record_list (GstBuffer ** buffer, guint idx,
+    KmsLayerTagger * self)
+{
+  kms_layer_tagger_record (self, *buffer);
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+kms_layer_tagger_sink_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsLayerTagger * self)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    kms_layer_tagger_record (self, GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    gst_buffer_list_foreach (GST_PAD_PROBE_INFO_BUFFER_LIST (info),
+        (GstBufferListFunc) kms_layer_tagger_record_list, self);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+kms_layer_tagger_tag (GstBuffer ** buffer, guint idx, KmsLayerTagger * self)
+{
+  GstClockTime pts = GST_BUFFER_PTS (*buffer);
+  KmsLayerFrame frame = { GST_CLOCK_TIME_NONE };
+  guint i;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts)) {
+    return TRUE;
+  }
+
+  g_mutex_lock (&self->mutex);
+  for (i = 0; i < LAYER_HISTORY; i++) {
+    if (self->frames[i].pts == pts) {
+      frame = self->frames[i];
+      break;
+    }
+  }
+  g_mutex_unlock (&self->mutex);
+
+  if (frame.pts != pts) {
+    return TRUE;
+  }
+
+  *buffer = gst_buffer_make_writable (*buffer);
+  kms_buffer_add_layer_meta (*buffer, frame.temporal_id, frame.spatial_id,
+      frame.layer_sync);
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+kms_layer_tagger_src_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsLayerTagger * self)
+{
+  GstBufferList *list;
+  GstBuffer *buffer;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    kms_layer_tagger_tag (&buffer, 0, self);
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    list = gst_buffer_list_make_writable (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+    gst_buffer_list_foreach (list, (GstBufferListFunc) kms_layer_tagger_tag,
+        self);
+    GST_PAD_PROBE_INFO_DATA (info) = list;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+void
+kms_rtp_layers_tag_depayloader (GstElement * depayloader,
+    KmsBitstreamCodec codec)
+{
+  KmsLayerTagger *self;
+  GstPad *sink, *src;
+  guint i;
+
+  kms_rtp_layers_init_debug ();
+
+  if (codec == KMS_BITSTREAM_CODEC_UNKNOWN) {
+    return;
+  }
+
+  sink = gst_element_get_static_pad (depayloader, "sink");
+  src = gst_element_get_static_pad (depayloader, "src");
+
+  if (sink == NULL || src == NULL) {
+    GST_WARNING_OBJECT (depayloader, "Cannot tag layers without static pads");
+    g_clear_object (&sink);
+    g_clear_object (&src);
+    return;
+  }
+
+  self = g_slice_new0 (KmsLayerTagger);
+  g_mutex_init (&self->mutex);
+  self->codec = codec;
+  for (i = 0; i < LAYER_HISTORY; i++) {
+    self->frames[i].pts = GST_CLOCK_TIME_NONE;
+  }
+
+  /* The sink probe owns the tagger, src pad goes away with the same element */
+  gst_pad_add_probe (sink,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) kms_layer_tagger_sink_probe, self,
+      (GDestroyNotify) kms_layer_tagger_destroy);
+  gst_pad_add_probe (src,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) kms_layer_tagger_src_probe, self, NULL);
+
+  g_object_unref (sink);
+  g_object_unref (src);
+}
+
+/* KmsLayerMeta */
+
+GType
+kms_layer_meta_api_get_type (void)
+{
+  static volatile GType type;
+  /* Layer ids describe the encoded bitstream: video codecs only keep */
+  /* metas tagged with "video" alone, so the extra tag makes them drop it */
+  static const gchar *tags[] = { GST_META_TAG_VIDEO_STR,
+    KMS_LAYER_META_TAG_STR, NULL
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("KmsLayerMetaAPI", tags);
+
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+static gboolean
+kms_layer_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  KmsLayerMeta *lmeta = (KmsLayerMeta *) meta;
+
+  lmeta->temporal_id = KMS_RTP_LAYER_UNKNOWN;
+  lmeta->spatial_id = KMS_RTP_LAYER_UNKNOWN;
+  lmeta->layer_sync = FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+kms_layer_meta_transform (GstBuffer * transbuf, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  KmsLayerMeta *lmeta = (KmsLayerMeta *) meta;
+
+  /* we always copy no matter what transform */
+  if (!GST_META_TRANSFORM_IS_COPY (type)) {
+    return TRUE;
+  }
+
+  return kms_buffer_add_layer_meta (transbuf, lmeta->temporal_id,
+      lmeta->spatial_id, lmeta->layer_sync) != NULL;
+}
+
+const GstMetaInfo *
+kms_layer_meta_get_info (void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter (&meta_info)) {
+    const GstMetaInfo *mi = gst_meta_register (KMS_LAYER_META_API_TYPE,
+        "KmsLayerMeta",
+        sizeof (KmsLayerMeta),
+        kms_layer_meta_init,
+        NULL,
+        kms_layer_meta_transform);
+
+    g_once_init_leave (&meta_info, mi);
+  }
+
+  return meta_info;
+}
+
+KmsLayerMeta *
+kms_buffer_add_layer_meta (GstBuffer * buffer, gint temporal_id,
+    gint spatial_id, gboolean layer_sync)
+{
+  KmsLayerMeta *meta;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+  meta = kms_buffer_get_layer_meta (buffer);
+
+  if (meta == NULL) {
+    meta = (KmsLayerMeta *) gst_buffer_add_meta (buffer, KMS_LAYER_META_INFO,
+        NULL);
+  }
+
+  meta->temporal_id = temporal_id;
+  meta->spatial_id = spatial_id;
+  meta->layer_sync = layer_sync;
+
+  return meta;
+}
@@ -0,0 +1,105 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_RTP_LAYERS_H__
+#define __KMS_RTP_LAYERS_H__
+
+#include <gst/gst.h>
+#include "kmsbitstream.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Scalability information carried by the RTP payload of layered video:
+ * the VP8 (RFC 7741) and VP9 payload descriptors and the H264 SVC NAL unit
+ * header extension (RFC 6190). Depayloaded frames of a layered stream are
+ * tagged with a KmsLayerMeta, so elements downstream of the depayloader can
+ * select layers without parsing the bitstream.
+ */
+
+#define KMS_RTP_LAYER_UNKNOWN (-1)
+
+typedef struct _KmsRtpLayerInfo
+{
+  gint temporal_id;
+  gint spatial_id;
+  gboolean layer_sync;          /* Upswitch point: depends on layer 0 only */
+  gboolean frame_start;
+  gboolean keyframe;            /* Only reliable when frame_start is set */
+  gint picture_id;
+  gint tl0picidx;
+} KmsRtpLayerInfo;
+
+void kms_rtp_layer_info_init (KmsRtpLayerInfo *info);
+
+/* 'data' is the RTP payload. FALSE if the payload is malformed */
+gboolean kms_rtp_layers_parse_vp8 (const guint8 *data, gsize size,
+    KmsRtpLayerInfo *info);
+gboolean kms_rtp_layers_parse_vp9 (const guint8 *data, gsize size,
+    KmsRtpLayerInfo *info);
+gboolean kms_rtp_layers_parse_h264 (const guint8 *data, gsize size,
+    KmsRtpLayerInfo *info);
+
+gboolean kms_rtp_layers_parse_buffer (GstBuffer *rtp, KmsBitstreamCodec codec,
+    KmsRtpLayerInfo *info);
+
+/* Codec of application/x-rtp caps, KMS_BITSTREAM_CODEC_UNKNOWN if it */
+/* carries no layer information */
+KmsBitstreamCodec kms_rtp_layers_codec_from_rtp_caps (const GstCaps *caps);
+
+/* Tags the frames produced by 'depayloader' with the layer of the packets */
+/* they were built from. Needs to be called before any other probe on the */
+/* depayloader src pad that changes the timestamps */
+void kms_rtp_layers_tag_depayloader (GstElement *depayloader,
+    KmsBitstreamCodec codec);
+
+typedef struct _KmsLayerMeta KmsLayerMeta;
+
+/**
+ * KmsLayerMeta:
+ * @meta: the parent type
+ * @temporal_id: temporal layer of the frame
+ * @spatial_id: spatial layer of the frame, KMS_RTP_LAYER_UNKNOWN if none
+ * @layer_sync: the frame is an upswitch point to its temporal layer
+ *
+ * Layer of an encoded video frame of a scalable stream.
+ */
+struct _KmsLayerMeta {
+  GstMeta meta;
+
+  gint temporal_id;
+  gint spatial_id;
+  gboolean layer_sync;
+};
+
+/* Tag of the layer meta API, marks metas tied to the encoded bitstream */
+#define KMS_LAYER_META_TAG_STR "kms-layer"
+
+GType kms_layer_meta_api_get_type (void);
+#define KMS_LAYER_META_API_TYPE (kms_layer_meta_api_get_type())
+
+#define kms_buffer_get_layer_meta(b) \
+  ((KmsLayerMeta*)gst_buffer_get_meta((b), KMS_LAYER_META_API_TYPE))
+
+/* implementation */
+const GstMetaInfo *kms_layer_meta_get_info (void);
+#define KMS_LAYER_META_INFO (kms_layer_meta_get_info ())
+
+KmsLayerMeta * kms_buffer_add_layer_meta (GstBuffer *buffer,
+    gint temporal_id, gint spatial_id, gboolean layer_sync);
+
+G_END_DECLS
+#endif /* __KMS_RTP_LAYERS_H__ */
@@ -0,0 +1,477 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsrtpssrcrouter.h"
+
+#define GST_DEFAULT_NAME "rtpssrcrouter"
+#define GST_CAT_DEFAULT kms_rtp_ssrc_router_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define kms_rtp_ssrc_router_parent_class parent_class
+G_DEFINE_TYPE (KmsRtpSsrcRouter, kms_rtp_ssrc_router, GST_TYPE_ELEMENT);
+
+#define KMS_RTP_SSRC_ROUTER_GET_PRIVATE(obj) ( \
+  G_TYPE_INSTANCE_GET_PRIVATE (                \
+    (obj),                                     \
+    KMS_TYPE_RTP_SSRC_ROUTER,                  \
+    KmsRtpSsrcRouterPrivate                    \
+  )                                            \
+)
+
+#define FALLBACK_ROUTE "fallback"
+
+#define RTP_SSRC_OFFSET 8
+#define RTCP_SSRC_OFFSET 4
+
+typedef struct _KmsRtpSsrcRoute
+{
+  GstPad *rtp_src;
+  GstPad *rtcp_src;
+} KmsRtpSsrcRoute;
+
+struct _KmsRtpSsrcRouterPrivate
+{
+  GstPad *rtp_sink, *rtcp_sink;
+  KmsRtpSsrcRoute fallback;
+
+  GMutex mutex;
+  GHashTable *routes;           /* name -> KmsRtpSsrcRoute */
+
+  /* ssrc -> KmsRtpSsrcRoute. Never modified once published: updates */
+  /* replace it with a new table, so lookups do not need any lock.    */
+  /* Replaced tables are freed once no lookup is in progress.         */
+  GHashTable *table;
+  gint readers;
+  GSList *retired;
+};
+
+static GstStaticPadTemplate rtp_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("application/x-rtp"));
+
+static GstStaticPadTemplate rtcp_sink_template =
+GST_STATIC_PAD_TEMPLATE ("rtcp_sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("application/x-rtcp"));
+
+static GstStaticPadTemplate rtp_src_template =
+GST_STATIC_PAD_TEMPLATE ("src_%s",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS ("application/x-rtp"));
+
+static GstStaticPadTemplate rtcp_src_template =
+GST_STATIC_PAD_TEMPLATE ("rtcp_src_%s",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS ("application/x-rtcp"));
+
+static void
+kms_rtp_ssrc_route_free (KmsRtpSsrcRoute * route)
+{
+  g_object_unref (route->rtp_src);
+  g_object_unref (route->rtcp_src);
+  g_slice_free (KmsRtpSsrcRoute, route);
+}
+
+static gboolean
+kms_rtp_ssrc_router_get_ssrc (GstBuffer * buffer, gsize offset,
+    guint32 * ssrc)
+{
+  guint8 data[RTP_SSRC_OFFSET + 4];
+  gsize size = offset + 4;
+
+  if (gst_buffer_extract (buffer, 0, data, size) != size
+      || (data[0] >> 6) != 2) {
+    return FALSE;
+  }
+
+  *ssrc = GST_READ_UINT32_BE (data + offset);
+
+  return TRUE;
+}
+
+/* The table returned stays valid until it is released */
+static GHashTable *
+kms_rtp_ssrc_router_acquire_table (KmsRtpSsrcRouter * self)
+{
+  g_atomic_int_inc (&self->priv->readers);
+
+  return g_atomic_pointer_get (&self->priv->table);
+}
+
+static void
+kms_rtp_ssrc_router_release_table (KmsRtpSsrcRouter * self)
+{
+  (void) g_atomic_int_dec_and_test (&self->priv->readers);
+}
+
+static GstPad *
+kms_rtp_ssrc_router_get_src (KmsRtpSsrcRouter * self, GHashTable * table,
+    GstBuffer * buffer, gboolean rtcp)
+{
+  KmsRtpSsrcRoute *route = NULL;
+  guint32 ssrc;
+
+  if (kms_rtp_ssrc_router_get_ssrc (buffer,
+          rtcp ? RTCP_SSRC_OFFSET : RTP_SSRC_OFFSET, &ssrc)) {
+    route = g_hash_table_lookup (table, GUINT_TO_POINTER (ssrc));
+  }
+
+  if (route == NULL) {
+    route = &self->priv->fallback;
+  }
+
+  return rtcp ? route->rtcp_src : route->rtp_src;
+}
+
+static GstFlowReturn
+kms_rtp_ssrc_router_check_flow (GstPad * src, GstFlowReturn ret)
+{
+  if (ret == GST_FLOW_NOT_LINKED) {
+    /* Other routes must not be stopped by this one */
+    GST_LOG_OBJECT (src, "Not linked");
+    return GST_FLOW_OK;
+  }
+
+  return ret;
+}
+
+static GstFlowReturn
+kms_rtp_ssrc_router_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  KmsRtpSsrcRouter *self = KMS_RTP_SSRC_ROUTER (parent);
+  GHashTable *table;
+  GstPad *src;
+
+  table = kms_rtp_ssrc_router_acquire_table (self);
+  src = kms_rtp_ssrc_router_get_src (self, table, buffer,
+      pad == self->priv->rtcp_sink);
+  kms_rtp_ssrc_router_release_table (self);
+
+  return kms_rtp_ssrc_router_check_flow (src, gst_pad_push (src, buffer));
+}
+
+static GstFlowReturn
+kms_rtp_ssrc_router_chain_list (GstPad * pad, GstObject * parent,
+    GstBufferList * list)
+{
+  KmsRtpSsrcRouter *self = KMS_RTP_SSRC_ROUTER (parent);
+  gboolean rtcp = pad == self->priv->rtcp_sink;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstPad *src, *next = NULL;
+  guint i = 0, end, len;
+  GHashTable *table;
+
+  len = gst_buffer_list_length (list);
+
+  if (len > 0) {
+    table = kms_rtp_ssrc_router_acquire_table (self);
+    next = kms_rtp_ssrc_router_get_src (self, table,
+        gst_buffer_list_get (list, 0), rtcp);
+    kms_rtp_ssrc_router_release_table (self);
+  }
+
+  /* Consecutive packets of the same route are pushed as a list */
+  while (i < len && ret == GST_FLOW_OK) {
+    GstBufferList *run;
+
+    src = next;
+
+    table = kms_rtp_ssrc_router_acquire_table (self);
+
+    for (end = i + 1; end < len; end++) {
+      next = kms_rtp_ssrc_router_get_src (self, table,
+          gst_buffer_list_get (list, end), rtcp);
+
+      if (next != src) {
+        break;
+      }
+    }
+
+    kms_rtp_ssrc_router_release_table (self);
+
+    if (i == 0 && end == len) {
+      run = gst_buffer_list_ref (list);
+    } else {
+      guint j;
+
+      run = gst_buffer_list_new_sized (end - i);
+
+      for (j = i; j < end; j++) {
+        gst_buffer_list_add (run, gst_buffer_ref (gst_buffer_list_get (list,
+                    j)));
+      }
+    }
+
+    ret = kms_rtp_ssrc_router_check_flow (src, gst_pad_push_list (src, run));
+    i = end;
+  }
+
+  gst_buffer_list_unref (list);
+
+  return ret;
+}
+
+static gboolean
+kms_rtp_ssrc_router_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  KmsRtpSsrcRouter *self = KMS_RTP_SSRC_ROUTER (parent);
+  gboolean rtcp = pad == self->priv->rtcp_sink;
+  GSList *srcs = NULL, *l;
+  KmsRtpSsrcRoute *route;
+  GHashTableIter iter;
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&self->priv->mutex);
+
+  srcs = g_slist_prepend (srcs, gst_object_ref (rtcp ?
+          self->priv->fallback.rtcp_src : self->priv->fallback.rtp_src));
+
+  g_hash_table_iter_init (&iter, self->priv->routes);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & route)) {
+    srcs = g_slist_prepend (srcs, gst_object_ref (rtcp ? route->rtcp_src :
+            route->rtp_src));
+  }
+
+  g_mutex_unlock (&self->priv->mutex);
+
+  for (l = srcs; l != NULL; l = l->next) {
+    ret |= gst_pad_push_event (GST_PAD (l->data), gst_event_ref (event));
+  }
+
+  g_slist_free_full (srcs, gst_object_unref);
+  gst_event_unref (event);
+
+  return ret;
+}
+
+static gboolean
+kms_rtp_ssrc_router_copy_sticky_event (GstPad * pad, GstEvent ** event,
+    gpointer src)
+{
+  gst_pad_store_sticky_event (GST_PAD (src), *event);
+
+  return TRUE;
+}
+
+static GstPad *
+kms_rtp_ssrc_router_create_src (KmsRtpSsrcRouter * self,
+    GstStaticPadTemplate * templ, const gchar * name, GstPad * sink)
+{
+  GstPadTemplate *pad_templ;
+  gchar *pad_name;
+  GstPad *pad;
+
+  pad_templ = gst_static_pad_template_get (templ);
+  pad_name = g_strdup_printf (templ->name_template, name);
+  pad = gst_pad_new_from_template (pad_templ, pad_name);
+  g_object_unref (pad_templ);
+  g_free (pad_name);
+
+  /* Ready to push before it is visible, with the events already received */
+  gst_pad_use_fixed_caps (pad);
+  gst_pad_set_active (pad, TRUE);
+  gst_pad_sticky_events_foreach (sink, kms_rtp_ssrc_router_copy_sticky_event,
+      pad);
+  gst_element_add_pad (GST_ELEMENT (self), pad);
+
+  return g_object_ref (pad);
+}
+
+gboolean
+kms_rtp_ssrc_router_add_route (KmsRtpSsrcRouter * self, const gchar * name)
+{
+  KmsRtpSsrcRoute *route;
+
+  g_return_val_if_fail (KMS_IS_RTP_SSRC_ROUTER (self), FALSE);
+  g_return_val_if_fail (g_strcmp0 (name, FALLBACK_ROUTE) != 0, FALSE);
+
+  g_mutex_lock (&self->priv->mutex);
+
+  if (g_hash_table_contains (self->priv->routes, name)) {
+    g_mutex_unlock (&self->priv->mutex);
+    GST_DEBUG_OBJECT (self, "Route '%s' already exists", name);
+    return FALSE;
+  }
+
+  route = g_slice_new0 (KmsRtpSsrcRoute);
+  route->rtp_src = kms_rtp_ssrc_router_create_src (self, &rtp_src_template,
+      name, self->priv->rtp_sink);
+  route->rtcp_src = kms_rtp_ssrc_router_create_src (self, &rtcp_src_template,
+      name, self->priv->rtcp_sink);
+  g_hash_table_insert (self->priv->routes, g_strdup (name), route);
+
+  g_mutex_unlock (&self->priv->mutex);
+
+  GST_DEBUG_OBJECT (self, "Route '%s' added", name);
+
+  return TRUE;
+}
+
+static void
+kms_rtp_ssrc_router_copy_entry (gpointer ssrc, gpointer route, gpointer table)
+{
+  g_hash_table_insert (table, ssrc, route);
+}
+
+gboolean
+kms_rtp_ssrc_router_set_ssrc (KmsRtpSsrcRouter * self, guint32 ssrc,
+    const gchar * name)
+{
+  GHashTable *table;
+  KmsRtpSsrcRoute *route;
+
+  g_return_val_if_fail (KMS_IS_RTP_SSRC_ROUTER (self), FALSE);
+
+  g_mutex_lock (&self->priv->mutex);
+
+  route = g_hash_table_lookup (self->priv->routes, name);
+  if (route == NULL) {
+    g_mutex_unlock (&self->priv->mutex);
+    GST_WARNING_OBJECT (self, "No route '%s' for SSRC %" G_GUINT32_FORMAT,
+        name, ssrc);
+    return FALSE;
+  }
+
+  if (g_hash_table_lookup (self->priv->table,
+          GUINT_TO_POINTER (ssrc)) == route) {
+    g_mutex_unlock (&self->priv->mutex);
+    return TRUE;
+  }
+
+  table = g_hash_table_new (NULL, NULL);
+  g_hash_table_foreach (self->priv->table, kms_rtp_ssrc_router_copy_entry,
+      table);
+  g_hash_table_insert (table, GUINT_TO_POINTER (ssrc), route);
+
+  self->priv->retired = g_slist_prepend (self->priv->retired,
+      self->priv->table);
+  g_atomic_pointer_set (&self->priv->table, table);
+
+  /* Lookups starting from now can only get the new table */
+  if (g_atomic_int_get (&self->priv->readers) == 0) {
+    g_slist_free_full (self->priv->retired,
+        (GDestroyNotify) g_hash_table_unref);
+    self->priv->retired = NULL;
+  }
+
+  g_mutex_unlock (&self->priv->mutex);
+
+  GST_DEBUG_OBJECT (self, "SSRC %" G_GUINT32_FORMAT " routed through '%s'",
+      ssrc, name);
+
+  return TRUE;
+}
+
+static void
+kms_rtp_ssrc_router_finalize (GObject * object)
+{
+  KmsRtpSsrcRouter *self = KMS_RTP_SSRC_ROUTER (object);
+
+  GST_DEBUG_OBJECT (self, "finalize");
+
+  g_hash_table_unref (self->priv->table);
+  g_slist_free_full (self->priv->retired, (GDestroyNotify) g_hash_table_unref);
+  g_hash_table_unref (self->priv->routes);
+  g_object_unref (self->priv->fallback.rtp_src);
+  g_object_unref (self->priv->fallback.rtcp_src);
+  g_mutex_clear (&self->priv->mutex);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static GstPad *
+kms_rtp_ssrc_router_create_sink (KmsRtpSsrcRouter * self,
+    GstStaticPadTemplate * templ)
+{
+  GstPad *pad;
+
+  pad = gst_pad_new_from_static_template (templ, templ->name_template);
+  gst_pad_set_chain_function (pad,
+      GST_DEBUG_FUNCPTR (kms_rtp_ssrc_router_chain));
+  gst_pad_set_chain_list_function (pad,
+      GST_DEBUG_FUNCPTR (kms_rtp_ssrc_router_chain_list));
+  gst_pad_set_event_function (pad,
+      GST_DEBUG_FUNCPTR (kms_rtp_ssrc_router_sink_event));
+  gst_element_add_pad (GST_ELEMENT (self), pad);
+
+  return pad;
+}
+
+static void
+kms_rtp_ssrc_router_class_init (KmsRtpSsrcRouterClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->finalize = kms_rtp_ssrc_router_finalize;
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&rtp_sink_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&rtcp_sink_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&rtp_src_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&rtcp_src_template));
+
+  gst_element_class_set_details_simple (gstelement_class,
+      "RTP SSRC router",
+      "Demux/Network/RTP",
+      "Routes RTP and RTCP packets by SSRC", "Kurento <kurento.org>");
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+
+  g_type_class_add_private (klass, sizeof (KmsRtpSsrcRouterPrivate));
+}
+
+static void
+kms_rtp_ssrc_router_init (KmsRtpSsrcRouter * self)
+{
+  self->priv = KMS_RTP_SSRC_ROUTER_GET_PRIVATE (self);
+
+  g_mutex_init (&self->priv->mutex);
+  self->priv->routes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) kms_rtp_ssrc_route_free);
+  self->priv->table = g_hash_table_new (NULL, NULL);
+
+  self->priv->rtp_sink = kms_rtp_ssrc_router_create_sink (self,
+      &rtp_sink_template);
+  self->priv->rtcp_sink = kms_rtp_ssrc_router_create_sink (self,
+      &rtcp_sink_template);
+
+  self->priv->fallback.rtp_src = kms_rtp_ssrc_router_create_src (self,
+      &rtp_src_template, FALLBACK_ROUTE, self->priv->rtp_sink);
+  self->priv->fallback.rtcp_src = kms_rtp_ssrc_router_create_src (self,
+      &rtcp_src_template, FALLBACK_ROUTE, self->priv->rtcp_sink);
+}
+
+GstElement *
+kms_rtp_ssrc_router_new (void)
+{
+  return g_object_new (KMS_TYPE_RTP_SSRC_ROUTER, NULL);
+}
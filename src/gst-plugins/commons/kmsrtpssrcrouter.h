@@ -0,0 +1,72 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_RTP_SSRC_ROUTER_H__
+#define __KMS_RTP_SSRC_ROUTER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+/* #defines don't like whitespacey bits */
+#define KMS_TYPE_RTP_SSRC_ROUTER \
+  (kms_rtp_ssrc_router_get_type())
+#define KMS_RTP_SSRC_ROUTER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),KMS_TYPE_RTP_SSRC_ROUTER,KmsRtpSsrcRouter))
+#define KMS_RTP_SSRC_ROUTER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),KMS_TYPE_RTP_SSRC_ROUTER,KmsRtpSsrcRouterClass))
+#define KMS_IS_RTP_SSRC_ROUTER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),KMS_TYPE_RTP_SSRC_ROUTER))
+#define KMS_IS_RTP_SSRC_ROUTER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),KMS_TYPE_RTP_SSRC_ROUTER))
+#define KMS_RTP_SSRC_ROUTER_CAST(obj) ((KmsRtpSsrcRouter*)(obj))
+
+typedef struct _KmsRtpSsrcRouter KmsRtpSsrcRouter;
+typedef struct _KmsRtpSsrcRouterClass KmsRtpSsrcRouterClass;
+typedef struct _KmsRtpSsrcRouterPrivate KmsRtpSsrcRouterPrivate;
+
+/*
+ * Demuxes the RTP and RTCP packets of a BUNDLE connection by SSRC. Routes
+ * ("src_<name>" and "rtcp_src_<name>" pads) and the SSRCs sent through
+ * them are set up when media is negotiated, so the streaming threads only
+ * do a lookup in the routing table. Packets of unknown SSRCs go out
+ * through "src_fallback" and "rtcp_src_fallback".
+ */
+struct _KmsRtpSsrcRouter
+{
+  GstElement parent;
+
+  KmsRtpSsrcRouterPrivate *priv;
+};
+
+struct _KmsRtpSsrcRouterClass
+{
+  GstElementClass parent_class;
+};
+
+GType kms_rtp_ssrc_router_get_type (void);
+
+GstElement * kms_rtp_ssrc_router_new (void);
+
+/* Creates the src pads of route 'name'. Returns FALSE if it already exists */
+gboolean kms_rtp_ssrc_router_add_route (KmsRtpSsrcRouter * self,
+    const gchar * name);
+
+/* Sends the packets of 'ssrc' through route 'name' from now on */
+gboolean kms_rtp_ssrc_router_set_ssrc (KmsRtpSsrcRouter * self, guint32 ssrc,
+    const gchar * name);
+
+G_END_DECLS
+#endif /* __KMS_RTP_SSRC_ROUTER_H__ */
@@ -16,6 +16,7 @@
  */
 
 #include "kmsrtpsynchronizer.h"
+#include "kmstracerecorder.h"
 #include <glib/gstdio.h>
 
 #include <sys/stat.h>  // 'ACCESSPERMS' is not POSIX, requires GNU extensions in GCC
@@ -28,9 +29,9 @@ GST_DEBUG_CATEGORY_STATIC (kms_rtp_synchronizer_debug_category);
 G_DEFINE_TYPE (KmsRtpSynchronizer, kms_rtp_synchronizer, G_TYPE_OBJECT);
 
 #define KMS_RTP_SYNCHRONIZER_LOCK(rtpsynchronizer) \
-  (g_rec_mutex_lock (&KMS_RTP_SYNCHRONIZER_CAST ((rtpsynchronizer))->priv->mutex))
+  (g_mutex_lock (&KMS_RTP_SYNCHRONIZER_CAST ((rtpsynchronizer))->priv->mutex))
 #define KMS_RTP_SYNCHRONIZER_UNLOCK(rtpsynchronizer) \
-  (g_rec_mutex_unlock (&KMS_RTP_SYNCHRONIZER_CAST ((rtpsynchronizer))->priv->mutex))
+  (g_mutex_unlock (&KMS_RTP_SYNCHRONIZER_CAST ((rtpsynchronizer))->priv->mutex))
 
 #define KMS_RTP_SYNCHRONIZER_GET_PRIVATE(obj) ( \
   G_TYPE_INSTANCE_GET_PRIVATE (                 \
@@ -41,29 +42,50 @@ G_DEFINE_TYPE (KmsRtpSynchronizer, kms_rtp_synchronizer, G_TYPE_OBJECT);
 )
 
 #define KMS_RTP_SYNC_STATS_PATH_ENV_VAR "KMS_RTP_SYNC_STATS_PATH"
+#define KMS_RTP_SYNC_STATS_SAMPLING_ENV_VAR "KMS_RTP_SYNC_STATS_SAMPLING"
+#define KMS_RTP_SYNC_STATS_RECORDS_ENV_VAR "KMS_RTP_SYNC_STATS_RECORDS"
+#define DEFAULT_STATS_RECORDS 65536     /* 4 MiB per stream */
 static const gchar *stats_files_dir = NULL;
+static guint stats_sampling = 100;
+static guint stats_records = DEFAULT_STATS_RECORDS;
 
-struct _KmsRtpSynchronizerPrivate
+#define RTP_FIXED_HEADER_SIZE 12
+
+typedef struct _KmsRtpSyncTiming
 {
-  GRecMutex mutex;
+  gboolean base_initiated;
+  GstClockTime base_ntp_time;
+  GstClockTime base_sync_time;
 
-  gboolean feeded_sorted;
+  guint32 last_sr_rtp_ts;
+  GstClockTime last_sr_ntp_time;
+} KmsRtpSyncTiming;
+
+struct _KmsRtpSynchronizerPrivate
+{
+  /* Serializes writers (configuration and RTCP SR); never taken for RTP */
+  GMutex mutex;
 
-  guint32 ssrc;
   gint32 pt;
   gint32 clock_rate;
 
-  gboolean base_initiated;
-  GstClockTime base_ntp_time;
-  GstClockTime base_sync_time;
+  /* Timing info from the last RTCP SR. Published with a sequence lock: */
+  /* the writer makes 'timing_seq' odd while updating 'timing', and */
+  /* readers retry until they copy it with the same, even, sequence */
+  guint timing_seq;
+  KmsRtpSyncTiming timing;
+
+  /* The RTP path state below is owned by the streaming thread of the */
+  /* first SSRC seen (claimed atomically), so it needs no locking */
+  guint32 ssrc;
+
+  gboolean feeded_sorted;
 
   guint64 rtp_ext_ts; // Extended timestamp: robust against input wraparound
-  guint64 last_sr_rtp_ext_ts;
-  GstClockTime last_sr_ntp_time;
 
   /* Interpolate PTSs */
   gboolean base_interpolate_initiated;
-  GstClockTime base_interpolate_ext_ts;
+  guint64 base_interpolate_ext_ts;
   GstClockTime base_interpolate_time;
 
   /* Feeded sorted case */
@@ -71,8 +93,7 @@ struct _KmsRtpSynchronizerPrivate
   GstClockTime fs_last_pts_time;
 
   /* Stats recording */
-  FILE *stats_file;
-  GMutex stats_mutex;
+  KmsTraceRecorder *trace;
 };
 
 static void
@@ -82,16 +103,38 @@ kms_rtp_synchronizer_finalize (GObject * object)
 
   GST_DEBUG_OBJECT (self, "finalize");
 
-  if (self->priv->stats_file) {
-    fclose (self->priv->stats_file);
-  }
-  g_mutex_clear (&self->priv->stats_mutex);
+  kms_trace_recorder_free (self->priv->trace);
 
-  g_rec_mutex_clear (&self->priv->mutex);
+  g_mutex_clear (&self->priv->mutex);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+kms_rtp_synchronizer_init_stats_config (void)
+{
+  static gsize init = 0;
+  const gchar *env;
+
+  if (!g_once_init_enter (&init)) {
+    return;
+  }
+
+  stats_files_dir = g_getenv (KMS_RTP_SYNC_STATS_PATH_ENV_VAR);
+
+  env = g_getenv (KMS_RTP_SYNC_STATS_SAMPLING_ENV_VAR);
+  if (env != NULL) {
+    stats_sampling = MIN (g_ascii_strtoull (env, NULL, 10), 100);
+  }
+
+  env = g_getenv (KMS_RTP_SYNC_STATS_RECORDS_ENV_VAR);
+  if (env != NULL && g_ascii_strtoull (env, NULL, 10) > 0) {
+    stats_records = MIN (g_ascii_strtoull (env, NULL, 10), G_MAXUINT);
+  }
+
+  g_once_init_leave (&init, 1);
+}
+
 static void
 kms_rtp_synchronizer_class_init (KmsRtpSynchronizerClass * klass)
 {
@@ -105,7 +148,7 @@ kms_rtp_synchronizer_class_init (KmsRtpSynchronizerClass * klass)
 
   g_type_class_add_private (klass, sizeof (KmsRtpSynchronizerPrivate));
 
-  stats_files_dir = g_getenv (KMS_RTP_SYNC_STATS_PATH_ENV_VAR);
+  kms_rtp_synchronizer_init_stats_config ();
 }
 
 static void
@@ -113,8 +156,7 @@ kms_rtp_synchronizer_init (KmsRtpSynchronizer * self)
 {
   self->priv = KMS_RTP_SYNCHRONIZER_GET_PRIVATE (self);
 
-  g_rec_mutex_init (&self->priv->mutex);
-  g_mutex_init (&self->priv->stats_mutex);
+  g_mutex_init (&self->priv->mutex);
 
   // 'gst_rtp_buffer_ext_timestamp()' requires an initial value of -1
   self->priv->rtp_ext_ts = (guint64)-1;  // == G_MAXUINT64
@@ -130,6 +172,7 @@ kms_rtp_synchronizer_init_stats_file (KmsRtpSynchronizer * self,
   gchar *stats_file_name;
   GDateTime *datetime;
   gchar *date_str;
+  GError *err = NULL;
 
   if (stats_name == NULL) {
     GST_DEBUG_OBJECT (self, "No name for stats file");
@@ -147,7 +190,8 @@ kms_rtp_synchronizer_init_stats_file (KmsRtpSynchronizer * self,
   g_date_time_unref (datetime);
 
   stats_file_name =
-      g_strdup_printf ("%s/%s_%s.csv", stats_files_dir, date_str, stats_name);
+      g_strdup_printf ("%s/%s_%s.trace", stats_files_dir, date_str,
+      stats_name);
   g_free (date_str);
 
   if (g_mkdir_with_parents (stats_files_dir, ACCESSPERMS) < 0) {
@@ -156,20 +200,29 @@ kms_rtp_synchronizer_init_stats_file (KmsRtpSynchronizer * self,
     goto end;
   }
 
-  self->priv->stats_file = g_fopen (stats_file_name, "w+");
+  self->priv->trace = kms_trace_recorder_new (stats_file_name, stats_name,
+      stats_records, &err);
 
-  if (self->priv->stats_file == NULL) {
-    GST_ERROR_OBJECT (self, "Cannot open file for stats: %s", stats_file_name);
+  if (self->priv->trace == NULL) {
+    GST_ERROR_OBJECT (self, "%s", err->message);
+    g_error_free (err);
   } else {
     GST_DEBUG_OBJECT (self, "File for stats: %s", stats_file_name);
-    g_fprintf (self->priv->stats_file,
-        "ENTRY_TS,THREAD,SSRC,CLOCK_RATE,PTS_ORIG,PTS,DTS,EXT_RTP,SR_NTP_NS,SR_EXT_RTP\n");
   }
 
 end:
   g_free (stats_file_name);
 }
 
+gboolean
+kms_rtp_synchronizer_stats_sample (void)
+{
+  kms_rtp_synchronizer_init_stats_config ();
+
+  return stats_files_dir != NULL
+      && (guint) g_random_int_range (0, 100) < stats_sampling;
+}
+
 KmsRtpSynchronizer *
 kms_rtp_synchronizer_new (gboolean feeded_sorted, const gchar * stats_name)
 {
@@ -212,8 +265,9 @@ kms_rtp_synchronizer_add_clock_rate_for_pt (KmsRtpSynchronizer * self,
     goto end;
   }
 
-  self->priv->pt = pt;
-  self->priv->clock_rate = clock_rate;
+  /* 'clock_rate' != 0 tells the RTP path that 'pt' is already valid */
+  g_atomic_int_set (&self->priv->pt, pt);
+  g_atomic_int_set (&self->priv->clock_rate, clock_rate);
 
   ret = TRUE;
 
@@ -223,10 +277,40 @@ end:
   return ret;
 }
 
+/* Must be called with the writer lock held */
+static void
+kms_rtp_synchronizer_publish_timing (KmsRtpSynchronizer * self,
+    const KmsRtpSyncTiming * timing)
+{
+  guint seq = self->priv->timing_seq;
+
+  __atomic_store_n (&self->priv->timing_seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  self->priv->timing = *timing;
+
+  __atomic_store_n (&self->priv->timing_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void
+kms_rtp_synchronizer_read_timing (KmsRtpSynchronizer * self,
+    KmsRtpSyncTiming * timing)
+{
+  guint seq_begin, seq_end;
+
+  do {
+    seq_begin = __atomic_load_n (&self->priv->timing_seq, __ATOMIC_ACQUIRE);
+    *timing = self->priv->timing;
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    seq_end = __atomic_load_n (&self->priv->timing_seq, __ATOMIC_RELAXED);
+  } while ((seq_begin & 1) || seq_begin != seq_end);
+}
+
 static void
 kms_rtp_synchronizer_process_rtcp_packet (KmsRtpSynchronizer * self,
     GstRTCPPacket * packet, GstClockTime current_time)
 {
+  KmsRtpSyncTiming timing;
   guint32 ssrc, rtp_ts;
   guint64 ntp_ts;
   GstClockTime ntp_time;
@@ -253,17 +337,22 @@ kms_rtp_synchronizer_process_rtcp_packet (KmsRtpSynchronizer * self,
 
   KMS_RTP_SYNCHRONIZER_LOCK (self);
 
-  if (!self->priv->base_initiated) {
+  /* Only writers modify 'timing', so it can be read here without retries */
+  timing = self->priv->timing;
+
+  if (!timing.base_initiated) {
     GST_DEBUG_OBJECT (self, "RTCP SR received: stop interpolating PTS");
-    self->priv->base_ntp_time = ntp_time;
-    self->priv->base_sync_time = current_time;
-    self->priv->base_initiated = TRUE;
+    timing.base_ntp_time = ntp_time;
+    timing.base_sync_time = current_time;
+    timing.base_initiated = TRUE;
   }
 
-  self->priv->last_sr_rtp_ext_ts =
-      gst_rtp_buffer_ext_timestamp (&self->priv->rtp_ext_ts, rtp_ts);
+  /* The SR RTP time is extended by the RTP path, relative to its own */
+  /* extended timestamp, so this thread never touches the RTP state */
+  timing.last_sr_rtp_ts = rtp_ts;
+  timing.last_sr_ntp_time = ntp_time;
 
-  self->priv->last_sr_ntp_time = ntp_time;
+  kms_rtp_synchronizer_publish_timing (self, &timing);
 
   KMS_RTP_SYNCHRONIZER_UNLOCK (self);
 }
@@ -301,136 +390,148 @@ unmap:
 
 static void
 kms_rtp_synchronizer_rtp_diff_full (KmsRtpSynchronizer * self,
-    GstRTPBuffer * rtp_buffer, gint32 clock_rate, guint64 base_ext_ts,
+    GstClockTime * pts, gint32 clock_rate, gint64 diff_rtp_ext_ts,
     gboolean wrapped_down, gboolean wrapped_up)
 {
-  GstBuffer *buffer = rtp_buffer->buffer;
-  guint64 diff_rtp_ext_ts, diff_rtp_time;
+  guint64 diff_rtp_time;
 
-  if (self->priv->rtp_ext_ts > base_ext_ts) {
-    diff_rtp_ext_ts = self->priv->rtp_ext_ts - base_ext_ts;
-    diff_rtp_time =
-        gst_util_uint64_scale_int (diff_rtp_ext_ts, GST_SECOND, clock_rate);
+  if (diff_rtp_ext_ts > 0) {
+    diff_rtp_time = gst_util_uint64_scale_int ((guint64) diff_rtp_ext_ts,
+        GST_SECOND, clock_rate);
 
     if (wrapped_up) {
       GST_WARNING_OBJECT (self, "PTS wrapped up, setting MAXUINT64");
-      GST_BUFFER_PTS (buffer) = G_MAXUINT64;
-    } else if (wrapped_down
-        && (diff_rtp_time < (G_MAXUINT64 - GST_BUFFER_PTS (buffer)))) {
+      *pts = G_MAXUINT64;
+    } else if (wrapped_down && (diff_rtp_time < (G_MAXUINT64 - *pts))) {
       GST_WARNING_OBJECT (self, "PTS wrapped down, setting to 0");
-      GST_BUFFER_PTS (buffer) = 0;
-    } else if (!wrapped_down
-        && (diff_rtp_time > (G_MAXUINT64 - GST_BUFFER_PTS (buffer)))) {
+      *pts = 0;
+    } else if (!wrapped_down && (diff_rtp_time > (G_MAXUINT64 - *pts))) {
       GST_WARNING_OBJECT (self,
           "Diff RTP time > (MAXUINT64 - base PTS), setting MAXUINT64");
-      GST_BUFFER_PTS (buffer) = G_MAXUINT64;
+      *pts = G_MAXUINT64;
     } else {
-      GST_BUFFER_PTS (buffer) += diff_rtp_time;
+      *pts += diff_rtp_time;
     }
   }
-  else if (self->priv->rtp_ext_ts < base_ext_ts) {
-    diff_rtp_ext_ts = base_ext_ts - self->priv->rtp_ext_ts;
-    diff_rtp_time =
-        gst_util_uint64_scale_int (diff_rtp_ext_ts, GST_SECOND, clock_rate);
+  else if (diff_rtp_ext_ts < 0) {
+    diff_rtp_time = gst_util_uint64_scale_int ((guint64) (-diff_rtp_ext_ts),
+        GST_SECOND, clock_rate);
 
     if (wrapped_down) {
       GST_WARNING_OBJECT (self, "PTS wrapped down, setting to 0");
-      GST_BUFFER_PTS (buffer) = 0;
-    } else if (wrapped_up && (diff_rtp_time < GST_BUFFER_PTS (buffer))) {
+      *pts = 0;
+    } else if (wrapped_up && (diff_rtp_time < *pts)) {
       GST_WARNING_OBJECT (self, "PTS wrapped up, setting to MAXUINT64");
-      GST_BUFFER_PTS (buffer) = G_MAXUINT64;
-    } else if (!wrapped_up && (diff_rtp_time > GST_BUFFER_PTS (buffer))) {
+      *pts = G_MAXUINT64;
+    } else if (!wrapped_up && (diff_rtp_time > *pts)) {
       GST_WARNING_OBJECT (self,
           "Diff RTP ns time greater than base PTS, setting to 0");
-      GST_BUFFER_PTS (buffer) = 0;
+      *pts = 0;
     } else {
-      GST_BUFFER_PTS (buffer) -= diff_rtp_time;
+      *pts -= diff_rtp_time;
     }
   }
   else {                      /* if equals */
     if (wrapped_down) {
       GST_WARNING_OBJECT (self, "PTS wrapped down, setting to 0");
-      GST_BUFFER_PTS (buffer) = 0;
+      *pts = 0;
     } else if (wrapped_up) {
       GST_WARNING_OBJECT (self, "PTS wrapped up, setting MAXUINT64");
-      GST_BUFFER_PTS (buffer) = G_MAXUINT64;
+      *pts = G_MAXUINT64;
     }
   }
 }
 
 static void
 kms_rtp_synchronizer_rtp_diff (KmsRtpSynchronizer * self,
-    GstRTPBuffer * rtp_buffer, gint32 clock_rate, guint64 base_ext_ts)
+    GstClockTime * pts, gint32 clock_rate, gint64 diff_rtp_ext_ts)
 {
-  kms_rtp_synchronizer_rtp_diff_full (self, rtp_buffer, clock_rate, base_ext_ts,
+  kms_rtp_synchronizer_rtp_diff_full (self, pts, clock_rate, diff_rtp_ext_ts,
       FALSE, FALSE);
 }
 
 static void
 kms_rtp_synchronizer_write_stats (KmsRtpSynchronizer * self, guint32 ssrc,
-    guint32 clock_rate, guint64 pts_orig, guint64 pts, guint64 dts,
-    guint64 rtp_ext_ts, guint64 last_sr_ntp_ns_time, guint64 last_sr_rtp_ext_ts)
+    guint16 seq, guint8 pt, guint32 rtp_ts, guint32 clock_rate,
+    guint64 pts_orig, guint64 pts, guint64 dts,
+    const KmsRtpSyncTiming * timing, gboolean sorted)
 {
-  if (self->priv->stats_file == NULL) {
+  KmsTraceRecord record = { 0 };
+
+  if (self->priv->trace == NULL) {
     return;
   }
 
-  g_mutex_lock (&self->priv->stats_mutex);
-  g_fprintf (self->priv->stats_file,
-      "%" G_GUINT64_FORMAT ",%p,%" G_GUINT32_FORMAT ",%" G_GUINT32_FORMAT ",%"
-      G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%"
-      G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT "\n",
-      g_get_real_time (), g_thread_self (), ssrc, clock_rate, pts_orig,
-      pts, dts, rtp_ext_ts, last_sr_ntp_ns_time, last_sr_rtp_ext_ts);
-  g_mutex_unlock (&self->priv->stats_mutex);
+  record.ssrc = ssrc;
+  record.seq = seq;
+  record.pt = pt;
+  record.rtp_ts = rtp_ts;
+  record.clock_rate = clock_rate;
+  record.pts_in = pts_orig;
+  record.pts_out = pts;
+  record.dts = dts;
+
+  if (timing->base_initiated) {
+    record.ref_ntp_time = timing->last_sr_ntp_time;
+    record.ref_rtp_ts = timing->last_sr_rtp_ts;
+    record.flags |= KMS_RTP_SYNC_TRACE_FLAG_SR;
+  }
+
+  if (sorted) {
+    record.flags |= KMS_RTP_SYNC_TRACE_FLAG_SORTED;
+  }
+
+  kms_trace_recorder_write (self->priv->trace, &record);
 }
 
 static gboolean
-kms_rtp_synchronizer_process_rtp_buffer_mapped (KmsRtpSynchronizer * self,
-    GstRTPBuffer * rtp_buffer, GError ** error)
+kms_rtp_synchronizer_process_rtp_header (KmsRtpSynchronizer * self,
+    guint32 ssrc, guint8 pt, guint16 rtp_seq, guint32 rtp_ts,
+    GstClockTime pts_orig, GstClockTime dts, GstClockTime * pts_out,
+    GError ** error)
 {
-  GstBuffer *buffer = rtp_buffer->buffer;
-  guint64 pts_orig, rtp_ext_ts, last_sr_rtp_ext_ts, last_sr_ntp_time_ns;
+  KmsRtpSynchronizerPrivate *priv = self->priv;
+  KmsRtpSyncTiming timing;
+  GstClockTime pts = pts_orig;
   guint64 diff_ntp_time_ns;
-  guint32 ssrc, rtp_ts;
-  gint32 clock_rate;
-  guint16 rtp_seq;
-  guint8 pt;
+  guint32 owner_ssrc;
+  gint32 clock_rate, expected_pt;
   gboolean ret = TRUE;
 
-  KMS_RTP_SYNCHRONIZER_LOCK (self);
-
-  ssrc = gst_rtp_buffer_get_ssrc (rtp_buffer);
-  rtp_seq = gst_rtp_buffer_get_seq (rtp_buffer);
-
   GST_LOG_OBJECT (self, "RTP SSRC: %u, Seq: %u", ssrc, rtp_seq);
 
-  if (self->priv->ssrc == 0) {
-    self->priv->ssrc = ssrc;
+  /* The first SSRC seen takes ownership of the RTP state */
+  owner_ssrc = __atomic_load_n (&priv->ssrc, __ATOMIC_ACQUIRE);
+  if (owner_ssrc == 0) {
+    if (__atomic_compare_exchange_n (&priv->ssrc, &owner_ssrc, ssrc, FALSE,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      owner_ssrc = ssrc;
+    }
   }
-  else if (ssrc != self->priv->ssrc) {
+
+  if (ssrc != owner_ssrc) {
     gchar *msg = g_strdup_printf ("Invalid SSRC (%u), not matching with %u",
-        ssrc, self->priv->ssrc);
+        ssrc, owner_ssrc);
 
     GST_ERROR_OBJECT (self, "%s", msg);
     g_set_error_literal (error, KMS_RTP_SYNC_ERROR, KMS_RTP_SYNC_INVALID_DATA,
         msg);
     g_free (msg);
 
-    KMS_RTP_SYNCHRONIZER_UNLOCK (self);
+    *pts_out = pts_orig;
 
     return FALSE;
   }
 
-  pt = gst_rtp_buffer_get_payload_type (rtp_buffer);
-  if (pt != self->priv->pt || self->priv->clock_rate <= 0) {
+  clock_rate = g_atomic_int_get (&priv->clock_rate);
+  expected_pt = g_atomic_int_get (&priv->pt);
+
+  if (pt != expected_pt || clock_rate <= 0) {
     gchar *msg;
-    if (pt != self->priv->pt) {
-      msg =
-          g_strdup_printf ("Unknown PT: %u, expected: %u", pt, self->priv->pt);
+    if (pt != expected_pt) {
+      msg = g_strdup_printf ("Unknown PT: %u, expected: %u", pt, expected_pt);
     } else {
-      msg =
-          g_strdup_printf ("Invalid clock-rate: %d", self->priv->clock_rate);
+      msg = g_strdup_printf ("Invalid clock-rate: %d", clock_rate);
     }
 
     GST_ERROR_OBJECT (self, "%s", msg);
@@ -438,56 +539,55 @@ kms_rtp_synchronizer_process_rtp_buffer_mapped (KmsRtpSynchronizer * self,
         msg);
     g_free (msg);
 
-    KMS_RTP_SYNCHRONIZER_UNLOCK (self);
+    *pts_out = pts_orig;
 
     return FALSE;
   }
 
-  pts_orig = GST_BUFFER_PTS (buffer);
-  rtp_ts = gst_rtp_buffer_get_timestamp (rtp_buffer);
-  gst_rtp_buffer_ext_timestamp (&self->priv->rtp_ext_ts, rtp_ts);
+  gst_rtp_buffer_ext_timestamp (&priv->rtp_ext_ts, rtp_ts);
 
-  if (self->priv->feeded_sorted) {
-    if (self->priv->fs_last_rtp_ext_ts != (guint64) -1
-        && self->priv->rtp_ext_ts < self->priv->fs_last_rtp_ext_ts) {
-      guint16 seq = gst_rtp_buffer_get_seq (rtp_buffer);
+  kms_rtp_synchronizer_read_timing (self, &timing);
+
+  if (priv->feeded_sorted) {
+    if (priv->fs_last_rtp_ext_ts != (guint64) -1
+        && priv->rtp_ext_ts < priv->fs_last_rtp_ext_ts) {
       gchar *msg =
           g_strdup_printf
           ("Received an unsorted RTP buffer when expecting sorted (ssrc: %"
           G_GUINT32_FORMAT ", seq: %" G_GUINT16_FORMAT ", ts: %"
           G_GUINT32_FORMAT ", ext_ts: %" G_GUINT64_FORMAT
           "). Moving to unsorted mode",
-          ssrc, seq, rtp_ts, self->priv->rtp_ext_ts);
+          ssrc, rtp_seq, rtp_ts, priv->rtp_ext_ts);
 
       GST_WARNING_OBJECT (self, "%s", msg);
       g_set_error_literal (error, KMS_RTP_SYNC_ERROR, KMS_RTP_SYNC_INVALID_DATA,
           msg);
       g_free (msg);
 
-      self->priv->feeded_sorted = FALSE;
+      priv->feeded_sorted = FALSE;
       ret = FALSE;
     }
-    else if (self->priv->rtp_ext_ts == self->priv->fs_last_rtp_ext_ts) {
-      if (GST_CLOCK_TIME_IS_VALID (self->priv->fs_last_pts_time)) {
-        GST_BUFFER_PTS (buffer) = self->priv->fs_last_pts_time;
+    else if (priv->rtp_ext_ts == priv->fs_last_rtp_ext_ts) {
+      if (GST_CLOCK_TIME_IS_VALID (priv->fs_last_pts_time)) {
+        pts = priv->fs_last_pts_time;
       }
       goto end;
     }
   }
 
-  if (!self->priv->base_initiated) {
+  if (!timing.base_initiated) {
     GST_DEBUG_OBJECT (self, "RTCP SR not received yet: interpolate PTS"
         ", SSRC: %u, PT: %u", ssrc, pt);
 
-    if (!self->priv->base_interpolate_initiated) {
-      self->priv->base_interpolate_ext_ts = self->priv->rtp_ext_ts;
-      self->priv->base_interpolate_time = GST_BUFFER_PTS (buffer);
-      self->priv->base_interpolate_initiated = TRUE;
+    if (!priv->base_interpolate_initiated) {
+      priv->base_interpolate_ext_ts = priv->rtp_ext_ts;
+      priv->base_interpolate_time = pts;
+      priv->base_interpolate_initiated = TRUE;
     }
     else {
-      GST_BUFFER_PTS (buffer) = self->priv->base_interpolate_time;
-      kms_rtp_synchronizer_rtp_diff (self, rtp_buffer, self->priv->clock_rate,
-          self->priv->base_interpolate_ext_ts);
+      pts = priv->base_interpolate_time;
+      kms_rtp_synchronizer_rtp_diff (self, &pts, clock_rate,
+          (gint64) (priv->rtp_ext_ts - priv->base_interpolate_ext_ts));
     }
   }
   else {
@@ -495,36 +595,33 @@ kms_rtp_synchronizer_process_rtp_buffer_mapped (KmsRtpSynchronizer * self,
 
     wrapped_down = wrapped_up = FALSE;
 
-    GST_BUFFER_PTS (buffer) = self->priv->base_sync_time;
+    pts = timing.base_sync_time;
 
-    if (self->priv->last_sr_ntp_time > self->priv->base_ntp_time) {
-      diff_ntp_time_ns =
-          self->priv->last_sr_ntp_time - self->priv->base_ntp_time;
-      wrapped_up = (diff_ntp_time_ns > (G_MAXUINT64 - GST_BUFFER_PTS (buffer)));
-      GST_BUFFER_PTS (buffer) += diff_ntp_time_ns;
+    if (timing.last_sr_ntp_time > timing.base_ntp_time) {
+      diff_ntp_time_ns = timing.last_sr_ntp_time - timing.base_ntp_time;
+      wrapped_up = (diff_ntp_time_ns > (G_MAXUINT64 - pts));
+      pts += diff_ntp_time_ns;
     }
-    else if (self->priv->last_sr_ntp_time < self->priv->base_ntp_time) {
-      diff_ntp_time_ns =
-          self->priv->base_ntp_time - self->priv->last_sr_ntp_time;
-      wrapped_down = (GST_BUFFER_PTS (buffer) < diff_ntp_time_ns);
-      GST_BUFFER_PTS (buffer) -= diff_ntp_time_ns;
+    else if (timing.last_sr_ntp_time < timing.base_ntp_time) {
+      diff_ntp_time_ns = timing.base_ntp_time - timing.last_sr_ntp_time;
+      wrapped_down = (pts < diff_ntp_time_ns);
+      pts -= diff_ntp_time_ns;
     }
     /* if equals do nothing */
 
-    kms_rtp_synchronizer_rtp_diff_full (self, rtp_buffer,
-        self->priv->clock_rate, self->priv->last_sr_rtp_ext_ts, wrapped_down,
-        wrapped_up);
+    /* The SR RTP time is taken as the closest one to the current packet */
+    kms_rtp_synchronizer_rtp_diff_full (self, &pts, clock_rate,
+        (gint32) (rtp_ts - timing.last_sr_rtp_ts), wrapped_down, wrapped_up);
   }
 
-  if (self->priv->feeded_sorted) {
-    const GstClockTime pts_current = GST_BUFFER_PTS (buffer);
+  if (priv->feeded_sorted) {
+    const GstClockTime pts_current = pts;
     GstClockTime pts_fixed = pts_current;
 
-    if (GST_CLOCK_TIME_IS_VALID (self->priv->fs_last_pts_time)
-        && pts_current < self->priv->fs_last_pts_time) {
+    if (GST_CLOCK_TIME_IS_VALID (priv->fs_last_pts_time)
+        && pts_current < priv->fs_last_pts_time) {
 
-      guint16 seq = gst_rtp_buffer_get_seq (rtp_buffer);
-      pts_fixed = self->priv->fs_last_pts_time;
+      pts_fixed = priv->fs_last_pts_time;
 
       GST_WARNING_OBJECT (self,
           "[Sorted mode] Fix PTS not increasing monotonically"
@@ -533,53 +630,66 @@ kms_rtp_synchronizer_process_rtp_buffer_mapped (KmsRtpSynchronizer * self,
           ", last: %" GST_TIME_FORMAT
           ", current: %" GST_TIME_FORMAT
           ", fixed = last: %" GST_TIME_FORMAT,
-          ssrc, seq, rtp_ts, self->priv->rtp_ext_ts,
-          GST_TIME_ARGS (self->priv->fs_last_pts_time),
+          ssrc, rtp_seq, rtp_ts, priv->rtp_ext_ts,
+          GST_TIME_ARGS (priv->fs_last_pts_time),
           GST_TIME_ARGS (pts_current),
           GST_TIME_ARGS (pts_fixed));
 
-      GST_BUFFER_PTS (buffer) = pts_fixed;
+      pts = pts_fixed;
     }
 
-    self->priv->fs_last_rtp_ext_ts = self->priv->rtp_ext_ts;
-    self->priv->fs_last_pts_time = pts_fixed;
+    priv->fs_last_rtp_ext_ts = priv->rtp_ext_ts;
+    priv->fs_last_pts_time = pts_fixed;
   }
 
 end:
-  clock_rate = self->priv->clock_rate;
-  rtp_ext_ts = self->priv->rtp_ext_ts;
-  last_sr_rtp_ext_ts = self->priv->last_sr_rtp_ext_ts;
-  last_sr_ntp_time_ns = self->priv->last_sr_ntp_time;
-
-  KMS_RTP_SYNCHRONIZER_UNLOCK (self);
+  *pts_out = pts;
 
-  kms_rtp_synchronizer_write_stats (self, ssrc, clock_rate,
-      pts_orig, GST_BUFFER_PTS (buffer), GST_BUFFER_DTS (buffer), rtp_ext_ts,
-      last_sr_ntp_time_ns, last_sr_rtp_ext_ts);
+  kms_rtp_synchronizer_write_stats (self, ssrc, rtp_seq, pt, rtp_ts,
+      clock_rate, pts_orig, pts, dts, &timing, priv->feeded_sorted);
 
   return ret;
 }
 
 gboolean
-kms_rtp_synchronizer_process_rtp_buffer (KmsRtpSynchronizer * self,
-    GstBuffer * buffer, GError ** error)
+kms_rtp_synchronizer_process_rtp_buffer_pts (KmsRtpSynchronizer * self,
+    GstBuffer * buffer, GstClockTime * pts, GError ** error)
 {
-  GstRTPBuffer rtp_buffer = GST_RTP_BUFFER_INIT;
-  gboolean ret;
+  guint8 header[RTP_FIXED_HEADER_SIZE];
 
-  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp_buffer)) {
+  /* Only the fixed header is needed, so avoid a full RTP map */
+  if (gst_buffer_extract (buffer, 0, header, sizeof (header))
+      != sizeof (header) || (header[0] >> 6) != 2) {
     const gchar *msg = "Buffer cannot be mapped as RTP";
 
     GST_ERROR_OBJECT (self, "%s", msg);
     g_set_error_literal (error, KMS_RTP_SYNC_ERROR,
         KMS_RTP_SYNC_UNEXPECTED_ERROR, msg);
+
+    *pts = GST_BUFFER_PTS (buffer);
+
     return FALSE;
   }
 
-  ret =
-      kms_rtp_synchronizer_process_rtp_buffer_mapped (self, &rtp_buffer, error);
+  return kms_rtp_synchronizer_process_rtp_header (self,
+      GST_READ_UINT32_BE (header + 8), header[1] & 0x7f,
+      GST_READ_UINT16_BE (header + 2), GST_READ_UINT32_BE (header + 4),
+      GST_BUFFER_PTS (buffer), GST_BUFFER_DTS (buffer), pts, error);
+}
+
+gboolean
+kms_rtp_synchronizer_process_rtp_buffer (KmsRtpSynchronizer * self,
+    GstBuffer * buffer, GError ** error)
+{
+  GstClockTime pts;
+  gboolean ret;
+
+  ret = kms_rtp_synchronizer_process_rtp_buffer_pts (self, buffer, &pts,
+      error);
 
-  gst_rtp_buffer_unmap (&rtp_buffer);
+  if (pts != GST_BUFFER_PTS (buffer)) {
+    GST_BUFFER_PTS (buffer) = pts;
+  }
 
   return ret;
 }
@@ -90,11 +90,22 @@ struct _KmsRtpSynchronizerClass
 
 GType kms_rtp_synchronizer_get_type ();
 
-// 'stats_name': Name of the stats file that will be generated if
+// Flags of the records written to the stats trace (see kmstracerecorder.h)
+#define KMS_RTP_SYNC_TRACE_FLAG_SR (1 << 0)      // PTS derived from RTCP SR
+#define KMS_RTP_SYNC_TRACE_FLAG_SORTED (1 << 1)  // Feeded sorted mode
+
+// 'stats_name': Name of the binary trace file that will be generated if
 // the environment variable "KMS_RTP_SYNC_STATS_PATH" is set. Can be NULL.
+// "KMS_RTP_SYNC_STATS_RECORDS" sets the size of the trace ring (in records).
+// Convert the traces to CSV with 'kms-trace-to-csv'.
 KmsRtpSynchronizer * kms_rtp_synchronizer_new (gboolean feeded_ordered,
     const gchar * stats_name);
 
+// Decide whether the synchronizers of a new set of streams (e.g. the audio
+// and video of one endpoint) should record stats. Follows the percentage in
+// the environment variable "KMS_RTP_SYNC_STATS_SAMPLING" (default 100).
+gboolean kms_rtp_synchronizer_stats_sample (void);
+
 gboolean kms_rtp_synchronizer_add_clock_rate_for_pt (KmsRtpSynchronizer * self,
                                                      gint32 pt,
                                                      gint32 clock_rate,
@@ -110,6 +121,14 @@ gboolean kms_rtp_synchronizer_process_rtp_buffer (KmsRtpSynchronizer * self,
                                                   GstBuffer * buffer,
                                                   GError ** error);
 
+// Same as 'kms_rtp_synchronizer_process_rtp_buffer()', but the adjusted PTS
+// is returned in 'pts' and the buffer is left untouched, so callers only need
+// to make it writable when the PTS actually changes
+gboolean kms_rtp_synchronizer_process_rtp_buffer_pts (KmsRtpSynchronizer * self,
+                                                      GstBuffer * buffer,
+                                                      GstClockTime * pts,
+                                                      GError ** error);
+
 G_END_DECLS
 
 #endif /* __KMS_RTP_SYNCHRONIZER_H__ */
@@ -43,10 +43,31 @@ kms_sdp_session_new (KmsBaseSdpEndpoint * ep, guint id)
   return self;
 }
 
+/*
+ * The negotiated description is the local or the remote one, so it is
+ * shared with them instead of copied. A message is freed once none of the
+ * three descriptions points to it.
+ */
+static void
+kms_sdp_session_set_sdp (KmsSdpSession * self, GstSDPMessage ** sdp,
+    GstSDPMessage * new_sdp)
+{
+  GstSDPMessage *old = *sdp;
+
+  *sdp = new_sdp;
+
+  if (old == NULL || old == self->local_sdp || old == self->remote_sdp
+      || old == self->neg_sdp) {
+    return;
+  }
+
+  gst_sdp_message_free (old);
+}
+
 GstSDPMessage *
 kms_sdp_session_generate_offer (KmsSdpSession * self)
 {
-  GstSDPMessage *offer = NULL;
+  GstSDPMessage *offer = NULL, *copy;
   GError *err = NULL;
   gchar *sdp_str = NULL;
 
@@ -62,11 +83,14 @@ kms_sdp_session_generate_offer (KmsSdpSession * self)
     goto error;
   }
 
-  if (gst_sdp_message_copy (offer, &self->local_sdp) != GST_SDP_OK) {
+  /* The offer is returned to the caller, which owns and frees it */
+  if (gst_sdp_message_copy (offer, &copy) != GST_SDP_OK) {
     GST_ERROR_OBJECT (self, "Generating SDP Offer: gst_sdp_message_copy");
     goto error;
   }
 
+  kms_sdp_session_set_sdp (self, &self->local_sdp, copy);
+
   GST_DEBUG_OBJECT (self, "Generated SDP Offer:\n%s",
       (sdp_str = gst_sdp_message_as_text (offer)));
   g_free (sdp_str);
@@ -96,12 +120,15 @@ kms_sdp_session_process_offer (KmsSdpSession * self, GstSDPMessage * offer)
   g_free (sdp_str);
   sdp_str = NULL;
 
-  if (self->remote_sdp != NULL) {
-    gst_sdp_message_free (self->remote_sdp);
+  if (gst_sdp_message_copy (offer, &copy) != GST_SDP_OK) {
+    GST_ERROR_OBJECT (self, "Processing SDP Offer: Cannot copy SDP message");
+    goto error;
   }
 
-  gst_sdp_message_copy (offer, &self->remote_sdp);
+  kms_sdp_session_set_sdp (self, &self->remote_sdp, copy);
 
+  /* The agent takes ownership of its description and replaces it on its */
+  /* own negotiation steps, so it cannot share the one kept here */
   if (gst_sdp_message_copy (offer, &copy) != GST_SDP_OK) {
     GST_ERROR_OBJECT (self, "Processing SDP Offer: Cannot copy SDP message");
     goto error;
@@ -110,6 +137,7 @@ kms_sdp_session_process_offer (KmsSdpSession * self, GstSDPMessage * offer)
   kms_sdp_agent_set_remote_description (self->agent, copy, &err);
   if (err != NULL) {
     GST_ERROR_OBJECT (self, "Processing SDP Offer: %s", err->message);
+    gst_sdp_message_free (copy);
     goto error;
   }
 
@@ -126,15 +154,14 @@ kms_sdp_session_process_offer (KmsSdpSession * self, GstSDPMessage * offer)
     goto error;
   }
 
-  if (self->local_sdp != NULL) {
-    gst_sdp_message_free (self->local_sdp);
+  /* The answer is returned to the caller, which owns and frees it */
+  if (gst_sdp_message_copy (answer, &copy) != GST_SDP_OK) {
+    GST_ERROR_OBJECT (self, "Processing SDP Offer: Cannot copy SDP message");
+    goto error;
   }
-  gst_sdp_message_copy (answer, &self->local_sdp);
 
-  if (self->neg_sdp != NULL) {
-    gst_sdp_message_free (self->neg_sdp);
-  }
-  gst_sdp_message_copy (self->local_sdp, &self->neg_sdp);
+  kms_sdp_session_set_sdp (self, &self->local_sdp, copy);
+  kms_sdp_session_set_sdp (self, &self->neg_sdp, self->local_sdp);
 
   GST_DEBUG_OBJECT (self, "Generated SDP Answer:\n%s",
       (sdp_str = gst_sdp_message_as_text (answer)));
@@ -178,18 +205,18 @@ kms_sdp_session_process_answer (KmsSdpSession * self, GstSDPMessage * answer)
   kms_sdp_agent_set_remote_description (self->agent, copy, &err);
   if (err != NULL) {
     GST_ERROR_OBJECT (self, "Processing SDP Answer: %s", err->message);
+    gst_sdp_message_free (copy);
+    g_error_free (err);
     return FALSE;
   }
 
-  if (self->remote_sdp != NULL) {
-    gst_sdp_message_free (self->remote_sdp);
+  if (gst_sdp_message_copy (answer, &copy) != GST_SDP_OK) {
+    GST_ERROR_OBJECT (self, "Processing SDP Answer: Cannot copy SDP message");
+    return FALSE;
   }
-  gst_sdp_message_copy (answer, &self->remote_sdp);
 
-  if (self->neg_sdp != NULL) {
-    gst_sdp_message_free (self->neg_sdp);
-  }
-  gst_sdp_message_copy (self->remote_sdp, &self->neg_sdp);
+  kms_sdp_session_set_sdp (self, &self->remote_sdp, copy);
+  kms_sdp_session_set_sdp (self, &self->neg_sdp, self->remote_sdp);
 
   return TRUE;
 }
@@ -251,17 +278,9 @@ kms_sdp_session_finalize (GObject * object)
 
   GST_LOG_OBJECT (self, "finalize");
 
-  if (self->local_sdp != NULL) {
-    gst_sdp_message_free (self->local_sdp);
-  }
-
-  if (self->remote_sdp != NULL) {
-    gst_sdp_message_free (self->remote_sdp);
-  }
-
-  if (self->neg_sdp != NULL) {
-    gst_sdp_message_free (self->neg_sdp);
-  }
+  kms_sdp_session_set_sdp (self, &self->local_sdp, NULL);
+  kms_sdp_session_set_sdp (self, &self->remote_sdp, NULL);
+  kms_sdp_session_set_sdp (self, &self->neg_sdp, NULL);
 
   g_clear_object (&self->ptmanager);
   g_clear_object (&self->agent);
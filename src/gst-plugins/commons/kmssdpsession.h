@@ -63,7 +63,7 @@ struct _KmsSdpSession
   KmsSdpPayloadManager *ptmanager;
   GstSDPMessage *local_sdp;
   GstSDPMessage *remote_sdp;
-  GstSDPMessage *neg_sdp;
+  GstSDPMessage *neg_sdp;      /* local_sdp or remote_sdp, not a copy */
 };
 
 struct _KmsSdpSessionClass
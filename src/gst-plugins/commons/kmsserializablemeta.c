@@ -17,6 +17,14 @@
 
 #include "kmsserializablemeta.h"
 
+#include <string.h>
+
+#define DEFAULT_NAME "metadata"
+
+#define SERIALIZED_MAGIC_0 'K'
+#define SERIALIZED_MAGIC_1 'S'
+#define SERIALIZED_VERSION 1
+
 GType
 kms_serializable_meta_api_get_type (void)
 {
@@ -38,6 +46,508 @@ kms_serializable_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
   KmsSerializableMeta *smeta = (KmsSerializableMeta *) meta;
 
   smeta->data = NULL;
+  smeta->name = 0;
+  smeta->fields = smeta->inline_fields;
+  smeta->n_fields = 0;
+  smeta->max_fields = KMS_SERIALIZABLE_META_INLINE_FIELDS;
+  smeta->arena = smeta->inline_arena;
+  smeta->arena_used = 0;
+  smeta->arena_size = KMS_SERIALIZABLE_META_INLINE_ARENA;
+
+  return TRUE;
+}
+
+static KmsSerializableField *
+kms_serializable_meta_find_field (KmsSerializableMeta * meta, GQuark key)
+{
+  guint i;
+
+  for (i = 0; i < meta->n_fields; i++) {
+    if (meta->fields[i].key == key) {
+      return &meta->fields[i];
+    }
+  }
+
+  return NULL;
+}
+
+static KmsSerializableField *
+kms_serializable_meta_get_field (KmsSerializableMeta * meta, GQuark key)
+{
+  KmsSerializableField *field = kms_serializable_meta_find_field (meta, key);
+
+  if (field != NULL) {
+    return field;
+  }
+
+  if (meta->n_fields == meta->max_fields) {
+    KmsSerializableField *fields;
+
+    fields = g_new (KmsSerializableField, meta->max_fields * 2);
+    memcpy (fields, meta->fields,
+        meta->n_fields * sizeof (KmsSerializableField));
+
+    if (meta->fields != meta->inline_fields) {
+      g_free (meta->fields);
+    }
+
+    meta->fields = fields;
+    meta->max_fields *= 2;
+  }
+
+  field = &meta->fields[meta->n_fields++];
+  field->key = key;
+
+  return field;
+}
+
+/* Copies 'size' bytes to the arena. Overwritten strings are not reclaimed, */
+/* the arena lives as long as the buffer */
+static gboolean
+kms_serializable_meta_store_bytes (KmsSerializableMeta * meta,
+    KmsSerializableField * field, const guint8 * bytes, gsize size)
+{
+  if (size > G_MAXUINT16) {
+    GST_WARNING ("Value of field %s is too big: %" G_GSIZE_FORMAT " bytes",
+        g_quark_to_string (field->key), size);
+    return FALSE;
+  }
+
+  if (meta->arena_used + size > meta->arena_size) {
+    gsize arena_size = meta->arena_size;
+    gboolean in_arena;
+    gsize offset = 0;
+    guint8 *arena;
+
+    /* The source may be another field of this meta, as in copying one */
+    /* string field to another. Locate it before the arena moves */
+    in_arena = bytes >= meta->arena && bytes < meta->arena + meta->arena_used;
+    if (in_arena) {
+      offset = bytes - meta->arena;
+    }
+
+    while (meta->arena_used + size > arena_size) {
+      arena_size *= 2;
+    }
+
+    arena = g_malloc (arena_size);
+    memcpy (arena, meta->arena, meta->arena_used);
+
+    if (meta->arena != meta->inline_arena) {
+      g_free (meta->arena);
+    }
+
+    meta->arena = arena;
+    meta->arena_size = arena_size;
+
+    if (in_arena) {
+      bytes = meta->arena + offset;
+    }
+  }
+
+  memcpy (meta->arena + meta->arena_used, bytes, size);
+  field->v.offset = meta->arena_used;
+  field->size = size;
+  meta->arena_used += size;
+
+  return TRUE;
+}
+
+static const gchar *
+kms_serializable_field_get_bytes (KmsSerializableMeta * meta,
+    KmsSerializableField * field)
+{
+  if (field->size == 0) {
+    return NULL;
+  }
+
+  return (const gchar *) meta->arena + field->v.offset;
+}
+
+static gboolean
+kms_serializable_field_to_value (KmsSerializableMeta * meta,
+    KmsSerializableField * field, GValue * value)
+{
+  const gchar *bytes;
+  GType type;
+
+  switch (field->type) {
+    case KMS_SERIALIZABLE_TYPE_BOOLEAN:
+      g_value_init (value, G_TYPE_BOOLEAN);
+      g_value_set_boolean (value, field->v.i != 0);
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_INT:
+      g_value_init (value, G_TYPE_INT);
+      g_value_set_int (value, field->v.i);
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_UINT:
+      g_value_init (value, G_TYPE_UINT);
+      g_value_set_uint (value, field->v.u);
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_INT64:
+      g_value_init (value, G_TYPE_INT64);
+      g_value_set_int64 (value, field->v.i);
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_UINT64:
+      g_value_init (value, G_TYPE_UINT64);
+      g_value_set_uint64 (value, field->v.u);
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_FLOAT:
+      g_value_init (value, G_TYPE_FLOAT);
+      g_value_set_float (value, field->v.d);
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_DOUBLE:
+      g_value_init (value, G_TYPE_DOUBLE);
+      g_value_set_double (value, field->v.d);
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_STRING:
+      g_value_init (value, G_TYPE_STRING);
+      g_value_set_string (value, kms_serializable_field_get_bytes (meta,
+              field));
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_VALUE:
+      /* Type name and serialized value, both nul terminated */
+      bytes = kms_serializable_field_get_bytes (meta, field);
+      type = g_type_from_name (bytes);
+
+      if (type == G_TYPE_INVALID) {
+        GST_WARNING ("Unknown type %s for field %s", bytes,
+            g_quark_to_string (field->key));
+        return FALSE;
+      }
+
+      g_value_init (value, type);
+      if (!gst_value_deserialize (value, bytes + strlen (bytes) + 1)) {
+        GST_WARNING ("Cannot deserialize field %s",
+            g_quark_to_string (field->key));
+        g_value_unset (value);
+        return FALSE;
+      }
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/* Keeps the GstStructure view, if somebody asked for it, up to date */
+static void
+kms_serializable_meta_sync_view (KmsSerializableMeta * meta,
+    KmsSerializableField * field)
+{
+  GValue value = G_VALUE_INIT;
+
+  if (meta->data == NULL) {
+    return;
+  }
+
+  if (kms_serializable_field_to_value (meta, field, &value)) {
+    gst_structure_id_take_value (meta->data, field->key, &value);
+  }
+}
+
+/* Getters can run on buffers shared between threads, so the view is */
+/* built aside and published atomically. Only writers, which own the */
+/* buffer, change it afterwards */
+static GstStructure *
+kms_serializable_meta_ensure_view (KmsSerializableMeta * meta)
+{
+  GstStructure *data;
+  guint i;
+
+  data = g_atomic_pointer_get (&meta->data);
+  if (data != NULL) {
+    return data;
+  }
+
+  data = gst_structure_new_id_empty (meta->name != 0 ? meta->name :
+      g_quark_from_static_string (DEFAULT_NAME));
+
+  for (i = 0; i < meta->n_fields; i++) {
+    GValue value = G_VALUE_INIT;
+
+    if (kms_serializable_field_to_value (meta, &meta->fields[i], &value)) {
+      gst_structure_id_take_value (data, meta->fields[i].key, &value);
+    }
+  }
+
+  if (!g_atomic_pointer_compare_and_exchange (&meta->data, NULL, data)) {
+    /* Another reader won */
+    gst_structure_free (data);
+    data = g_atomic_pointer_get (&meta->data);
+  }
+
+  return data;
+}
+
+static void
+kms_serializable_meta_set_number (KmsSerializableMeta * meta, GQuark key,
+    KmsSerializableType type, guint64 bits)
+{
+  KmsSerializableField *field = kms_serializable_meta_get_field (meta, key);
+
+  field->type = type;
+  field->size = 0;
+  field->v.u = bits;
+
+  kms_serializable_meta_sync_view (meta, field);
+}
+
+void
+kms_serializable_meta_set_boolean (KmsSerializableMeta * meta, GQuark key,
+    gboolean value)
+{
+  kms_serializable_meta_set_number (meta, key, KMS_SERIALIZABLE_TYPE_BOOLEAN,
+      value ? 1 : 0);
+}
+
+void
+kms_serializable_meta_set_int (KmsSerializableMeta * meta, GQuark key,
+    gint value)
+{
+  kms_serializable_meta_set_number (meta, key, KMS_SERIALIZABLE_TYPE_INT,
+      (guint64) (gint64) value);
+}
+
+void
+kms_serializable_meta_set_uint (KmsSerializableMeta * meta, GQuark key,
+    guint value)
+{
+  kms_serializable_meta_set_number (meta, key, KMS_SERIALIZABLE_TYPE_UINT,
+      value);
+}
+
+void
+kms_serializable_meta_set_int64 (KmsSerializableMeta * meta, GQuark key,
+    gint64 value)
+{
+  kms_serializable_meta_set_number (meta, key, KMS_SERIALIZABLE_TYPE_INT64,
+      (guint64) value);
+}
+
+void
+kms_serializable_meta_set_uint64 (KmsSerializableMeta * meta, GQuark key,
+    guint64 value)
+{
+  kms_serializable_meta_set_number (meta, key, KMS_SERIALIZABLE_TYPE_UINT64,
+      value);
+}
+
+static void
+kms_serializable_meta_set_floating (KmsSerializableMeta * meta, GQuark key,
+    KmsSerializableType type, gdouble value)
+{
+  KmsSerializableField *field = kms_serializable_meta_get_field (meta, key);
+
+  field->type = type;
+  field->size = 0;
+  field->v.d = value;
+
+  kms_serializable_meta_sync_view (meta, field);
+}
+
+void
+kms_serializable_meta_set_double (KmsSerializableMeta * meta, GQuark key,
+    gdouble value)
+{
+  kms_serializable_meta_set_floating (meta, key, KMS_SERIALIZABLE_TYPE_DOUBLE,
+      value);
+}
+
+static void
+kms_serializable_meta_set_bytes (KmsSerializableMeta * meta, GQuark key,
+    KmsSerializableType type, const guint8 * bytes, gsize size)
+{
+  KmsSerializableField *field = kms_serializable_meta_get_field (meta, key);
+
+  field->type = type;
+  field->size = 0;
+
+  if (size > 0 && !kms_serializable_meta_store_bytes (meta, field, bytes,
+          size)) {
+    /* Keep the field, but empty */
+    field->type = KMS_SERIALIZABLE_TYPE_STRING;
+  }
+
+  kms_serializable_meta_sync_view (meta, field);
+}
+
+void
+kms_serializable_meta_set_string (KmsSerializableMeta * meta, GQuark key,
+    const gchar * value)
+{
+  kms_serializable_meta_set_bytes (meta, key, KMS_SERIALIZABLE_TYPE_STRING,
+      (const guint8 *) value, value != NULL ? strlen (value) + 1 : 0);
+}
+
+void
+kms_serializable_meta_set_value (KmsSerializableMeta * meta, GQuark key,
+    const GValue * value)
+{
+  GType type = G_VALUE_TYPE (value);
+  gchar *serialized;
+  GString *bytes;
+
+  switch (type) {
+    case G_TYPE_BOOLEAN:
+      kms_serializable_meta_set_boolean (meta, key,
+          g_value_get_boolean (value));
+      return;
+    case G_TYPE_INT:
+      kms_serializable_meta_set_int (meta, key, g_value_get_int (value));
+      return;
+    case G_TYPE_UINT:
+      kms_serializable_meta_set_uint (meta, key, g_value_get_uint (value));
+      return;
+    case G_TYPE_INT64:
+      kms_serializable_meta_set_int64 (meta, key, g_value_get_int64 (value));
+      return;
+    case G_TYPE_UINT64:
+      kms_serializable_meta_set_uint64 (meta, key,
+          g_value_get_uint64 (value));
+      return;
+    case G_TYPE_FLOAT:
+      kms_serializable_meta_set_floating (meta, key,
+          KMS_SERIALIZABLE_TYPE_FLOAT, g_value_get_float (value));
+      return;
+    case G_TYPE_DOUBLE:
+      kms_serializable_meta_set_double (meta, key, g_value_get_double (value));
+      return;
+    case G_TYPE_STRING:
+      kms_serializable_meta_set_string (meta, key, g_value_get_string (value));
+      return;
+    default:
+      break;
+  }
+
+  /* Slow path for anything else: structures, caps, fractions... */
+  serialized = gst_value_serialize (value);
+  if (serialized == NULL) {
+    GST_WARNING ("Cannot serialize field %s of type %s",
+        g_quark_to_string (key), g_type_name (type));
+    return;
+  }
+
+  bytes = g_string_new (g_type_name (type));
+  g_string_append_len (bytes, "", 1);
+  g_string_append_len (bytes, serialized, strlen (serialized) + 1);
+
+  kms_serializable_meta_set_bytes (meta, key, KMS_SERIALIZABLE_TYPE_VALUE,
+      (const guint8 *) bytes->str, bytes->len);
+
+  g_string_free (bytes, TRUE);
+  g_free (serialized);
+}
+
+guint
+kms_serializable_meta_get_n_fields (KmsSerializableMeta * meta)
+{
+  return meta->n_fields;
+}
+
+gboolean
+kms_serializable_meta_has_field (KmsSerializableMeta * meta, GQuark key)
+{
+  return kms_serializable_meta_find_field (meta, key) != NULL;
+}
+
+gboolean
+kms_serializable_meta_get_int64 (KmsSerializableMeta * meta, GQuark key,
+    gint64 * value)
+{
+  KmsSerializableField *field = kms_serializable_meta_find_field (meta, key);
+
+  if (field == NULL) {
+    return FALSE;
+  }
+
+  switch (field->type) {
+    case KMS_SERIALIZABLE_TYPE_BOOLEAN:
+    case KMS_SERIALIZABLE_TYPE_INT:
+    case KMS_SERIALIZABLE_TYPE_INT64:
+      *value = field->v.i;
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_UINT:
+    case KMS_SERIALIZABLE_TYPE_UINT64:
+      *value = field->v.u;
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_FLOAT:
+    case KMS_SERIALIZABLE_TYPE_DOUBLE:
+      *value = field->v.d;
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+gboolean
+kms_serializable_meta_get_double (KmsSerializableMeta * meta, GQuark key,
+    gdouble * value)
+{
+  KmsSerializableField *field = kms_serializable_meta_find_field (meta, key);
+
+  if (field == NULL) {
+    return FALSE;
+  }
+
+  switch (field->type) {
+    case KMS_SERIALIZABLE_TYPE_BOOLEAN:
+    case KMS_SERIALIZABLE_TYPE_INT:
+    case KMS_SERIALIZABLE_TYPE_INT64:
+      *value = field->v.i;
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_UINT:
+    case KMS_SERIALIZABLE_TYPE_UINT64:
+      *value = field->v.u;
+      return TRUE;
+    case KMS_SERIALIZABLE_TYPE_FLOAT:
+    case KMS_SERIALIZABLE_TYPE_DOUBLE:
+      *value = field->v.d;
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+const gchar *
+kms_serializable_meta_get_string (KmsSerializableMeta * meta, GQuark key)
+{
+  KmsSerializableField *field = kms_serializable_meta_find_field (meta, key);
+
+  if (field == NULL || field->type != KMS_SERIALIZABLE_TYPE_STRING) {
+    return NULL;
+  }
+
+  return kms_serializable_field_get_bytes (meta, field);
+}
+
+static void
+kms_serializable_meta_merge (KmsSerializableMeta * dest,
+    KmsSerializableMeta * src)
+{
+  guint i;
+
+  for (i = 0; i < src->n_fields; i++) {
+    KmsSerializableField *field = &src->fields[i];
+
+    switch (field->type) {
+      case KMS_SERIALIZABLE_TYPE_STRING:
+      case KMS_SERIALIZABLE_TYPE_VALUE:
+        kms_serializable_meta_set_bytes (dest, field->key, field->type,
+            (const guint8 *) kms_serializable_field_get_bytes (src, field),
+            field->size);
+        break;
+      default:
+        kms_serializable_meta_set_number (dest, field->key, field->type,
+            field->v.u);
+        break;
+    }
+  }
+}
+
+static gboolean
+add_fields_to_meta (GQuark field_id, const GValue * value, gpointer meta)
+{
+  kms_serializable_meta_set_value (meta, field_id, value);
 
   return TRUE;
 }
@@ -46,19 +556,25 @@ static gboolean
 kms_serializable_meta_transform (GstBuffer * transbuf, GstMeta * meta,
     GstBuffer * buffer, GQuark type, gpointer data)
 {
-  KmsSerializableMeta *smeta;
+  KmsSerializableMeta *smeta, *dest;
+  GstStructure *view;
 
   if (GST_META_TRANSFORM_IS_COPY (type)) {
-    GstStructure *copy = NULL;
-
     smeta = (KmsSerializableMeta *) meta;
 
-    if (smeta->data != NULL) {
-      copy = gst_structure_copy (smeta->data);
-    }
-
     GST_DEBUG ("copy serializable metadata");
-    kms_buffer_add_serializable_meta (transbuf, copy);
+    dest = kms_buffer_get_or_add_serializable_meta (transbuf,
+        g_quark_to_string (smeta->name));
+
+    view = g_atomic_pointer_get (&smeta->data);
+    if (view != NULL) {
+      /* The view may have been edited in place, removals included, so it */
+      /* is what gets copied. The copy gets a view too.                   */
+      gst_structure_foreach (view, add_fields_to_meta, dest);
+      kms_serializable_meta_ensure_view (dest);
+    } else {
+      kms_serializable_meta_merge (dest, smeta);
+    }
   }
 
   return TRUE;
@@ -72,6 +588,14 @@ kms_serializable_meta_free (GstMeta * meta, GstBuffer * buffer)
   if (smeta->data != NULL) {
     gst_structure_free (smeta->data);
   }
+
+  if (smeta->fields != smeta->inline_fields) {
+    g_free (smeta->fields);
+  }
+
+  if (smeta->arena != smeta->inline_arena) {
+    g_free (smeta->arena);
+  }
 }
 
 const GstMetaInfo *
@@ -96,22 +620,21 @@ kms_serializable_meta_get_info (void)
 KmsSerializableMeta *
 kms_buffer_get_serializable_meta (GstBuffer * b)
 {
-  return ((KmsSerializableMeta *) gst_buffer_get_meta ((b),
-          KMS_SERIALIZABLE_META_API_TYPE));
-}
+  KmsSerializableMeta *meta;
 
-gboolean
-add_fields_to_structure (GQuark field_id, const GValue * value, gpointer st)
-{
-  GstStructure *data = GST_STRUCTURE (st);
+  meta = (KmsSerializableMeta *) gst_buffer_get_meta ((b),
+      KMS_SERIALIZABLE_META_API_TYPE);
 
-  gst_structure_id_set_value (data, field_id, value);
+  if (meta != NULL) {
+    kms_serializable_meta_ensure_view (meta);
+  }
 
-  return TRUE;
+  return meta;
 }
 
 KmsSerializableMeta *
-kms_buffer_add_serializable_meta (GstBuffer * buffer, GstStructure * data)
+kms_buffer_get_or_add_serializable_meta (GstBuffer * buffer,
+    const gchar * name)
 {
   KmsSerializableMeta *meta;
 
@@ -120,15 +643,34 @@ kms_buffer_add_serializable_meta (GstBuffer * buffer, GstStructure * data)
   meta = (KmsSerializableMeta *) gst_buffer_get_meta (buffer,
       KMS_SERIALIZABLE_META_API_TYPE);
 
-  if (meta != NULL) {
-    gst_structure_foreach (data, add_fields_to_structure, meta->data);
-    gst_structure_free (data);
-
-  } else {
+  if (meta == NULL) {
     meta = (KmsSerializableMeta *) gst_buffer_add_meta (buffer,
         KMS_SERIALIZABLE_META_INFO, NULL);
+    meta->name = name != NULL ? g_quark_from_string (name) : 0;
+  }
 
+  return meta;
+}
+
+KmsSerializableMeta *
+kms_buffer_add_serializable_meta (GstBuffer * buffer, GstStructure * data)
+{
+  KmsSerializableMeta *meta;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+  meta = kms_buffer_get_or_add_serializable_meta (buffer,
+      gst_structure_get_name (data));
+
+  if (meta->n_fields == 0 && meta->data == NULL) {
+    /* The given structure already is the view of the new fields */
+    gst_structure_foreach (data, add_fields_to_meta, meta);
     meta->data = data;
+  } else {
+    gst_structure_foreach (data, add_fields_to_meta, meta);
+    gst_structure_free (data);
+    /* Metas made from a GstStructure always have their view */
+    kms_serializable_meta_ensure_view (meta);
   }
 
   return meta;
@@ -148,5 +690,266 @@ kms_serializable_meta_get_metadata (GstBuffer * buffer)
     return NULL;
   }
 
-  return meta->data;
+  return kms_serializable_meta_ensure_view (meta);
+}
+
+/*
+ * Binary format, integers in network byte order:
+ *
+ *   'K' 'S' version(1) | name length(1) name | number of fields(2)
+ *   field: type(1) | key length(1) key | value
+ *
+ * Numbers are 8 byte values, doubles as their IEEE 754 bits. Strings and
+ * other values are a length(2) followed by that many bytes, nul included.
+ */
+
+typedef struct _Writer
+{
+  guint8 *dest;
+  gsize size;
+  gsize pos;
+} Writer;
+
+static void
+writer_put (Writer * w, const void *bytes, gsize len)
+{
+  if (len > 0 && w->pos + len <= w->size) {
+    memcpy (w->dest + w->pos, bytes, len);
+  }
+  w->pos += len;
+}
+
+static void
+writer_put_uint8 (Writer * w, guint8 value)
+{
+  writer_put (w, &value, 1);
+}
+
+static void
+writer_put_uint16 (Writer * w, guint16 value)
+{
+  guint8 bytes[2];
+
+  GST_WRITE_UINT16_BE (bytes, value);
+  writer_put (w, bytes, 2);
+}
+
+static void
+writer_put_uint64 (Writer * w, guint64 value)
+{
+  guint8 bytes[8];
+
+  GST_WRITE_UINT64_BE (bytes, value);
+  writer_put (w, bytes, 8);
+}
+
+static void
+writer_put_key (Writer * w, GQuark key)
+{
+  const gchar *str = key != 0 ? g_quark_to_string (key) : "";
+  gsize len = strlen (str);
+
+  writer_put_uint8 (w, len);
+  writer_put (w, str, len);
+}
+
+static gboolean
+kms_serializable_meta_key_fits (GQuark key)
+{
+  return key == 0 || strlen (g_quark_to_string (key)) <= G_MAXUINT8;
+}
+
+gsize
+kms_serializable_meta_serialize (KmsSerializableMeta * meta, guint8 * dest,
+    gsize size)
+{
+  Writer w = { dest, dest != NULL ? size : 0, 0 };
+  guint i, n_fields = 0;
+
+  g_return_val_if_fail (meta != NULL, 0);
+
+  for (i = 0; i < meta->n_fields; i++) {
+    if (kms_serializable_meta_key_fits (meta->fields[i].key)) {
+      n_fields++;
+    }
+  }
+
+  writer_put_uint8 (&w, SERIALIZED_MAGIC_0);
+  writer_put_uint8 (&w, SERIALIZED_MAGIC_1);
+  writer_put_uint8 (&w, SERIALIZED_VERSION);
+  writer_put_key (&w, kms_serializable_meta_key_fits (meta->name) ?
+      meta->name : 0);
+  writer_put_uint16 (&w, n_fields);
+
+  for (i = 0; i < meta->n_fields; i++) {
+    KmsSerializableField *field = &meta->fields[i];
+
+    if (!kms_serializable_meta_key_fits (field->key)) {
+      GST_WARNING ("Key %s is too long, not serialized",
+          g_quark_to_string (field->key));
+      continue;
+    }
+
+    writer_put_uint8 (&w, field->type);
+    writer_put_key (&w, field->key);
+
+    if (field->type == KMS_SERIALIZABLE_TYPE_STRING
+        || field->type == KMS_SERIALIZABLE_TYPE_VALUE) {
+      writer_put_uint16 (&w, field->size);
+      writer_put (&w, kms_serializable_field_get_bytes (meta, field),
+          field->size);
+    } else {
+      writer_put_uint64 (&w, field->v.u);
+    }
+  }
+
+  return w.pos;
+}
+
+typedef struct _Reader
+{
+  const guint8 *data;
+  gsize size;
+  gsize pos;
+} Reader;
+
+static const guint8 *
+reader_get (Reader * r, gsize len)
+{
+  const guint8 *bytes;
+
+  if (r->size - r->pos < len) {
+    return NULL;
+  }
+
+  bytes = r->data + r->pos;
+  r->pos += len;
+
+  return bytes;
+}
+
+static gboolean
+reader_get_key (Reader * r, gchar key[G_MAXUINT8 + 1])
+{
+  const guint8 *bytes;
+  guint8 len;
+
+  if ((bytes = reader_get (r, 1)) == NULL) {
+    return FALSE;
+  }
+
+  len = bytes[0];
+  if ((bytes = reader_get (r, len)) == NULL) {
+    return FALSE;
+  }
+
+  memcpy (key, bytes, len);
+  key[len] = '\0';
+
+  return TRUE;
+}
+
+/* Checks the whole data when 'meta' is NULL, fills 'meta' otherwise */
+static gboolean
+kms_serializable_meta_parse (const guint8 * data, gsize size,
+    KmsSerializableMeta * meta, gchar name[G_MAXUINT8 + 1])
+{
+  Reader r = { data, size, 0 };
+  gchar key[G_MAXUINT8 + 1];
+  const guint8 *bytes;
+  guint n_fields, i;
+
+  bytes = reader_get (&r, 3);
+  if (bytes == NULL || bytes[0] != SERIALIZED_MAGIC_0
+      || bytes[1] != SERIALIZED_MAGIC_1 || bytes[2] != SERIALIZED_VERSION) {
+    return FALSE;
+  }
+
+  if (!reader_get_key (&r, name) || (bytes = reader_get (&r, 2)) == NULL) {
+    return FALSE;
+  }
+
+  n_fields = GST_READ_UINT16_BE (bytes);
+
+  for (i = 0; i < n_fields; i++) {
+    guint8 type;
+    guint16 len;
+
+    if ((bytes = reader_get (&r, 1)) == NULL) {
+      return FALSE;
+    }
+    type = bytes[0];
+
+    if (!reader_get_key (&r, key)) {
+      return FALSE;
+    }
+
+    switch (type) {
+      case KMS_SERIALIZABLE_TYPE_BOOLEAN:
+      case KMS_SERIALIZABLE_TYPE_INT:
+      case KMS_SERIALIZABLE_TYPE_UINT:
+      case KMS_SERIALIZABLE_TYPE_INT64:
+      case KMS_SERIALIZABLE_TYPE_UINT64:
+      case KMS_SERIALIZABLE_TYPE_FLOAT:
+      case KMS_SERIALIZABLE_TYPE_DOUBLE:
+        if ((bytes = reader_get (&r, 8)) == NULL) {
+          return FALSE;
+        }
+
+        if (meta != NULL) {
+          kms_serializable_meta_set_number (meta, g_quark_from_string (key),
+              type, GST_READ_UINT64_BE (bytes));
+        }
+        break;
+      case KMS_SERIALIZABLE_TYPE_STRING:
+      case KMS_SERIALIZABLE_TYPE_VALUE:
+        if ((bytes = reader_get (&r, 2)) == NULL) {
+          return FALSE;
+        }
+        len = GST_READ_UINT16_BE (bytes);
+
+        if ((bytes = reader_get (&r, len)) == NULL) {
+          return FALSE;
+        }
+
+        /* Strings are nul terminated, values are two strings */
+        if ((len > 0 && bytes[len - 1] != '\0')
+            || (type == KMS_SERIALIZABLE_TYPE_VALUE
+                && (len == 0 || memchr (bytes, '\0', len) == bytes + len - 1))) {
+          return FALSE;
+        }
+
+        if (meta != NULL) {
+          kms_serializable_meta_set_bytes (meta, g_quark_from_string (key),
+              type, bytes, len);
+        }
+        break;
+      default:
+        GST_WARNING ("Unknown type %u for field %s", type, key);
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+KmsSerializableMeta *
+kms_buffer_add_serializable_meta_from_bytes (GstBuffer * buffer,
+    const guint8 * data, gsize size)
+{
+  KmsSerializableMeta *meta;
+  gchar name[G_MAXUINT8 + 1];
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+  if (!kms_serializable_meta_parse (data, size, NULL, name)) {
+    GST_WARNING ("Invalid serialized metadata");
+    return NULL;
+  }
+
+  meta = kms_buffer_get_or_add_serializable_meta (buffer,
+      name[0] != '\0' ? name : NULL);
+  kms_serializable_meta_parse (data, size, meta, name);
+
+  return meta;
 }
@@ -25,19 +25,66 @@
 G_BEGIN_DECLS
 
 typedef struct _KmsSerializableMeta KmsSerializableMeta;
+typedef struct _KmsSerializableField KmsSerializableField;
+
+typedef enum
+{
+  KMS_SERIALIZABLE_TYPE_BOOLEAN = 1,
+  KMS_SERIALIZABLE_TYPE_INT,
+  KMS_SERIALIZABLE_TYPE_UINT,
+  KMS_SERIALIZABLE_TYPE_INT64,
+  KMS_SERIALIZABLE_TYPE_UINT64,
+  KMS_SERIALIZABLE_TYPE_FLOAT,
+  KMS_SERIALIZABLE_TYPE_DOUBLE,
+  KMS_SERIALIZABLE_TYPE_STRING,
+  /* Any other GValue, kept as its type name and gst_value_serialize() */
+  KMS_SERIALIZABLE_TYPE_VALUE,
+} KmsSerializableType;
+
+/* Fixed-width field. Strings live in the arena of the meta */
+struct _KmsSerializableField {
+  GQuark key;
+  guint16 type;
+  guint16 size;
+  union {
+    gint64 i;
+    guint64 u;
+    gdouble d;
+    guint32 offset;
+  } v;
+};
+
+#define KMS_SERIALIZABLE_META_INLINE_FIELDS 8
+#define KMS_SERIALIZABLE_META_INLINE_ARENA 128
 
 /**
  * KmsSerializableMeta:
  * @meta: the parent type
- * @ts: The time stamp
+ * @data: GstStructure view of the fields. It is set by
+ *   kms_buffer_add_serializable_meta(), otherwise built the first time
+ *   kms_serializable_meta_get_metadata() is called
  *
  * Metadata for sending aditional information that can be passed over network
- * with the buffer
+ * with the buffer. Fields are kept as typed fixed-width values keyed by
+ * quark, so small metadata such as face coordinates needs no allocations
+ * apart from the meta itself.
  */
 struct _KmsSerializableMeta {
   GstMeta       meta;
 
   GstStructure *data;
+
+  /*< private >*/
+  GQuark name;
+  KmsSerializableField *fields;
+  guint n_fields;
+  guint max_fields;
+  guint8 *arena;
+  gsize arena_used;
+  gsize arena_size;
+
+  KmsSerializableField inline_fields[KMS_SERIALIZABLE_META_INLINE_FIELDS];
+  guint8 inline_arena[KMS_SERIALIZABLE_META_INLINE_ARENA];
 };
 
 GType kms_serializable_meta_api_get_type (void);
@@ -84,11 +131,80 @@ KmsSerializableMeta * kms_buffer_add_serializable_meta (GstBuffer *buffer,
  * This function returns the metadata into a buffer. The metadata has the same
  * life cycle than the type which contains it in the buffer.
  *
+ * The structure is built from the typed fields the first time it is asked
+ * for, which is safe on buffers shared between threads, and kept up to date
+ * afterwards. Changes made directly to it, removed fields included, are
+ * kept when the buffer is copied, but they are not serialized: use the
+ * setters instead.
+ *
  * @param b: the buffer which contains the metadata
  * @return The metadata [transfer none]
  */
 GstStructure * kms_serializable_meta_get_metadata (GstBuffer *buffer);
 
+/**
+ * kms_buffer_get_or_add_serializable_meta
+ *
+ * Returns the metadata of the buffer, adding an empty one named 'name' if
+ * there is none. Fields are then set with the typed setters below.
+ */
+KmsSerializableMeta * kms_buffer_get_or_add_serializable_meta (
+  GstBuffer *buffer, const gchar *name);
+
+/* Typed access. Setting a field overwrites it whatever its previous type */
+void kms_serializable_meta_set_boolean (KmsSerializableMeta *meta,
+  GQuark key, gboolean value);
+void kms_serializable_meta_set_int (KmsSerializableMeta *meta, GQuark key,
+  gint value);
+void kms_serializable_meta_set_uint (KmsSerializableMeta *meta, GQuark key,
+  guint value);
+void kms_serializable_meta_set_int64 (KmsSerializableMeta *meta, GQuark key,
+  gint64 value);
+void kms_serializable_meta_set_uint64 (KmsSerializableMeta *meta,
+  GQuark key, guint64 value);
+void kms_serializable_meta_set_double (KmsSerializableMeta *meta,
+  GQuark key, gdouble value);
+void kms_serializable_meta_set_string (KmsSerializableMeta *meta,
+  GQuark key, const gchar *value);
+void kms_serializable_meta_set_value (KmsSerializableMeta *meta, GQuark key,
+  const GValue *value);
+
+guint kms_serializable_meta_get_n_fields (KmsSerializableMeta *meta);
+gboolean kms_serializable_meta_has_field (KmsSerializableMeta *meta,
+  GQuark key);
+
+/* Numeric getters convert from any numeric field type */
+gboolean kms_serializable_meta_get_int64 (KmsSerializableMeta *meta,
+  GQuark key, gint64 *value);
+gboolean kms_serializable_meta_get_double (KmsSerializableMeta *meta,
+  GQuark key, gdouble *value);
+/* The string belongs to the meta [transfer none] */
+const gchar * kms_serializable_meta_get_string (KmsSerializableMeta *meta,
+  GQuark key);
+
+/**
+ * kms_serializable_meta_serialize
+ *
+ * Writes the metadata in a compact binary format to 'dest' if 'size' is
+ * enough for it.
+ *
+ * @return The number of bytes the serialized metadata takes
+ */
+gsize kms_serializable_meta_serialize (KmsSerializableMeta *meta,
+  guint8 *dest, gsize size);
+
+/**
+ * kms_buffer_add_serializable_meta_from_bytes
+ *
+ * Parses data written by kms_serializable_meta_serialize() and merges it
+ * into the metadata of the buffer the same way
+ * kms_buffer_add_serializable_meta() does.
+ *
+ * @return The metadata of the buffer, or NULL if data is not valid
+ */
+KmsSerializableMeta * kms_buffer_add_serializable_meta_from_bytes (
+  GstBuffer *buffer, const guint8 *data, gsize size);
+
 G_END_DECLS
 
 #endif /* __KMS_SERIALIZABLE_META_H__ */
@@ -132,7 +132,10 @@ process_buffer_probe_cb (GstPad * pad, GstPadProbeInfo * info,
   } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
     GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
 
+    /* All buffers in the list share the same timestamp */
+    kms_utils_time_cache_begin ();
     gst_buffer_list_foreach (list, process_buffer_list_cb, user_data);
+    kms_utils_time_cache_end ();
   }
 
   return GST_PAD_PROBE_OK;
@@ -170,7 +173,7 @@ buffer_latency_probe_cb (GstBuffer * buffer, ProbeData * pdata)
   BufferLatencyValues *blv = (BufferLatencyValues *) pdata->invoke_data;
   GstClockTime time;
 
-  time = kms_utils_get_time_nsecs ();
+  time = kms_utils_get_cached_time_nsecs ();
 
   kms_buffer_add_buffer_latency_meta (buffer, time, blv->valid, blv->type);
 }
@@ -263,7 +266,7 @@ buffer_for_each_meta_cb (GstBuffer * buffer, GstMeta ** meta, ProbeData * pdata)
     return TRUE;
   }
 
-  now = kms_utils_get_time_nsecs ();
+  now = kms_utils_get_cached_time_nsecs ();
   diff = GST_CLOCK_DIFF (blmeta->ts, now);
 
   if (pdata->locked) {
@@ -0,0 +1,211 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmstracerecorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define GST_CAT_DEFAULT kms_trace_recorder_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "tracerecorder"
+
+G_STATIC_ASSERT (sizeof (KmsTraceFileHeader) == 128);
+G_STATIC_ASSERT (sizeof (KmsTraceRecord) == 64);
+
+struct _KmsTraceRecorder
+{
+  gpointer map;
+  gsize map_size;
+
+  KmsTraceFileHeader *header;
+  KmsTraceRecord *records;
+  guint64 mask;
+};
+
+static void
+kms_trace_recorder_init_debug (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+static void
+kms_trace_set_errno_error (GError ** error, const gchar * what,
+    const gchar * path, gint err)
+{
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (err),
+      "Cannot %s trace file '%s': %s", what, path, g_strerror (err));
+}
+
+KmsTraceRecorder *
+kms_trace_recorder_new (const gchar * path, const gchar * name,
+    guint capacity, GError ** error)
+{
+  KmsTraceRecorder *recorder;
+  gsize map_size;
+  gpointer map;
+  gint fd, err;
+
+  kms_trace_recorder_init_debug ();
+
+  capacity = MAX (capacity, 1);
+  if (capacity > G_MAXUINT / 2 + 1) {
+    capacity = G_MAXUINT / 2 + 1;
+  }
+  capacity = capacity > 1 ? 1u << g_bit_storage (capacity - 1) : 1;
+  map_size = sizeof (KmsTraceFileHeader) +
+      (gsize) capacity * sizeof (KmsTraceRecord);
+
+  fd = open (path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    kms_trace_set_errno_error (error, "create", path, errno);
+    return NULL;
+  }
+
+  /* Reserve the disk blocks now, so writing to the mapping cannot fault */
+  /* later because the disk is full */
+  err = posix_fallocate (fd, 0, map_size);
+  if (err != 0) {
+    kms_trace_set_errno_error (error, "allocate", path, err);
+    close (fd);
+    return NULL;
+  }
+
+  map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  err = errno;
+  close (fd);
+
+  if (map == MAP_FAILED) {
+    kms_trace_set_errno_error (error, "map", path, err);
+    return NULL;
+  }
+
+  recorder = g_slice_new0 (KmsTraceRecorder);
+  recorder->map = map;
+  recorder->map_size = map_size;
+  recorder->header = map;
+  recorder->records =
+      (KmsTraceRecord *) ((guint8 *) map + sizeof (KmsTraceFileHeader));
+  recorder->mask = capacity - 1;
+
+  memcpy (recorder->header->magic, KMS_TRACE_FILE_MAGIC,
+      sizeof (recorder->header->magic));
+  recorder->header->version = KMS_TRACE_FILE_VERSION;
+  recorder->header->record_size = sizeof (KmsTraceRecord);
+  recorder->header->capacity = capacity;
+  recorder->header->start_time = g_get_real_time ();
+  g_strlcpy (recorder->header->name, name != NULL ? name : "",
+      sizeof (recorder->header->name));
+
+  GST_DEBUG ("Trace file: %s, %u records", path, capacity);
+
+  return recorder;
+}
+
+void
+kms_trace_recorder_free (KmsTraceRecorder * recorder)
+{
+  if (recorder == NULL) {
+    return;
+  }
+
+  munmap (recorder->map, recorder->map_size);
+  g_slice_free (KmsTraceRecorder, recorder);
+}
+
+void
+kms_trace_recorder_write (KmsTraceRecorder * recorder,
+    const KmsTraceRecord * record)
+{
+  KmsTraceRecord *slot;
+  guint64 idx;
+
+  idx = __atomic_fetch_add (&recorder->header->head, 1, __ATOMIC_RELAXED);
+  slot = &recorder->records[idx & recorder->mask];
+
+  *slot = *record;
+  slot->wall_time = g_get_real_time ();
+}
+
+gboolean
+kms_trace_file_foreach (const gchar * path, KmsTraceFileFunc func,
+    gpointer user_data, GError ** error)
+{
+  const KmsTraceFileHeader *header;
+  const KmsTraceRecord *records;
+  GMappedFile *file;
+  guint64 count, idx;
+  gsize size;
+  gboolean ret = FALSE;
+
+  kms_trace_recorder_init_debug ();
+
+  file = g_mapped_file_new (path, FALSE, error);
+  if (file == NULL) {
+    return FALSE;
+  }
+
+  size = g_mapped_file_get_length (file);
+  header = (const KmsTraceFileHeader *) g_mapped_file_get_contents (file);
+
+  if (size < sizeof (KmsTraceFileHeader)
+      || memcmp (header->magic, KMS_TRACE_FILE_MAGIC,
+          sizeof (header->magic)) != 0) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "'%s' is not a trace file", path);
+    goto end;
+  }
+
+  if (header->version != KMS_TRACE_FILE_VERSION
+      || header->record_size != sizeof (KmsTraceRecord)
+      || header->capacity == 0
+      || (header->capacity & (header->capacity - 1)) != 0
+      || size < sizeof (KmsTraceFileHeader) +
+      (gsize) header->capacity * sizeof (KmsTraceRecord)) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Unsupported or truncated trace file '%s' (version %u)", path,
+        header->version);
+    goto end;
+  }
+
+  records = (const KmsTraceRecord *) ((const guint8 *) header +
+      sizeof (KmsTraceFileHeader));
+  count = MIN (header->head, header->capacity);
+
+  for (idx = header->head - count; idx < header->head; idx++) {
+    func (header, &records[idx & (header->capacity - 1)], user_data);
+  }
+
+  ret = TRUE;
+
+end:
+  g_mapped_file_unref (file);
+
+  return ret;
+}
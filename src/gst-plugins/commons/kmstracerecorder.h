@@ -0,0 +1,90 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_TRACE_RECORDER_H__
+#define __KMS_TRACE_RECORDER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Packet trace files: a fixed header followed by a ring of fixed-size
+ * binary records, preallocated and memory-mapped by the recorder. Writing
+ * a record is a copy into the mapping, with no syscalls or formatting, so
+ * it is cheap enough to stay enabled in production.
+ *
+ * All fields are stored in host byte order; files are meant to be
+ * converted on the same architecture (see kms-trace-to-csv).
+ */
+
+#define KMS_TRACE_FILE_MAGIC "KMSTRACE"
+#define KMS_TRACE_FILE_VERSION 1
+
+typedef struct _KmsTraceFileHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 record_size;
+  guint32 capacity;             /* Number of records in the ring */
+  guint32 reserved;
+  guint64 head;                 /* Records written since creation */
+  gint64 start_time;            /* Wall time (us) of creation */
+  gchar name[88];
+} KmsTraceFileHeader;
+
+typedef struct _KmsTraceRecord
+{
+  gint64 wall_time;             /* Wall time (us), set by the recorder */
+  guint64 pts_in;
+  guint64 pts_out;
+  guint64 dts;
+  guint64 ref_ntp_time;         /* Reference timing (ns), e.g. last RTCP SR */
+  guint32 ref_rtp_ts;           /* RTP time matching 'ref_ntp_time' */
+  guint32 ssrc;
+  guint32 rtp_ts;
+  guint32 clock_rate;
+  guint16 seq;
+  guint8 pt;
+  guint8 flags;                 /* Meaning defined by each producer */
+  guint32 reserved;
+} KmsTraceRecord;
+
+typedef struct _KmsTraceRecorder KmsTraceRecorder;
+
+/*
+ * Creates (truncating) the file at 'path' with room for 'capacity'
+ * records, rounded up to a power of 2. Once full, the oldest records are
+ * overwritten.
+ */
+KmsTraceRecorder *kms_trace_recorder_new (const gchar *path,
+    const gchar *name, guint capacity, GError **error);
+
+void kms_trace_recorder_free (KmsTraceRecorder *recorder);
+
+/* Thread-safe and lock-free; 'wall_time' is filled in by the recorder */
+void kms_trace_recorder_write (KmsTraceRecorder *recorder,
+    const KmsTraceRecord *record);
+
+typedef void (*KmsTraceFileFunc) (const KmsTraceFileHeader *header,
+    const KmsTraceRecord *record, gpointer user_data);
+
+/* Calls 'func' for every record still in the file, oldest first */
+gboolean kms_trace_file_foreach (const gchar *path, KmsTraceFileFunc func,
+    gpointer user_data, GError **error);
+
+G_END_DECLS
+#endif /* __KMS_TRACE_RECORDER_H__ */
@@ -0,0 +1,60 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/* Converts packet trace files written by KmsTraceRecorder to CSV */
+/* Usage: kms-trace-to-csv FILE... > out.csv */
+
+#include "kmstracerecorder.h"
+
+#include <stdio.h>
+
+static void
+print_record (const KmsTraceFileHeader * header, const KmsTraceRecord * r,
+    gpointer user_data)
+{
+  printf ("%s,%" G_GINT64_FORMAT ",%" G_GUINT32_FORMAT ",%u,%u,%"
+      G_GUINT32_FORMAT ",%" G_GUINT32_FORMAT ",%" G_GUINT64_FORMAT ",%"
+      G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%"
+      G_GUINT32_FORMAT ",%u\n", header->name, r->wall_time, r->ssrc, r->seq,
+      r->pt, r->clock_rate, r->rtp_ts, r->pts_in, r->pts_out, r->dts,
+      r->ref_ntp_time, r->ref_rtp_ts, r->flags);
+}
+
+int
+main (int argc, char **argv)
+{
+  GError *err = NULL;
+  int i, ret = 0;
+
+  if (argc < 2) {
+    fprintf (stderr, "Usage: %s FILE...\n", argv[0]);
+    return 1;
+  }
+
+  printf ("NAME,WALL_TIME_US,SSRC,SEQ,PT,CLOCK_RATE,RTP_TS,PTS_IN,PTS_OUT,DTS,"
+      "REF_NTP_NS,REF_RTP_TS,FLAGS\n");
+
+  for (i = 1; i < argc; i++) {
+    if (!kms_trace_file_foreach (argv[i], print_record, NULL, &err)) {
+      fprintf (stderr, "%s\n", err->message);
+      g_clear_error (&err);
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
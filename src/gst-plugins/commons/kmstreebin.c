@@ -19,6 +19,8 @@
 #  include <config.h>
 #endif
 
+#include <gst/video/video.h>
+
 #include "kmstreebin.h"
 #include "kmsutils.h"
 
@@ -154,6 +156,32 @@ tee_event_function (GstPad * pad, GstObject * parent, GstEvent * event)
   return TRUE;
 }
 
+/* The fakesink never touches the frames, so it does not keep the tee from */
+/* telling upstream that frames can come with any layout described by a */
+/* GstVideoMeta, instead of being copied to the default one */
+static GstPadProbeReturn
+fakesink_allocation_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer data)
+{
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+  GstCaps *caps;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_query_parse_allocation (query, &caps, NULL);
+
+  if (caps == NULL || !kms_utils_caps_is_video (caps)
+      || !kms_utils_caps_is_raw (caps)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+
+  return GST_PAD_PROBE_HANDLED;
+}
+
 static void
 kms_tree_bin_finalize (GObject * object)
 {
@@ -193,6 +221,11 @@ kms_tree_bin_init (KmsTreeBin * self)
     g_object_unref (sink);
   }
 
+  sink = gst_element_get_static_pad (fakesink, "sink");
+  gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM,
+      fakesink_allocation_probe, NULL, NULL);
+  g_object_unref (sink);
+
   gst_bin_add_many (GST_BIN (self), self->priv->output_tee, fakesink, NULL);
   gst_element_link (self->priv->output_tee, fakesink);
 }
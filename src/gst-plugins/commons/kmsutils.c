@@ -18,9 +18,11 @@
 #include "kmsutils.h"
 #include "constants.h"
 #include "kmsagnosticcaps.h"
+#include "kmsbitstream.h"
 #include <gst/video/video-event.h>
 #include <uuid/uuid.h>
 #include <string.h>
+#include <time.h>
 
 #define GST_CAT_DEFAULT kmsutils
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -38,8 +40,6 @@ G_DEFINE_QUARK (KMS_KEY_ID, kms_key_id);
 #define BEGIN_CERTIFICATE "-----BEGIN CERTIFICATE-----"
 #define END_CERTIFICATE "-----END CERTIFICATE-----"
 
-#define buffer_is_keyframe(buffer) \
-    (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
 
 static gboolean
 debug_graph (gpointer bin)
@@ -365,36 +365,107 @@ end:
   gst_caps_unref (caps);
 }
 
+/* Buffers without the delta unit flag set by depayloaders and parsers */
+/* are trusted as key frames. Flagged ones are only promoted when the  */
+/* bitstream of a known codec says they start a key frame              */
 static gboolean
-find_keyframe_idx (GstBuffer ** buf, guint idx, gpointer user_data)
+buffer_is_keyframe (GstBuffer * buffer, KmsBitstreamCodec codec)
 {
-  if (buffer_is_keyframe (*buf)) {
-    *(gint *) (user_data) = idx;
+  KmsBitstreamInfo info;
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    return TRUE;
+  }
+
+  if (codec == KMS_BITSTREAM_CODEC_UNKNOWN
+      || !kms_bitstream_parse_buffer (buffer, codec, &info)) {
+    return FALSE;
+  }
+
+  return info.keyframe;
+}
+
+typedef struct _FindKeyframeData
+{
+  KmsBitstreamCodec codec;
+  gint idx;
+} FindKeyframeData;
+
+static gboolean
+find_keyframe_idx (GstBuffer ** buf, guint idx, FindKeyframeData * data)
+{
+  if (buffer_is_keyframe (*buf, data->codec)) {
+    data->idx = idx;
     return FALSE;
   }
 
   return TRUE;
 }
 
+typedef struct _DropUntilKeyframeData
+{
+  gboolean all_headers;
+  KmsBitstreamCodec codec;
+} DropUntilKeyframeData;
+
+static DropUntilKeyframeData *
+drop_until_keyframe_data_new (GstPad * pad, gboolean all_headers)
+{
+  DropUntilKeyframeData *data = g_slice_new (DropUntilKeyframeData);
+  GstCaps *caps;
+
+  data->all_headers = all_headers;
+
+  caps = gst_pad_get_current_caps (pad);
+  data->codec = kms_bitstream_codec_from_caps (caps);
+
+  if (caps != NULL) {
+    gst_caps_unref (caps);
+  }
+
+  return data;
+}
+
+static void
+drop_until_keyframe_data_destroy (DropUntilKeyframeData * data)
+{
+  g_slice_free (DropUntilKeyframeData, data);
+}
+
 static GstPadProbeReturn
 drop_until_keyframe_probe (GstPad * pad, GstPadProbeInfo * info,
     gpointer user_data)
 {
-  gboolean all_headers = GPOINTER_TO_INT (user_data);
+  DropUntilKeyframeData *data = user_data;
   gboolean drop = FALSE;
 
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      GstCaps *caps;
+
+      gst_event_parse_caps (event, &caps);
+      data->codec = kms_bitstream_codec_from_caps (caps);
+    }
+
+    return GST_PAD_PROBE_OK;
+  }
+
   if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
     GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
 
-    drop = !buffer_is_keyframe (buffer);
+    drop = !buffer_is_keyframe (buffer, data->codec);
     GST_TRACE_OBJECT (pad, "%s",
         drop ? "Drop buffer" : "Keep buffer (is keyframe)");
   } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
     GstBufferList *bufflist = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
-    gint keyframe_idx = -1;
+    FindKeyframeData find_data = { data->codec, -1 };
+    gint keyframe_idx;
 
     gst_buffer_list_foreach (bufflist,
-        (GstBufferListFunc) find_keyframe_idx, &keyframe_idx);
+        (GstBufferListFunc) find_keyframe_idx, &find_data);
+    keyframe_idx = find_data.idx;
 
     if (keyframe_idx == -1) {
       GST_TRACE_OBJECT (pad, "Drop bufferlist, there is no keyframe");
@@ -413,13 +484,13 @@ drop_until_keyframe_probe (GstPad * pad, GstPadProbeInfo * info,
     }
   } else {
     GST_WARNING_OBJECT (pad,
-        "This probe should receive only buffers or buflists");
+        "This probe should receive only buffers, buflists or events");
     return GST_PAD_PROBE_OK;
   }
 
   if (drop) {
     /* Drop until a keyframe is received */
-    send_force_key_unit_event (pad, all_headers);
+    send_force_key_unit_event (pad, data->all_headers);
     return GST_PAD_PROBE_DROP;
   }
 
@@ -445,8 +516,10 @@ kms_utils_drop_until_keyframe (GstPad * pad, gboolean all_headers)
     set_dropping (pad, TRUE);
     GST_OBJECT_UNLOCK (pad);
     gst_pad_add_probe (pad,
-        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
-        drop_until_keyframe_probe, GINT_TO_POINTER (all_headers), NULL);
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, drop_until_keyframe_probe,
+        drop_until_keyframe_data_new (pad, all_headers),
+        (GDestroyNotify) drop_until_keyframe_data_destroy);
     send_force_key_unit_event (pad, all_headers);
   }
 }
@@ -811,6 +884,9 @@ struct _RembEventManager
   GstClockTime oldest_remb_time;
   GstClockTime clear_interval;
 
+  /* Events go on upstream after being accounted. Accessed atomically */
+  gint forward_events;
+
   /* Callback */
   RembBitrateUpdatedCallback callback;
   gpointer user_data;
@@ -824,12 +900,12 @@ typedef struct _RembHashValue
 } RembHashValue;
 
 static RembHashValue *
-remb_hash_value_create (guint bitrate)
+remb_hash_value_create (guint bitrate, GstClockTime ts)
 {
   RembHashValue *value = g_slice_new0 (RembHashValue);
 
   value->bitrate = bitrate;
-  value->ts = kms_utils_get_time_nsecs ();
+  value->ts = ts;
 
   return value;
 }
@@ -854,10 +930,10 @@ remb_event_manager_set_min (RembEventManager * manager, guint min)
 }
 
 static void
-remb_event_manager_calc_min (RembEventManager * manager, guint default_min)
+remb_event_manager_calc_min (RembEventManager * manager, guint default_min,
+    GstClockTime time)
 {
   guint remb_min = 0;
-  GstClockTime time = kms_utils_get_time_nsecs ();
   GstClockTime oldest_time = GST_CLOCK_TIME_NONE;
   GHashTableIter iter;
   gpointer key, v;
@@ -907,11 +983,11 @@ remb_event_manager_update_min (RembEventManager * manager, guint bitrate,
   if (last_value != NULL) {
     new_br = (bitrate != last_value->bitrate);
     last_value->bitrate = bitrate;
-    last_value->ts = kms_utils_get_time_nsecs ();
+    last_value->ts = time;
   } else {
     RembHashValue *value;
 
-    value = remb_hash_value_create (bitrate);
+    value = remb_hash_value_create (bitrate, time);
     g_hash_table_insert (manager->remb_hash, GUINT_TO_POINTER (ssrc), value);
   }
 
@@ -924,7 +1000,7 @@ remb_event_manager_update_min (RembEventManager * manager, guint bitrate,
     calc_min = calc_min
         || (time - manager->oldest_remb_time > manager->clear_interval);
     if (calc_min) {
-      remb_event_manager_calc_min (manager, bitrate);
+      remb_event_manager_calc_min (manager, bitrate, time);
     }
   }
 
@@ -952,6 +1028,10 @@ remb_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
 
   remb_event_manager_update_min (manager, bitrate, ssrc);
 
+  if (g_atomic_int_get (&manager->forward_events)) {
+    return GST_PAD_PROBE_OK;
+  }
+
   return GST_PAD_PROBE_DROP;
 }
 
@@ -1008,7 +1088,7 @@ kms_utils_remb_event_manager_get_min (RembEventManager * manager)
 
   g_mutex_lock (&manager->mutex);
   if (time - manager->oldest_remb_time > manager->clear_interval) {
-    remb_event_manager_calc_min (manager, 0);
+    remb_event_manager_calc_min (manager, 0, time);
   }
 
   ret = manager->remb_min;
@@ -1043,20 +1123,89 @@ kms_utils_remb_event_manager_get_clear_interval (RembEventManager * manager)
   return manager->clear_interval;
 }
 
+void
+kms_utils_remb_event_manager_set_forward_events (RembEventManager * manager,
+    gboolean forward)
+{
+  g_atomic_int_set (&manager->forward_events, forward);
+}
+
 /* REMB event end */
 
 /* time begin */
 
+static KmsUtilsTimeSource time_source = NULL;
+
+void
+kms_utils_set_time_source (KmsUtilsTimeSource source)
+{
+  time_source = source;
+}
+
 GstClockTime
 kms_utils_get_time_nsecs ()
 {
   GstClockTime time;
 
+  if (G_UNLIKELY (time_source != NULL)) {
+    return time_source ();
+  }
+
   time = g_get_monotonic_time () * GST_USECOND;
 
   return time;
 }
 
+GstClockTime
+kms_utils_get_coarse_time_nsecs ()
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+  struct timespec ts;
+
+  if (G_UNLIKELY (time_source != NULL)) {
+    return time_source ();
+  }
+
+  if (clock_gettime (CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+    return GST_TIMESPEC_TO_TIME (ts);
+  }
+#endif
+
+  return kms_utils_get_time_nsecs ();
+}
+
+/* Nesting depth and time captured by the outermost cache of each thread */
+static __thread guint time_cache_depth = 0;
+static __thread GstClockTime time_cache_value = GST_CLOCK_TIME_NONE;
+
+void
+kms_utils_time_cache_begin ()
+{
+  if (time_cache_depth++ == 0) {
+    time_cache_value = kms_utils_get_time_nsecs ();
+  }
+}
+
+void
+kms_utils_time_cache_end ()
+{
+  g_return_if_fail (time_cache_depth > 0);
+
+  if (--time_cache_depth == 0) {
+    time_cache_value = GST_CLOCK_TIME_NONE;
+  }
+}
+
+GstClockTime
+kms_utils_get_cached_time_nsecs ()
+{
+  if (time_cache_depth > 0) {
+    return time_cache_value;
+  }
+
+  return kms_utils_get_time_nsecs ();
+}
+
 /* time end */
 
 /* RTP connection end */
@@ -90,10 +90,29 @@ guint kms_utils_remb_event_manager_get_min (RembEventManager * manager);
 void kms_utils_remb_event_manager_set_callback (RembEventManager * manager, RembBitrateUpdatedCallback cb, gpointer data, GDestroyNotify destroy_notify);
 void kms_utils_remb_event_manager_set_clear_interval (RembEventManager * manager, GstClockTime interval);
 GstClockTime kms_utils_remb_event_manager_get_clear_interval (RembEventManager * manager);
+/* By default the REMB events are consumed by the manager */
+void kms_utils_remb_event_manager_set_forward_events (RembEventManager * manager, gboolean forward);
 
 /* time */
 GstClockTime kms_utils_get_time_nsecs ();
 
+/* Replaces the clock used by all the time functions below. Only intended */
+/* for offline simulations, set it before any time is read. NULL restores */
+/* the system clock                                                       */
+typedef GstClockTime (*KmsUtilsTimeSource) (void);
+void kms_utils_set_time_source (KmsUtilsTimeSource source);
+
+/* Monotonic time with the granularity of the system tick (a few ms). It is */
+/* cheaper than kms_utils_get_time_nsecs, but both must not be mixed        */
+GstClockTime kms_utils_get_coarse_time_nsecs ();
+
+/* While a time cache is open in the calling thread, all calls to           */
+/* kms_utils_get_cached_time_nsecs return the time captured when it was     */
+/* opened. Used to take one timestamp for a whole buffer list               */
+void kms_utils_time_cache_begin ();
+void kms_utils_time_cache_end ();
+GstClockTime kms_utils_get_cached_time_nsecs ();
+
 gboolean kms_utils_contains_proto (const gchar *search_term, const gchar *proto);
 const GstStructure * kms_utils_get_structure_by_name (const GstStructure *str, const gchar *name);
 
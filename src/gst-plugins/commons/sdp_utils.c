@@ -19,6 +19,7 @@
 #include <gst/gst.h>
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "constants.h"
 
@@ -33,6 +34,28 @@ static gchar *directions[] =
 #define RTPMAP "rtpmap"
 #define FMTP "fmtp"
 
+#define SDP_UTILS_MAX_PT 128
+
+typedef struct _SdpUtilsPtEntry
+{
+  gboolean in_fmts;
+  const gchar *rtpmap_attr;     /* "96 VP8/90000" */
+  const gchar *rtpmap;          /* "VP8/90000" */
+  gchar *codec_name;
+  gint clock_rate;
+  const gchar *fmtp;            /* Whole attribute value, with the PT */
+  GSList *rtcp_fb;              /* Feedback types, without the PT */
+} SdpUtilsPtEntry;
+
+struct _SdpUtilsPtIndex
+{
+  SdpUtilsPtEntry entries[SDP_UTILS_MAX_PT];
+  guint8 pts[SDP_UTILS_MAX_PT]; /* Format list order */
+  guint n_pts;
+  guint8 rtpmap_pts[SDP_UTILS_MAX_PT];  /* rtpmap attributes order */
+  guint n_rtpmaps;
+};
+
 static gchar *rtpmaps[] = {
   "PCMU/8000/1",
   NULL,
@@ -942,94 +965,298 @@ gboolean
 sdp_utils_get_data_from_rtpmap_codec (const GstSDPMedia * media,
     const gchar * codec, gint * pt, gint * clock_rate)
 {
+  SdpUtilsPtIndex *index;
   gboolean found = FALSE;
-  guint8 i;
+  guint i;
 
-  for (i = 0;; i++) {
-    const gchar *val = NULL;
-    gchar **attrs;
+  index = sdp_utils_pt_index_new (media);
 
-    val = gst_sdp_media_get_attribute_val_n (media, "rtpmap", i);
+  for (i = 0; i < index->n_rtpmaps && !found; i++) {
+    gint payload = index->rtpmap_pts[i];
+    SdpUtilsPtEntry *entry = &index->entries[payload];
 
-    if (val == NULL) {
-      break;
+    if (!entry->in_fmts || entry->codec_name == NULL) {
+      continue;
     }
 
-    if (!g_str_match_string (codec, val, TRUE)) {
+    if (!g_str_match_string (codec, entry->rtpmap_attr, TRUE)) {
       continue;
     }
 
-    attrs = g_strsplit (val, " ", 0);
+    if (pt != NULL) {
+      *pt = payload;
+    }
 
-    if (attrs[0] == NULL) {
-      /* No pt */
-      g_strfreev (attrs);
-      continue;
+    if (clock_rate != NULL) {
+      *clock_rate = entry->clock_rate;
     }
 
-    if (attrs[1] == NULL) {
-      /* No codec */
-      g_strfreev (attrs);
+    found = TRUE;
+  }
+
+  sdp_utils_pt_index_free (index);
+
+  return found;
+}
+
+gint
+sdp_utils_get_pt_for_codec_name (const GstSDPMedia * media,
+    const gchar * codec_name)
+{
+  SdpUtilsPtIndex *index;
+  gint pt;
+
+  index = sdp_utils_pt_index_new (media);
+  pt = sdp_utils_pt_index_get_pt_for_codec_name (index, codec_name);
+  sdp_utils_pt_index_free (index);
+
+  return pt;
+}
+
+/* Returns the payload type at the beginning of 'str', or -1 */
+static gint
+sdp_utils_parse_pt (const gchar * str, const gchar ** end)
+{
+  gint pt = 0;
+
+  if (!g_ascii_isdigit (*str)) {
+    return -1;
+  }
+
+  for (; g_ascii_isdigit (*str); str++) {
+    pt = pt * 10 + (*str - '0');
+
+    if (pt >= SDP_UTILS_MAX_PT) {
+      return -1;
+    }
+  }
+
+  *end = str;
+
+  return pt;
+}
+
+/* Returns what follows "<pt> " in an attribute value, or NULL */
+static const gchar *
+sdp_utils_parse_attr_pt (const gchar * value, gint * pt)
+{
+  const gchar *end;
+
+  if (value == NULL) {
+    return NULL;
+  }
+
+  *pt = sdp_utils_parse_pt (value, &end);
+
+  if (*pt < 0 || *end != ' ') {
+    return NULL;
+  }
+
+  return end + 1;
+}
+
+static void
+sdp_utils_pt_entry_set_codec (SdpUtilsPtEntry * entry)
+{
+  const gchar *slash;
+
+  if (entry->rtpmap == NULL) {
+    return;
+  }
+
+  /* Same checks as sdp_utils_get_data_from_rtpmap */
+  slash = strchr (entry->rtpmap, '/');
+  if (slash == NULL || slash == entry->rtpmap) {
+    return;
+  }
+
+  entry->codec_name = g_strndup (entry->rtpmap, slash - entry->rtpmap);
+  entry->clock_rate = atoi (slash + 1);
+}
+
+SdpUtilsPtIndex *
+sdp_utils_pt_index_new (const GstSDPMedia * media)
+{
+  SdpUtilsPtIndex *index;
+  guint i, len;
+
+  index = g_slice_new0 (SdpUtilsPtIndex);
+
+  len = gst_sdp_media_formats_len (media);
+  for (i = 0; i < len && index->n_pts < SDP_UTILS_MAX_PT; i++) {
+    const gchar *end;
+    gint pt;
+
+    pt = sdp_utils_parse_pt (gst_sdp_media_get_format (media, i), &end);
+    if (pt < 0 || *end != '\0') {
       continue;
     }
 
-    if (!sdp_utils_is_pt_in_fmts (media, atoi (attrs[0]))) {
-      /* pt is not in the offer */
-      g_strfreev (attrs);
+    index->entries[pt].in_fmts = TRUE;
+    index->pts[index->n_pts++] = pt;
+  }
+
+  len = gst_sdp_media_attributes_len (media);
+  for (i = 0; i < len; i++) {
+    const GstSDPAttribute *attr = gst_sdp_media_get_attribute (media, i);
+    SdpUtilsPtEntry *entry;
+    const gchar *val;
+    gint pt;
+
+    if (attr->key == NULL) {
       continue;
     }
 
-    if (!sdp_utils_get_data_from_rtpmap (attrs[1], NULL, clock_rate)) {
-      g_strfreev (attrs);
+    val = sdp_utils_parse_attr_pt (attr->value, &pt);
+    if (val == NULL) {
       continue;
     }
 
-    if (pt != NULL) {
-      *pt = atoi (attrs[0]);
+    entry = &index->entries[pt];
+
+    if (g_ascii_strcasecmp (RTPMAP, attr->key) == 0) {
+      if (entry->rtpmap_attr == NULL) {
+        entry->rtpmap_attr = attr->value;
+        entry->rtpmap = val;
+        index->rtpmap_pts[index->n_rtpmaps++] = pt;
+      }
+    } else if (g_strcmp0 (FMTP, attr->key) == 0) {
+      if (entry->fmtp == NULL) {
+        entry->fmtp = attr->value;
+      }
+    } else if (g_strcmp0 (SDP_MEDIA_RTCP_FB, attr->key) == 0) {
+      entry->rtcp_fb = g_slist_prepend (entry->rtcp_fb, (gpointer) val);
     }
+  }
 
-    found = TRUE;
+  for (i = 0; i < SDP_UTILS_MAX_PT; i++) {
+    SdpUtilsPtEntry *entry = &index->entries[i];
 
-    g_strfreev (attrs);
+    /* Static payload types can omit their rtpmap */
+    if (entry->rtpmap == NULL && entry->in_fmts
+        && i < G_N_ELEMENTS (rtpmaps)) {
+      entry->rtpmap = rtpmaps[i];
+    }
 
-    break;
+    sdp_utils_pt_entry_set_codec (entry);
   }
 
-  return found;
+  return index;
+}
+
+void
+sdp_utils_pt_index_free (SdpUtilsPtIndex * index)
+{
+  guint i;
+
+  for (i = 0; i < SDP_UTILS_MAX_PT; i++) {
+    g_free (index->entries[i].codec_name);
+    g_slist_free (index->entries[i].rtcp_fb);
+  }
+
+  g_slice_free (SdpUtilsPtIndex, index);
+}
+
+guint
+sdp_utils_pt_index_get_n_pts (const SdpUtilsPtIndex * index)
+{
+  return index->n_pts;
 }
 
 gint
-sdp_utils_get_pt_for_codec_name (const GstSDPMedia * media,
-    const gchar * codec_name)
+sdp_utils_pt_index_get_pt (const SdpUtilsPtIndex * index, guint pos)
 {
-  const gchar *rtpmap;
-  guint j, f_len;
-  gint pt = -1;
+  g_return_val_if_fail (pos < index->n_pts, -1);
+
+  return index->pts[pos];
+}
 
-  f_len = gst_sdp_media_formats_len (media);
-  for (j = 0; j < f_len; j++) {
-    gchar *found_codec_name;
-    const gchar *payload = gst_sdp_media_get_format (media, j);
+const gchar *
+sdp_utils_pt_index_get_rtpmap (const SdpUtilsPtIndex * index, gint pt)
+{
+  if (pt < 0 || pt >= SDP_UTILS_MAX_PT) {
+    return NULL;
+  }
 
-    rtpmap = sdp_utils_sdp_media_get_rtpmap (media, payload);
+  if (index->entries[pt].rtpmap == NULL
+      && (guint) pt < G_N_ELEMENTS (rtpmaps)) {
+    return rtpmaps[pt];
+  }
 
-    if (!sdp_utils_get_data_from_rtpmap (rtpmap, &found_codec_name, NULL)) {
-      continue;
-    }
+  return index->entries[pt].rtpmap;
+}
 
-    if (g_strcmp0 (found_codec_name, codec_name) == 0) {
-      GST_ERROR ("Found codec name pt is: %u", atoi (payload));
-      pt = atoi (payload);
-    }
+const gchar *
+sdp_utils_pt_index_get_fmtp (const SdpUtilsPtIndex * index, gint pt)
+{
+  if (pt < 0 || pt >= SDP_UTILS_MAX_PT) {
+    return NULL;
+  }
+
+  return index->entries[pt].fmtp;
+}
+
+gboolean
+sdp_utils_pt_index_get_codec (const SdpUtilsPtIndex * index, gint pt,
+    const gchar ** codec_name, gint * clock_rate)
+{
+  const SdpUtilsPtEntry *entry;
+
+  if (pt < 0 || pt >= SDP_UTILS_MAX_PT) {
+    return FALSE;
+  }
+
+  entry = &index->entries[pt];
+
+  if (entry->codec_name == NULL) {
+    return FALSE;
+  }
+
+  if (codec_name != NULL) {
+    *codec_name = entry->codec_name;
+  }
+
+  if (clock_rate != NULL) {
+    *clock_rate = entry->clock_rate;
+  }
+
+  return TRUE;
+}
 
-    g_free (found_codec_name);
+gint
+sdp_utils_pt_index_get_pt_for_codec_name (const SdpUtilsPtIndex * index,
+    const gchar * codec_name)
+{
+  guint i;
+
+  for (i = 0; i < index->n_pts; i++) {
+    gint pt = index->pts[i];
 
-    if (pt != -1) {
+    if (g_strcmp0 (index->entries[pt].codec_name, codec_name) == 0) {
       return pt;
     }
   }
 
-  return pt;
+  return -1;
+}
+
+gboolean
+sdp_utils_pt_index_has_rtcp_fb (const SdpUtilsPtIndex * index, gint pt,
+    const gchar * type)
+{
+  GSList *l;
+
+  if (pt < 0 || pt >= SDP_UTILS_MAX_PT) {
+    return FALSE;
+  }
+
+  for (l = index->entries[pt].rtcp_fb; l != NULL; l = g_slist_next (l)) {
+    if (g_strcmp0 (l->data, type) == 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
 }
 
 gint
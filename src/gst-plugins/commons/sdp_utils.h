@@ -61,6 +61,28 @@ gboolean sdp_utils_is_pt_in_fmts (const GstSDPMedia * media, gint pt);
 
 gint sdp_utils_get_pt_for_codec_name (const GstSDPMedia *media, const gchar *codec_name);
 
+/*
+ * Payload type index of a media, built in one pass over its formats and
+ * attributes. Use it instead of the helpers above when looking up several
+ * payload types of the same media. Strings returned point into the media,
+ * which must not be modified while the index is in use.
+ */
+typedef struct _SdpUtilsPtIndex SdpUtilsPtIndex;
+
+SdpUtilsPtIndex *sdp_utils_pt_index_new (const GstSDPMedia * media);
+void sdp_utils_pt_index_free (SdpUtilsPtIndex * index);
+
+/* Payload types in the media format list, in order */
+guint sdp_utils_pt_index_get_n_pts (const SdpUtilsPtIndex * index);
+gint sdp_utils_pt_index_get_pt (const SdpUtilsPtIndex * index, guint pos);
+
+/* Same results as sdp_utils_sdp_media_get_rtpmap and sdp_utils_sdp_media_get_fmtp */
+const gchar *sdp_utils_pt_index_get_rtpmap (const SdpUtilsPtIndex * index, gint pt);
+const gchar *sdp_utils_pt_index_get_fmtp (const SdpUtilsPtIndex * index, gint pt);
+gboolean sdp_utils_pt_index_get_codec (const SdpUtilsPtIndex * index, gint pt, const gchar ** codec_name, gint * clock_rate);
+gint sdp_utils_pt_index_get_pt_for_codec_name (const SdpUtilsPtIndex * index, const gchar * codec_name);
+gboolean sdp_utils_pt_index_has_rtcp_fb (const SdpUtilsPtIndex * index, gint pt, const gchar * type);
+
 gint sdp_utils_get_abs_send_time_id (const GstSDPMedia * media);
 gboolean sdp_utils_media_is_inactive (const GstSDPMedia * media);
 
@@ -162,7 +162,7 @@ struct _KmsSdpAgentPrivate
   GRecMutex mutex;
 
   KmsSDPAgentState state;
-  GstSDPMessage *prev_sdp;
+  GstSDPMessage *prev_sdp;      /* shared with one of the descriptions */
   GSList *offer_handlers;
 
   SdpSessionDescription local;
@@ -341,15 +341,24 @@ sdp_handler_new (guint id, const gchar * media, KmsSdpMediaHandler * handler)
   return sdp_handler;
 }
 
+/*
+ * Descriptions of the same negotiation are shared instead of copied, so a
+ * message is only freed when no other description points to it.
+ */
 static void
-kms_sdp_agent_release_sdp (GstSDPMessage ** sdp)
+kms_sdp_agent_set_sdp (KmsSdpAgent * agent, GstSDPMessage ** sdp,
+    GstSDPMessage * new_sdp)
 {
-  if (*sdp == NULL) {
+  GstSDPMessage *old = *sdp;
+
+  *sdp = new_sdp;
+
+  if (old == NULL || old == agent->priv->local_description ||
+      old == agent->priv->remote_description || old == agent->priv->prev_sdp) {
     return;
   }
 
-  gst_sdp_message_free (*sdp);
-  *sdp = NULL;
+  gst_sdp_message_free (old);
 }
 
 static SdpHandler *
@@ -388,15 +397,9 @@ kms_sdp_agent_finalize (GObject * object)
     self->priv->callbacks.destroy (self->priv->callbacks.user_data);
   }
 
-  if (self->priv->local_description != NULL) {
-    gst_sdp_message_free (self->priv->local_description);
-  }
-
-  if (self->priv->prev_sdp != NULL) {
-    gst_sdp_message_free (self->priv->prev_sdp);
-  }
-
-  kms_sdp_agent_release_sdp (&self->priv->remote_description);
+  kms_sdp_agent_set_sdp (self, &self->priv->local_description, NULL);
+  kms_sdp_agent_set_sdp (self, &self->priv->prev_sdp, NULL);
+  kms_sdp_agent_set_sdp (self, &self->priv->remote_description, NULL);
 
   g_slist_free_full (self->priv->extensions, g_object_unref);
 
@@ -682,12 +685,12 @@ end:
   return ret;
 }
 
-static GstSDPMedia *
+static const GstSDPMedia *
 kms_sdp_agent_get_negotiated_media (KmsSdpAgent * agent,
     SdpHandler * sdp_handler, GError ** error)
 {
   GstSDPMessage *desc;
-  GstSDPMedia *media = NULL;
+  const GstSDPMedia *media = NULL;
   guint index;
 
   index = sdp_handler->sdph->index;
@@ -718,7 +721,7 @@ kms_sdp_agent_get_negotiated_media (KmsSdpAgent * agent,
         "Cannot process media: Invalid media index %u (%s)",
         index, sdp_handler->sdph->media);
   } else {
-    gst_sdp_media_copy (gst_sdp_message_get_media (desc, index), &media);
+    media = gst_sdp_message_get_media (desc, index);
   }
 
   return media;
@@ -764,8 +767,8 @@ create_reject_handler ()
   return handler;
 }
 
-static void
-reject_sdp_media (GstSDPMedia ** media)
+static GstSDPMedia *
+reject_sdp_media (const GstSDPMedia * media)
 {
   KmsSdpMediaHandler *handler = create_reject_handler ();
   GstSDPMedia *rejected;
@@ -779,18 +782,18 @@ reject_sdp_media (GstSDPMedia ** media)
   kms_sdp_media_handler_add_media_extension (handler,
       KMS_I_SDP_MEDIA_EXTENSION (ext));
 
-  rejected = kms_sdp_media_handler_create_answer (handler, NULL, *media, NULL);
+  rejected = kms_sdp_media_handler_create_answer (handler, NULL, media, NULL);
   g_object_unref (handler);
 
-  gst_sdp_media_free (*media);
-  *media = rejected;
+  return rejected;
 }
 
 static GstSDPMedia *
 kms_sdp_agent_create_proper_media_offer (KmsSdpAgent * agent,
     SdpHandler * sdp_handler, GError ** err)
 {
-  GstSDPMedia *media, *prev;
+  const GstSDPMedia *prev;
+  GstSDPMedia *media;
   guint index;
 
   if (sdp_handler->disabled || sdp_handler->rejected) {
@@ -799,12 +802,12 @@ kms_sdp_agent_create_proper_media_offer (KmsSdpAgent * agent,
     /* checking the index attribute of the media handler */
     GST_DEBUG ("Removed negotiated media %u, %s", sdp_handler->sdph->index,
         sdp_handler->sdph->media);
-    media = kms_sdp_agent_get_negotiated_media (agent, sdp_handler, err);
-    if (media != NULL) {
-      reject_sdp_media (&media);
+    prev = kms_sdp_agent_get_negotiated_media (agent, sdp_handler, err);
+    if (prev == NULL) {
+      return NULL;
     }
 
-    return media;
+    return reject_sdp_media (prev);
   }
 
   if (sdp_handler->unsupported) {
@@ -834,15 +837,10 @@ kms_sdp_agent_create_proper_media_offer (KmsSdpAgent * agent,
 
   /* Start a new negotiation based on the previous one */
 
-  gst_sdp_media_copy (gst_sdp_message_get_media (agent->priv->local_description,
-          index), &prev);
+  prev = gst_sdp_message_get_media (agent->priv->local_description, index);
 
-  media = kms_sdp_media_handler_create_offer (sdp_handler->sdph->handler,
+  return kms_sdp_media_handler_create_offer (sdp_handler->sdph->handler,
       sdp_handler->sdph->media, prev, err);
-
-  gst_sdp_media_free (prev);
-
-  return media;
 }
 
 static void
@@ -1557,24 +1555,35 @@ create_media_answer (const GstSDPMedia * media, struct SdpAnswerData *data)
         gst_sdp_media_get_media (media), gst_sdp_media_get_proto (media));
     sdp_handler = kms_sdp_agent_create_reject_media_handler (agent, media);
   } else if (gst_sdp_media_get_port (media) == 0) {
+    /* RFC rfc3264 [8.2]: A stream that is offered with a port */
+    /* of zero MUST be marked with port zero in the answer     */
     if (sdp_handler->sdph->negotiated) {
-      answer_media = kms_sdp_agent_get_negotiated_media (agent, sdp_handler,
-          err);
-      if (answer_media == NULL) {
+      const GstSDPMedia *neg_media;
+
+      neg_media = kms_sdp_agent_get_negotiated_media (agent, sdp_handler, err);
+      if (neg_media == NULL) {
         return FALSE;
       }
+
+      answer_media = reject_sdp_media (neg_media);
     } else {
+      GstSDPMedia *offered_answer;
+
       /* Process offer as usual and reject it later */
       GST_WARNING_OBJECT (agent,
           "Not negotiated media offered with port set to 0");
-      answer_media =
+      offered_answer =
           kms_sdp_media_handler_create_answer (sdp_handler->sdph->handler,
           data->answer, media, err);
+      if (offered_answer == NULL) {
+        ret = FALSE;
+        goto end;
+      }
+
+      answer_media = reject_sdp_media (offered_answer);
+      gst_sdp_media_free (offered_answer);
     }
 
-    /* RFC rfc3264 [8.2]: A stream that is offered with a port */
-    /* of zero MUST be marked with port zero in the answer     */
-    reject_sdp_media (&answer_media);
     goto set_unsupported;
   }
 
@@ -1834,6 +1843,7 @@ kms_sdp_agent_set_local_description_impl (KmsSdpAgent * agent,
 {
   KmsSDPAgentState new_state;
   const GstSDPOrigin *orig;
+  GstSDPMessage *copy;
   gboolean ret = FALSE;
 
   SDP_AGENT_LOCK (agent);
@@ -1852,18 +1862,11 @@ kms_sdp_agent_set_local_description_impl (KmsSdpAgent * agent,
     goto end;
   }
 
-  if (agent->priv->local_description != NULL) {
-    gst_sdp_message_free (agent->priv->local_description);
-  }
-
-  gst_sdp_message_copy (description, &agent->priv->local_description);
+  gst_sdp_message_copy (description, &copy);
+  kms_sdp_agent_set_sdp (agent, &agent->priv->local_description, copy);
 
   if (agent->priv->state == KMS_SDP_AGENT_STATE_REMOTE_OFFER) {
-    if (agent->priv->prev_sdp != NULL) {
-      gst_sdp_message_free (agent->priv->prev_sdp);
-    }
-
-    gst_sdp_message_copy (description, &agent->priv->prev_sdp);
+    kms_sdp_agent_set_sdp (agent, &agent->priv->prev_sdp, copy);
   }
 
   new_state = (agent->priv->state == KMS_SDP_AGENT_STATE_LOCAL_OFFER) ?
@@ -1982,12 +1985,9 @@ kms_sdp_agent_set_remote_description_impl (KmsSdpAgent * agent,
         break;
       }
 
-      if (agent->priv->prev_sdp != NULL) {
-        gst_sdp_message_free (agent->priv->prev_sdp);
-      }
-
       update_rejected_medias (agent, description);
-      gst_sdp_message_copy (description, &agent->priv->prev_sdp);
+      /* Becomes the remote description below */
+      kms_sdp_agent_set_sdp (agent, &agent->priv->prev_sdp, description);
       kms_sdp_agent_process_answer (agent);
       SDP_AGENT_NEW_STATE (agent, KMS_SDP_AGENT_STATE_NEGOTIATED);
 
@@ -2030,8 +2030,8 @@ kms_sdp_agent_set_remote_description_impl (KmsSdpAgent * agent,
   }
 
   if (ret) {
-    kms_sdp_agent_release_sdp (&agent->priv->remote_description);
-    agent->priv->remote_description = description;
+    kms_sdp_agent_set_sdp (agent, &agent->priv->remote_description,
+        description);
 
     if (agent->priv->state == KMS_SDP_AGENT_STATE_NEGOTIATED) {
       kms_sdp_agent_process_answered_description (agent, description, TRUE);
@@ -51,8 +51,28 @@ struct _KmsSdpRtpAvpMediaHandlerPrivate
   KmsISdpPayloadManager *ptmanager;
   GSList *audio_fmts;
   GSList *video_fmts;
+
+  /* Keys of the offer templates for this configuration, built on demand */
+  gchar *audio_template_key;
+  gchar *video_template_key;
 };
 
+/*
+ * Offer templates: formats, extmaps and rtpmap/fmtp attributes of a new
+ * offer only depend on the configuration of the handler, which is the same
+ * for every endpoint created from one configuration. They are built once
+ * per configuration and copied into new offers. Session specific attributes
+ * (ICE, DTLS, SSRCs...) are still added by the extensions.
+ *
+ * Templates are never freed once cached, so they can be used without the
+ * lock. The number of them is bounded, offers for configurations beyond
+ * that are built as usual.
+ */
+#define MAX_OFFER_TEMPLATES 64
+
+G_LOCK_DEFINE_STATIC (offer_templates);
+static GHashTable *offer_templates = NULL;      /* key -> GstSDPMedia */
+
 #define SDP_AUDIO_MEDIA "audio"
 #define SDP_VIDEO_MEDIA "video"
 
@@ -865,7 +885,7 @@ kms_sdp_rtp_avp_media_handler_init_offer (KmsSdpMediaHandler * handler,
 }
 
 static gboolean
-kms_sdp_rtp_avp_media_handler_add_new_offer_attributes (KmsSdpRtpAvpMediaHandler
+kms_sdp_rtp_avp_media_handler_build_offer_attributes (KmsSdpRtpAvpMediaHandler
     * self, GstSDPMedia * offer, GError ** error)
 {
   if (!kms_sdp_rtp_avp_media_handler_add_supported_fmts (self, offer, error)) {
@@ -883,6 +903,159 @@ kms_sdp_rtp_avp_media_handler_add_new_offer_attributes (KmsSdpRtpAvpMediaHandler
   return TRUE;
 }
 
+static void
+kms_sdp_rtp_avp_media_handler_invalidate_templates (KmsSdpRtpAvpMediaHandler *
+    self)
+{
+  g_clear_pointer (&self->priv->audio_template_key, g_free);
+  g_clear_pointer (&self->priv->video_template_key, g_free);
+}
+
+static gint
+cmp_extmap_ids (gconstpointer a, gconstpointer b)
+{
+  return GPOINTER_TO_UINT (a) - GPOINTER_TO_UINT (b);
+}
+
+static gchar *
+kms_sdp_rtp_avp_media_handler_build_template_key (KmsSdpRtpAvpMediaHandler *
+    self, const gchar * media, GSList * fmts)
+{
+  GString *key = g_string_new (media);
+  GList *ids, *l;
+  GSList *item;
+
+  for (item = fmts; item != NULL; item = g_slist_next (item)) {
+    KmsSdpRtpMap *rtpmap = item->data;
+    GSList *f;
+
+    g_string_append_printf (key, "|%u %s", rtpmap->payload, rtpmap->name);
+
+    for (f = rtpmap->fmtps; f != NULL; f = g_slist_next (f)) {
+      GstSDPAttribute *fmtp = f->data;
+
+      g_string_append_printf (key, ";%s", fmtp->value);
+    }
+  }
+
+  ids = g_list_sort (g_hash_table_get_keys (self->priv->extmaps),
+      cmp_extmap_ids);
+  for (l = ids; l != NULL; l = l->next) {
+    g_string_append_printf (key, "|extmap %u %s", GPOINTER_TO_UINT (l->data),
+        (const gchar *) g_hash_table_lookup (self->priv->extmaps, l->data));
+  }
+  g_list_free (ids);
+
+  return g_string_free (key, FALSE);
+}
+
+static const GstSDPMedia *
+kms_sdp_rtp_avp_media_handler_get_offer_template (KmsSdpRtpAvpMediaHandler *
+    self, const gchar * media, GstSDPMedia ** built, GError ** error)
+{
+  GstSDPMedia *template = NULL;
+  gchar **key;
+
+  if (g_strcmp0 (media, SDP_AUDIO_MEDIA) == 0) {
+    key = &self->priv->audio_template_key;
+    if (*key == NULL) {
+      *key = kms_sdp_rtp_avp_media_handler_build_template_key (self, media,
+          self->priv->audio_fmts);
+    }
+  } else if (g_strcmp0 (media, SDP_VIDEO_MEDIA) == 0) {
+    key = &self->priv->video_template_key;
+    if (*key == NULL) {
+      *key = kms_sdp_rtp_avp_media_handler_build_template_key (self, media,
+          self->priv->video_fmts);
+    }
+  } else {
+    g_set_error (error, KMS_SDP_AGENT_ERROR, SDP_AGENT_UNEXPECTED_ERROR,
+        "Unsuported media '%s'", media);
+    return NULL;
+  }
+
+  G_LOCK (offer_templates);
+  if (offer_templates != NULL) {
+    template = g_hash_table_lookup (offer_templates, *key);
+  }
+  G_UNLOCK (offer_templates);
+
+  if (template != NULL) {
+    return template;
+  }
+
+  gst_sdp_media_new (&template);
+  gst_sdp_media_set_media (template, media);
+
+  if (!kms_sdp_rtp_avp_media_handler_build_offer_attributes (self, template,
+          error)) {
+    gst_sdp_media_free (template);
+    return NULL;
+  }
+
+  G_LOCK (offer_templates);
+  if (offer_templates == NULL) {
+    offer_templates = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) gst_sdp_media_free);
+  }
+
+  if (g_hash_table_contains (offer_templates, *key)) {
+    /* Built by another handler in the meantime */
+    gst_sdp_media_free (template);
+    template = g_hash_table_lookup (offer_templates, *key);
+  } else if (g_hash_table_size (offer_templates) < MAX_OFFER_TEMPLATES) {
+    GST_DEBUG_OBJECT (self, "New offer template: %s", *key);
+    g_hash_table_insert (offer_templates, g_strdup (*key), template);
+  } else {
+    /* Not cached, the caller frees it */
+    *built = template;
+  }
+  G_UNLOCK (offer_templates);
+
+  return template;
+}
+
+static gboolean
+kms_sdp_rtp_avp_media_handler_add_new_offer_attributes (KmsSdpRtpAvpMediaHandler
+    * self, GstSDPMedia * offer, GError ** error)
+{
+  const GstSDPMedia *template;
+  GstSDPMedia *built = NULL;
+  gboolean ret = TRUE;
+  guint i, len;
+
+  template = kms_sdp_rtp_avp_media_handler_get_offer_template (self,
+      gst_sdp_media_get_media (offer), &built, error);
+  if (template == NULL) {
+    return FALSE;
+  }
+
+  len = gst_sdp_media_formats_len (template);
+  for (i = 0; i < len && ret; i++) {
+    ret = gst_sdp_media_add_format (offer,
+        gst_sdp_media_get_format (template, i)) == GST_SDP_OK;
+  }
+
+  len = gst_sdp_media_attributes_len (template);
+  for (i = 0; i < len && ret; i++) {
+    const GstSDPAttribute *attr = gst_sdp_media_get_attribute (template, i);
+
+    ret = gst_sdp_media_add_attribute (offer, attr->key,
+        attr->value) == GST_SDP_OK;
+  }
+
+  if (!ret) {
+    g_set_error_literal (error, KMS_SDP_AGENT_ERROR,
+        SDP_AGENT_UNEXPECTED_ERROR, "Can not copy offer template");
+  }
+
+  if (built != NULL) {
+    gst_sdp_media_free (built);
+  }
+
+  return ret;
+}
+
 static gboolean
 kms_sdp_rtp_avp_media_handler_set_supported_fmts (KmsSdpRtpAvpMediaHandler *
     self, const GstSDPMedia * origin, GstSDPMedia * target, GError ** error)
@@ -915,8 +1088,11 @@ static gboolean
 kms_sdp_rtp_avp_media_handler_add_supported_fmtp (KmsSdpRtpAvpMediaHandler *
     self, const GstSDPMedia * prev_offer, GstSDPMedia * offer, GError ** error)
 {
+  SdpUtilsPtIndex *index;
+  gboolean ret = TRUE;
   guint i, len;
 
+  index = sdp_utils_pt_index_new (prev_offer);
   len = gst_sdp_media_formats_len (offer);
 
   for (i = 0; i < len; i++) {
@@ -928,10 +1104,11 @@ kms_sdp_rtp_avp_media_handler_add_supported_fmtp (KmsSdpRtpAvpMediaHandler *
     if (payload == NULL) {
       g_set_error_literal (error, KMS_SDP_AGENT_ERROR,
           SDP_AGENT_UNEXPECTED_ERROR, "Can not add payloads to the offer");
-      return FALSE;
+      ret = FALSE;
+      break;
     }
 
-    fmtp = sdp_utils_sdp_media_get_fmtp (prev_offer, payload);
+    fmtp = sdp_utils_pt_index_get_fmtp (index, atoi (payload));
 
     if (fmtp == NULL) {
       continue;
@@ -940,11 +1117,14 @@ kms_sdp_rtp_avp_media_handler_add_supported_fmtp (KmsSdpRtpAvpMediaHandler *
     if (gst_sdp_media_add_attribute (offer, "fmtp", fmtp) != GST_SDP_OK) {
       g_set_error_literal (error, KMS_SDP_AGENT_ERROR,
           SDP_AGENT_UNEXPECTED_ERROR, "Can not add fmtp attribute to offer");
-      return FALSE;
+      ret = FALSE;
+      break;
     }
   }
 
-  return TRUE;
+  sdp_utils_pt_index_free (index);
+
+  return ret;
 }
 
 static gboolean
@@ -1117,6 +1297,8 @@ kms_sdp_rtp_avp_media_handler_finalize (GObject * object)
   g_slist_free_full (self->priv->audio_fmts, kms_sdp_rtp_map_destroy_pointer);
   g_slist_free_full (self->priv->video_fmts, kms_sdp_rtp_map_destroy_pointer);
 
+  kms_sdp_rtp_avp_media_handler_invalidate_templates (self);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -1184,6 +1366,7 @@ kms_sdp_rtp_avp_media_handler_add_extmap (KmsSdpRtpAvpMediaHandler * self,
 
   g_hash_table_insert (self->priv->extmaps, GUINT_TO_POINTER (id),
       g_strdup (uri));
+  kms_sdp_rtp_avp_media_handler_invalidate_templates (self);
 
   return TRUE;
 }
@@ -1255,6 +1438,7 @@ kms_sdp_rtp_avp_media_handler_add_codec (KmsSdpRtpAvpMediaHandler * self,
   }
 
   *fmts = g_slist_append (*fmts, rtpmap);
+  kms_sdp_rtp_avp_media_handler_invalidate_templates (self);
 
   return rtpmap->payload;
 }
@@ -1333,6 +1517,7 @@ kms_sdp_rtp_avp_media_handler_add_fmtp (KmsSdpRtpAvpMediaHandler * self,
 
   rtpmap = l->data;
   rtpmap->fmtps = g_slist_prepend (rtpmap->fmtps, fmtp);
+  kms_sdp_rtp_avp_media_handler_invalidate_templates (self);
 
   return TRUE;
 }
@@ -22,8 +22,10 @@
 #include "kmsagnosticbin.h"
 #include "kmsagnosticcaps.h"
 #include "kmsutils.h"
+#include "kmskeyframearbiter.h"
 #include "kmsparsetreebin.h"
 #include "kmsdectreebin.h"
+#include "kmsconvtreebin.h"
 #include "kmsenctreebin.h"
 #include "kmsrtppaytreebin.h"
 
@@ -34,6 +36,9 @@
 #define UNLINKING_DATA "unlinking-data"
 G_DEFINE_QUARK (UNLINKING_DATA, unlinking_data);
 
+#define RUNG_SIZE "rung-size"
+G_DEFINE_QUARK (RUNG_SIZE, rung_size);
+
 #define KMS_AGNOSTIC_PAD_STARTED (GST_PAD_FLAG_LAST << 1)
 
 static GstStaticCaps static_raw_audio_caps =
@@ -69,6 +74,7 @@ G_DEFINE_TYPE (KmsAgnosticBin2, kms_agnostic_bin2, GST_TYPE_BIN);
 #define MIN_BITRATE_DEFAULT 0
 #define MAX_BITRATE_DEFAULT G_MAXINT
 #define LEAKY_TIME 600000000    /*600 ms */
+#define KEYFRAME_REQUEST_WINDOW_DEFAULT 1000    /* ms */
 
 enum
 {
@@ -103,6 +109,8 @@ struct _KmsAgnosticBin2Private
   gboolean bitrate_unlimited;
 
   gboolean transcoding_emitted;
+
+  guint keyframe_request_window;
 };
 
 enum
@@ -111,6 +119,8 @@ enum
   PROP_MIN_BITRATE,
   PROP_MAX_BITRATE,
   PROP_CODEC_CONFIG,
+  PROP_KEYFRAME_REQUEST_WINDOW,
+  PROP_KEYFRAME_REQUEST_STATS,
   N_PROPERTIES
 };
 
@@ -181,12 +191,66 @@ tee_src_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
   return GST_PAD_PROBE_OK;
 }
 
+/* The fakesink of the tree bin is always linked to the tee */
+static gboolean
+kms_agnostic_bin2_conv_tee_is_used (GstElement * tee)
+{
+  gboolean used;
+
+  GST_OBJECT_LOCK (tee);
+  used = tee->numsrcpads > 1;
+  GST_OBJECT_UNLOCK (tee);
+
+  return used;
+}
+
+/* Removes a conversion bin that has no consumers anymore. Another consumer */
+/* may have taken it meanwhile, so this is checked again under the lock */
+static void
+kms_agnostic_bin2_remove_conv_bin (KmsAgnosticBin2 * self,
+    GstElement * conv_bin)
+{
+  GstElement *tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (conv_bin));
+
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+
+  if (g_hash_table_lookup (self->priv->bins,
+          GST_OBJECT_NAME (conv_bin)) != conv_bin
+      || kms_agnostic_bin2_conv_tee_is_used (tee)) {
+    KMS_AGNOSTIC_BIN2_UNLOCK (self);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "Removing unused %" GST_PTR_FORMAT, conv_bin);
+
+  g_hash_table_remove (self->priv->bins, GST_OBJECT_NAME (conv_bin));
+
+  /* Releases the pad of the source tee, a rung may be left unused too */
+  kms_tree_bin_unlink_input_element_from_tee (KMS_TREE_BIN (conv_bin));
+  gst_element_set_locked_state (conv_bin, TRUE);
+  gst_bin_remove (GST_BIN (self), conv_bin);
+
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+
+  gst_element_set_state (conv_bin, GST_STATE_NULL);
+}
+
 static void
 remove_on_unlinked_async (gpointer data, gpointer not_used)
 {
   GstElement *elem = GST_ELEMENT_CAST (data);
   GstObject *parent;
 
+  if (KMS_IS_CONV_TREE_BIN (elem)) {
+    parent = gst_object_get_parent (GST_OBJECT (elem));
+    if (parent != NULL) {
+      kms_agnostic_bin2_remove_conv_bin (KMS_AGNOSTIC_BIN2 (parent), elem);
+      g_object_unref (parent);
+    }
+    g_object_unref (elem);
+    return;
+  }
+
   gst_element_set_locked_state (elem, TRUE);
   if (g_strcmp0 (GST_OBJECT_NAME (gst_element_get_factory (elem)),
           "queue") == 0) {
@@ -413,9 +477,33 @@ proxy_src_pad_query_function (GstPad * pad, GstObject * parent,
   return ret;
 }
 
+static gboolean
+kms_agnostic_bin2_caps_is_raw (GstCaps * caps)
+{
+  return !(gst_caps_is_any (caps) || gst_caps_is_empty (caps))
+      && kms_utils_caps_is_raw (caps);
+}
+
+static gboolean
+kms_agnostic_bin2_get_caps_size (const GstCaps * caps, gint * width,
+    gint * height)
+{
+  GstStructure *st;
+
+  if (!kms_utils_caps_is_video (caps) || gst_caps_get_size (caps) != 1) {
+    return FALSE;
+  }
+
+  st = gst_caps_get_structure (caps, 0);
+
+  return gst_structure_get_int (st, "width", width)
+      && gst_structure_get_int (st, "height", height);
+}
+
+/* 'convert_media' is FALSE when the tee already outputs media in 'caps' */
 static void
 kms_agnostic_bin2_link_to_tee (KmsAgnosticBin2 * self, GstPad * pad,
-    GstElement * tee, GstCaps * caps)
+    GstElement * tee, GstCaps * caps, gboolean convert_media)
 {
   GstElement *queue = kms_utils_element_factory_make ("queue", "agnosticbin_");
   GstPad *target;
@@ -424,16 +512,15 @@ kms_agnostic_bin2_link_to_tee (KmsAgnosticBin2 * self, GstPad * pad,
   gst_bin_add (GST_BIN (self), queue);
   gst_element_sync_state_with_parent (queue);
 
-  if (!(gst_caps_is_any (caps) || gst_caps_is_empty (caps))
-      && kms_utils_caps_is_raw (caps)) {
+  if (kms_agnostic_bin2_caps_is_raw (caps) && kms_utils_caps_is_video (caps)) {
+    g_object_set (queue, "leaky", 2, "max-size-time", LEAKY_TIME, NULL);
+  }
+
+  if (convert_media && kms_agnostic_bin2_caps_is_raw (caps)) {
     GstElement *convert = kms_utils_create_convert_for_caps (caps);
     GstElement *rate = kms_utils_create_rate_for_caps (caps);
     GstElement *mediator = kms_utils_create_mediator_element (caps);
 
-    if (kms_utils_caps_is_video (caps)) {
-      g_object_set (queue, "leaky", 2, "max-size-time", LEAKY_TIME, NULL);
-    }
-
     remove_element_on_unlinked (convert, "src", "sink");
     if (rate) {
       remove_element_on_unlinked (rate, "src", "sink");
@@ -516,11 +603,15 @@ kms_agnostic_bin2_find_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
 {
   GList *bins, *l;
   GstBin *bin = NULL;
+  gint width, height;
+  gboolean sized;
 
   if (gst_caps_is_any (caps) || gst_caps_is_empty (caps)) {
     return self->priv->input_bin;
   }
 
+  sized = kms_agnostic_bin2_get_caps_size (caps, &width, &height);
+
   if (check_bin (KMS_TREE_BIN (self->priv->input_bin), caps)) {
     bin = self->priv->input_bin;
   }
@@ -534,6 +625,18 @@ kms_agnostic_bin2_find_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
       continue;
     }
 
+    if (KMS_IS_CONV_TREE_BIN (tree_bin)) {
+      // Skip: only found by kms_agnostic_bin2_get_or_create_conv_bin
+      continue;
+    }
+
+    if (sized && KMS_IS_ENC_TREE_BIN (tree_bin)
+        && g_object_get_qdata (G_OBJECT (tree_bin),
+            rung_size_quark ()) != GINT_TO_POINTER (width << 16 | height)) {
+      // Skip: it is not fed from a rung of the requested size
+      continue;
+    }
+
     if (check_bin (tree_bin, caps)) {
       bin = GST_BIN_CAST (tree_bin);
     }
@@ -621,6 +724,165 @@ kms_agnostic_bin2_get_or_create_dec_bin (KmsAgnosticBin2 * self, GstCaps * caps)
   }
 }
 
+static void
+kms_agnostic_bin2_conv_tee_pad_removed (GstElement * tee, GstPad * pad,
+    KmsAgnosticBin2 * self)
+{
+  GstObject *conv_bin;
+
+  if (GST_PAD_DIRECTION (pad) != GST_PAD_SRC
+      || kms_agnostic_bin2_conv_tee_is_used (tee)) {
+    return;
+  }
+
+  conv_bin = gst_object_get_parent (GST_OBJECT (tee));
+  if (conv_bin == NULL) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "Last consumer of %" GST_PTR_FORMAT " is gone",
+      conv_bin);
+  g_thread_pool_push (self->priv->remove_pool, conv_bin, NULL);
+}
+
+/*
+ * Raw consumers that want the same caps from the same bin share one
+ * conversion, and frames are not copied when it works in passthrough.
+ * Consumers are the pads of its tee: queues of raw outputs, encoders and
+ * smaller rungs. It is removed when the last one is released.
+ */
+static GstBin *
+kms_agnostic_bin2_get_or_create_conv_bin (KmsAgnosticBin2 * self,
+    GstBin * source, GstCaps * caps)
+{
+  KmsConvTreeBin *conv_bin = NULL;
+  GstElement *output_tee, *input_element;
+  GList *bins, *l;
+
+  bins = g_hash_table_get_values (self->priv->bins);
+  for (l = bins; l != NULL && conv_bin == NULL; l = l->next) {
+    if (!KMS_IS_CONV_TREE_BIN (l->data)) {
+      continue;
+    }
+
+    if (kms_conv_tree_bin_get_source (l->data) == source
+        && kms_conv_tree_bin_is_for_caps (l->data, caps)) {
+      conv_bin = KMS_CONV_TREE_BIN (l->data);
+    }
+  }
+  g_list_free (bins);
+
+  if (conv_bin != NULL) {
+    GST_DEBUG_OBJECT (self, "Sharing %" GST_PTR_FORMAT, conv_bin);
+    return GST_BIN (conv_bin);
+  }
+
+  conv_bin = kms_conv_tree_bin_new (caps);
+  if (conv_bin == NULL) {
+    return NULL;
+  }
+
+  kms_conv_tree_bin_set_source (conv_bin, source);
+
+  gst_bin_add (GST_BIN (self), GST_ELEMENT (conv_bin));
+  gst_element_sync_state_with_parent (GST_ELEMENT (conv_bin));
+
+  output_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (source));
+  input_element = kms_tree_bin_get_input_element (KMS_TREE_BIN (conv_bin));
+  gst_element_link (output_tee, input_element);
+
+  g_signal_connect (kms_tree_bin_get_output_tee (KMS_TREE_BIN (conv_bin)),
+      "pad-removed", G_CALLBACK (kms_agnostic_bin2_conv_tee_pad_removed),
+      self);
+
+  kms_agnostic_bin2_insert_bin (self, GST_BIN (conv_bin));
+
+  GST_DEBUG_OBJECT (self, "Created %" GST_PTR_FORMAT " for %" GST_PTR_FORMAT,
+      conv_bin, caps);
+
+  return GST_BIN (conv_bin);
+}
+
+/*
+ * Scaling ladder: encoders that want a given size take their frames from a
+ * rung, a conversion bin whose caps only fix the size. Each rung scales
+ * from the smallest rung above it instead of from the decoded frames, so
+ * 1080p -> 720p -> 360p -> 180p is a cascade of cheap scales sharing one
+ * decode. Rungs are created on demand, so the cascade is only complete
+ * when the bigger sizes are requested first.
+ */
+static gboolean
+kms_agnostic_bin2_get_rung_size (KmsConvTreeBin * conv_bin, gint * width,
+    gint * height)
+{
+  GstCaps *caps = kms_conv_tree_bin_get_caps (conv_bin);
+  gboolean ret;
+
+  ret = gst_structure_n_fields (gst_caps_get_structure (caps, 0)) == 2
+      && kms_agnostic_bin2_get_caps_size (caps, width, height)
+      && kms_agnostic_bin2_caps_is_raw (caps);
+  gst_caps_unref (caps);
+
+  return ret;
+}
+
+static GstBin *
+kms_agnostic_bin2_get_rung_root (KmsConvTreeBin * conv_bin)
+{
+  GstBin *source = kms_conv_tree_bin_get_source (conv_bin);
+
+  while (KMS_IS_CONV_TREE_BIN (source)) {
+    source = kms_conv_tree_bin_get_source (KMS_CONV_TREE_BIN (source));
+  }
+
+  return source;
+}
+
+static GstBin *
+kms_agnostic_bin2_get_or_create_rung (KmsAgnosticBin2 * self, GstBin * root,
+    gint width, gint height)
+{
+  GstBin *source = root, *rung = NULL;
+  gint64 source_area = G_MAXINT64;
+  GList *bins, *l;
+  GstCaps *caps;
+
+  /* Smallest rung of this decode that is at least as big as the new one */
+  bins = g_hash_table_get_values (self->priv->bins);
+  for (l = bins; l != NULL && rung == NULL; l = l->next) {
+    gint w, h;
+
+    if (!KMS_IS_CONV_TREE_BIN (l->data)
+        || !kms_agnostic_bin2_get_rung_size (l->data, &w, &h)
+        || kms_agnostic_bin2_get_rung_root (l->data) != root) {
+      continue;
+    }
+
+    if (w == width && h == height) {
+      rung = GST_BIN (l->data);
+    } else if (w >= width && h >= height && (gint64) w * h < source_area) {
+      source = GST_BIN (l->data);
+      source_area = (gint64) w * h;
+    }
+  }
+  g_list_free (bins);
+
+  if (rung != NULL) {
+    GST_DEBUG_OBJECT (self, "Sharing rung %dx%d", width, height);
+    return rung;
+  }
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, width,
+      "height", G_TYPE_INT, height, NULL);
+  rung = kms_agnostic_bin2_get_or_create_conv_bin (self, source, caps);
+  gst_caps_unref (caps);
+
+  GST_DEBUG_OBJECT (self, "Rung %dx%d scales from %" GST_PTR_FORMAT, width,
+      height, source);
+
+  return rung;
+}
+
 static GstBin *
 kms_agnostic_bin2_create_rtp_pay_bin (KmsAgnosticBin2 * self, GstCaps * caps)
 {
@@ -660,6 +922,7 @@ kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
   GstBin *dec_bin;
   KmsEncTreeBin *enc_bin;
   GstElement *input_element, *output_tee;
+  gint width, height;
 
   if (kms_utils_caps_is_rtp (caps)) {
     return kms_agnostic_bin2_create_rtp_pay_bin (self, caps);
@@ -682,6 +945,19 @@ kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
     return NULL;
   }
 
+  if (kms_agnostic_bin2_get_caps_size (caps, &width, &height)) {
+    GstBin *rung;
+
+    /* The encoder scaler works in passthrough with frames from the rung */
+    rung = kms_agnostic_bin2_get_or_create_rung (self, dec_bin, width,
+        height);
+    if (rung != NULL) {
+      g_object_set_qdata (G_OBJECT (enc_bin), rung_size_quark (),
+          GINT_TO_POINTER (width << 16 | height));
+      dec_bin = rung;
+    }
+  }
+
   gst_bin_add (GST_BIN (self), GST_ELEMENT (enc_bin));
   gst_element_sync_state_with_parent (GST_ELEMENT (enc_bin));
 
@@ -784,13 +1060,23 @@ kms_agnostic_bin2_link_pad (KmsAgnosticBin2 * self, GstPad * pad, GstPad * peer)
 
   bin = kms_agnostic_bin2_find_or_create_bin_for_caps (self, peer_caps);
 
+  if (bin != NULL && kms_agnostic_bin2_caps_is_raw (peer_caps)) {
+    GstBin *conv_bin;
+
+    conv_bin = kms_agnostic_bin2_get_or_create_conv_bin (self, bin, peer_caps);
+    if (conv_bin != NULL) {
+      bin = conv_bin;
+    }
+  }
+
   if (bin != NULL) {
     GstElement *tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (bin));
 
     if (!kms_utils_caps_is_rtp (peer_caps)) {
       kms_utils_drop_until_keyframe (pad, TRUE);
     }
-    kms_agnostic_bin2_link_to_tee (self, pad, tee, peer_caps);
+    kms_agnostic_bin2_link_to_tee (self, pad, tee, peer_caps,
+        !KMS_IS_CONV_TREE_BIN (bin));
   }
 
   gst_caps_unref (peer_caps);
@@ -1217,6 +1503,13 @@ kms_agnostic_bin2_set_property (GObject * object, guint property_id,
       self->priv->codec_config = g_value_dup_boxed (value);
       KMS_AGNOSTIC_BIN2_UNLOCK (self);
       break;
+    case PROP_KEYFRAME_REQUEST_WINDOW:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      self->priv->keyframe_request_window = g_value_get_uint (value);
+      kms_keyframe_arbiter_set_window (self->priv->sink,
+          self->priv->keyframe_request_window * GST_MSECOND);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1249,6 +1542,21 @@ kms_agnostic_bin2_get_property (GObject * object, guint property_id,
       g_value_set_boxed (value, self->priv->codec_config);
       KMS_AGNOSTIC_BIN2_UNLOCK (self);
       break;
+    case PROP_KEYFRAME_REQUEST_WINDOW:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      g_value_set_uint (value, self->priv->keyframe_request_window);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_KEYFRAME_REQUEST_STATS:{
+      KmsKeyframeArbiterStats stats;
+
+      kms_keyframe_arbiter_get_stats (self->priv->sink, &stats);
+      g_value_take_boxed (value, gst_structure_new ("keyframe-requests",
+              "requests", G_TYPE_UINT64, stats.requests,
+              "forwarded", G_TYPE_UINT64, stats.forwarded,
+              "suppressed", G_TYPE_UINT64, stats.suppressed, NULL));
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1301,6 +1609,17 @@ kms_agnostic_bin2_class_init (KmsAgnosticBin2Class * klass)
       g_param_spec_boxed ("codec-config", "codec config",
           "Codec configuration", GST_TYPE_STRUCTURE, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_KEYFRAME_REQUEST_WINDOW,
+      g_param_spec_uint ("keyframe-request-window", "Keyframe request window",
+          "Time (ms) during which the keyframe requests of all the consumers "
+          "are merged into the one sent upstream",
+          0, G_MAXUINT, KEYFRAME_REQUEST_WINDOW_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_KEYFRAME_REQUEST_STATS,
+      g_param_spec_boxed ("keyframe-request-stats", "Keyframe request stats",
+          "Keyframe requests received from the consumers, forwarded upstream "
+          "and suppressed", GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
   /* Signal "KmsAgnosticBin::media-transcoding"
    * Arguments:
    * - Is transcoding?
@@ -1454,6 +1773,8 @@ kms_agnostic_bin2_init (KmsAgnosticBin2 * self)
   gst_pad_set_chain_list_function (self->priv->sink,
       kms_agnostic_bin2_sink_chain_list);
   kms_utils_pad_monitor_gaps (self->priv->sink);
+  kms_keyframe_arbiter_add (self->priv->sink,
+      KEYFRAME_REQUEST_WINDOW_DEFAULT * GST_MSECOND);
   g_object_unref (templ);
   g_object_unref (target);
 
@@ -1474,6 +1795,7 @@ kms_agnostic_bin2_init (KmsAgnosticBin2 * self)
   self->priv->max_bitrate = MAX_BITRATE_DEFAULT;
   self->priv->bitrate_unlimited = FALSE;
   self->priv->transcoding_emitted = FALSE;
+  self->priv->keyframe_request_window = KEYFRAME_REQUEST_WINDOW_DEFAULT;
 }
 
 gboolean
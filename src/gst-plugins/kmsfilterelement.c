@@ -25,10 +25,15 @@
 #include "kmsutils.h"
 #include "kms-core-enumtypes.h"
 #include "kmsfiltertype.h"
+#include "kmsfilterpool.h"
 
 #define PLUGIN_NAME "filterelement"
 
 #define DEFAULT_FILTER_TYPE KMS_FILTER_TYPE_AUTODETECT
+#define DEFAULT_WORKERS 1
+#define MAX_WORKERS 32
+#define DEFAULT_QUEUE_SIZE 1
+#define DEFAULT_DROP_POLICY KMS_FILTER_DROP_POLICY_OLDEST
 
 GST_DEBUG_CATEGORY_STATIC (kms_filter_element_debug_category);
 #define GST_CAT_DEFAULT kms_filter_element_debug_category
@@ -55,6 +60,11 @@ struct _KmsFilterElementPrivate
   gchar *filter_factory;
   GstElement *filter;
   KmsFilterType filter_type;
+
+  KmsFilterPool *pool;
+  guint workers;
+  guint queue_size;
+  KmsFilterDropPolicy drop_policy;
 };
 
 /* properties */
@@ -63,7 +73,10 @@ enum
   PROP_0,
   PROP_FILTER_FACTORY,
   PROP_FILTER,
-  PROP_FILTER_TYPE
+  PROP_FILTER_TYPE,
+  PROP_WORKERS,
+  PROP_QUEUE_SIZE,
+  PROP_DROP_POLICY
 };
 
 /* pad templates */
@@ -79,19 +92,21 @@ static void
 kms_filter_element_connect_filter (KmsFilterElement * self,
     KmsElementPadType type, GstElement * filter, GstElement * agnosticbin)
 {
-  GstElement *queue = gst_element_factory_make ("queue", NULL);
-  GstPad *target = gst_element_get_static_pad (queue, "sink");
+  GstPad *target;
 
-  g_object_set (queue, "leaky", 2, "max-size-buffers", 1, NULL);
+  self->priv->pool = kms_filter_pool_new (GST_BIN (self), filter,
+      self->priv->workers, self->priv->queue_size, self->priv->drop_policy);
 
-  gst_bin_add_many (GST_BIN (self), queue, filter, NULL);
+  if (self->priv->pool == NULL) {
+    GST_ERROR_OBJECT (self, "Cannot run filter %" GST_PTR_FORMAT, filter);
+    return;
+  }
 
-  self->priv->filter = filter;
+  self->priv->filter = kms_filter_pool_get_filter (self->priv->pool);
 
-  gst_element_link_many (queue, filter, agnosticbin, NULL);
-  gst_element_sync_state_with_parent (filter);
-  gst_element_sync_state_with_parent (queue);
+  kms_filter_pool_link (self->priv->pool, agnosticbin);
 
+  target = kms_filter_pool_get_sink (self->priv->pool);
   kms_element_connect_sink_target (KMS_ELEMENT (self), target, type);
   g_object_unref (target);
 }
@@ -246,6 +261,15 @@ kms_filter_element_get_property (GObject * object, guint prop_id,
     case PROP_FILTER_TYPE:
       g_value_set_enum (value, self->priv->filter_type);
       break;
+    case PROP_WORKERS:
+      g_value_set_uint (value, self->priv->workers);
+      break;
+    case PROP_QUEUE_SIZE:
+      g_value_set_uint (value, self->priv->queue_size);
+      break;
+    case PROP_DROP_POLICY:
+      g_value_set_enum (value, self->priv->drop_policy);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -291,6 +315,15 @@ kms_filter_element_set_property (GObject * object, guint prop_id,
     case PROP_FILTER_TYPE:
       self->priv->filter_type = g_value_get_enum (value);
       break;
+    case PROP_WORKERS:
+      self->priv->workers = g_value_get_uint (value);
+      break;
+    case PROP_QUEUE_SIZE:
+      self->priv->queue_size = g_value_get_uint (value);
+      break;
+    case PROP_DROP_POLICY:
+      self->priv->drop_policy = g_value_get_enum (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -326,11 +359,69 @@ kms_filter_element_finalize (GObject * object)
     filter_element->priv->filter_factory = NULL;
   }
 
+  /* Elements of the pool went away with the bin */
+  if (filter_element->priv->pool != NULL) {
+    kms_filter_pool_destroy (filter_element->priv->pool);
+    filter_element->priv->pool = NULL;
+  }
+
   g_rec_mutex_clear (&filter_element->priv->mutex);
 
   G_OBJECT_CLASS (kms_filter_element_parent_class)->finalize (object);
 }
 
+static GstStateChangeReturn
+kms_filter_element_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  KmsFilterElement *self = KMS_FILTER_ELEMENT (element);
+  GstStateChangeReturn ret;
+  KmsFilterPool *pool;
+
+  KMS_FILTER_ELEMENT_LOCK (self);
+  pool = self->priv->pool;
+  KMS_FILTER_ELEMENT_UNLOCK (self);
+
+  /* Workers waiting for their turn would keep the pads from deactivating */
+  if (pool != NULL && transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    kms_filter_pool_set_flushing (pool, TRUE);
+  }
+
+  ret = GST_ELEMENT_CLASS (kms_filter_element_parent_class)->change_state
+      (element, transition);
+
+  if (pool != NULL && transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+    kms_filter_pool_set_flushing (pool, FALSE);
+  }
+
+  return ret;
+}
+
+static GstStructure *
+kms_filter_element_stats (KmsElement * obj, gchar * selector)
+{
+  KmsFilterElement *self = KMS_FILTER_ELEMENT (obj);
+  GstStructure *stats, *pool_stats;
+
+  /* chain up */
+  stats =
+      KMS_ELEMENT_CLASS (kms_filter_element_parent_class)->stats (obj,
+      selector);
+
+  KMS_FILTER_ELEMENT_LOCK (self);
+
+  if (self->priv->pool != NULL) {
+    pool_stats = kms_filter_pool_get_stats (self->priv->pool);
+    gst_structure_set (stats, "filter-workers", GST_TYPE_STRUCTURE,
+        pool_stats, NULL);
+    gst_structure_free (pool_stats);
+  }
+
+  KMS_FILTER_ELEMENT_UNLOCK (self);
+
+  return stats;
+}
+
 static void
 kms_filter_element_class_init (KmsFilterElementClass * klass)
 {
@@ -346,6 +437,11 @@ kms_filter_element_class_init (KmsFilterElementClass * klass)
   gobject_class->set_property = kms_filter_element_set_property;
   gobject_class->get_property = kms_filter_element_get_property;
 
+  GST_ELEMENT_CLASS (klass)->change_state =
+      GST_DEBUG_FUNCPTR (kms_filter_element_change_state);
+  KMS_ELEMENT_CLASS (klass)->stats =
+      GST_DEBUG_FUNCPTR (kms_filter_element_stats);
+
   /* define properties */
   g_object_class_install_property (gobject_class, PROP_FILTER_FACTORY,
       g_param_spec_string ("filter-factory", "filter-factory",
@@ -361,6 +457,24 @@ kms_filter_element_class_init (KmsFilterElementClass * klass)
           "type of the filter",
           KMS_TYPE_FILTER_TYPE, DEFAULT_FILTER_TYPE, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_WORKERS,
+      g_param_spec_uint ("workers", "Workers",
+          "Filter instances processing frames in parallel. Only applies to "
+          "filters set afterwards", 1, MAX_WORKERS, DEFAULT_WORKERS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_QUEUE_SIZE,
+      g_param_spec_uint ("queue-size", "Queue size",
+          "Frames waiting for each worker. Only applies to filters set "
+          "afterwards", 1, G_MAXUINT, DEFAULT_QUEUE_SIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_DROP_POLICY,
+      g_param_spec_enum ("drop-policy", "Drop policy",
+          "Frames dropped when a worker queue is full. Only applies to "
+          "filters set afterwards", KMS_TYPE_FILTER_DROP_POLICY,
+          DEFAULT_DROP_POLICY, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
   /* Registers a private structure for the instantiatable type */
   g_type_class_add_private (klass, sizeof (KmsFilterElementPrivate));
 }
@@ -374,6 +488,10 @@ kms_filter_element_init (KmsFilterElement * self)
 
   self->priv->filter = NULL;
   self->priv->filter_factory = NULL;
+  self->priv->pool = NULL;
+  self->priv->workers = DEFAULT_WORKERS;
+  self->priv->queue_size = DEFAULT_QUEUE_SIZE;
+  self->priv->drop_policy = DEFAULT_DROP_POLICY;
 }
 
 gboolean
@@ -0,0 +1,754 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsfilterpool.h"
+
+#define GST_CAT_DEFAULT kms_filter_pool_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "filterpool"
+
+/* A worker never waits longer than this for the ones before it. Dropped */
+/* and swallowed frames are accounted for, so it should not happen */
+#define REORDER_TIMEOUT (G_TIME_SPAN_SECOND)
+
+/* Upper limits, in microseconds, of the processing time histogram */
+static const gint64 histogram_limits[] = {
+  1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+
+static const gchar *histogram_names[] = {
+  "under-1ms", "under-2ms", "under-5ms", "under-10ms", "under-20ms",
+  "under-50ms", "under-100ms", "over-100ms"
+};
+
+#define HISTOGRAM_BUCKETS G_N_ELEMENTS (histogram_names)
+
+/* Frame dispatched to a worker. The buffer is not referenced, it only */
+/* tells the frame apart when it comes out of the queue */
+typedef struct _KmsFilterFrame
+{
+  gsize seq;
+  gconstpointer data;
+} KmsFilterFrame;
+
+typedef struct _KmsFilterWorker
+{
+  KmsFilterPool *pool;
+  guint index;
+
+  GstElement *queue;
+  GstElement *filter;
+
+  guint64 queued;
+  guint64 dequeued;
+  guint64 processed;
+  guint64 dropped;
+
+  /* Frames given to this worker whose output has not been sent yet */
+  GQueue frames;                /* KmsFilterFrame, in order */
+
+  /* Frame being processed, its output has not been seen yet */
+  gboolean busy;
+  gboolean flushing;
+  gsize seq;
+  gint64 start_time;
+  gint64 busy_time;
+} KmsFilterWorker;
+
+struct _KmsFilterPool
+{
+  GMutex mutex;
+  GCond cond;
+
+  GstBin *bin;
+  GstElement *tee;              /* NULL with one worker */
+  GstElement *funnel;           /* NULL with one worker */
+
+  KmsFilterWorker *workers;
+  guint n_workers;
+
+  gint dispatch;                /* Worker that gets the current frame */
+  gsize dispatch_seq;           /* Sequence number of the current frame */
+  guint next_worker;
+  gboolean flushing;
+  guint queue_size;
+  KmsFilterDropPolicy drop_policy;
+
+  gint64 start_time;
+  guint64 histogram[HISTOGRAM_BUCKETS];
+  guint64 reorder_timeouts;
+
+  gulong notify_id;
+};
+
+static void
+kms_filter_pool_init_debug (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&init, 1);
+  }
+}
+
+static guint
+kms_filter_pool_count_buffers (GstPadProbeInfo * info)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    return gst_buffer_list_length (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+  }
+
+  return 1;
+}
+
+/* Property mirroring */
+
+static gboolean
+kms_filter_pool_is_mirrored (GParamSpec * pspec)
+{
+  if ((pspec->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE
+      || (pspec->flags & G_PARAM_CONSTRUCT_ONLY)) {
+    return FALSE;
+  }
+
+  /* GstObject ones identify the instance */
+  return pspec->owner_type != GST_TYPE_OBJECT;
+}
+
+static void
+kms_filter_pool_copy_property (KmsFilterPool * pool, GParamSpec * pspec)
+{
+  GValue value = G_VALUE_INIT;
+  guint i;
+
+  g_value_init (&value, pspec->value_type);
+  g_object_get_property (G_OBJECT (pool->workers[0].filter), pspec->name,
+      &value);
+
+  for (i = 1; i < pool->n_workers; i++) {
+    g_object_set_property (G_OBJECT (pool->workers[i].filter), pspec->name,
+        &value);
+  }
+
+  g_value_unset (&value);
+}
+
+static void
+kms_filter_pool_filter_notify (GObject * filter, GParamSpec * pspec,
+    KmsFilterPool * pool)
+{
+  if (kms_filter_pool_is_mirrored (pspec)) {
+    GST_DEBUG_OBJECT (filter, "Copying \"%s\" to the workers", pspec->name);
+    kms_filter_pool_copy_property (pool, pspec);
+  }
+}
+
+static void
+kms_filter_pool_copy_properties (KmsFilterPool * pool)
+{
+  GParamSpec **pspecs;
+  guint i, n;
+
+  pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS
+      (pool->workers[0].filter), &n);
+
+  for (i = 0; i < n; i++) {
+    if (kms_filter_pool_is_mirrored (pspecs[i])) {
+      kms_filter_pool_copy_property (pool, pspecs[i]);
+    }
+  }
+
+  g_free (pspecs);
+}
+
+/* Dispatching */
+
+static GstPadProbeReturn
+kms_filter_pool_dispatch_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsFilterPool * pool)
+{
+  /* The tee pushes the frame to all the workers after this, in this thread */
+  pool->dispatch_seq++;
+  g_atomic_int_set (&pool->dispatch, pool->next_worker);
+  pool->next_worker = (pool->next_worker + 1) % pool->n_workers;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+kms_filter_pool_branch_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsFilterWorker * worker)
+{
+  if (g_atomic_int_get (&worker->pool->dispatch) != (gint) worker->index) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+kms_filter_pool_queue_in_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsFilterWorker * worker)
+{
+  KmsFilterPool *pool = worker->pool;
+  guint n = kms_filter_pool_count_buffers (info);
+  KmsFilterFrame *frame;
+  guint level = 0;
+
+  if (pool->tee == NULL) {
+    /* Nothing dispatches frames to a single worker */
+    pool->dispatch_seq++;
+  }
+
+  if (pool->drop_policy == KMS_FILTER_DROP_POLICY_NEWEST
+      && pool->queue_size > 0) {
+    /* Only this thread fills the queue, so it cannot get fuller */
+    g_object_get (worker->queue, "current-level-buffers", &level, NULL);
+  }
+
+  g_mutex_lock (&pool->mutex);
+
+  worker->queued += n;
+
+  if (level >= pool->queue_size && level > 0) {
+    /* Dropped here instead of in the queue, so it is not waited for */
+    worker->dropped += n;
+    g_mutex_unlock (&pool->mutex);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  if (!worker->flushing) {
+    frame = g_slice_new (KmsFilterFrame);
+    frame->seq = pool->dispatch_seq;
+    frame->data = GST_PAD_PROBE_INFO_DATA (info);
+    g_queue_push_tail (&worker->frames, frame);
+  }
+
+  g_mutex_unlock (&pool->mutex);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Frame accounting, always called with the mutex held */
+
+static void
+kms_filter_frame_free (KmsFilterFrame * frame)
+{
+  g_slice_free (KmsFilterFrame, frame);
+}
+
+static gsize
+kms_filter_pool_worker_first (KmsFilterWorker * worker)
+{
+  KmsFilterFrame *frame = g_queue_peek_head (&worker->frames);
+
+  return frame != NULL ? frame->seq : 0;
+}
+
+static void
+kms_filter_pool_worker_clear (KmsFilterWorker * worker)
+{
+  KmsFilterFrame *frame;
+
+  while ((frame = g_queue_pop_head (&worker->frames)) != NULL) {
+    kms_filter_frame_free (frame);
+  }
+}
+
+static void
+kms_filter_pool_worker_done (KmsFilterWorker * worker, gint64 now)
+{
+  KmsFilterPool *pool = worker->pool;
+  gint64 elapsed = now - worker->start_time;
+  guint i;
+
+  for (i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+    if (elapsed < histogram_limits[i]) {
+      break;
+    }
+  }
+
+  pool->histogram[i]++;
+  worker->busy_time += elapsed;
+  worker->processed++;
+  worker->busy = FALSE;
+}
+
+/* The frame 'seq' does not hold the ones after it anymore */
+static void
+kms_filter_pool_worker_release (KmsFilterWorker * worker, gsize seq)
+{
+  if (!g_queue_is_empty (&worker->frames)
+      && kms_filter_pool_worker_first (worker) == seq) {
+    kms_filter_frame_free (g_queue_pop_head (&worker->frames));
+    g_cond_broadcast (&worker->pool->cond);
+  }
+}
+
+static void
+kms_filter_pool_worker_reset (KmsFilterWorker * worker)
+{
+  kms_filter_pool_worker_clear (worker);
+  worker->busy = FALSE;
+  g_cond_broadcast (&worker->pool->cond);
+}
+
+/* Other workers still have frames that went before 'seq' */
+static gboolean
+kms_filter_pool_is_behind (KmsFilterWorker * worker, gsize seq)
+{
+  KmsFilterPool *pool = worker->pool;
+  guint i;
+
+  for (i = 0; i < pool->n_workers; i++) {
+    KmsFilterWorker *other = &pool->workers[i];
+
+    if (other != worker && !g_queue_is_empty (&other->frames)
+        && kms_filter_pool_worker_first (other) < seq) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* The queue ran out of frames after pushing the last one to the filter */
+static void
+kms_filter_pool_queue_underrun (GstElement * queue, KmsFilterWorker * worker)
+{
+  KmsFilterPool *pool = worker->pool;
+
+  g_mutex_lock (&pool->mutex);
+
+  if (worker->busy) {
+    /* The filter did not output anything for it */
+    kms_filter_pool_worker_done (worker, g_get_monotonic_time ());
+    kms_filter_pool_worker_release (worker, worker->seq);
+  }
+
+  g_mutex_unlock (&pool->mutex);
+}
+
+static GstPadProbeReturn
+kms_filter_pool_filter_in_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsFilterWorker * worker)
+{
+  KmsFilterPool *pool = worker->pool;
+  gconstpointer data;
+  KmsFilterFrame *frame;
+  gboolean found = FALSE;
+  gsize seq = 0;
+  GList *l;
+  gint64 now;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_BOTH) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    g_mutex_lock (&pool->mutex);
+
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_FLUSH_START:
+        worker->flushing = TRUE;
+        kms_filter_pool_worker_reset (worker);
+        break;
+      case GST_EVENT_FLUSH_STOP:
+        worker->flushing = FALSE;
+        kms_filter_pool_worker_reset (worker);
+        break;
+      case GST_EVENT_EOS:
+        kms_filter_pool_worker_reset (worker);
+        break;
+      default:
+        break;
+    }
+
+    g_mutex_unlock (&pool->mutex);
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  data = GST_PAD_PROBE_INFO_DATA (info);
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&pool->mutex);
+
+  if (worker->busy) {
+    /* The filter did not output anything for the previous frame */
+    kms_filter_pool_worker_done (worker, now);
+    kms_filter_pool_worker_release (worker, worker->seq);
+  }
+
+  /* The latest entry of this buffer, earlier ones can only be dropped */
+  /* frames whose buffer was reused */
+  for (l = worker->frames.tail; l != NULL; l = l->prev) {
+    frame = l->data;
+
+    if (frame->data == data) {
+      seq = frame->seq;
+      found = TRUE;
+      break;
+    }
+  }
+
+  /* Frames before this one were dropped by the leaky queue */
+  while (found && kms_filter_pool_worker_first (worker) < seq) {
+    kms_filter_frame_free (g_queue_pop_head (&worker->frames));
+    worker->dropped++;
+    g_cond_broadcast (&pool->cond);
+  }
+
+  if (pool->start_time == 0) {
+    pool->start_time = now;
+  }
+
+  worker->dequeued += kms_filter_pool_count_buffers (info);
+  worker->busy = TRUE;
+  worker->seq = seq;
+  worker->start_time = now;
+
+  g_mutex_unlock (&pool->mutex);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+kms_filter_pool_filter_out_probe (GstPad * pad, GstPadProbeInfo * info,
+    KmsFilterWorker * worker)
+{
+  KmsFilterPool *pool = worker->pool;
+  gint64 deadline;
+
+  g_mutex_lock (&pool->mutex);
+
+  if (!worker->busy) {
+    /* More output for a frame already done */
+    g_mutex_unlock (&pool->mutex);
+    return GST_PAD_PROBE_OK;
+  }
+
+  kms_filter_pool_worker_done (worker, g_get_monotonic_time ());
+
+  deadline = g_get_monotonic_time () + REORDER_TIMEOUT;
+
+  while (!pool->flushing && !worker->flushing
+      && kms_filter_pool_is_behind (worker, worker->seq)) {
+    if (!g_cond_wait_until (&pool->cond, &pool->mutex, deadline)) {
+      GST_WARNING_OBJECT (worker->filter, "Frame %" G_GSIZE_FORMAT
+          " sent out of order", worker->seq);
+      pool->reorder_timeouts++;
+      break;
+    }
+  }
+
+  kms_filter_pool_worker_release (worker, worker->seq);
+
+  g_mutex_unlock (&pool->mutex);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Construction */
+
+static gboolean
+kms_filter_pool_add_worker (KmsFilterPool * pool, guint index,
+    GstElement * filter, guint queue_size, KmsFilterDropPolicy drop_policy)
+{
+  KmsFilterWorker *worker = &pool->workers[index];
+  GstPad *pad;
+  gint leaky;
+
+  switch (drop_policy) {
+    case KMS_FILTER_DROP_POLICY_NEWEST:
+      leaky = 1;                /* upstream */
+      break;
+    case KMS_FILTER_DROP_POLICY_OLDEST:
+      leaky = 2;                /* downstream */
+      break;
+    default:
+      leaky = 0;
+      break;
+  }
+
+  worker->pool = pool;
+  worker->index = index;
+  worker->filter = filter;
+  worker->queue = gst_element_factory_make ("queue", NULL);
+  g_object_set (worker->queue, "leaky", leaky, "max-size-buffers", queue_size,
+      "max-size-bytes", 0, "max-size-time", G_GUINT64_CONSTANT (0), NULL);
+  g_signal_connect (worker->queue, "underrun",
+      G_CALLBACK (kms_filter_pool_queue_underrun), worker);
+
+  gst_bin_add_many (pool->bin, worker->queue, worker->filter, NULL);
+
+  if (!gst_element_link (worker->queue, worker->filter)) {
+    GST_ERROR_OBJECT (pool->bin, "Cannot link worker %u", index);
+    return FALSE;
+  }
+
+  if (pool->tee != NULL) {
+    if (!gst_element_link (pool->tee, worker->queue)
+        || !gst_element_link (worker->filter, pool->funnel)) {
+      GST_ERROR_OBJECT (pool->bin, "Cannot connect worker %u", index);
+      return FALSE;
+    }
+  }
+
+  pad = gst_element_get_static_pad (worker->queue, "sink");
+  if (pool->tee != NULL) {
+    /* Before counting, only the dispatched frames get into the queue */
+    gst_pad_add_probe (pad,
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+        (GstPadProbeCallback) kms_filter_pool_branch_probe, worker, NULL);
+  }
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) kms_filter_pool_queue_in_probe, worker, NULL);
+  g_object_unref (pad);
+
+  pad = gst_element_get_static_pad (worker->queue, "src");
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback) kms_filter_pool_filter_in_probe, worker, NULL);
+  g_object_unref (pad);
+
+  pad = gst_element_get_static_pad (worker->filter, "src");
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) kms_filter_pool_filter_out_probe, worker, NULL);
+  g_object_unref (pad);
+
+  return TRUE;
+}
+
+static void
+kms_filter_pool_sync_state (KmsFilterPool * pool)
+{
+  guint i;
+
+  for (i = 0; i < pool->n_workers; i++) {
+    gst_element_sync_state_with_parent (pool->workers[i].filter);
+    gst_element_sync_state_with_parent (pool->workers[i].queue);
+  }
+
+  if (pool->tee != NULL) {
+    gst_element_sync_state_with_parent (pool->funnel);
+    gst_element_sync_state_with_parent (pool->tee);
+  }
+}
+
+KmsFilterPool *
+kms_filter_pool_new (GstBin * bin, GstElement * filter, guint workers,
+    guint queue_size, KmsFilterDropPolicy drop_policy)
+{
+  GstElementFactory *factory;
+  KmsFilterPool *pool;
+  GstPad *pad;
+  guint i;
+
+  kms_filter_pool_init_debug ();
+
+  factory = gst_element_get_factory (filter);
+  workers = MAX (workers, 1);
+
+  if (workers > 1 && factory == NULL) {
+    GST_ERROR_OBJECT (bin, "Cannot create workers for %" GST_PTR_FORMAT,
+        filter);
+    return NULL;
+  }
+
+  pool = g_slice_new0 (KmsFilterPool);
+  g_mutex_init (&pool->mutex);
+  g_cond_init (&pool->cond);
+  pool->bin = bin;
+  pool->n_workers = workers;
+  pool->queue_size = queue_size;
+  pool->drop_policy = drop_policy;
+  pool->workers = g_new0 (KmsFilterWorker, workers);
+
+  if (workers > 1) {
+    pool->tee = gst_element_factory_make ("tee", NULL);
+    pool->funnel = gst_element_factory_make ("funnel", NULL);
+    gst_bin_add_many (bin, pool->tee, pool->funnel, NULL);
+
+    pad = gst_element_get_static_pad (pool->tee, "sink");
+    gst_pad_add_probe (pad,
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+        (GstPadProbeCallback) kms_filter_pool_dispatch_probe, pool, NULL);
+    g_object_unref (pad);
+  }
+
+  for (i = 0; i < workers; i++) {
+    GstElement *worker_filter = filter;
+
+    if (i > 0) {
+      worker_filter = gst_element_factory_create (factory, NULL);
+    }
+
+    if (worker_filter == NULL
+        || !kms_filter_pool_add_worker (pool, i, worker_filter, queue_size,
+            drop_policy)) {
+      GST_ERROR_OBJECT (bin, "Cannot create filter worker %u", i);
+      break;
+    }
+  }
+
+  if (i < workers) {
+    /* Elements already in the bin are released with it */
+    pool->n_workers = i;
+    kms_filter_pool_destroy (pool);
+    return NULL;
+  }
+
+  if (workers > 1) {
+    kms_filter_pool_copy_properties (pool);
+    pool->notify_id = g_signal_connect (filter, "notify",
+        G_CALLBACK (kms_filter_pool_filter_notify), pool);
+  }
+
+  kms_filter_pool_sync_state (pool);
+
+  GST_DEBUG_OBJECT (bin, "Running %" GST_PTR_FORMAT " in %u workers", filter,
+      workers);
+
+  return pool;
+}
+
+void
+kms_filter_pool_destroy (KmsFilterPool * pool)
+{
+  guint i;
+
+  if (pool->notify_id != 0 && pool->n_workers > 0) {
+    g_signal_handler_disconnect (pool->workers[0].filter, pool->notify_id);
+  }
+
+  for (i = 0; i < pool->n_workers; i++) {
+    kms_filter_pool_worker_clear (&pool->workers[i]);
+  }
+
+  g_free (pool->workers);
+  g_cond_clear (&pool->cond);
+  g_mutex_clear (&pool->mutex);
+  g_slice_free (KmsFilterPool, pool);
+}
+
+GstElement *
+kms_filter_pool_get_filter (KmsFilterPool * pool)
+{
+  return pool->workers[0].filter;
+}
+
+GstPad *
+kms_filter_pool_get_sink (KmsFilterPool * pool)
+{
+  if (pool->tee != NULL) {
+    return gst_element_get_static_pad (pool->tee, "sink");
+  }
+
+  return gst_element_get_static_pad (pool->workers[0].queue, "sink");
+}
+
+gboolean
+kms_filter_pool_link (KmsFilterPool * pool, GstElement * element)
+{
+  if (pool->funnel != NULL) {
+    return gst_element_link (pool->funnel, element);
+  }
+
+  return gst_element_link (pool->workers[0].filter, element);
+}
+
+void
+kms_filter_pool_set_flushing (KmsFilterPool * pool, gboolean flushing)
+{
+  guint i;
+
+  g_mutex_lock (&pool->mutex);
+
+  pool->flushing = flushing;
+
+  if (!flushing) {
+    for (i = 0; i < pool->n_workers; i++) {
+      kms_filter_pool_worker_clear (&pool->workers[i]);
+      pool->workers[i].busy = FALSE;
+    }
+    pool->start_time = 0;
+  }
+
+  g_cond_broadcast (&pool->cond);
+
+  g_mutex_unlock (&pool->mutex);
+}
+
+GstStructure *
+kms_filter_pool_get_stats (KmsFilterPool * pool)
+{
+  GstStructure *stats, *histogram;
+  guint64 dropped = 0, processed = 0;
+  gint64 elapsed;
+  guint i;
+
+  stats = gst_structure_new ("filter-workers",
+      "workers", G_TYPE_UINT, pool->n_workers, NULL);
+  histogram = gst_structure_new_empty ("processing-time");
+
+  g_mutex_lock (&pool->mutex);
+
+  elapsed = pool->start_time != 0 ?
+      g_get_monotonic_time () - pool->start_time : 0;
+
+  for (i = 0; i < pool->n_workers; i++) {
+    KmsFilterWorker *worker = &pool->workers[i];
+    GstStructure *w_stats;
+    gchar *name;
+
+    name = g_strdup_printf ("worker-%u", i);
+    w_stats = gst_structure_new (name,
+        "processed", G_TYPE_UINT64, worker->processed,
+        "dropped", G_TYPE_UINT64, worker->dropped,
+        "utilization", G_TYPE_DOUBLE, elapsed > 0 ?
+        MIN ((gdouble) worker->busy_time / elapsed, 1.0) : 0.0, NULL);
+    gst_structure_set (stats, name, GST_TYPE_STRUCTURE, w_stats, NULL);
+    gst_structure_free (w_stats);
+    g_free (name);
+
+    dropped += worker->dropped;
+    processed += worker->processed;
+  }
+
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    gst_structure_set (histogram, histogram_names[i], G_TYPE_UINT64,
+        pool->histogram[i], NULL);
+  }
+
+  gst_structure_set (stats, "processed", G_TYPE_UINT64, processed,
+      "dropped", G_TYPE_UINT64, dropped,
+      "reorder-timeouts", G_TYPE_UINT64, pool->reorder_timeouts,
+      "processing-time", GST_TYPE_STRUCTURE, histogram, NULL);
+
+  g_mutex_unlock (&pool->mutex);
+
+  gst_structure_free (histogram);
+
+  return stats;
+}
@@ -0,0 +1,56 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_FILTER_POOL_H__
+#define __KMS_FILTER_POOL_H__
+
+#include <gst/gst.h>
+#include "kmsfiltertype.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Runs a filter in several workers, each one with its own queue and
+ * streaming thread. Frames are dispatched round-robin to the workers and
+ * put back in order at the output. The first worker uses the filter it is
+ * given, the rest use instances of the same factory whose properties
+ * follow the ones of the first filter.
+ *
+ * With only one worker the pool is just a queue in front of the filter.
+ */
+
+typedef struct _KmsFilterPool KmsFilterPool;
+
+/* Adds the pool elements to 'bin'. Takes the floating reference of */
+/* 'filter'. Returns NULL if the filter cannot be cloned */
+KmsFilterPool * kms_filter_pool_new (GstBin *bin, GstElement *filter,
+    guint workers, guint queue_size, KmsFilterDropPolicy drop_policy);
+void kms_filter_pool_destroy (KmsFilterPool *pool);
+
+/* Filter of the first worker, the one to be configured */
+GstElement * kms_filter_pool_get_filter (KmsFilterPool *pool);
+
+/* Returns a new reference to the pad that feeds the pool */
+GstPad * kms_filter_pool_get_sink (KmsFilterPool *pool);
+gboolean kms_filter_pool_link (KmsFilterPool *pool, GstElement *element);
+
+/* Unblocks the workers waiting for their turn, so the pool can be stopped */
+void kms_filter_pool_set_flushing (KmsFilterPool *pool, gboolean flushing);
+
+GstStructure * kms_filter_pool_get_stats (KmsFilterPool *pool);
+
+G_END_DECLS
+#endif /* __KMS_FILTER_POOL_H__ */
@@ -19,8 +19,7 @@
 #endif
 
 #include "kmsvp8parse.h"
-
-#include <string.h>
+#include "kmsbitstream.h"
 
 #include <gst/gst.h>
 #include <gst/base/gstbaseparse.h>
@@ -28,9 +27,6 @@
 
 #define PLUGIN_NAME "vp8parse"
 
-#include <vpx/vpx_decoder.h>
-#include <vpx/vp8dx.h>
-
 #define GST_CAT_DEFAULT kms_vp8_parse_debug_category
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 
@@ -162,37 +158,30 @@ static GstFlowReturn
 kms_vp8_parse_handle_frame (GstBaseParse * parse, GstBaseParseFrame * frame,
     gint * skipsize)
 {
-  vpx_codec_stream_info_t stream_info = {0};
-  vpx_codec_err_t status = {0};
-  GstMapInfo minfo = {0};
+  guint8 header[KMS_BITSTREAM_VPX_HEADER_SIZE];
+  KmsBitstreamInfo info;
   gboolean update_caps = FALSE;
   KmsVp8Parse *self = KMS_VP8_PARSE (parse);
+  gsize size;
 
-  if (!gst_buffer_map (frame->buffer, &minfo, GST_MAP_READ)) {
-    GST_ERROR_OBJECT (parse, "Failed to map input buffer");
-    return GST_FLOW_ERROR;
-  }
+  /* Only the frame tag and the key frame header are needed */
+  size = gst_buffer_extract (frame->buffer, 0, header, sizeof (header));
 
   if ((GST_CLOCK_TIME_IS_VALID (frame->buffer->duration) ||
           GST_BUFFER_PTS_IS_VALID (frame->buffer) ||
           GST_BUFFER_DTS_IS_VALID (frame->buffer)) && !self->priv->started)
     gst_base_parse_set_has_timing_info (parse, TRUE);
 
-  stream_info.sz = sizeof (stream_info);
-
-  status = vpx_codec_peek_stream_info (&vpx_codec_vp8_dx_algo,
-      minfo.data, minfo.size, &stream_info);
-
-  if (status == VPX_CODEC_OK && stream_info.is_kf) {
-    if (self->priv->height != stream_info.h) {
-      self->priv->height = stream_info.h;
-      GST_INFO_OBJECT (parse, "Updating height: %d", stream_info.h);
+  if (kms_bitstream_vp8_parse (header, size, &info) && info.keyframe) {
+    if (self->priv->height != info.height) {
+      self->priv->height = info.height;
+      GST_INFO_OBJECT (parse, "Updating height: %d", info.height);
       update_caps = TRUE;
     }
 
-    if (self->priv->width != stream_info.w) {
-      self->priv->width = stream_info.w;
-      GST_INFO_OBJECT (parse, "Updating width: %d", stream_info.w);
+    if (self->priv->width != info.width) {
+      self->priv->width = info.width;
+      GST_INFO_OBJECT (parse, "Updating width: %d", info.width);
       update_caps = TRUE;
     }
 
@@ -240,9 +229,7 @@ kms_vp8_parse_handle_frame (GstBaseParse * parse, GstBaseParseFrame * frame,
   self->priv->last_dts = frame->buffer->dts;
   self->priv->last_pts = frame->buffer->pts;
 
-  frame->size = minfo.size;
-
-  gst_buffer_unmap (frame->buffer, &minfo);
+  frame->size = gst_buffer_get_size (frame->buffer);
 
   return gst_base_parse_finish_frame (parse, frame, frame->size);
 }
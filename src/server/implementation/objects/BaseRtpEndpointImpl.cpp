@@ -26,6 +26,7 @@
 #include <MediaType.hpp>
 
 #include "RembParams.hpp"
+#include "CongestionControl.hpp"
 
 #include "StatsType.hpp"
 #include "RTCInboundRTPStreamStats.hpp"
@@ -43,6 +44,8 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define KMS_CONNECTION_DISCONNECTED 0
 #define KMS_CONNECTION_CONNECTED 1
 #define REMB_PARAMS "remb-params"
+#define CONGESTION_CONTROL_LOSS_BASED "loss-based"
+#define CONGESTION_CONTROL_DELAY_BASED "delay-based"
 
 #define KMS_STATISTIC_FIELD_PREFIX_SESSION "session-"
 #define KMS_STATISTIC_FIELD_PREFIX_SSRC "ssrc-"
@@ -50,10 +53,20 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define PARAM_MIN_PORT "minPort"
 #define PARAM_MAX_PORT "maxPort"
 #define PARAM_MTU "mtu"
+#define PARAM_AUDIO_JB_MIN_LATENCY "audioJitterBufferMinLatency"
+#define PARAM_AUDIO_JB_MAX_LATENCY "audioJitterBufferMaxLatency"
+#define PARAM_VIDEO_JB_MIN_LATENCY "videoJitterBufferMinLatency"
+#define PARAM_VIDEO_JB_MAX_LATENCY "videoJitterBufferMaxLatency"
+#define PARAM_SEND_BATCHING "sendBatching"
 
 #define PROP_MIN_PORT "min-port"
 #define PROP_MAX_PORT "max-port"
 #define PROP_MTU "mtu"
+#define PROP_AUDIO_JB_MIN_LATENCY "audio-jitterbuffer-min-latency"
+#define PROP_AUDIO_JB_MAX_LATENCY "audio-jitterbuffer-max-latency"
+#define PROP_VIDEO_JB_MIN_LATENCY "video-jitterbuffer-min-latency"
+#define PROP_VIDEO_JB_MAX_LATENCY "video-jitterbuffer-max-latency"
+#define PROP_SEND_BATCHING "send-batching"
 
 /* Fixed point conversion macros */
 #define FRIC        65536.                  /* 2^16 as a double */
@@ -113,6 +126,34 @@ BaseRtpEndpointImpl::BaseRtpEndpointImpl (const boost::property_tree::ptree
   } else {
     GST_DEBUG ("No predefined RTP MTU found in config; using default");
   }
+
+  guint latency;
+  if (getConfigValue <guint, BaseRtpEndpoint> (&latency,
+      PARAM_AUDIO_JB_MIN_LATENCY)) {
+    g_object_set (G_OBJECT (element), PROP_AUDIO_JB_MIN_LATENCY, latency, NULL);
+  }
+
+  if (getConfigValue <guint, BaseRtpEndpoint> (&latency,
+      PARAM_AUDIO_JB_MAX_LATENCY)) {
+    g_object_set (G_OBJECT (element), PROP_AUDIO_JB_MAX_LATENCY, latency, NULL);
+  }
+
+  if (getConfigValue <guint, BaseRtpEndpoint> (&latency,
+      PARAM_VIDEO_JB_MIN_LATENCY)) {
+    g_object_set (G_OBJECT (element), PROP_VIDEO_JB_MIN_LATENCY, latency, NULL);
+  }
+
+  if (getConfigValue <guint, BaseRtpEndpoint> (&latency,
+      PARAM_VIDEO_JB_MAX_LATENCY)) {
+    g_object_set (G_OBJECT (element), PROP_VIDEO_JB_MAX_LATENCY, latency, NULL);
+  }
+
+  bool sendBatching;
+  if (getConfigValue <bool, BaseRtpEndpoint> (&sendBatching,
+      PARAM_SEND_BATCHING)) {
+    g_object_set (G_OBJECT (element), PROP_SEND_BATCHING,
+                  (gboolean) sendBatching, NULL);
+  }
 }
 
 BaseRtpEndpointImpl::~BaseRtpEndpointImpl ()
@@ -262,6 +303,7 @@ BaseRtpEndpointImpl::getRembParams ()
 {
   std::shared_ptr<RembParams> ret (new RembParams() );
   GstStructure *params;
+  const gchar *auxs;
   gint auxi;
   gfloat auxf;
 
@@ -293,6 +335,17 @@ BaseRtpEndpointImpl::getRembParams ()
 
   gst_structure_get (params, "up-losses", G_TYPE_INT, &auxi, NULL);
   ret->setUpLosses (auxi);
+
+  auxs = gst_structure_get_string (params, "congestion-control");
+
+  if (g_strcmp0 (auxs, CONGESTION_CONTROL_DELAY_BASED) == 0) {
+    ret->setCongestionControl (std::make_shared<CongestionControl>
+                               (CongestionControl::DELAY_BASED) );
+  } else if (g_strcmp0 (auxs, CONGESTION_CONTROL_LOSS_BASED) == 0) {
+    ret->setCongestionControl (std::make_shared<CongestionControl>
+                               (CongestionControl::LOSS_BASED) );
+  }
+
   /* REMB local end */
 
   /* REMB remote begin */
@@ -360,6 +413,24 @@ BaseRtpEndpointImpl::setRembParams (std::shared_ptr<RembParams> rembParams)
                       rembParams->getUpLosses() );
   }
 
+  if (rembParams->isSetCongestionControl () ) {
+    const gchar *cc;
+
+    switch (rembParams->getCongestionControl ()->getValue () ) {
+    case CongestionControl::DELAY_BASED:
+      cc = CONGESTION_CONTROL_DELAY_BASED;
+      break;
+
+    case CongestionControl::LOSS_BASED:
+    default:
+      cc = CONGESTION_CONTROL_LOSS_BASED;
+      break;
+    }
+
+    gst_structure_set (params, "congestion-control", G_TYPE_STRING, cc, NULL);
+    GST_DEBUG_OBJECT (element, "New 'congestion-control' value %s", cc);
+  }
+
   /* REMB local end */
 
   /* REMB remote begin */
@@ -400,7 +471,9 @@ static std::shared_ptr<RTCInboundRTPStreamStats>
 createRTCInboundRTPStreamStats (const GstStructure *stats)
 {
   guint64 bytesReceived, packetsReceived;
-  guint jitter, fractionLost, pliCount, firCount, remb;
+  std::shared_ptr<RTCInboundRTPStreamStats> rtcStats;
+  const GstStructure *jitterStats;
+  guint jitter, fractionLost, pliCount, firCount, remb, targetLatency;
   gint packetLost, clock_rate;
   float jitterSec;
 
@@ -432,11 +505,21 @@ createRTCInboundRTPStreamStats (const GstStructure *stats)
     GST_TRACE ("No remb stats collected");
   }
 
-  return std::make_shared <RTCInboundRTPStreamStats> ("",
-         std::make_shared <StatsType> (StatsType::inboundrtp), 0.0, 0, "",
-         "", false, "", "", "", firCount, pliCount, 0, 0, remb,
-         packetLost, (float) fractionLost, packetsReceived, bytesReceived,
-         jitterSec);
+  rtcStats = std::make_shared <RTCInboundRTPStreamStats> ("",
+             std::make_shared <StatsType> (StatsType::inboundrtp), 0.0, 0, "",
+             "", false, "", "", "", firCount, pliCount, 0, 0, remb,
+             packetLost, (float) fractionLost, packetsReceived, bytesReceived,
+             jitterSec);
+
+  jitterStats = kms_utils_get_structure_by_name (stats, "jitter-buffer");
+
+  if (jitterStats != nullptr
+      && gst_structure_get_uint (jitterStats, "target-latency", &targetLatency) ) {
+    /* Target latency is given in milliseconds. Convert it to seconds */
+    rtcStats->setJitterBufferTargetLatency ( (double) targetLatency / 1000);
+  }
+
+  return rtcStats;
 }
 
 static std::shared_ptr<RTCOutboundRTPStreamStats>
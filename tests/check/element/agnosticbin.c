@@ -18,6 +18,7 @@
 #include <gst/check/gstcheck.h>
 #include <gst/gst.h>
 #include <glib.h>
+#include <time.h>
 
 #define AGNOSTIC_KEY "agnostic"
 G_DEFINE_QUARK (AGNOSTIC_KEY, agnostic_key);
@@ -1429,6 +1430,367 @@ GST_START_TEST (test_codec_config_openh264)
 }
 
 GST_END_TEST;
+/* Benchmark: a 1080p decode feeding four raw consumers */
+
+#define BENCH_FRAMES 90
+#define BENCH_CONSUMERS 4
+
+static void
+bench_hand_off (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    gpointer data)
+{
+  g_atomic_int_inc ((gint *) data);
+}
+
+static guint
+count_elements_from_factory (GstBin * bin, const gchar * factory_name)
+{
+  GstIterator *it = gst_bin_iterate_recurse (bin);
+  GValue item = G_VALUE_INIT;
+  guint count = 0;
+
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object (&item);
+    GstElementFactory *factory = gst_element_get_factory (element);
+
+    if (factory != NULL
+        && g_strcmp0 (GST_OBJECT_NAME (factory), factory_name) == 0) {
+      count++;
+    }
+    g_value_reset (&item);
+  }
+
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return count;
+}
+
+GST_START_TEST (raw_consumers_benchmark)
+{
+  GString *desc = g_string_new (NULL);
+  gint frames[BENCH_CONSUMERS] = { 0 };
+  GstElement *pipeline, *agnosticbin;
+  gint64 wall;
+  clock_t cpu;
+  GstBus *bus;
+  guint i;
+
+  g_string_append_printf (desc, "videotestsrc num-buffers=%d"
+      "  ! video/x-raw,width=1920,height=1080,framerate=30/1"
+      "  ! vp8enc deadline=1 ! agnosticbin name=ag", BENCH_FRAMES);
+
+  /* Same format for all of them, so it is converted once */
+  for (i = 0; i < BENCH_CONSUMERS; i++) {
+    g_string_append_printf (desc, " ag. ! video/x-raw,width=640,height=360"
+        "  ! fakesink name=sink%u sync=false async=false"
+        "    signal-handoffs=true", i);
+  }
+
+  pipeline = gst_parse_launch (desc->str, NULL);
+  fail_unless (pipeline != NULL);
+  g_string_free (desc, TRUE);
+
+  for (i = 0; i < BENCH_CONSUMERS; i++) {
+    gchar *name = g_strdup_printf ("sink%u", i);
+    GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), name);
+
+    g_signal_connect (sink, "handoff", G_CALLBACK (bench_hand_off),
+        &frames[i]);
+    g_object_unref (sink);
+    g_free (name);
+  }
+
+  loop = g_main_loop_new (NULL, TRUE);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_timeout_add_seconds (60, timeout_check, pipeline);
+
+  wall = g_get_monotonic_time ();
+  cpu = clock ();
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  cpu = clock () - cpu;
+  wall = g_get_monotonic_time () - wall;
+
+  agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline), "ag");
+  fail_unless (count_elements_from_factory (GST_BIN (agnosticbin),
+          "videoscale") == 1);
+  g_object_unref (agnosticbin);
+
+  for (i = 0; i < BENCH_CONSUMERS; i++) {
+    GST_INFO ("Consumer %u got %d frames", i, g_atomic_int_get (&frames[i]));
+    fail_if (g_atomic_int_get (&frames[i]) == 0);
+  }
+
+  GST_INFO ("1080p decode to %d consumers: %.1f frames/s, %.1f ms of CPU "
+      "per frame", BENCH_CONSUMERS,
+      BENCH_FRAMES * (gdouble) G_USEC_PER_SEC / MAX (wall, 1),
+      1000.0 * cpu / CLOCKS_PER_SEC / BENCH_FRAMES);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (pipeline);
+  g_object_unref (bus);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST;
+
+/* Width of the frames a conversion bin outputs, from its capsfilter */
+static gint
+get_conv_bin_width (GstBin * conv_bin)
+{
+  GstIterator *it = gst_bin_iterate_elements (conv_bin);
+  GValue item = G_VALUE_INIT;
+  gint width = -1;
+
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object (&item);
+    GstElementFactory *factory = gst_element_get_factory (element);
+    GstCaps *caps;
+
+    if (factory != NULL
+        && g_strcmp0 (GST_OBJECT_NAME (factory), "capsfilter") == 0) {
+      g_object_get (element, "caps", &caps, NULL);
+      gst_structure_get_int (gst_caps_get_structure (caps, 0), "width",
+          &width);
+      gst_caps_unref (caps);
+    }
+    g_value_reset (&item);
+  }
+
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return width;
+}
+
+/* Bin whose output tee feeds 'bin' */
+static GstElement *
+get_source_bin (GstElement * bin)
+{
+  GstIterator *it = gst_element_iterate_sink_pads (bin);
+  GValue item = G_VALUE_INIT;
+  GstElement *source = NULL;
+
+  if (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstPad *peer = gst_pad_get_peer (g_value_get_object (&item));
+
+    if (peer != NULL) {
+      source = gst_pad_get_parent_element (peer);
+      g_object_unref (peer);
+    }
+  }
+
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return source;
+}
+
+GST_START_TEST (scaling_ladder)
+{
+  const gint widths[] = { 1280, 640, 320 };
+  const gint heights[] = { 720, 360, 180 };
+  GString *desc = g_string_new (NULL);
+  gint frames[G_N_ELEMENTS (widths)] = { 0 };
+  GstElement *pipeline, *agnosticbin;
+  guint i, rungs = 0, cascaded = 0;
+  GstIterator *it;
+  GValue item = G_VALUE_INIT;
+  GstBus *bus;
+
+  g_string_append (desc, "videotestsrc num-buffers=30"
+      "  ! video/x-raw,width=1920,height=1080,framerate=30/1"
+      "  ! vp8enc deadline=1 ! agnosticbin name=ag");
+
+  /* Bigger sizes first, so each rung scales from the previous one */
+  for (i = 0; i < G_N_ELEMENTS (widths); i++) {
+    g_string_append_printf (desc, " ag. ! video/x-vp8,width=%d,height=%d"
+        "  ! fakesink name=sink%u sync=false async=false"
+        "    signal-handoffs=true", widths[i], heights[i], i);
+  }
+
+  pipeline = gst_parse_launch (desc->str, NULL);
+  fail_unless (pipeline != NULL);
+  g_string_free (desc, TRUE);
+
+  for (i = 0; i < G_N_ELEMENTS (widths); i++) {
+    gchar *name = g_strdup_printf ("sink%u", i);
+    GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), name);
+
+    g_signal_connect (sink, "handoff", G_CALLBACK (bench_hand_off),
+        &frames[i]);
+    g_object_unref (sink);
+    g_free (name);
+  }
+
+  loop = g_main_loop_new (NULL, TRUE);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  for (i = 0; i < G_N_ELEMENTS (widths); i++) {
+    GST_INFO ("%dx%d consumer got %d frames", widths[i], heights[i],
+        g_atomic_int_get (&frames[i]));
+    fail_if (g_atomic_int_get (&frames[i]) == 0);
+  }
+
+  /* One rung per size, each one scaling from a bigger one or the decoder */
+  agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline), "ag");
+  it = gst_bin_iterate_elements (GST_BIN (agnosticbin));
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object (&item);
+    GstElement *source;
+    gint width;
+
+    if (g_strcmp0 (G_OBJECT_TYPE_NAME (element), "KmsConvTreeBin") != 0) {
+      g_value_reset (&item);
+      continue;
+    }
+
+    rungs++;
+    width = get_conv_bin_width (GST_BIN (element));
+    source = get_source_bin (element);
+    fail_unless (source != NULL);
+
+    if (g_strcmp0 (G_OBJECT_TYPE_NAME (source), "KmsConvTreeBin") == 0) {
+      fail_unless (get_conv_bin_width (GST_BIN (source)) > width);
+      cascaded++;
+    } else {
+      fail_unless (width == widths[0]);
+    }
+
+    g_object_unref (source);
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+  g_object_unref (agnosticbin);
+
+  fail_unless (rungs == G_N_ELEMENTS (widths));
+  fail_unless (cascaded == G_N_ELEMENTS (widths) - 1);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (pipeline);
+  g_object_unref (bus);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST;
+
+static guint
+count_conv_bins (GstElement * agnosticbin)
+{
+  GstIterator *it = gst_bin_iterate_elements (GST_BIN (agnosticbin));
+  GValue item = G_VALUE_INIT;
+  guint count = 0;
+
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    if (g_strcmp0 (G_OBJECT_TYPE_NAME (g_value_get_object (&item)),
+            "KmsConvTreeBin") == 0) {
+      count++;
+    }
+    g_value_reset (&item);
+  }
+
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return count;
+}
+
+static gboolean
+wait_conv_bins (GstElement * agnosticbin, guint expected)
+{
+  gint64 end = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  while (count_conv_bins (agnosticbin) != expected) {
+    if (g_get_monotonic_time () > end) {
+      return FALSE;
+    }
+    g_usleep (10000);
+  }
+
+  return TRUE;
+}
+
+GST_START_TEST (conv_bin_removed_on_unlink)
+{
+  GstElement *pipeline, *agnosticbin, *filters[2];
+  gint frames[G_N_ELEMENTS (filters)] = { 0 };
+  gint64 end;
+  guint i;
+
+  pipeline = gst_parse_launch ("videotestsrc is-live=true ! agnosticbin name=ag"
+      "  ag. ! capsfilter name=filter0 caps=video/x-raw,width=320,height=240"
+      "  ! fakesink name=sink0 sync=false async=false signal-handoffs=true"
+      "  ag. ! capsfilter name=filter1 caps=video/x-raw,width=320,height=240"
+      "  ! fakesink name=sink1 sync=false async=false signal-handoffs=true",
+      NULL);
+  fail_unless (pipeline != NULL);
+
+  agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline), "ag");
+
+  for (i = 0; i < G_N_ELEMENTS (filters); i++) {
+    gchar *name = g_strdup_printf ("sink%u", i);
+    GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), name);
+
+    g_signal_connect (sink, "handoff", G_CALLBACK (bench_hand_off),
+        &frames[i]);
+    g_object_unref (sink);
+    g_free (name);
+
+    name = g_strdup_printf ("filter%u", i);
+    filters[i] = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    g_free (name);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  end = g_get_monotonic_time () + 10 * G_TIME_SPAN_SECOND;
+  while (g_atomic_int_get (&frames[0]) == 0
+      || g_atomic_int_get (&frames[1]) == 0) {
+    fail_if (g_get_monotonic_time () > end);
+    g_usleep (10000);
+  }
+
+  /* Both consumers share one conversion */
+  fail_unless (count_conv_bins (agnosticbin) == 1);
+
+  /* It stays while somebody uses it */
+  gst_element_unlink (agnosticbin, filters[0]);
+  g_usleep (200000);
+  fail_unless (count_conv_bins (agnosticbin) == 1);
+
+  /* And goes away with the last consumer */
+  gst_element_unlink (agnosticbin, filters[1]);
+  fail_unless (wait_conv_bins (agnosticbin, 0));
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  for (i = 0; i < G_N_ELEMENTS (filters); i++) {
+    g_object_unref (filters[i]);
+  }
+  g_object_unref (agnosticbin);
+  g_object_unref (pipeline);
+}
+
+GST_END_TEST;
+
 /*
  * End of test cases
  */
@@ -1440,6 +1802,7 @@ agnostic2_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, create_test);
+  tcase_add_test (tc_chain, conv_bin_removed_on_unlink);
   tcase_add_test (tc_chain, simple_link);
   tcase_add_test (tc_chain, encoded_input_link);
   tcase_add_test (tc_chain, static_link);
@@ -1465,6 +1828,9 @@ agnostic2_suite (void)
   tcase_add_test (tc_chain, test_raw_to_rtp);
   tcase_add_test (tc_chain, test_codec_to_rtp);
 
+  tcase_add_test (tc_chain, raw_consumers_benchmark);
+  tcase_add_test (tc_chain, scaling_ladder);
+
   return s;
 }
 
@@ -17,6 +17,18 @@
 #include <gst/check/gstcheck.h>
 #include <gst/gst.h>
 #include <glib.h>
+#include "../../src/gst-plugins/commons/kmselementpadtype.h"
+
+#define ORDERED_FRAMES 60
+
+typedef struct _OrderData
+{
+  GMainLoop *loop;
+  GstElement *sink;
+  guint received;
+  GstClockTime last_pts;
+  gboolean disordered;
+} OrderData;
 GST_START_TEST (check_invalid_factory)
 {
   GstElement *filterelement, *filter;
@@ -223,6 +235,193 @@ GST_START_TEST (provide_invalid_created_filter)
 
 GST_END_TEST;
 
+GST_START_TEST (filter_workers)
+{
+  GstElement *filterelement, *filter;
+  GstStructure *stats;
+  const GstStructure *workers;
+  GstIterator *it;
+  GValue item = G_VALUE_INIT;
+  guint flips = 0, n;
+  gint method;
+
+  filterelement = gst_element_factory_make ("filterelement", NULL);
+
+  g_object_set (filterelement, "workers", 3, "queue-size", 2,
+      "filter_factory", "videoflip", NULL);
+
+  g_object_get (filterelement, "filter", &filter, NULL);
+  fail_unless (filter != NULL);
+
+  /* Settings of the filter are copied to every worker */
+  g_object_set (filter, "method", 1, NULL);
+
+  it = gst_bin_iterate_elements (GST_BIN (filterelement));
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *child = g_value_get_object (&item);
+    GstElementFactory *factory = gst_element_get_factory (child);
+
+    if (factory != NULL && g_strcmp0 (GST_OBJECT_NAME (factory),
+            "videoflip") == 0) {
+      g_object_get (child, "method", &method, NULL);
+      fail_unless (method == 1);
+      flips++;
+    }
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  fail_unless (flips == 3);
+
+  g_signal_emit_by_name (filterelement, "stats", NULL, &stats);
+  fail_unless (stats != NULL);
+  GST_DEBUG ("Stats: %" GST_PTR_FORMAT, stats);
+
+  workers = gst_value_get_structure (gst_structure_get_value (stats,
+          "filter-workers"));
+  fail_unless (workers != NULL);
+  fail_unless (gst_structure_get_uint (workers, "workers", &n) && n == 3);
+  fail_unless (gst_structure_has_field (workers, "processing-time"));
+  fail_unless (gst_structure_has_field (workers, "worker-2"));
+
+  gst_structure_free (stats);
+  g_object_unref (filter);
+  gst_object_unref (filterelement);
+}
+
+GST_END_TEST;
+
+static void
+check_output_order (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    OrderData * data)
+{
+  /* Called from the streaming thread, the test checks it at the end */
+  if (data->received > 0 && GST_BUFFER_PTS (buf) <= data->last_pts) {
+    GST_ERROR ("Frame %" GST_TIME_FORMAT " after %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (GST_BUFFER_PTS (buf)), GST_TIME_ARGS (data->last_pts));
+    data->disordered = TRUE;
+  }
+
+  data->last_pts = GST_BUFFER_PTS (buf);
+
+  if (++data->received == ORDERED_FRAMES) {
+    g_main_loop_quit (data->loop);
+  }
+}
+
+static void
+link_ordered_sink (GstElement * element, GstPad * pad, OrderData * data)
+{
+  GstPad *sinkpad;
+
+  if (gst_pad_get_direction (pad) != GST_PAD_SRC
+      || !g_str_has_prefix (GST_PAD_NAME (pad), "video_src_")) {
+    return;
+  }
+
+  sinkpad = gst_element_get_static_pad (data->sink, "sink");
+  fail_unless (gst_pad_link (pad, sinkpad) == GST_PAD_LINK_OK);
+  g_object_unref (sinkpad);
+}
+
+static GstPadProbeReturn
+slow_worker_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  g_usleep (20 * G_TIME_SPAN_MILLISECOND);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Slows down the worker whose filter is not 'filter' */
+static void
+slow_down_one_worker (GstElement * filterelement, GstElement * filter)
+{
+  GValue item = G_VALUE_INIT;
+  gboolean done = FALSE;
+  GstIterator *it;
+
+  it = gst_bin_iterate_elements (GST_BIN (filterelement));
+  while (!done && gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *child = g_value_get_object (&item);
+    GstElementFactory *factory = gst_element_get_factory (child);
+
+    if (child != filter && factory != NULL
+        && g_strcmp0 (GST_OBJECT_NAME (factory), "videoflip") == 0) {
+      GstPad *pad = gst_element_get_static_pad (child, "sink");
+
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+          slow_worker_probe, NULL, NULL);
+      g_object_unref (pad);
+      done = TRUE;
+    }
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  fail_unless (done);
+}
+
+GST_START_TEST (filter_workers_order)
+{
+  GstElement *pipeline, *src, *capsfilter, *filterelement, *filter;
+  OrderData data = { 0 };
+  gchar *padname = NULL;
+  GstCaps *caps;
+
+  data.loop = g_main_loop_new (NULL, TRUE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  src = gst_element_factory_make ("videotestsrc", NULL);
+  capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  filterelement = gst_element_factory_make ("filterelement", NULL);
+  data.sink = gst_element_factory_make ("fakesink", NULL);
+
+  caps = gst_caps_from_string ("video/x-raw,width=160,height=120,"
+      "framerate=30/1");
+  g_object_set (capsfilter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (src, "num-buffers", ORDERED_FRAMES, NULL);
+  g_object_set (data.sink, "sync", FALSE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (data.sink, "handoff", G_CALLBACK (check_output_order),
+      &data);
+
+  g_object_set (filterelement, "workers", 3, "queue-size", 4,
+      "filter_factory", "videoflip", NULL);
+  g_object_get (filterelement, "filter", &filter, NULL);
+  fail_unless (filter != NULL);
+
+  /* Frames of the other workers would overtake the ones of this one */
+  slow_down_one_worker (filterelement, filter);
+  g_object_unref (filter);
+
+  g_signal_connect (filterelement, "pad-added",
+      G_CALLBACK (link_ordered_sink), &data);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, capsfilter, filterelement,
+      data.sink, NULL);
+  fail_unless (gst_element_link (src, capsfilter));
+  fail_unless (gst_element_link_pads (capsfilter, NULL, filterelement,
+          "sink_video_default"));
+
+  g_signal_emit_by_name (filterelement, "request-new-pad",
+      KMS_ELEMENT_PAD_TYPE_VIDEO, NULL, GST_PAD_SRC, &padname);
+  fail_unless (padname != NULL);
+  g_free (padname);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_main_loop_run (data.loop);
+
+  fail_unless (data.received == ORDERED_FRAMES);
+  fail_if (data.disordered);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  g_main_loop_unref (data.loop);
+}
+
+GST_END_TEST;
+
 /* Suite initialization */
 static Suite *
 filterelement_suite (void)
@@ -236,6 +435,8 @@ filterelement_suite (void)
   tcase_add_test (tc_chain, check_invalid_factory);
   tcase_add_test (tc_chain, provide_created_filter);
   tcase_add_test (tc_chain, provide_invalid_created_filter);
+  tcase_add_test (tc_chain, filter_workers);
+  tcase_add_test (tc_chain, filter_workers_order);
 
   return s;
 }
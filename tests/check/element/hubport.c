@@ -121,6 +121,47 @@ GST_START_TEST (connect_sinks)
   g_object_unref (pipe);
 }
 
+GST_END_TEST
+static gboolean
+has_child_from_factory (GstBin * bin, const gchar * factory_name)
+{
+  GstIterator *it = gst_bin_iterate_elements (bin);
+  GValue item = G_VALUE_INIT;
+  gboolean found = FALSE;
+
+  while (!found && gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *child = g_value_get_object (&item);
+    GstElementFactory *factory = gst_element_get_factory (child);
+
+    found = factory != NULL &&
+        g_strcmp0 (GST_OBJECT_NAME (factory), factory_name) == 0;
+    g_value_reset (&item);
+  }
+
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return found;
+}
+
+GST_START_TEST (lean_output)
+{
+  GstElement *hubport = gst_element_factory_make ("hubport", NULL);
+  GstPad *sink;
+
+  g_object_set (hubport, "lean", TRUE, NULL);
+
+  sink = gst_element_get_request_pad (hubport, HUB_VIDEO_SINK);
+  fail_unless (sink != NULL);
+
+  /* Media from the hub is output through a tee */
+  fail_unless (has_child_from_factory (GST_BIN (hubport), "tee"));
+  fail_if (has_child_from_factory (GST_BIN (hubport), "agnosticbin"));
+
+  g_object_unref (sink);
+  g_object_unref (hubport);
+}
+
 GST_END_TEST
 GST_START_TEST (create_element)
 {
@@ -144,6 +185,7 @@ hubport_suite (void)
   tcase_add_test (tc_chain, create_element);
   tcase_add_test (tc_chain, connect_sinks);
   tcase_add_test (tc_chain, connect_srcs);
+  tcase_add_test (tc_chain, lean_output);
 
   return s;
 }
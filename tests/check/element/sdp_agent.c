@@ -5709,6 +5709,282 @@ GST_START_TEST (sdp_agent_renegotiation_chrome)
 
 GST_END_TEST;
 
+/* Benchmark: full offer/answer cycles of a 2-media BUNDLE session */
+
+#define BENCH_NEGOTIATIONS 500
+
+static KmsSdpAgent *
+create_bundle_agent (void)
+{
+  const gchar *medias[] = { "audio", "video" };
+  KmsSdpAgent *agent;
+  gint gid, hid;
+  guint i;
+
+  agent = kms_sdp_agent_new ();
+  gid = kms_sdp_agent_create_group (agent, KMS_TYPE_SDP_BUNDLE_GROUP, NULL,
+      NULL);
+  fail_if (gid < 0);
+
+  for (i = 0; i < G_N_ELEMENTS (medias); i++) {
+    KmsSdpMediaHandler *handler;
+
+    handler = KMS_SDP_MEDIA_HANDLER (kms_sdp_rtp_savpf_media_handler_new ());
+    set_default_codecs (KMS_SDP_RTP_AVP_MEDIA_HANDLER (handler), audio_codecs,
+        G_N_ELEMENTS (audio_codecs), video_codecs,
+        G_N_ELEMENTS (video_codecs));
+
+    hid = kms_sdp_agent_add_proto_handler (agent, medias[i], handler, NULL);
+    fail_if (hid < 0);
+    fail_unless (kms_sdp_agent_group_add (agent, gid, hid, NULL));
+  }
+
+  return agent;
+}
+
+GST_START_TEST (sdp_agent_negotiation_benchmark)
+{
+  GstSDPMessage *offer, *answer, *copy;
+  KmsSdpAgent *offerer, *answerer;
+  GError *err = NULL;
+  gint64 elapsed;
+  guint i;
+
+  elapsed = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCH_NEGOTIATIONS; i++) {
+    offerer = create_bundle_agent ();
+    answerer = create_bundle_agent ();
+
+    offer = kms_sdp_agent_create_offer (offerer, &err);
+    fail_if (err != NULL);
+    fail_unless (kms_sdp_agent_set_local_description (offerer, offer, &err));
+
+    gst_sdp_message_copy (offer, &copy);
+    fail_unless (kms_sdp_agent_set_remote_description (answerer, copy, &err));
+    answer = kms_sdp_agent_create_answer (answerer, &err);
+    fail_if (err != NULL);
+    fail_unless (kms_sdp_agent_set_local_description (answerer, answer,
+            &err));
+
+    fail_unless (gst_sdp_message_medias_len (answer) == 2);
+    fail_if (gst_sdp_message_get_attribute_val (answer, "group") == NULL);
+
+    gst_sdp_message_copy (answer, &copy);
+    fail_unless (kms_sdp_agent_set_remote_description (offerer, copy, &err));
+
+    gst_sdp_message_free (offer);
+    gst_sdp_message_free (answer);
+    g_object_unref (offerer);
+    g_object_unref (answerer);
+  }
+
+  elapsed = g_get_monotonic_time () - elapsed;
+
+  GST_INFO ("2-media BUNDLE offer/answer: %.1f negotiations/s, %.1f us each",
+      BENCH_NEGOTIATIONS * (gdouble) G_USEC_PER_SEC / MAX (elapsed, 1),
+      (gdouble) elapsed / BENCH_NEGOTIATIONS);
+}
+
+GST_END_TEST;
+
+static KmsSdpRtpAvpMediaHandler *
+create_template_handler (void)
+{
+  KmsSdpRtpAvpMediaHandler *handler;
+  GError *err = NULL;
+
+  handler = kms_sdp_rtp_avp_media_handler_new ();
+  set_default_codecs (handler, audio_codecs, G_N_ELEMENTS (audio_codecs),
+      video_codecs, G_N_ELEMENTS (video_codecs));
+  fail_unless (kms_sdp_rtp_avp_media_handler_add_extmap (handler, 2, "URI-B",
+          &err));
+  fail_unless (kms_sdp_rtp_avp_media_handler_add_extmap (handler, 1, "URI-A",
+          &err));
+
+  return handler;
+}
+
+static gchar *
+create_media_offer_text (KmsSdpRtpAvpMediaHandler * handler)
+{
+  GstSDPMedia *media;
+  GError *err = NULL;
+  gchar *text;
+
+  media = kms_sdp_media_handler_create_offer (KMS_SDP_MEDIA_HANDLER (handler),
+      "video", NULL, &err);
+  fail_if (err != NULL);
+  fail_if (media == NULL);
+
+  text = gst_sdp_media_as_text (media);
+  gst_sdp_media_free (media);
+
+  return text;
+}
+
+GST_START_TEST (sdp_agent_offer_templates)
+{
+  KmsSdpRtpAvpMediaHandler *handler1, *handler2;
+  gchar *text1, *text2;
+  GError *err = NULL;
+  gint pt;
+
+  handler1 = create_template_handler ();
+  handler2 = create_template_handler ();
+
+  /* Second handler gets its offer from the template of the first one */
+  text1 = create_media_offer_text (handler1);
+  text2 = create_media_offer_text (handler2);
+  GST_DEBUG ("Offer:\n%s", text1);
+  fail_unless (g_strcmp0 (text1, text2) == 0);
+  fail_if (strstr (text1, "a=extmap:1 URI-A") == NULL);
+  fail_if (strstr (text1, "a=extmap:2 URI-B") == NULL);
+  g_free (text2);
+
+  /* Changing the configuration must not reuse the previous template */
+  pt = kms_sdp_rtp_avp_media_handler_add_generic_video_payload (handler2,
+      "red/90000", &err);
+  fail_if (err != NULL);
+  fail_unless (kms_sdp_rtp_avp_media_handler_add_fmtp (handler2, pt,
+          "0/5/100", &err));
+
+  text2 = create_media_offer_text (handler2);
+  GST_DEBUG ("Offer:\n%s", text2);
+  fail_if (g_strcmp0 (text1, text2) == 0);
+  fail_if (strstr (text2, "0/5/100") == NULL);
+  g_free (text2);
+
+  /* The first handler is not affected */
+  text2 = create_media_offer_text (handler1);
+  fail_unless (g_strcmp0 (text1, text2) == 0);
+
+  g_free (text1);
+  g_free (text2);
+  g_object_unref (handler1);
+  g_object_unref (handler2);
+}
+
+GST_END_TEST;
+
+#define BENCH_PT_INDEXES 1000
+
+static GstSDPMedia *
+create_browser_video_media (void)
+{
+  static const gchar *codecs[] = {
+    "VP8/90000", "rtx/90000", "VP9/90000", "rtx/90000", "H264/90000",
+    "rtx/90000", "AV1/90000", "red/90000", "ulpfec/90000"
+  };
+  GstSDPMedia *media;
+  gchar *fmt, *val;
+  guint pt;
+
+  gst_sdp_media_new (&media);
+  gst_sdp_media_set_media (media, "video");
+  gst_sdp_media_set_proto (media, "UDP/TLS/RTP/SAVPF");
+  gst_sdp_media_add_format (media, "26");
+  gst_sdp_media_add_format (media, "34");
+
+  for (pt = 96; pt < 128; pt++) {
+    const gchar *codec = codecs[pt % G_N_ELEMENTS (codecs)];
+
+    fmt = g_strdup_printf ("%u", pt);
+    gst_sdp_media_add_format (media, fmt);
+    g_free (fmt);
+
+    val = g_strdup_printf ("%u %s", pt, codec);
+    gst_sdp_media_add_attribute (media, "rtpmap", val);
+    g_free (val);
+
+    if (g_str_has_prefix (codec, "rtx")) {
+      val = g_strdup_printf ("%u apt=%u", pt, pt - 1);
+      gst_sdp_media_add_attribute (media, "fmtp", val);
+      g_free (val);
+      continue;
+    }
+
+    val = g_strdup_printf ("%u goog-remb", pt);
+    gst_sdp_media_add_attribute (media, "rtcp-fb", val);
+    g_free (val);
+    val = g_strdup_printf ("%u ccm fir", pt);
+    gst_sdp_media_add_attribute (media, "rtcp-fb", val);
+    g_free (val);
+    val = g_strdup_printf ("%u nack pli", pt);
+    gst_sdp_media_add_attribute (media, "rtcp-fb", val);
+    g_free (val);
+  }
+
+  return media;
+}
+
+GST_START_TEST (sdp_utils_pt_index)
+{
+  SdpUtilsPtIndex *index;
+  const gchar *codec_name;
+  GstSDPMedia *media;
+  gint64 elapsed;
+  gint clock_rate;
+  guint i, len;
+
+  media = create_browser_video_media ();
+  index = sdp_utils_pt_index_new (media);
+
+  len = gst_sdp_media_formats_len (media);
+  fail_unless (sdp_utils_pt_index_get_n_pts (index) == len);
+
+  /* Same results as the helpers scanning the media */
+  for (i = 0; i < len; i++) {
+    const gchar *payload = gst_sdp_media_get_format (media, i);
+    gint pt = sdp_utils_pt_index_get_pt (index, i);
+
+    fail_unless (pt == g_ascii_strtoll (payload, NULL, 10));
+    fail_unless (g_strcmp0 (sdp_utils_pt_index_get_rtpmap (index, pt),
+            sdp_utils_sdp_media_get_rtpmap (media, payload)) == 0);
+    fail_unless (g_strcmp0 (sdp_utils_pt_index_get_fmtp (index, pt),
+            sdp_utils_sdp_media_get_fmtp (media, payload)) == 0);
+  }
+
+  fail_unless (sdp_utils_pt_index_get_pt_for_codec_name (index, "H264") ==
+      sdp_utils_get_pt_for_codec_name (media, "H264"));
+  fail_unless (sdp_utils_pt_index_get_pt_for_codec_name (index, "H265") ==
+      -1);
+
+  /* Static payload type without rtpmap */
+  fail_unless (sdp_utils_pt_index_get_codec (index, 26, &codec_name,
+          &clock_rate));
+  fail_unless (g_strcmp0 (codec_name, "JPEG") == 0);
+  fail_unless (clock_rate == 90000);
+
+  fail_unless (sdp_utils_pt_index_get_codec (index, 99, &codec_name, NULL));
+  fail_unless (g_strcmp0 (codec_name, "VP8") == 0);
+  fail_unless (sdp_utils_pt_index_has_rtcp_fb (index, 99, "nack pli"));
+  fail_unless (sdp_utils_pt_index_has_rtcp_fb (index, 99, "ccm fir"));
+  fail_if (sdp_utils_pt_index_has_rtcp_fb (index, 99, "nack"));
+  fail_if (sdp_utils_pt_index_has_rtcp_fb (index, 100, "nack pli"));
+  fail_unless (g_strcmp0 (sdp_utils_pt_index_get_fmtp (index, 100),
+          "100 apt=99") == 0);
+  fail_unless (sdp_utils_pt_index_get_rtpmap (index, 200) == NULL);
+
+  sdp_utils_pt_index_free (index);
+
+  elapsed = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCH_PT_INDEXES; i++) {
+    index = sdp_utils_pt_index_new (media);
+    sdp_utils_pt_index_free (index);
+  }
+
+  elapsed = g_get_monotonic_time () - elapsed;
+
+  GST_INFO ("Index of a media with %u payload types: %.2f us", len,
+      (gdouble) elapsed / BENCH_PT_INDEXES);
+
+  gst_sdp_media_free (media);
+}
+
+GST_END_TEST;
+
 static Suite *
 sdp_agent_suite (void)
 {
@@ -5759,6 +6035,10 @@ sdp_agent_suite (void)
 
   tcase_add_test (tc_chain, sdp_agent_renegotiation_chrome);
 
+  tcase_add_test (tc_chain, sdp_agent_negotiation_benchmark);
+  tcase_add_test (tc_chain, sdp_agent_offer_templates);
+  tcase_add_test (tc_chain, sdp_utils_pt_index);
+
   return s;
 }
 
@@ -0,0 +1,177 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include <kmsbitstream.h>
+
+/* VP8 key frame, 640x480 */
+static const guint8 vp8_key[] = {
+  0x10, 0x02, 0x00, 0x9d, 0x01, 0x2a, 0x80, 0x02, 0xe0, 0x01, 0x00, 0x00
+};
+
+static const guint8 vp8_delta[] = { 0x31, 0x02, 0x00, 0x00 };
+
+/* VP9 profile 0 key frame, 352x288 */
+static const guint8 vp9_key[] = {
+  0x82, 0x49, 0x83, 0x42, 0x00, 0x15, 0xf0, 0x11, 0xf0, 0x00, 0x00, 0x00
+};
+
+static const guint8 vp9_delta[] = { 0x86, 0x00, 0x00, 0x00 };
+
+/* Baseline SPS (1280x720, with an emulation prevention byte), PPS, IDR */
+static const guint8 h264_idr[] = {
+  0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16,
+  0xe8, 0x40, 0x00, 0x00, 0x03, 0x00, 0x40, 0x00, 0x00, 0x0c, 0x83, 0xc6,
+  0x0c, 0xa8, 0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80, 0x00, 0x00,
+  0x01, 0x65, 0x88, 0x84
+};
+
+/* High profile SPS (1920x1080, cropped) and IDR */
+static const guint8 h264_high_idr[] = {
+  0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02,
+  0x27, 0xe5, 0xc0, 0x44, 0x00, 0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03,
+  0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58, 0x00, 0x00, 0x01, 0x65, 0x88
+};
+
+/* AUD and non-IDR slice */
+static const guint8 h264_delta[] = {
+  0x00, 0x00, 0x00, 0x01, 0x09, 0xf0, 0x00, 0x00, 0x01, 0x41, 0x9a
+};
+
+/* AUD and IDR slice with length prefixes */
+static const guint8 h264_avc_idr[] = {
+  0x00, 0x00, 0x00, 0x02, 0x09, 0xf0, 0x00, 0x00, 0x00, 0x03, 0x65, 0x88,
+  0x84
+};
+
+GST_START_TEST (test_vpx)
+{
+  KmsBitstreamInfo info;
+
+  fail_unless (kms_bitstream_vp8_parse (vp8_key, sizeof (vp8_key), &info));
+  fail_unless (info.keyframe);
+  fail_unless_equals_int (info.width, 640);
+  fail_unless_equals_int (info.height, 480);
+
+  fail_unless (kms_bitstream_vp8_parse (vp8_delta, sizeof (vp8_delta),
+          &info));
+  fail_if (info.keyframe);
+
+  /* Truncated key frame */
+  fail_if (kms_bitstream_vp8_parse (vp8_key, 6, &info));
+
+  fail_unless (kms_bitstream_vp9_parse (vp9_key, sizeof (vp9_key), &info));
+  fail_unless (info.keyframe);
+  fail_unless_equals_int (info.width, 352);
+  fail_unless_equals_int (info.height, 288);
+
+  fail_unless (kms_bitstream_vp9_parse (vp9_delta, sizeof (vp9_delta),
+          &info));
+  fail_if (info.keyframe);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_h264)
+{
+  KmsBitstreamInfo info;
+
+  fail_unless (kms_bitstream_h264_parse (h264_idr, sizeof (h264_idr), FALSE,
+          &info));
+  fail_unless (info.keyframe);
+  fail_unless_equals_int (info.width, 1280);
+  fail_unless_equals_int (info.height, 720);
+
+  fail_unless (kms_bitstream_h264_parse (h264_high_idr,
+          sizeof (h264_high_idr), FALSE, &info));
+  fail_unless (info.keyframe);
+  fail_unless_equals_int (info.width, 1920);
+  fail_unless_equals_int (info.height, 1080);
+
+  fail_unless (kms_bitstream_h264_parse (h264_delta, sizeof (h264_delta),
+          FALSE, &info));
+  fail_if (info.keyframe);
+
+  fail_unless (kms_bitstream_h264_parse (h264_avc_idr,
+          sizeof (h264_avc_idr), TRUE, &info));
+  fail_unless (info.keyframe);
+
+  /* Parameter sets without a slice */
+  fail_if (kms_bitstream_h264_parse (h264_idr, 30, FALSE, &info));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_buffer)
+{
+  KmsBitstreamInfo info;
+  GstBuffer *buffer;
+  GstCaps *caps;
+
+  caps = gst_caps_from_string ("video/x-h264, stream-format=avc");
+  fail_unless (kms_bitstream_codec_from_caps (caps) ==
+      KMS_BITSTREAM_CODEC_H264_AVC);
+  gst_caps_unref (caps);
+
+  caps = gst_caps_from_string ("video/x-vp8");
+  fail_unless (kms_bitstream_codec_from_caps (caps) ==
+      KMS_BITSTREAM_CODEC_VP8);
+  gst_caps_unref (caps);
+
+  /* Frame header split across memories */
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer,
+      gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, (gpointer) vp8_key, 4,
+          0, 4, NULL, NULL));
+  gst_buffer_append_memory (buffer,
+      gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, (gpointer) vp8_key,
+          sizeof (vp8_key), 4, sizeof (vp8_key) - 4, NULL, NULL));
+
+  fail_unless (kms_bitstream_parse_buffer (buffer, KMS_BITSTREAM_CODEC_VP8,
+          &info));
+  fail_unless (info.keyframe);
+  fail_unless_equals_int (info.width, 640);
+  gst_buffer_unref (buffer);
+
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      (gpointer) h264_delta, sizeof (h264_delta), 0, sizeof (h264_delta),
+      NULL, NULL);
+  fail_unless (kms_bitstream_parse_buffer (buffer, KMS_BITSTREAM_CODEC_H264,
+          &info));
+  fail_if (info.keyframe);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+static Suite *
+bitstream_suite (void)
+{
+  Suite *s = suite_create ("bitstream");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_vpx);
+  tcase_add_test (tc_chain, test_h264);
+  tcase_add_test (tc_chain, test_buffer);
+
+  return s;
+}
+
+GST_CHECK_MAIN (bitstream);
@@ -0,0 +1,138 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <gst/video/video-event.h>
+
+#include <kmskeyframearbiter.h>
+
+static guint upstream_requests;
+
+static gboolean
+count_request (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  if (gst_video_event_is_force_key_unit (event)) {
+    upstream_requests++;
+  }
+
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+drop_buffer (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static void
+request_key_frame (GstPad * sink)
+{
+  gst_pad_push_event (sink,
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE,
+          0));
+}
+
+static void
+push_frame (GstPad * src, gboolean keyframe)
+{
+  GstBuffer *buffer = gst_buffer_new ();
+
+  if (!keyframe) {
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  fail_unless (gst_pad_push (src, buffer) == GST_FLOW_OK);
+}
+
+GST_START_TEST (test_merge_requests)
+{
+  KmsKeyframeArbiterStats stats;
+  GstSegment segment;
+  GstPad *src, *sink;
+  guint i;
+
+  upstream_requests = 0;
+
+  src = gst_pad_new ("src", GST_PAD_SRC);
+  gst_pad_set_event_function (src, count_request);
+  sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sink, drop_buffer);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_stream_start ("keyframearbiter"));
+  gst_pad_push_event (src,
+      gst_event_new_caps (gst_caps_from_string ("video/x-vp8")));
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+
+  fail_if (kms_keyframe_arbiter_get_stats (sink, &stats));
+  kms_keyframe_arbiter_add (sink, 10 * GST_SECOND);
+
+  /* Every consumer asks for a key frame at once */
+  for (i = 0; i < 200; i++) {
+    request_key_frame (sink);
+  }
+  fail_unless_equals_int (upstream_requests, 1);
+
+  /* Delta frames do not serve the pending request */
+  push_frame (src, FALSE);
+  request_key_frame (sink);
+  fail_unless_equals_int (upstream_requests, 1);
+
+  /* Once the key frame arrives, a new request is forwarded again */
+  push_frame (src, TRUE);
+  request_key_frame (sink);
+  fail_unless_equals_int (upstream_requests, 2);
+
+  /* A lost key frame is requested again when the window elapses */
+  kms_keyframe_arbiter_set_window (sink, 0);
+  request_key_frame (sink);
+  fail_unless_equals_int (upstream_requests, 3);
+
+  fail_unless (kms_keyframe_arbiter_get_stats (sink, &stats));
+  fail_unless_equals_uint64 (stats.requests, 203);
+  fail_unless_equals_uint64 (stats.forwarded, 3);
+  fail_unless_equals_uint64 (stats.suppressed, 200);
+
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+}
+
+GST_END_TEST;
+
+static Suite *
+keyframearbiter_suite (void)
+{
+  Suite *s = suite_create ("keyframearbiter");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_merge_requests);
+
+  return s;
+}
+
+GST_CHECK_MAIN (keyframearbiter);
@@ -0,0 +1,650 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Offline replay of congestion control traces through KmsRembLocal and
+ * its RembEventManager, driven by a virtual clock.
+ *
+ * Traces are CSV files, one record per line, times in microseconds from
+ * the beginning of the trace and in non-decreasing order:
+ *
+ *   <time_us>,rtp,<seq>,<payload_size>,<abs_send_time or -1>
+ *   <time_us>,rtcp[,<link_capacity_bps>]
+ *   <time_us>,remb,<ssrc>,<bitrate_bps>
+ *
+ * "rtp" is the arrival of a packet of the remote video SSRC, "rtcp" is a
+ * RTCP sending opportunity of the local session (where REMB is computed)
+ * and "remb" is an upstream REMB event from a downstream element.
+ *
+ * Set KMS_REMB_REPLAY_TRACE to the path of a trace to replay it, and
+ * KMS_REMB_REPLAY_CC to "loss-based" or "delay-based" to choose the
+ * estimator. Without them, a synthetic trace is generated and replayed.
+ * Timelines are logged with GST_DEBUG="rembreplay:5".
+ */
+
+#include "kmsremb.h"
+#include "constants.h"
+
+#include <gst/check/gstcheck.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/rtp/gstrtcpbuffer.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+#define GST_CAT_DEFAULT rembreplay_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "rembreplay"
+
+#define REPLAY_TRACE_ENV "KMS_REMB_REPLAY_TRACE"
+#define REPLAY_CC_ENV "KMS_REMB_REPLAY_CC"
+
+#define REPLAY_REMOTE_SSRC 0x12345678
+#define REPLAY_PT 96
+#define REPLAY_ABS_SEND_TIME_ID 3
+
+/* Virtual time of the first record, some code takes 0 as "not set" */
+#define REPLAY_TIME_BASE GST_SECOND
+
+#define REPLAY_STEP GST_MSECOND
+#define REPLAY_RTCP_INTERVAL (RTCP_MIN_INTERVAL * GST_MSECOND)
+#define REPLAY_PACKET_SIZE 1200 /* bytes */
+#define REPLAY_INITIAL_BITRATE 300000   /* bps */
+#define REPLAY_BASE_DELAY (40 * GST_MSECOND)
+#define REPLAY_MAX_QUEUE_DELAY (300 * GST_MSECOND)
+#define REPLAY_RANDOM_SEED 42
+
+/* REMB is considered converged within this ratio of the reference */
+#define REPLAY_CONVERGENCE_BAND 0.15
+
+static GstClockTime virtual_time;
+
+static GstClockTime
+replay_get_virtual_time (void)
+{
+  return virtual_time;
+}
+
+/* Synthetic network with a bottleneck link and a drop tail queue */
+typedef struct _ReplayScenario
+{
+  const gchar *name;
+  GstClockTime duration;
+  guint capacity;               /* bps */
+  GstClockTime step_time;
+  guint step_capacity;          /* bps since step_time */
+  gdouble loss;                 /* random losses after the bottleneck */
+  GstClockTime spike_period;
+  GstClockTime spike_duration;
+  GstClockTime spike_delay;
+} ReplayScenario;
+
+static const ReplayScenario step_down_scenario = {
+  "step-down", 60 * GST_SECOND,
+  2500000, 30 * GST_SECOND, 1000000,
+  0.0,
+  0, 0, 0
+};
+
+static const ReplayScenario random_loss_scenario = {
+  "random-loss", 60 * GST_SECOND,
+  1500000, 0, 1500000,
+  0.03,
+  0, 0, 0
+};
+
+static const ReplayScenario delay_spikes_scenario = {
+  "delay-spikes", 60 * GST_SECOND,
+  1500000, 0, 1500000,
+  0.0,
+  10 * GST_SECOND, 2 * GST_SECOND, 200 * GST_MSECOND
+};
+
+static guint
+replay_scenario_get_capacity (const ReplayScenario * s, GstClockTime t)
+{
+  return (s->step_time > 0 && t >= s->step_time) ? s->step_capacity :
+      s->capacity;
+}
+
+static GstClockTime
+replay_scenario_get_delay (const ReplayScenario * s, GstClockTime t)
+{
+  if (s->spike_period > 0 && t % s->spike_period < s->spike_duration) {
+    return REPLAY_BASE_DELAY + s->spike_delay;
+  }
+
+  return REPLAY_BASE_DELAY;
+}
+
+typedef struct _ReplaySample
+{
+  GstClockTime time;
+  guint remb;
+  guint capacity;               /* 0 if unknown */
+} ReplaySample;
+
+typedef struct _Replay
+{
+  GstElement *rtpbin;
+  GstPad *rtpbin_pad;
+  GstPad *pad;                  /* RTP is pushed and REMB events received here */
+  KmsRembLocal *rl;
+  GArray *timeline;             /* ReplaySample */
+} Replay;
+
+static Replay *
+replay_new (const gchar * congestion_control)
+{
+  Replay *self = g_slice_new0 (Replay);
+  GObject *rtpsession = NULL;
+  GstStructure *params;
+
+  self->rtpbin = gst_element_factory_make ("rtpbin", NULL);
+  fail_unless (self->rtpbin != NULL);
+  self->rtpbin_pad = gst_element_get_request_pad (self->rtpbin,
+      VIDEO_RTPBIN_RECV_RTP_SINK);
+  g_signal_emit_by_name (self->rtpbin, "get-internal-session",
+      VIDEO_RTP_SESSION, &rtpsession);
+  fail_unless (rtpsession != NULL);
+
+  self->rl = kms_remb_local_create (rtpsession, 0, 0);
+  kms_remb_local_add_remote_session (self->rl, rtpsession, REPLAY_REMOTE_SSRC);
+  kms_remb_local_set_abs_send_time_id (self->rl, REPLAY_ABS_SEND_TIME_ID);
+  g_object_unref (rtpsession);
+
+  params = gst_structure_new ("remb-params", "congestion-control",
+      G_TYPE_STRING, congestion_control, NULL);
+  kms_remb_local_set_params (self->rl, params);
+  gst_structure_free (params);
+
+  self->pad = gst_pad_new (NULL, GST_PAD_SRC);
+  gst_pad_set_active (self->pad, TRUE);
+  self->rl->event_manager = kms_utils_remb_event_manager_create (self->pad);
+  kms_remb_local_add_recv_pad (self->rl, self->pad);
+
+  self->timeline = g_array_new (FALSE, FALSE, sizeof (ReplaySample));
+
+  return self;
+}
+
+static void
+replay_destroy (Replay * self)
+{
+  kms_remb_local_destroy (self->rl);
+  g_object_unref (self->pad);
+  gst_element_release_request_pad (self->rtpbin, self->rtpbin_pad);
+  g_object_unref (self->rtpbin_pad);
+  g_object_unref (self->rtpbin);
+  g_array_free (self->timeline, TRUE);
+
+  g_slice_free (Replay, self);
+}
+
+static void
+replay_push_rtp (Replay * self, GstClockTime time, guint16 seq,
+    guint payload_size, gint abs_send_time)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstBuffer *buffer;
+
+  buffer = gst_rtp_buffer_new_allocate (payload_size, 0, 0);
+  fail_unless (gst_rtp_buffer_map (buffer, GST_MAP_READWRITE, &rtp));
+  gst_rtp_buffer_set_ssrc (&rtp, REPLAY_REMOTE_SSRC);
+  gst_rtp_buffer_set_seq (&rtp, seq);
+  gst_rtp_buffer_set_payload_type (&rtp, REPLAY_PT);
+
+  if (abs_send_time >= 0) {
+    guint8 data[3];
+
+    data[0] = (abs_send_time >> 16) & 0xff;
+    data[1] = (abs_send_time >> 8) & 0xff;
+    data[2] = abs_send_time & 0xff;
+    gst_rtp_buffer_add_extension_onebyte_header (&rtp,
+        REPLAY_ABS_SEND_TIME_ID, data, sizeof (data));
+  }
+  gst_rtp_buffer_unmap (&rtp);
+
+  virtual_time = REPLAY_TIME_BASE + time;
+
+  /* The pad is not linked, only the REMB probe sees the buffer */
+  gst_pad_push (self->pad, buffer);
+}
+
+static gboolean
+replay_send_rtcp (Replay * self, GstClockTime time, guint capacity)
+{
+  GstBuffer *buffer;
+  gboolean sent = FALSE;
+
+  buffer = gst_rtcp_buffer_new (1400);
+  virtual_time = REPLAY_TIME_BASE + time;
+
+  g_signal_emit_by_name (KMS_REMB_BASE (self->rl)->rtpsess, "on-sending-rtcp",
+      buffer, FALSE, &sent);
+  gst_buffer_unref (buffer);
+
+  if (sent) {
+    ReplaySample sample;
+
+    sample.time = time;
+    sample.remb = self->rl->remb_sent;
+    sample.capacity = capacity;
+    g_array_append_val (self->timeline, sample);
+
+    GST_DEBUG ("t: %" GST_TIME_FORMAT ", REMB: %u, capacity: %u",
+        GST_TIME_ARGS (time), sample.remb, capacity);
+  }
+
+  return sent;
+}
+
+static void
+replay_send_remb_event (Replay * self, GstClockTime time, guint ssrc,
+    guint bitrate)
+{
+  virtual_time = REPLAY_TIME_BASE + time;
+
+  gst_pad_send_event (self->pad,
+      kms_utils_remb_event_upstream_new (bitrate, ssrc));
+}
+
+/* Trace files */
+
+static void
+replay_load_trace (Replay * self, const gchar * path)
+{
+  GError *err = NULL;
+  gchar *contents;
+  gchar **lines;
+  guint i;
+
+  if (!g_file_get_contents (path, &contents, NULL, &err)) {
+    fail ("Cannot read trace '%s': %s", path, err->message);
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++) {
+    gchar *line = g_strstrip (lines[i]);
+    GstClockTime time;
+    gchar **fields;
+    guint n_fields;
+
+    if (line[0] == '\0' || line[0] == '#') {
+      continue;
+    }
+
+    fields = g_strsplit (line, ",", -1);
+    n_fields = g_strv_length (fields);
+    fail_unless (n_fields >= 2, "Invalid record at line %u", i + 1);
+
+    time = g_ascii_strtoull (fields[0], NULL, 10) * GST_USECOND;
+
+    if (g_strcmp0 (fields[1], "rtp") == 0 && n_fields == 5) {
+      replay_push_rtp (self, time, g_ascii_strtoull (fields[2], NULL, 10),
+          g_ascii_strtoull (fields[3], NULL, 10),
+          g_ascii_strtoll (fields[4], NULL, 10));
+    } else if (g_strcmp0 (fields[1], "rtcp") == 0) {
+      replay_send_rtcp (self, time, (n_fields > 2) ?
+          g_ascii_strtoull (fields[2], NULL, 10) : 0);
+    } else if (g_strcmp0 (fields[1], "remb") == 0 && n_fields == 4) {
+      replay_send_remb_event (self, time,
+          g_ascii_strtoull (fields[2], NULL, 10),
+          g_ascii_strtoull (fields[3], NULL, 10));
+    } else {
+      fail ("Invalid record at line %u: '%s'", i + 1, line);
+    }
+
+    g_strfreev (fields);
+  }
+
+  g_strfreev (lines);
+}
+
+/* Synthetic traces */
+
+typedef struct _ReplayPacket
+{
+  guint16 seq;
+  GstClockTime send;
+  GstClockTime arrival;
+} ReplayPacket;
+
+static gint
+replay_get_abs_send_time (GstClockTime send)
+{
+  return ((send << 18) / GST_SECOND) & 0xffffff;
+}
+
+/*
+ * Runs the scenario in closed loop: the sender follows the REMB
+ * computed by the replay. The resulting records are written to trace
+ * if it is not NULL.
+ */
+static void
+replay_run_scenario (Replay * self, const ReplayScenario * s, FILE * trace)
+{
+  GQueue in_flight = G_QUEUE_INIT;
+  GstClockTime t, next_send = 0, next_rtcp = REPLAY_RTCP_INTERVAL;
+  GstClockTime link_free = 0, last_arrival = 0;
+  guint target = REPLAY_INITIAL_BITRATE;
+  guint16 seq = 0;
+  ReplayPacket *p;
+  GRand *rand;
+
+  rand = g_rand_new_with_seed (REPLAY_RANDOM_SEED);
+
+  for (t = 0; t < s->duration; t += REPLAY_STEP) {
+    while (next_send <= t) {
+      GstClockTime departure;
+
+      departure = MAX (link_free, next_send) +
+          gst_util_uint64_scale (REPLAY_PACKET_SIZE * 8, GST_SECOND,
+          replay_scenario_get_capacity (s, next_send));
+
+      if (departure - next_send <= REPLAY_MAX_QUEUE_DELAY) {
+        link_free = departure;
+
+        if (g_rand_double (rand) >= s->loss) {
+          GstClockTime arrival;
+
+          arrival = departure + replay_scenario_get_delay (s, departure);
+          /* Keep FIFO order and the precision of the trace files */
+          arrival = MAX (arrival, last_arrival);
+          arrival -= arrival % GST_USECOND;
+          last_arrival = arrival;
+
+          p = g_slice_new (ReplayPacket);
+          p->seq = seq;
+          p->send = next_send;
+          p->arrival = arrival;
+          g_queue_push_tail (&in_flight, p);
+        }
+      }
+
+      seq++;
+      next_send += gst_util_uint64_scale (REPLAY_PACKET_SIZE * 8, GST_SECOND,
+          target);
+    }
+
+    while ((p = g_queue_peek_head (&in_flight)) != NULL && p->arrival <= t) {
+      g_queue_pop_head (&in_flight);
+
+      replay_push_rtp (self, p->arrival, p->seq, REPLAY_PACKET_SIZE,
+          replay_get_abs_send_time (p->send));
+      if (trace != NULL) {
+        fprintf (trace, "%" G_GUINT64_FORMAT ",rtp,%u,%u,%d\n",
+            p->arrival / GST_USECOND, p->seq, REPLAY_PACKET_SIZE,
+            replay_get_abs_send_time (p->send));
+      }
+
+      g_slice_free (ReplayPacket, p);
+    }
+
+    if (t >= next_rtcp) {
+      guint capacity = replay_scenario_get_capacity (s, t);
+
+      if (replay_send_rtcp (self, t, capacity)) {
+        target = self->rl->remb_sent;
+      }
+      if (trace != NULL) {
+        fprintf (trace, "%" G_GUINT64_FORMAT ",rtcp,%u\n", t / GST_USECOND,
+            capacity);
+      }
+
+      next_rtcp += REPLAY_RTCP_INTERVAL;
+    }
+  }
+
+  while ((p = g_queue_pop_head (&in_flight)) != NULL) {
+    g_slice_free (ReplayPacket, p);
+  }
+
+  g_rand_free (rand);
+}
+
+/* Timeline analysis */
+
+typedef struct _ReplayResult
+{
+  GstClockTime convergence;     /* GST_CLOCK_TIME_NONE if not converged */
+  gdouble overshoot;            /* ratio over the reference */
+  guint final_remb;
+} ReplayResult;
+
+static guint
+replay_sample_get_reference (ReplaySample * sample, guint fallback)
+{
+  return (sample->capacity > 0) ? sample->capacity : fallback;
+}
+
+/*
+ * Samples are compared with the link capacity. When it is unknown, the
+ * mean of the last quarter of the timeline is used as reference.
+ * Convergence is measured from the last change of capacity.
+ */
+static void
+replay_analyze (Replay * self, ReplayResult * result)
+{
+  GArray *timeline = self->timeline;
+  guint i, since = 0, converged, fallback = 0, n_tail;
+  guint64 sum = 0;
+
+  result->convergence = GST_CLOCK_TIME_NONE;
+  result->overshoot = 0;
+  result->final_remb = 0;
+
+  if (timeline->len == 0) {
+    return;
+  }
+
+  n_tail = MAX (timeline->len / 4, 1);
+  for (i = timeline->len - n_tail; i < timeline->len; i++) {
+    sum += g_array_index (timeline, ReplaySample, i).remb;
+  }
+  fallback = sum / n_tail;
+
+  for (i = 1; i < timeline->len; i++) {
+    if (g_array_index (timeline, ReplaySample, i).capacity !=
+        g_array_index (timeline, ReplaySample, i - 1).capacity) {
+      since = i;
+    }
+  }
+
+  converged = timeline->len;
+  for (i = timeline->len; i > since; i--) {
+    ReplaySample *sample = &g_array_index (timeline, ReplaySample, i - 1);
+    guint ref = replay_sample_get_reference (sample, fallback);
+
+    if (ABS ((gdouble) sample->remb - ref) > ref * REPLAY_CONVERGENCE_BAND) {
+      break;
+    }
+    converged = i - 1;
+  }
+
+  if (converged < timeline->len) {
+    result->convergence =
+        g_array_index (timeline, ReplaySample, converged).time -
+        g_array_index (timeline, ReplaySample, since).time;
+  }
+
+  for (i = since; i < timeline->len; i++) {
+    ReplaySample *sample = &g_array_index (timeline, ReplaySample, i);
+    guint ref = replay_sample_get_reference (sample, fallback);
+
+    if (ref > 0) {
+      result->overshoot =
+          MAX (result->overshoot, (gdouble) sample->remb / ref - 1);
+    }
+  }
+
+  result->final_remb =
+      g_array_index (timeline, ReplaySample, timeline->len - 1).remb;
+}
+
+static void
+replay_print_result (const gchar * name, const gchar * cc,
+    ReplayResult * result)
+{
+  if (GST_CLOCK_TIME_IS_VALID (result->convergence)) {
+    g_print ("%s (%s): convergence: %.1f s, overshoot: %.1f%%, "
+        "final REMB: %u bps\n", name, cc,
+        (gdouble) result->convergence / GST_SECOND, result->overshoot * 100,
+        result->final_remb);
+  } else {
+    g_print ("%s (%s): not converged, overshoot: %.1f%%, "
+        "final REMB: %u bps\n", name, cc, result->overshoot * 100,
+        result->final_remb);
+  }
+}
+
+static void
+replay_check_scenario (const ReplayScenario * s, const gchar * cc,
+    ReplayResult * result)
+{
+  Replay *replay = replay_new (cc);
+
+  replay_run_scenario (replay, s, NULL);
+  fail_unless (replay->timeline->len > 0, "No REMB sent in '%s'", s->name);
+
+  replay_analyze (replay, result);
+  replay_print_result (s->name, cc, result);
+
+  replay_destroy (replay);
+}
+
+GST_START_TEST (check_step_down)
+{
+  ReplayResult result;
+
+  replay_check_scenario (&step_down_scenario,
+      KMS_REMB_CONGESTION_CONTROL_LOSS_BASED, &result);
+  fail_unless (result.final_remb < step_down_scenario.capacity);
+
+  replay_check_scenario (&step_down_scenario,
+      KMS_REMB_CONGESTION_CONTROL_DELAY_BASED, &result);
+  fail_unless (result.final_remb < step_down_scenario.capacity);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (check_random_loss)
+{
+  ReplayResult result;
+
+  replay_check_scenario (&random_loss_scenario,
+      KMS_REMB_CONGESTION_CONTROL_LOSS_BASED, &result);
+  replay_check_scenario (&random_loss_scenario,
+      KMS_REMB_CONGESTION_CONTROL_DELAY_BASED, &result);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (check_delay_spikes)
+{
+  ReplayResult result;
+
+  replay_check_scenario (&delay_spikes_scenario,
+      KMS_REMB_CONGESTION_CONTROL_LOSS_BASED, &result);
+  replay_check_scenario (&delay_spikes_scenario,
+      KMS_REMB_CONGESTION_CONTROL_DELAY_BASED, &result);
+}
+
+GST_END_TEST;
+
+/*
+ * Replaying a trace recorded from a closed loop run must reproduce the
+ * same REMB timeline, or replay the trace given by the environment.
+ */
+GST_START_TEST (check_replay_trace)
+{
+  const gchar *path = g_getenv (REPLAY_TRACE_ENV);
+  const gchar *cc = g_getenv (REPLAY_CC_ENV);
+  ReplayResult result;
+  Replay *replay;
+
+  if (cc == NULL) {
+    cc = KMS_REMB_CONGESTION_CONTROL_DELAY_BASED;
+  }
+
+  if (path != NULL) {
+    replay = replay_new (cc);
+    replay_load_trace (replay, path);
+    replay_analyze (replay, &result);
+    replay_print_result (path, cc, &result);
+    replay_destroy (replay);
+  } else {
+    Replay *recorded;
+    gchar *tmp_path;
+    FILE *trace;
+    guint i;
+    gint fd;
+
+    fd = g_file_open_tmp ("kms-remb-trace-XXXXXX.csv", &tmp_path, NULL);
+    fail_unless (fd >= 0);
+    trace = fdopen (fd, "w");
+    fprintf (trace, "# %s\n", step_down_scenario.name);
+
+    recorded = replay_new (cc);
+    replay_run_scenario (recorded, &step_down_scenario, trace);
+    fclose (trace);
+
+    replay = replay_new (cc);
+    replay_load_trace (replay, tmp_path);
+    replay_analyze (replay, &result);
+    replay_print_result (tmp_path, cc, &result);
+
+    fail_unless (replay->timeline->len == recorded->timeline->len);
+    for (i = 0; i < replay->timeline->len; i++) {
+      ReplaySample *a = &g_array_index (replay->timeline, ReplaySample, i);
+      ReplaySample *b = &g_array_index (recorded->timeline, ReplaySample, i);
+
+      fail_unless (a->time == b->time && a->remb == b->remb,
+          "Timelines differ at sample %u", i);
+    }
+
+    replay_destroy (recorded);
+    replay_destroy (replay);
+    g_unlink (tmp_path);
+    g_free (tmp_path);
+  }
+}
+
+GST_END_TEST;
+
+/* Suite initialization */
+static Suite *
+rembreplay_suite (void)
+{
+  Suite *s = suite_create ("rembreplay");
+  TCase *tc_chain = tcase_create ("element");
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+  kms_utils_set_time_source (replay_get_virtual_time);
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, check_step_down);
+  tcase_add_test (tc_chain, check_random_loss);
+  tcase_add_test (tc_chain, check_delay_spikes);
+  tcase_add_test (tc_chain, check_replay_trace);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rembreplay);
@@ -0,0 +1,127 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <gst/video/video-event.h>
+
+#include <kmsrtcpcomposer.h>
+
+#define SSRC_A 0x1111
+#define SSRC_B 0x2222
+
+GST_START_TEST (test_dedup_within_rtt)
+{
+  KmsRtcpComposer *composer = kms_rtcp_composer_new ();
+  KmsRtcpComposerCounters counters;
+
+  kms_rtcp_composer_set_rtt (composer, 10 * GST_SECOND);
+
+  fail_unless (kms_rtcp_composer_check_key_unit (composer, SSRC_A));
+  fail_if (kms_rtcp_composer_check_key_unit (composer, SSRC_A));
+  fail_unless (kms_rtcp_composer_check_key_unit (composer, SSRC_B));
+
+  fail_unless (kms_rtcp_composer_check_nack (composer, SSRC_A, 10));
+  fail_unless (kms_rtcp_composer_check_nack (composer, SSRC_A, 11));
+  fail_unless (kms_rtcp_composer_check_nack (composer, SSRC_B, 10));
+  fail_if (kms_rtcp_composer_check_nack (composer, SSRC_A, 10));
+
+  kms_rtcp_composer_get_counters (composer, &counters);
+  fail_unless_equals_uint64 (counters.key_requests_sent, 2);
+  fail_unless_equals_uint64 (counters.key_requests_suppressed, 1);
+  fail_unless_equals_uint64 (counters.nacks_sent, 3);
+  fail_unless_equals_uint64 (counters.nacks_suppressed, 1);
+
+  /* Requests are sent again once the RTT has elapsed */
+  kms_rtcp_composer_set_rtt (composer, 0);
+  fail_unless (kms_rtcp_composer_check_key_unit (composer, SSRC_A));
+  fail_unless (kms_rtcp_composer_check_nack (composer, SSRC_A, 10));
+
+  kms_rtcp_composer_destroy (composer);
+}
+
+GST_END_TEST;
+
+static gboolean
+count_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  guint *count = g_object_get_data (G_OBJECT (pad), "count");
+
+  (*count)++;
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+GST_START_TEST (test_feedback_probe)
+{
+  KmsRtcpComposer *composer = kms_rtcp_composer_new ();
+  GstPad *src, *sink;
+  guint count = 0;
+
+  kms_rtcp_composer_set_rtt (composer, 10 * GST_SECOND);
+
+  src = gst_pad_new (NULL, GST_PAD_SRC);
+  g_object_set_data (G_OBJECT (src), "count", &count);
+  gst_pad_set_event_function (src, count_event);
+  sink = gst_pad_new (NULL, GST_PAD_SINK);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+
+  kms_rtcp_composer_add_feedback_probe (composer, sink, SSRC_A);
+
+  gst_pad_push_event (sink,
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE,
+          0));
+  gst_pad_push_event (sink,
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE,
+          0));
+  fail_unless_equals_int (count, 1);
+
+  gst_pad_push_event (sink, gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+          gst_structure_new ("GstRTPRetransmissionRequest", "seqnum",
+              G_TYPE_UINT, 5, "ssrc", G_TYPE_UINT, SSRC_A, NULL)));
+  gst_pad_push_event (sink, gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+          gst_structure_new ("GstRTPRetransmissionRequest", "seqnum",
+              G_TYPE_UINT, 5, "ssrc", G_TYPE_UINT, SSRC_A, NULL)));
+  fail_unless_equals_int (count, 2);
+
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+
+  kms_rtcp_composer_destroy (composer);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtcpcomposer_suite (void)
+{
+  Suite *s = suite_create ("rtcpcomposer");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_dedup_within_rtt);
+  tcase_add_test (tc_chain, test_feedback_probe);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtcpcomposer);
@@ -0,0 +1,354 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <time.h>
+
+#include <kmsrtpbatch.h>
+
+#define RTP_HEADER_SIZE 12
+
+static guint buffers_received;
+static guint lists_received;
+static guint last_list_length;
+static guint list_length_at_eos;
+
+static GstBuffer *
+create_rtp_packet (guint16 seq, guint32 rtp_ts, gboolean marker,
+    gsize payload_size)
+{
+  guint8 header[RTP_HEADER_SIZE] = { 0x80, 96 };
+  GstMemory *payload;
+  GstBuffer *buffer;
+
+  if (marker) {
+    header[1] |= 0x80;
+  }
+
+  GST_WRITE_UINT16_BE (header + 2, seq);
+  GST_WRITE_UINT32_BE (header + 4, rtp_ts);
+  GST_WRITE_UINT32_BE (header + 8, 0x1234);
+
+  /* Header and payload in different memories, as payloaders do */
+  buffer = gst_buffer_new_allocate (NULL, RTP_HEADER_SIZE, NULL);
+  gst_buffer_fill (buffer, 0, header, RTP_HEADER_SIZE);
+
+  payload = gst_allocator_alloc (NULL, payload_size, NULL);
+  gst_buffer_append_memory (buffer, payload);
+  gst_buffer_memset (buffer, RTP_HEADER_SIZE, seq & 0xff, payload_size);
+
+  return buffer;
+}
+
+static GstFlowReturn
+sink_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  buffers_received++;
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+sink_chain_list (GstPad * pad, GstObject * parent, GstBufferList * list)
+{
+  lists_received++;
+  last_list_length = gst_buffer_list_length (list);
+  gst_buffer_list_unref (list);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+    list_length_at_eos = last_list_length;
+  }
+
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static void
+push_frame (GstPad * src, guint16 * seq, guint32 rtp_ts, guint packets,
+    gboolean marker)
+{
+  guint i;
+
+  for (i = 0; i < packets; i++) {
+    gboolean last = marker && i == packets - 1;
+
+    fail_unless (gst_pad_push (src, create_rtp_packet ((*seq)++, rtp_ts, last,
+                100)) == GST_FLOW_OK);
+  }
+}
+
+GST_START_TEST (test_batch_frames)
+{
+  GstPad *src, *sink;
+  GstSegment segment;
+  guint16 seq = 0;
+  GstCaps *caps;
+
+  src = gst_pad_new ("src", GST_PAD_SRC);
+  sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sink, sink_chain);
+  gst_pad_set_chain_list_function (sink, sink_chain_list);
+  gst_pad_set_event_function (sink, sink_event);
+
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+
+  kms_rtp_batch_add_probe (src);
+
+  caps = gst_caps_new_empty_simple ("application/x-rtp");
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_stream_start ("rtpbatch"));
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+  gst_caps_unref (caps);
+
+  /* A frame goes downstream as a single list */
+  push_frame (src, &seq, 1000, 5, TRUE);
+  fail_unless (lists_received == 1 && last_list_length == 5);
+  fail_unless (buffers_received == 0);
+
+  /* Single packet frames are not batched */
+  push_frame (src, &seq, 2000, 1, TRUE);
+  fail_unless (lists_received == 1 && buffers_received == 1);
+
+  /* Frames without marker are closed by the next timestamp */
+  push_frame (src, &seq, 3000, 3, FALSE);
+  fail_unless (lists_received == 1);
+  push_frame (src, &seq, 4000, 1, TRUE);
+  fail_unless (lists_received == 2 && last_list_length == 3);
+  fail_unless (buffers_received == 2);
+
+  /* Large frames are split */
+  push_frame (src, &seq, 5000, KMS_RTP_BATCH_MAX_PACKETS + 1, TRUE);
+  fail_unless (lists_received == 3 && buffers_received == 3);
+
+  /* Pending packets go before serialized events */
+  push_frame (src, &seq, 6000, 2, FALSE);
+  gst_pad_push_event (src, gst_event_new_eos ());
+  fail_unless (lists_received == 4 && list_length_at_eos == 2);
+
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+}
+
+GST_END_TEST;
+
+static GstFlowReturn
+sink_chain_list_eos (GstPad * pad, GstObject * parent, GstBufferList * list)
+{
+  lists_received++;
+  gst_buffer_list_unref (list);
+
+  return GST_FLOW_EOS;
+}
+
+static GstFlowReturn
+sink_chain_eos (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  buffers_received++;
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_EOS;
+}
+
+GST_START_TEST (test_batch_flow_return)
+{
+  GstPad *src, *sink;
+  GstSegment segment;
+  guint16 seq = 0;
+  GstCaps *caps;
+  guint i;
+
+  lists_received = buffers_received = 0;
+
+  src = gst_pad_new ("src", GST_PAD_SRC);
+  sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sink, sink_chain_eos);
+  gst_pad_set_chain_list_function (sink, sink_chain_list_eos);
+  gst_pad_set_event_function (sink, sink_event);
+
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+
+  kms_rtp_batch_add_probe (src);
+
+  caps = gst_caps_new_empty_simple ("application/x-rtp");
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_stream_start ("rtpbatch"));
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+  gst_caps_unref (caps);
+
+  /* Packets kept in the list return OK */
+  for (i = 0; i < 3; i++) {
+    fail_unless (gst_pad_push (src, create_rtp_packet (seq++, 1000, i == 2,
+                100)) == GST_FLOW_OK);
+  }
+  fail_unless (lists_received == 1);
+
+  /* The next buffer returns what downstream answered to the list */
+  fail_unless (gst_pad_push (src, create_rtp_packet (seq++, 2000, FALSE,
+              100)) == GST_FLOW_EOS);
+  fail_unless (buffers_received == 1);
+
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+}
+
+GST_END_TEST;
+
+/* Pad path benchmark: per packet pushes against frames batched by the probe */
+
+#define BENCH_FRAMES 500
+#define BENCH_PACKETS_PER_FRAME 20
+#define BENCH_PAYLOAD_SIZE (1200 - RTP_HEADER_SIZE)
+#define BENCH_DOWNSTREAM_PROBES 4
+
+static guint bench_calls;
+
+static GstPadProbeReturn
+bench_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  /* Stands for a downstream element with list support */
+  bench_calls++;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gint64
+thread_cpu_time_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+
+  return ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static void
+run_pad_benchmark (gboolean batched)
+{
+  GstPad *src, *sink;
+  GstSegment segment;
+  GstCaps *caps;
+  gint64 wall, cpu;
+  gdouble secs;
+  guint i, j, total;
+
+  lists_received = buffers_received = bench_calls = 0;
+
+  src = gst_pad_new ("src", GST_PAD_SRC);
+  sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sink, sink_chain);
+  gst_pad_set_chain_list_function (sink, sink_chain_list);
+  gst_pad_set_event_function (sink, sink_event);
+
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+
+  if (batched) {
+    kms_rtp_batch_add_probe (src);
+  }
+
+  for (i = 0; i < BENCH_DOWNSTREAM_PROBES; i++) {
+    gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_BUFFER |
+        GST_PAD_PROBE_TYPE_BUFFER_LIST, bench_probe, NULL, NULL);
+  }
+
+  caps = gst_caps_new_empty_simple ("application/x-rtp");
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_stream_start ("rtpbatch"));
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+  gst_caps_unref (caps);
+
+  wall = g_get_monotonic_time ();
+  cpu = thread_cpu_time_us ();
+
+  for (i = 0; i < BENCH_FRAMES; i++) {
+    for (j = 0; j < BENCH_PACKETS_PER_FRAME; j++) {
+      fail_unless (gst_pad_push (src,
+              create_rtp_packet (i * BENCH_PACKETS_PER_FRAME + j, i * 3000,
+                  j == BENCH_PACKETS_PER_FRAME - 1,
+                  BENCH_PAYLOAD_SIZE)) == GST_FLOW_OK);
+    }
+  }
+
+  cpu = thread_cpu_time_us () - cpu;
+  wall = g_get_monotonic_time () - wall;
+
+  total = BENCH_FRAMES * BENCH_PACKETS_PER_FRAME;
+  secs = MAX (wall, 1) / (gdouble) G_USEC_PER_SEC;
+
+  GST_INFO ("%s pushes: %.0f packets/s, %.1f %% CPU, %u downstream calls "
+      "(%u lists, %u buffers)", batched ? "Batched" : "Per packet",
+      total / secs, 100.0 * cpu / MAX (wall, 1), bench_calls, lists_received,
+      buffers_received);
+
+  if (batched) {
+    fail_unless (lists_received == BENCH_FRAMES);
+    fail_unless (bench_calls == BENCH_FRAMES * BENCH_DOWNSTREAM_PROBES);
+  } else {
+    fail_unless (buffers_received == total);
+    fail_unless (bench_calls == total * BENCH_DOWNSTREAM_PROBES);
+  }
+
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+}
+
+GST_START_TEST (test_pad_benchmark)
+{
+  run_pad_benchmark (FALSE);
+  run_pad_benchmark (TRUE);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtpbatch_suite (void)
+{
+  Suite *s = suite_create ("rtpbatch");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_batch_frames);
+  tcase_add_test (tc_chain, test_batch_flow_return);
+  tcase_add_test (tc_chain, test_pad_benchmark);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtpbatch);
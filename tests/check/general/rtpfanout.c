@@ -0,0 +1,200 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include <kmsrtpfanout.h>
+
+#define PAYLOAD_SIZE 1000
+#define ABS_SEND_TIME_ID 3
+#define OTHER_EXT_ID 1
+
+/* Same layout as the payloaders output: header and payload memories */
+static GstBuffer *
+generate_rtp_buffer (gboolean with_ext)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  guint8 other_ext[2] = { 0xAB, 0xCD };
+  GstMapInfo info;
+  GstMemory *payload;
+  GstBuffer *buf;
+  guint i;
+
+  buf = gst_rtp_buffer_new_allocate (0, 0, 0);
+  GST_BUFFER_PTS (buf) = GST_SECOND;
+
+  gst_rtp_buffer_map (buf, GST_MAP_READWRITE, &rtp);
+  gst_rtp_buffer_set_payload_type (&rtp, 96);
+  gst_rtp_buffer_set_ssrc (&rtp, 0x1234);
+  gst_rtp_buffer_set_seq (&rtp, 100);
+  gst_rtp_buffer_set_timestamp (&rtp, 90000);
+
+  if (with_ext) {
+    fail_unless (gst_rtp_buffer_add_extension_onebyte_header (&rtp,
+            OTHER_EXT_ID, other_ext, sizeof (other_ext)));
+  }
+  gst_rtp_buffer_unmap (&rtp);
+
+  payload = gst_allocator_alloc (NULL, PAYLOAD_SIZE, NULL);
+  gst_memory_map (payload, &info, GST_MAP_WRITE);
+  for (i = 0; i < PAYLOAD_SIZE; i++) {
+    info.data[i] = i % 256;
+  }
+  gst_memory_unmap (payload, &info);
+  gst_buffer_append_memory (buf, payload);
+
+  return buf;
+}
+
+static const guint8 *
+peek_payload_data (GstBuffer * buffer)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  const guint8 *data;
+
+  fail_unless (gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp));
+  fail_unless (gst_rtp_buffer_get_payload_len (&rtp) == PAYLOAD_SIZE);
+  data = gst_rtp_buffer_get_payload (&rtp);
+  gst_rtp_buffer_unmap (&rtp);
+
+  return data;
+}
+
+static void
+check_forwarded (GstBuffer * fwd, const KmsRtpFanoutPeer * peer,
+    gboolean with_ext)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  gpointer data;
+  guint size;
+
+  fail_unless (fwd != NULL);
+  fail_unless (GST_BUFFER_PTS (fwd) == GST_SECOND);
+
+  fail_unless (gst_rtp_buffer_map (fwd, GST_MAP_READ, &rtp));
+  fail_unless (gst_rtp_buffer_get_payload_type (&rtp) == 96);
+  fail_unless (gst_rtp_buffer_get_ssrc (&rtp) == peer->ssrc);
+  fail_unless (gst_rtp_buffer_get_seq (&rtp) == 100 + peer->seq_offset);
+  fail_unless (gst_rtp_buffer_get_timestamp (&rtp) ==
+      90000 + peer->ts_offset);
+
+  fail_unless (gst_rtp_buffer_get_extension_onebyte_header (&rtp,
+          ABS_SEND_TIME_ID, 0, &data, &size));
+  fail_unless (size == 3);
+
+  if (with_ext) {
+    fail_unless (gst_rtp_buffer_get_extension_onebyte_header (&rtp,
+            OTHER_EXT_ID, 0, &data, &size));
+    fail_unless (size == 2);
+    fail_unless (((guint8 *) data)[0] == 0xAB);
+    fail_unless (((guint8 *) data)[1] == 0xCD);
+  }
+
+  gst_rtp_buffer_unmap (&rtp);
+}
+
+static void
+check_fanout (gboolean with_ext)
+{
+  GstBuffer *buf, *fwd[3];
+  const guint8 *payload;
+  guint i;
+
+  buf = generate_rtp_buffer (with_ext);
+  payload = peek_payload_data (buf);
+
+  for (i = 0; i < G_N_ELEMENTS (fwd); i++) {
+    KmsRtpFanoutPeer peer = { 0 };
+
+    peer.ssrc = 0x1000 + i;
+    peer.seq_offset = i * 10;
+    peer.ts_offset = i * 3000;
+    peer.abs_send_time_id = ABS_SEND_TIME_ID;
+    peer.set_abs_send_time = TRUE;
+
+    fwd[i] = kms_rtp_fanout_forward (buf, &peer);
+    check_forwarded (fwd[i], &peer, with_ext);
+
+    /* The payload is shared with the original buffer, not copied */
+    fail_unless (gst_buffer_n_memory (fwd[i]) >= 2);
+    fail_unless (peek_payload_data (fwd[i]) == payload);
+  }
+
+  /* The original buffer is left untouched */
+  {
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    gpointer data;
+    guint size;
+
+    fail_unless (gst_rtp_buffer_map (buf, GST_MAP_READ, &rtp));
+    fail_unless (gst_rtp_buffer_get_ssrc (&rtp) == 0x1234);
+    fail_unless (gst_rtp_buffer_get_seq (&rtp) == 100);
+    fail_if (gst_rtp_buffer_get_extension_onebyte_header (&rtp,
+            ABS_SEND_TIME_ID, 0, &data, &size));
+    gst_rtp_buffer_unmap (&rtp);
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (fwd); i++) {
+    gst_buffer_unref (fwd[i]);
+  }
+  gst_buffer_unref (buf);
+}
+
+GST_START_TEST (test_fanout_shares_payload)
+{
+  check_fanout (FALSE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_fanout_keeps_extensions)
+{
+  check_fanout (TRUE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_fanout_invalid)
+{
+  KmsRtpFanoutPeer peer = { 0 };
+  GstBuffer *buf;
+
+  buf = gst_buffer_new_allocate (NULL, 4, NULL);
+  gst_buffer_memset (buf, 0, 0, 4);
+  fail_unless (kms_rtp_fanout_forward (buf, &peer) == NULL);
+  gst_buffer_unref (buf);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtpfanout_suite (void)
+{
+  Suite *s = suite_create ("rtpfanout");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_fanout_shares_payload);
+  tcase_add_test (tc_chain, test_fanout_keeps_extensions);
+  tcase_add_test (tc_chain, test_fanout_invalid);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtpfanout);
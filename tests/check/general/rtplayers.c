@@ -0,0 +1,293 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include <kmsrtplayers.h>
+#include <kmslayerselector.h>
+#include <kmsutils.h>
+
+#define FRAME_DURATION (GST_SECOND / 30)
+
+GST_START_TEST (test_vp8_descriptor)
+{
+  /* X, S, PID 0 | I, L, T | 15 bits picture id | TL0PICIDX | TID 1, Y */
+  const guint8 payload[] = { 0x90, 0xe0, 0x81, 0x23, 0x05, 0x60, 0x00 };
+  KmsRtpLayerInfo info;
+
+  fail_unless (kms_rtp_layers_parse_vp8 (payload, sizeof (payload), &info));
+  fail_unless (info.picture_id == 0x123);
+  fail_unless (info.tl0picidx == 5);
+  fail_unless (info.temporal_id == 1);
+  fail_unless (info.layer_sync);
+  fail_unless (info.frame_start && info.keyframe);
+  fail_unless (info.spatial_id == KMS_RTP_LAYER_UNKNOWN);
+
+  /* No temporal layer when only K is set */
+  {
+    const guint8 k_only[] = { 0x80, 0x10, 0x1f, 0xaa };
+
+    fail_unless (kms_rtp_layers_parse_vp8 (k_only, sizeof (k_only), &info));
+    fail_unless (info.temporal_id == KMS_RTP_LAYER_UNKNOWN);
+    fail_if (info.frame_start);
+  }
+
+  fail_if (kms_rtp_layers_parse_vp8 (payload, 4, &info));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_vp9_descriptor)
+{
+  /* I, L, B | 7 bits picture id | TID 2, U, SID 1 | TL0PICIDX */
+  const guint8 payload[] = { 0xa8, 0x05, 0x52, 0x07, 0x00 };
+  /* I, P, F, B | 7 bits picture id | 2 reference indices */
+  const guint8 flexible[] = { 0xd8, 0x06, 0x03, 0x02, 0x00 };
+  KmsRtpLayerInfo info;
+
+  fail_unless (kms_rtp_layers_parse_vp9 (payload, sizeof (payload), &info));
+  fail_unless (info.picture_id == 5);
+  fail_unless (info.temporal_id == 2);
+  fail_unless (info.spatial_id == 1);
+  fail_unless (info.tl0picidx == 7);
+  fail_unless (info.layer_sync);
+  fail_unless (info.frame_start);
+  /* Not predicted, but not the base spatial layer */
+  fail_if (info.keyframe);
+
+  fail_unless (kms_rtp_layers_parse_vp9 (flexible, sizeof (flexible), &info));
+  fail_unless (info.picture_id == 6);
+  fail_unless (info.temporal_id == KMS_RTP_LAYER_UNKNOWN);
+  fail_if (info.keyframe);
+
+  fail_if (kms_rtp_layers_parse_vp9 (flexible, 3, &info));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_h264_svc)
+{
+  /* Prefix NAL: SVC extension, IDR | DID 1 | TID 2 */
+  const guint8 prefix[] = { 0x6e, 0xc0, 0x10, 0x40 };
+  /* FU-A start of a NAL 20: DID 2 | TID 3 */
+  const guint8 fu_a[] = { 0x7c, 0x94, 0x80, 0x20, 0x60, 0xaa };
+  /* STAP-A: prefix NAL with TID 0 and an IDR slice */
+  const guint8 stap_a[] = { 0x78, 0x00, 0x04, 0x6e, 0x80, 0x00, 0x00,
+    0x00, 0x02, 0x65, 0x88
+  };
+  KmsRtpLayerInfo info;
+
+  fail_unless (kms_rtp_layers_parse_h264 (prefix, sizeof (prefix), &info));
+  fail_unless (info.temporal_id == 2 && info.spatial_id == 1);
+  fail_unless (info.keyframe);
+  fail_if (info.layer_sync);
+
+  fail_unless (kms_rtp_layers_parse_h264 (fu_a, sizeof (fu_a), &info));
+  fail_unless (info.temporal_id == 3 && info.spatial_id == 2);
+  fail_unless (info.frame_start);
+
+  fail_unless (kms_rtp_layers_parse_h264 (stap_a, sizeof (stap_a), &info));
+  fail_unless (info.temporal_id == 0 && info.spatial_id == 0);
+  fail_unless (info.keyframe && info.layer_sync);
+
+  /* Plain AVC has no layers */
+  {
+    const guint8 slice[] = { 0x41, 0x9a };
+
+    fail_unless (kms_rtp_layers_parse_h264 (slice, sizeof (slice), &info));
+    fail_unless (info.temporal_id == KMS_RTP_LAYER_UNKNOWN);
+  }
+
+  fail_if (kms_rtp_layers_parse_h264 (stap_a, 10, &info));
+}
+
+GST_END_TEST;
+
+static guint remb_events_upstream;
+static guint frames_received;
+
+static gboolean
+upstream_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  if (kms_utils_is_remb_event_upstream (event)) {
+    remb_events_upstream++;
+  }
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+counter_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  frames_received++;
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+counter_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+/* Hierarchical 3 layers pattern: 0 2 1 2 */
+static GstFlowReturn
+push_frame (GstPad * src, guint n)
+{
+  static const gint layers[] = { 0, 2, 1, 2 };
+  static const gsize sizes[] = { 4000, 1000, 2000, 1000 };
+  gint tid = layers[n % 4];
+  GstBuffer *buffer;
+
+  buffer = gst_buffer_new_allocate (NULL, sizes[n % 4], NULL);
+  GST_BUFFER_PTS (buffer) = n * FRAME_DURATION;
+
+  if (n != 0) {
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  kms_buffer_add_layer_meta (buffer, tid, KMS_RTP_LAYER_UNKNOWN, tid == 0);
+
+  return gst_pad_push (src, buffer);
+}
+
+GST_START_TEST (test_selector)
+{
+  GstPad *src, *sink, *pad;
+  KmsLayerSelectorStats stats;
+  GstElement *identity;
+  GstSegment segment;
+  guint n = 0, received;
+
+  remb_events_upstream = frames_received = 0;
+
+  identity = gst_element_factory_make ("identity", NULL);
+  kms_layer_selector_add (identity);
+
+  src = gst_pad_new ("src", GST_PAD_SRC);
+  gst_pad_set_event_function (src, upstream_event);
+  sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sink, counter_chain);
+  gst_pad_set_event_function (sink, counter_event);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+
+  pad = gst_element_get_static_pad (identity, "sink");
+  fail_unless (gst_pad_link (src, pad) == GST_PAD_LINK_OK);
+  g_object_unref (pad);
+  pad = gst_element_get_static_pad (identity, "src");
+  fail_unless (gst_pad_link (pad, sink) == GST_PAD_LINK_OK);
+  g_object_unref (pad);
+
+  fail_unless (gst_element_set_state (identity,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_stream_start ("rtplayers"));
+  gst_pad_push_event (src,
+      gst_event_new_caps (gst_caps_from_string ("video/x-vp8")));
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+
+  /* Not layered yet, REMB goes upstream */
+  gst_pad_push_event (sink, kms_utils_remb_event_upstream_new (5000000, 1));
+  fail_unless (remb_events_upstream == 1);
+
+  /* Layer rates: about 240, 120 and 120 kbps */
+  for (; n < 40; n++) {
+    fail_unless (push_frame (src, n) == GST_FLOW_OK);
+  }
+  fail_unless (frames_received == 40);
+
+  /* Only the base layer fits */
+  gst_pad_push_event (sink, kms_utils_remb_event_upstream_new (300000, 1));
+  fail_unless (remb_events_upstream == 1);
+
+  for (; n < 48; n++) {
+    fail_unless (push_frame (src, n) == GST_FLOW_OK);
+  }
+  fail_unless (frames_received == 42);
+
+  fail_unless (kms_layer_selector_get_stats (identity, &stats));
+  fail_unless (stats.temporal_layer == 0);
+  fail_unless (stats.bitrate == 300000);
+  fail_unless (stats.dropped == 6);
+
+  /* Layers come back with the next base layer frame */
+  gst_pad_push_event (sink, kms_utils_remb_event_upstream_new (1000000, 1));
+  received = frames_received;
+  fail_unless (push_frame (src, 49) == GST_FLOW_OK);
+  fail_unless (frames_received == received);
+  for (n = 52; n < 56; n++) {
+    fail_unless (push_frame (src, n) == GST_FLOW_OK);
+  }
+  fail_unless (frames_received == received + 4);
+
+  gst_element_set_state (identity, GST_STATE_NULL);
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+  gst_object_unref (identity);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_meta_tags)
+{
+  GstBuffer *buffer, *copy;
+
+  /* Codecs must not carry the layer of an encoded frame to another one */
+  fail_unless (gst_meta_api_type_has_tag (KMS_LAYER_META_API_TYPE,
+          g_quark_from_string ("video")));
+  fail_unless (gst_meta_api_type_has_tag (KMS_LAYER_META_API_TYPE,
+          g_quark_from_string (KMS_LAYER_META_TAG_STR)));
+
+  /* Plain copies keep it */
+  buffer = gst_buffer_new ();
+  kms_buffer_add_layer_meta (buffer, 1, KMS_RTP_LAYER_UNKNOWN, TRUE);
+  copy = gst_buffer_copy (buffer);
+  fail_unless (kms_buffer_get_layer_meta (copy) != NULL);
+  fail_unless (kms_buffer_get_layer_meta (copy)->temporal_id == 1);
+
+  gst_buffer_unref (copy);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtplayers_suite (void)
+{
+  Suite *s = suite_create ("rtplayers");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_vp8_descriptor);
+  tcase_add_test (tc_chain, test_vp9_descriptor);
+  tcase_add_test (tc_chain, test_h264_svc);
+  tcase_add_test (tc_chain, test_selector);
+  tcase_add_test (tc_chain, test_meta_tags);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtplayers);
@@ -0,0 +1,252 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include <kmsrtpssrcrouter.h>
+
+#define AUDIO_SSRC 0x1111
+#define VIDEO_SSRC 0x2222
+#define UNKNOWN_SSRC 0x3333
+
+typedef struct _Counter
+{
+  guint buffers;
+  guint lists;
+  guint last_list_length;
+} Counter;
+
+static GstFlowReturn
+counter_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  Counter *counter = g_object_get_data (G_OBJECT (pad), "counter");
+
+  counter->buffers++;
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+counter_chain_list (GstPad * pad, GstObject * parent, GstBufferList * list)
+{
+  Counter *counter = g_object_get_data (G_OBJECT (pad), "counter");
+
+  counter->lists++;
+  counter->last_list_length = gst_buffer_list_length (list);
+  gst_buffer_list_unref (list);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+counter_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static GstPad *
+link_counter (GstElement * router, const gchar * pad_name, Counter * counter)
+{
+  GstPad *src, *sink;
+
+  sink = gst_pad_new (NULL, GST_PAD_SINK);
+  g_object_set_data (G_OBJECT (sink), "counter", counter);
+  gst_pad_set_chain_function (sink, counter_chain);
+  gst_pad_set_chain_list_function (sink, counter_chain_list);
+  gst_pad_set_event_function (sink, counter_event);
+  gst_pad_set_active (sink, TRUE);
+
+  src = gst_element_get_static_pad (router, pad_name);
+  fail_unless (src != NULL);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+  g_object_unref (src);
+
+  return sink;
+}
+
+static GstPad *
+link_input (GstElement * router, const gchar * pad_name, const gchar * caps)
+{
+  GstSegment segment;
+  GstPad *src, *sink;
+
+  src = gst_pad_new (NULL, GST_PAD_SRC);
+  gst_pad_set_active (src, TRUE);
+
+  sink = gst_element_get_static_pad (router, pad_name);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+  g_object_unref (sink);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_stream_start ("rtpssrcrouter"));
+  gst_pad_push_event (src, gst_event_new_caps (gst_caps_from_string (caps)));
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+
+  return src;
+}
+
+static GstBuffer *
+create_rtp_packet (guint32 ssrc)
+{
+  guint8 data[12] = { 0x80, 96 };
+
+  GST_WRITE_UINT32_BE (data + 8, ssrc);
+
+  return gst_buffer_new_wrapped (g_memdup (data, sizeof (data)),
+      sizeof (data));
+}
+
+static GstBuffer *
+create_rtcp_packet (guint32 ssrc)
+{
+  guint8 data[8] = { 0x80, 201, 0, 1 };
+
+  GST_WRITE_UINT32_BE (data + 4, ssrc);
+
+  return gst_buffer_new_wrapped (g_memdup (data, sizeof (data)),
+      sizeof (data));
+}
+
+GST_START_TEST (test_routing)
+{
+  Counter audio = { 0 }, video = { 0 }, fallback = { 0 }, audio_rtcp = { 0 };
+  GstPad *sinks[4], *rtp, *rtcp;
+  KmsRtpSsrcRouter *router;
+  GstElement *element;
+  GstBufferList *list;
+  guint i;
+
+  element = kms_rtp_ssrc_router_new ();
+  router = KMS_RTP_SSRC_ROUTER (element);
+
+  fail_unless (kms_rtp_ssrc_router_add_route (router, "audio"));
+  fail_unless (kms_rtp_ssrc_router_add_route (router, "video"));
+  fail_if (kms_rtp_ssrc_router_add_route (router, "audio"));
+
+  fail_unless (kms_rtp_ssrc_router_set_ssrc (router, AUDIO_SSRC, "audio"));
+  fail_unless (kms_rtp_ssrc_router_set_ssrc (router, VIDEO_SSRC, "video"));
+  fail_if (kms_rtp_ssrc_router_set_ssrc (router, UNKNOWN_SSRC, "data"));
+
+  sinks[0] = link_counter (element, "src_audio", &audio);
+  sinks[1] = link_counter (element, "src_video", &video);
+  sinks[2] = link_counter (element, "src_fallback", &fallback);
+  sinks[3] = link_counter (element, "rtcp_src_audio", &audio_rtcp);
+
+  fail_unless (gst_element_set_state (element,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS);
+
+  rtp = link_input (element, "sink", "application/x-rtp");
+  rtcp = link_input (element, "rtcp_sink", "application/x-rtcp");
+
+  fail_unless (gst_pad_push (rtp, create_rtp_packet (AUDIO_SSRC)) ==
+      GST_FLOW_OK);
+  fail_unless (gst_pad_push (rtp, create_rtp_packet (VIDEO_SSRC)) ==
+      GST_FLOW_OK);
+  fail_unless (gst_pad_push (rtp, create_rtp_packet (UNKNOWN_SSRC)) ==
+      GST_FLOW_OK);
+  fail_unless (audio.buffers == 1 && video.buffers == 1);
+  fail_unless (fallback.buffers == 1);
+
+  /* RTCP is routed by the sender SSRC, unlinked routes are not an error */
+  fail_unless (gst_pad_push (rtcp, create_rtcp_packet (AUDIO_SSRC)) ==
+      GST_FLOW_OK);
+  fail_unless (gst_pad_push (rtcp, create_rtcp_packet (VIDEO_SSRC)) ==
+      GST_FLOW_OK);
+  fail_unless (audio_rtcp.buffers == 1);
+
+  /* Lists are split in runs of the same route */
+  list = gst_buffer_list_new ();
+  for (i = 0; i < 3; i++) {
+    gst_buffer_list_add (list, create_rtp_packet (AUDIO_SSRC));
+  }
+  for (i = 0; i < 2; i++) {
+    gst_buffer_list_add (list, create_rtp_packet (VIDEO_SSRC));
+  }
+  fail_unless (gst_pad_push_list (rtp, list) == GST_FLOW_OK);
+  fail_unless (audio.lists == 1 && audio.last_list_length == 3);
+  fail_unless (video.lists == 1 && video.last_list_length == 2);
+
+  /* SSRCs can be added while packets flow */
+  fail_unless (kms_rtp_ssrc_router_set_ssrc (router, UNKNOWN_SSRC, "video"));
+  fail_unless (gst_pad_push (rtp, create_rtp_packet (UNKNOWN_SSRC)) ==
+      GST_FLOW_OK);
+  fail_unless (video.buffers == 2 && fallback.buffers == 1);
+
+  gst_element_set_state (element, GST_STATE_NULL);
+
+  gst_pad_set_active (rtp, FALSE);
+  gst_pad_set_active (rtcp, FALSE);
+  gst_object_unref (rtp);
+  gst_object_unref (rtcp);
+
+  for (i = 0; i < G_N_ELEMENTS (sinks); i++) {
+    gst_pad_set_active (sinks[i], FALSE);
+    gst_object_unref (sinks[i]);
+  }
+
+  gst_object_unref (element);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_late_route_gets_sticky_events)
+{
+  GstElement *element;
+  GstPad *rtp, *src;
+  GstEvent *event;
+
+  element = kms_rtp_ssrc_router_new ();
+  fail_unless (gst_element_set_state (element,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS);
+
+  rtp = link_input (element, "sink", "application/x-rtp");
+
+  fail_unless (kms_rtp_ssrc_router_add_route (KMS_RTP_SSRC_ROUTER (element),
+          "video"));
+  src = gst_element_get_static_pad (element, "src_video");
+
+  event = gst_pad_get_sticky_event (src, GST_EVENT_CAPS, 0);
+  fail_unless (event != NULL);
+  gst_event_unref (event);
+
+  g_object_unref (src);
+  gst_element_set_state (element, GST_STATE_NULL);
+  gst_pad_set_active (rtp, FALSE);
+  gst_object_unref (rtp);
+  gst_object_unref (element);
+}
+
+GST_END_TEST;
+
+static Suite *
+rtpssrcrouter_suite (void)
+{
+  Suite *s = suite_create ("rtpssrcrouter");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_routing);
+  tcase_add_test (tc_chain, test_late_route_gets_sticky_events);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtpssrcrouter);
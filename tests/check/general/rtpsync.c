@@ -18,8 +18,11 @@
 #include <gst/check/gstcheck.h>
 #include <gst/rtp/gstrtpbuffer.h>
 #include <gst/rtp/gstrtcpbuffer.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
 
 #include <kmsrtpsynchronizer.h>
+#include <kmstracerecorder.h>
 
 /* based on rtpjitterbuffer.c */
 static GstBuffer *
@@ -337,6 +340,191 @@ GST_START_TEST (test_interpolate_avoid_negative_pts)
 
 GST_END_TEST;
 
+#define SYNC_BENCHMARK_PACKETS 1000000
+#define SYNC_BENCHMARK_BUFFERS 1000
+#define SYNC_BENCHMARK_SR_COUNT 10
+#define SYNC_BENCHMARK_CLOCK 90000
+#define SYNC_BENCHMARK_STEP (SYNC_BENCHMARK_CLOCK / 100)  /* 10 ms */
+#define SYNC_BENCHMARK_REF_TIME (100 * GST_SECOND)
+
+typedef struct _SyncBenchmarkSr
+{
+  KmsRtpSynchronizer *sync;
+  GstBuffer *sr[SYNC_BENCHMARK_SR_COUNT];
+  gint stop;
+  guint updates;
+  guint failed_updates;         /* Checked once the updater is joined */
+} SyncBenchmarkSr;
+
+static gpointer
+sync_benchmark_sr_updater (SyncBenchmarkSr * data)
+{
+  guint i = 0;
+
+  /* Check assertions must not be raised outside the test thread */
+  while (!g_atomic_int_get (&data->stop)) {
+    if (!kms_rtp_synchronizer_process_rtcp_buffer (data->sync,
+            data->sr[i++ % SYNC_BENCHMARK_SR_COUNT], NULL)) {
+      data->failed_updates++;
+    }
+  }
+
+  data->updates = i;
+
+  return NULL;
+}
+
+static GstClockTime
+sync_benchmark_run (KmsRtpSynchronizer * sync, GstBuffer ** buffers,
+    guint * torn_reads)
+{
+  GstClockTime start, end, pts;
+  guint i;
+
+  *torn_reads = 0;
+
+  start = gst_util_get_timestamp ();
+  for (i = 0; i < SYNC_BENCHMARK_PACKETS; i++) {
+    guint n = i % SYNC_BENCHMARK_BUFFERS;
+
+    kms_rtp_synchronizer_process_rtp_buffer_pts (sync, buffers[n], &pts, NULL);
+
+    /* Every SR describes the same timeline, so a torn read would show up */
+    if (pts != SYNC_BENCHMARK_REF_TIME + n * 10 * GST_MSECOND) {
+      (*torn_reads)++;
+    }
+  }
+  end = gst_util_get_timestamp ();
+
+  return (end - start) / (SYNC_BENCHMARK_PACKETS / 1000);
+}
+
+GST_START_TEST (test_sync_benchmark)
+{
+  GstBuffer *buffers[SYNC_BENCHMARK_BUFFERS];
+  SyncBenchmarkSr data = { 0 };
+  GstClockTime idle, concurrent;
+  guint torn_reads;
+  GThread *thread;
+  guint i;
+
+  const guint64 Day_ntp_ts = gst_util_uint64_scale (60 * GST_SECOND,
+      (1LL << 32), GST_SECOND);
+
+  data.sync = kms_rtp_synchronizer_new (FALSE, NULL);
+  fail_unless (kms_rtp_synchronizer_add_clock_rate_for_pt (data.sync, 96,
+          SYNC_BENCHMARK_CLOCK, NULL));
+
+  for (i = 0; i < SYNC_BENCHMARK_BUFFERS; i++) {
+    buffers[i] = generate_rtp_buffer_full (i, 0x1, 96, i,
+        i * SYNC_BENCHMARK_STEP);
+  }
+
+  for (i = 0; i < SYNC_BENCHMARK_SR_COUNT; i++) {
+    data.sr[i] = generate_rtcp_sr_buffer_full (0x1,
+        Day_ntp_ts + ((guint64) i << 32), i * SYNC_BENCHMARK_CLOCK);
+    GST_BUFFER_DTS (data.sr[i]) = SYNC_BENCHMARK_REF_TIME;
+  }
+
+  /* The first SR sets the base */
+  fail_unless (kms_rtp_synchronizer_process_rtcp_buffer (data.sync,
+          data.sr[0], NULL));
+
+  idle = sync_benchmark_run (data.sync, buffers, &torn_reads);
+  fail_unless (torn_reads == 0);
+
+  thread = g_thread_new ("sr-updater",
+      (GThreadFunc) sync_benchmark_sr_updater, &data);
+  concurrent = sync_benchmark_run (data.sync, buffers, &torn_reads);
+  g_atomic_int_set (&data.stop, 1);
+  g_thread_join (thread);
+
+  fail_unless (torn_reads == 0, "%u RTP timestamps read a torn SR",
+      torn_reads);
+  fail_unless (data.failed_updates == 0, "%u of %u SR updates failed",
+      data.failed_updates, data.updates);
+
+  GST_INFO ("Time per 1000 RTP packets: %" G_GUINT64_FORMAT
+      " ns without SR updates, %" G_GUINT64_FORMAT " ns with %u concurrent"
+      " SR updates", idle, concurrent, data.updates);
+
+  for (i = 0; i < SYNC_BENCHMARK_BUFFERS; i++) {
+    gst_buffer_unref (buffers[i]);
+  }
+
+  for (i = 0; i < SYNC_BENCHMARK_SR_COUNT; i++) {
+    gst_buffer_unref (data.sr[i]);
+  }
+
+  g_object_unref (data.sync);
+}
+
+GST_END_TEST;
+
+static void
+trace_collect (const KmsTraceFileHeader * header,
+    const KmsTraceRecord * record, GArray * seqs)
+{
+  fail_unless (g_strcmp0 (header->name, "test_video") == 0);
+  fail_unless (header->capacity == 8);
+  fail_unless (record->wall_time > 0);
+  fail_unless (record->ssrc == 0x1);
+  fail_unless (record->pts_out == record->pts_in + GST_SECOND);
+
+  g_array_append_val (seqs, record->seq);
+}
+
+GST_START_TEST (test_trace_recorder)
+{
+  KmsTraceRecorder *recorder;
+  GArray *seqs;
+  GError *err = NULL;
+  gchar *path;
+  gint fd;
+  guint i;
+
+  fd = g_file_open_tmp ("kms-trace-XXXXXX", &path, NULL);
+  fail_unless (fd >= 0);
+  close (fd);
+
+  /* Capacity is rounded up to 8, so the first 2 records are overwritten */
+  recorder = kms_trace_recorder_new (path, "test_video", 5, &err);
+  fail_unless (recorder != NULL);
+
+  for (i = 0; i < 10; i++) {
+    KmsTraceRecord record = { 0 };
+
+    record.ssrc = 0x1;
+    record.seq = i;
+    record.pts_in = i * GST_MSECOND;
+    record.pts_out = record.pts_in + GST_SECOND;
+    kms_trace_recorder_write (recorder, &record);
+  }
+
+  kms_trace_recorder_free (recorder);
+
+  seqs = g_array_new (FALSE, FALSE, sizeof (guint16));
+  fail_unless (kms_trace_file_foreach (path,
+          (KmsTraceFileFunc) trace_collect, seqs, &err));
+  fail_unless (seqs->len == 8);
+  for (i = 0; i < seqs->len; i++) {
+    fail_unless (g_array_index (seqs, guint16, i) == i + 2);
+  }
+  g_array_unref (seqs);
+
+  /* Not a trace file */
+  fail_unless (g_file_set_contents (path, "ENTRY_TS,THREAD\n", -1, NULL));
+  fail_if (kms_trace_file_foreach (path, (KmsTraceFileFunc) trace_collect,
+          NULL, &err));
+  fail_unless (err != NULL);
+  g_clear_error (&err);
+
+  g_unlink (path);
+  g_free (path);
+}
+
+GST_END_TEST;
+
 static Suite *
 rtpsync_suite (void)
 {
@@ -357,6 +545,10 @@ rtpsync_suite (void)
   tcase_add_test (tc_chain, test_interpolate);
   tcase_add_test (tc_chain, test_interpolate_avoid_negative_pts);
 
+  tcase_add_test (tc_chain, test_sync_benchmark);
+
+  tcase_add_test (tc_chain, test_trace_recorder);
+
   return s;
 }
 
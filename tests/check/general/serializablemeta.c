@@ -0,0 +1,245 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include <kmsserializablemeta.h>
+
+GST_START_TEST (test_typed_fields)
+{
+  GstBuffer *buffer = gst_buffer_new ();
+  KmsSerializableMeta *meta;
+  gdouble d;
+  gint64 i;
+
+  meta = kms_buffer_get_or_add_serializable_meta (buffer, "face");
+  kms_serializable_meta_set_int (meta, g_quark_from_string ("x"), -10);
+  kms_serializable_meta_set_int (meta, g_quark_from_string ("y"), 20);
+  kms_serializable_meta_set_uint (meta, g_quark_from_string ("width"), 64);
+  kms_serializable_meta_set_uint (meta, g_quark_from_string ("height"), 80);
+  kms_serializable_meta_set_double (meta, g_quark_from_string ("score"),
+      0.75);
+  kms_serializable_meta_set_string (meta, g_quark_from_string ("label"),
+      "person");
+
+  /* Small metadata fits in the meta itself */
+  fail_unless (meta->fields == meta->inline_fields);
+  fail_unless (meta->arena == meta->inline_arena);
+  fail_unless (kms_serializable_meta_get_n_fields (meta) == 6);
+
+  fail_unless (kms_serializable_meta_get_int64 (meta,
+          g_quark_from_string ("x"), &i));
+  fail_unless (i == -10);
+  fail_unless (kms_serializable_meta_get_double (meta,
+          g_quark_from_string ("width"), &d));
+  fail_unless (d == 64);
+  fail_unless_equals_string (kms_serializable_meta_get_string (meta,
+          g_quark_from_string ("label")), "person");
+
+  /* Overwriting changes the type too */
+  kms_serializable_meta_set_string (meta, g_quark_from_string ("x"), "left");
+  fail_unless (kms_serializable_meta_get_n_fields (meta) == 6);
+  fail_if (kms_serializable_meta_get_int64 (meta, g_quark_from_string ("x"),
+          &i));
+
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_structure_adapter)
+{
+  GstBuffer *buffer = gst_buffer_new (), *copy;
+  KmsSerializableMeta *meta;
+  GstStructure *data;
+  const gchar *str;
+  gint value;
+
+  kms_buffer_add_serializable_meta (buffer,
+      gst_structure_new ("data", "a", G_TYPE_INT, 1, "b", G_TYPE_STRING,
+          "one", NULL));
+  data = kms_serializable_meta_get_metadata (buffer);
+  fail_unless (gst_structure_has_name (data, "data"));
+
+  /* Merged into typed fields, the public view is still there */
+  copy = gst_buffer_new ();
+  meta = kms_buffer_get_or_add_serializable_meta (copy, "typed");
+  kms_serializable_meta_set_int (meta, g_quark_from_string ("a"), 1);
+  meta = kms_buffer_add_serializable_meta (copy,
+      gst_structure_new ("other", "b", G_TYPE_INT, 2, NULL));
+  fail_unless (meta->data != NULL);
+  fail_unless (gst_structure_get_int (meta->data, "a", &value) && value == 1);
+  fail_unless (gst_structure_get_int (meta->data, "b", &value) && value == 2);
+  gst_buffer_unref (copy);
+
+  /* Merged, the view is the same structure */
+  meta = kms_buffer_add_serializable_meta (buffer,
+      gst_structure_new ("other", "a", G_TYPE_INT, 2, NULL));
+  fail_unless (kms_serializable_meta_get_metadata (buffer) == data);
+  fail_unless (gst_structure_get_int (data, "a", &value) && value == 2);
+  fail_unless_equals_string (gst_structure_get_string (data, "b"), "one");
+
+  /* Typed setters keep the view up to date */
+  kms_serializable_meta_set_boolean (meta, g_quark_from_string ("c"), TRUE);
+  fail_unless (gst_structure_has_field_typed (data, "c", G_TYPE_BOOLEAN));
+
+  str = kms_serializable_meta_get_string (meta, g_quark_from_string ("b"));
+  fail_unless_equals_string (str, "one");
+
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_serialize)
+{
+  GstBuffer *buffer = gst_buffer_new (), *copy, *received;
+  KmsSerializableMeta *meta;
+  GstStructure *data;
+  guint8 *bytes;
+  gsize size;
+  gint num, den;
+  guint i;
+
+  meta = kms_buffer_get_or_add_serializable_meta (buffer, "face");
+  kms_serializable_meta_set_int64 (meta, g_quark_from_string ("id"),
+      G_GINT64_CONSTANT (1) << 40);
+  kms_serializable_meta_set_string (meta, g_quark_from_string ("label"),
+      "person");
+
+  /* Types without a compact representation still travel */
+  kms_buffer_add_serializable_meta (buffer, gst_structure_new ("face",
+          "rate", GST_TYPE_FRACTION, 30, 1, NULL));
+
+  size = kms_serializable_meta_serialize (meta, NULL, 0);
+  fail_unless (size > 0);
+  bytes = g_malloc (size);
+  fail_unless (kms_serializable_meta_serialize (meta, bytes, size) == size);
+
+  received = gst_buffer_new ();
+  meta = kms_buffer_add_serializable_meta_from_bytes (received, bytes, size);
+  fail_unless (meta != NULL);
+  fail_unless (kms_serializable_meta_get_n_fields (meta) == 3);
+
+  data = kms_serializable_meta_get_metadata (received);
+  fail_unless (gst_structure_has_name (data, "face"));
+  fail_unless (gst_structure_get_fraction (data, "rate", &num, &den));
+  fail_unless (num == 30 && den == 1);
+  fail_unless_equals_string (gst_structure_get_string (data, "label"),
+      "person");
+
+  /* Truncated data is rejected as a whole */
+  for (i = 0; i < size; i++) {
+    GstBuffer *b = gst_buffer_new ();
+
+    fail_unless (kms_buffer_add_serializable_meta_from_bytes (b, bytes,
+            i) == NULL);
+    fail_unless (kms_serializable_meta_get_metadata (b) == NULL);
+    gst_buffer_unref (b);
+  }
+
+  /* Copied with the buffer */
+  copy = gst_buffer_copy (received);
+  meta = kms_buffer_get_or_add_serializable_meta (copy, NULL);
+  fail_unless (kms_serializable_meta_get_n_fields (meta) == 3);
+  fail_unless_equals_string (kms_serializable_meta_get_string (meta,
+          g_quark_from_string ("label")), "person");
+
+  g_free (bytes);
+  gst_buffer_unref (copy);
+  gst_buffer_unref (received);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_copy_own_field)
+{
+  GstBuffer *buffer = gst_buffer_new ();
+  KmsSerializableMeta *meta;
+  gchar *text;
+
+  meta = kms_buffer_get_or_add_serializable_meta (buffer, "copy");
+  text = g_strnfill (KMS_SERIALIZABLE_META_INLINE_ARENA - 10, 'x');
+  kms_serializable_meta_set_string (meta, g_quark_from_string ("a"), text);
+
+  /* The source lives in the arena that grows to store the copy */
+  kms_serializable_meta_set_string (meta, g_quark_from_string ("b"),
+      kms_serializable_meta_get_string (meta, g_quark_from_string ("a")));
+  fail_unless (meta->arena != meta->inline_arena);
+  fail_unless_equals_string (kms_serializable_meta_get_string (meta,
+          g_quark_from_string ("b")), text);
+
+  g_free (text);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_copy_view)
+{
+  GstBuffer *buffer = gst_buffer_new (), *copy;
+  KmsSerializableMeta *meta;
+  GstStructure *data;
+  gint value;
+
+  meta = kms_buffer_get_or_add_serializable_meta (buffer, "view");
+  kms_serializable_meta_set_int (meta, g_quark_from_string ("a"), 1);
+
+  kms_serializable_meta_set_int (meta, g_quark_from_string ("c"), 3);
+
+  /* Edits made on the view are not lost on copies */
+  data = kms_serializable_meta_get_metadata (buffer);
+  gst_structure_set (data, "b", G_TYPE_INT, 2, NULL);
+  gst_structure_remove_field (data, "c");
+
+  copy = gst_buffer_copy (buffer);
+  meta = (KmsSerializableMeta *) gst_buffer_get_meta (copy,
+      KMS_SERIALIZABLE_META_API_TYPE);
+  fail_unless (meta->data != NULL);
+  data = kms_serializable_meta_get_metadata (copy);
+  fail_unless (gst_structure_get_int (data, "a", &value));
+  fail_unless (value == 1);
+  fail_unless (gst_structure_get_int (data, "b", &value));
+  fail_unless (value == 2);
+  fail_if (gst_structure_has_field (data, "c"));
+  fail_if (kms_serializable_meta_has_field (meta, g_quark_from_string ("c")));
+
+  gst_buffer_unref (copy);
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+static Suite *
+serializablemeta_suite (void)
+{
+  Suite *s = suite_create ("serializablemeta");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_typed_fields);
+  tcase_add_test (tc_chain, test_structure_adapter);
+  tcase_add_test (tc_chain, test_serialize);
+  tcase_add_test (tc_chain, test_copy_own_field);
+  tcase_add_test (tc_chain, test_copy_view);
+
+  return s;
+}
+
+GST_CHECK_MAIN (serializablemeta);
@@ -282,6 +282,55 @@ GST_START_TEST (check_kms_utils_drop_until_keyframe_buffer)
 
 GST_END_TEST;
 
+static const guint8 vp8_key[] = {
+  0x10, 0x02, 0x00, 0x9d, 0x01, 0x2a, 0x80, 0x02, 0xe0, 0x01, 0x00, 0x00
+};
+
+static const guint8 vp8_delta[] = { 0x31, 0x02, 0x00, 0x00 };
+
+static GstBuffer *
+new_vp8_buffer (const guint8 * data, gsize size)
+{
+  GstBuffer *buf = gst_buffer_new_allocate (NULL, size, NULL);
+
+  gst_buffer_fill (buf, 0, data, size);
+  GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  return buf;
+}
+
+GST_START_TEST (check_kms_utils_drop_until_keyframe_caps)
+{
+  GstElement *identity = gst_element_factory_make ("identity", NULL);
+  GstHarness *h = gst_harness_new_with_element (identity, "sink", "src");
+  GstBuffer *buf, *out_buf;
+  GstPad *srcpad;
+
+  srcpad = gst_element_get_static_pad (identity, "src");
+  kms_utils_drop_until_keyframe (srcpad, TRUE);
+  g_object_unref (srcpad);
+
+  /* The codec is taken from the caps event seen by the probe */
+  gst_harness_set_src_caps_str (h, "video/x-vp8");
+
+  buf = new_vp8_buffer (vp8_delta, sizeof (vp8_delta));
+  gst_harness_push (h, buf);
+  out_buf = gst_harness_try_pull (h);
+  fail_unless (out_buf == NULL);
+
+  /* A key frame flagged as delta unit upstream is promoted */
+  buf = new_vp8_buffer (vp8_key, sizeof (vp8_key));
+  gst_harness_push (h, buf);
+  out_buf = gst_harness_try_pull (h);
+  fail_unless (out_buf == buf);
+  gst_buffer_unref (buf);
+
+  gst_harness_teardown (h);
+  g_object_unref (identity);
+}
+
+GST_END_TEST;
+
 GstFlowReturn
 check_chain_list_func (GstPad * pad, GstObject * parent, GstBufferList * list)
 {
@@ -380,6 +429,55 @@ GST_START_TEST (check_kms_utils_drop_until_keyframe_bufferlist)
 
 GST_END_TEST;
 
+#define TIME_BENCHMARK_ITERATIONS 1000000
+
+static GstClockTime
+time_benchmark_run (GstClockTime (*time_func) (void))
+{
+  GstClockTime start, end, sink = 0;
+  guint i;
+
+  start = kms_utils_get_time_nsecs ();
+  for (i = 0; i < TIME_BENCHMARK_ITERATIONS; i++) {
+    sink += time_func ();
+  }
+  end = kms_utils_get_time_nsecs ();
+
+  fail_if (sink == 0);
+
+  return (end - start) / (TIME_BENCHMARK_ITERATIONS / 1000);
+}
+
+GST_START_TEST (check_kms_utils_time_sources)
+{
+  GstClockTime first, cached, fine, coarse, cached_bench;
+
+  /* Cached time is stable while the cache is open, even if nested */
+  kms_utils_time_cache_begin ();
+  first = kms_utils_get_cached_time_nsecs ();
+  g_usleep (1000);
+  kms_utils_time_cache_begin ();
+  fail_unless (kms_utils_get_cached_time_nsecs () == first);
+  kms_utils_time_cache_end ();
+  fail_unless (kms_utils_get_cached_time_nsecs () == first);
+
+  cached_bench = time_benchmark_run (kms_utils_get_cached_time_nsecs);
+  kms_utils_time_cache_end ();
+
+  /* Without cache a fresh time is returned */
+  cached = kms_utils_get_cached_time_nsecs ();
+  fail_unless (cached > first);
+
+  fine = time_benchmark_run (kms_utils_get_time_nsecs);
+  coarse = time_benchmark_run (kms_utils_get_coarse_time_nsecs);
+
+  GST_INFO ("Time per 1000 calls: monotonic %" G_GUINT64_FORMAT
+      " ns, coarse %" G_GUINT64_FORMAT " ns, cached %" G_GUINT64_FORMAT " ns",
+      fine, coarse, cached_bench);
+}
+
+GST_END_TEST;
+
 /* Suite initialization */
 static Suite *
 utils_suite (void)
@@ -397,6 +495,9 @@ utils_suite (void)
 
   tcase_add_test (tc_chain, check_kms_utils_drop_until_keyframe_buffer);
   tcase_add_test (tc_chain, check_kms_utils_drop_until_keyframe_bufferlist);
+  tcase_add_test (tc_chain, check_kms_utils_drop_until_keyframe_caps);
+
+  tcase_add_test (tc_chain, check_kms_utils_time_sources);
 
   return s;
 }